@@ -0,0 +1,128 @@
+# fmedia benchmark
+# Run from the directory with fmedia binary.  No audio device is needed.
+# Results are appended to $OUT (JSON, one object per track, see --bench in help.txt).
+#  sh bench.sh [run]                 Generate the corpus (once) and run all pipelines
+#  sh bench.sh compare BASE [NEW]    Compare results against a saved baseline;
+#                                    exit with error if a pipeline is slower than $THRESHOLD %
+#  sh bench.sh clean
+
+# exit if a child process reports an error
+set -e
+
+BIN=./fmedia
+DIR=bench-data
+OUT=${OUT:-bench.json}
+THRESHOLD=${THRESHOLD:-10}
+# length of each input signal (msec)
+LEN=${LEN:-30000}
+
+CMD=$1
+if test "$CMD" = "" ; then
+	CMD=run
+fi
+
+if test "$CMD" = "clean" ; then
+	rm -rf $DIR
+	exit
+fi
+
+if test "$CMD" = "compare" ; then
+	BASE=$2
+	NEW=${3:-$OUT}
+	# key: input -> output; value: real_usec.  Equal keys in one file are averaged.
+	awk -v thr=$THRESHOLD '
+	function val(s, key,   r) {
+		if (!match(s, "\"" key "\":[^,}]*"))
+			return ""
+		r = substr(s, RSTART + length(key) + 3, RLENGTH - length(key) - 3)
+		gsub("\"", "", r)
+		return r
+	}
+	{
+		k = val($0, "input") " -> " val($0, "output")
+		t = val($0, "real_usec")
+		if (FILENAME == ARGV[1]) {
+			base[k] += t;  nbase[k]++
+		} else {
+			cur[k] += t;  ncur[k]++
+		}
+	}
+	END {
+		bad = 0
+		for (k in cur) {
+			if (!(k in base))
+				continue
+			b = base[k] / nbase[k];  c = cur[k] / ncur[k]
+			d = (b != 0) ? (c - b) * 100 / b : 0
+			st = ""
+			if (d > thr) {
+				st = "  REGRESSION"
+				bad = 1
+			}
+			printf "%-60s %10d %10d %+7.1f%%%s\n", k, b, c, d, st
+		}
+		exit bad
+	}' "$BASE" "$NEW"
+	exit
+fi
+
+if test "$CMD" != "run" ; then
+	echo "usage: sh bench.sh [run | compare BASE [NEW] | clean]"
+	exit 1
+fi
+
+B="$BIN --bench=$OUT"
+mkdir -p $DIR
+
+# corpus
+if ! test -f "$DIR/tone-44-16.wav" ; then
+	$BIN @gen:tone --until=$LEN --rate=44100 --format=int16 -o $DIR/tone-44-16.wav -y
+	$BIN @gen:noise --until=$LEN --rate=44100 --format=int16 -o $DIR/noise-44-16.wav -y
+	$BIN @gen:tone --until=$LEN --rate=96000 --format=int24 -o $DIR/tone-96-24.wav -y
+	$BIN @gen:noise --until=$LEN --rate=96000 --format=int24 -o $DIR/noise-96-24.wav -y
+fi
+
+# generator
+$B @gen:noise --until=$LEN --rate=44100 --format=int16 --pcm-peaks
+
+# encode
+for S in tone noise ; do
+	for EXT in wav flac mp3 m4a ogg opus ; do
+		$B $DIR/$S-44-16.wav -o $DIR/$S-44-16.$EXT -y
+	done
+	$B $DIR/$S-96-24.wav -o $DIR/$S-96-24.flac -y
+done
+
+# decoders without an encoder in fmedia: use the files prepared by ffmpeg (optional)
+if which ffmpeg >/dev/null 2>&1 && ! test -f "$DIR/noise-44-16.wv" ; then
+	ffmpeg -v error -i $DIR/noise-44-16.wav -c:a alac -y $DIR/noise-44-16.caf
+	ffmpeg -v error -i $DIR/noise-44-16.wav -c:a wavpack -y $DIR/noise-44-16.wv
+fi
+
+# decode
+for F in $DIR/*-44-16.* $DIR/*-96-24.flac $DIR/*.ape $DIR/*.mpc ; do
+	if test -f "$F" ; then
+		$B "$F" --pcm-peaks
+	fi
+done
+
+# convert
+$B $DIR/noise-44-16.wav --format=float32 -o $DIR/conv-f32.wav -y
+$B $DIR/noise-96-24.wav --format=int16 -o $DIR/conv-i16.wav -y
+$B $DIR/noise-44-16.wav --channels=mono -o $DIR/conv-mono.wav -y
+
+# resample
+$B $DIR/noise-96-24.wav --rate=48000 -o $DIR/sr-96-48.wav -y
+$B $DIR/noise-44-16.wav --rate=48000 -o $DIR/sr-44-48.wav -y
+$B $DIR/noise-96-24.wav --rate=44100 -o $DIR/sr-96-44.wav -y
+
+# filters
+$B $DIR/noise-44-16.wav --gain=-6 -o $DIR/f-gain.wav -y
+$B $DIR/noise-44-16.wav --dynanorm -o $DIR/f-dynanorm.wav -y
+$B $DIR/noise-44-16.wav --auto-attenuate=-12 -o $DIR/f-autoatt.wav -y
+$B $DIR/tone-44-16.wav --start-dblevel=-20 --stop-dblevel=-20 -o $DIR/f-level.wav -y
+$B $DIR/noise-44-16.wav --split=10 -o "$DIR/f-split-\$counter.wav" -y
+$B $DIR/noise-44-16.wav -o $DIR/f-tee.flac -o $DIR/f-tee.mp3 -y
+$B $DIR/tone-44-16.wav $DIR/noise-44-16.wav --mix -o $DIR/f-mix.wav -y
+
+echo "results: $OUT"
@@ -76,6 +76,11 @@ static int flac_enc_encode(void *ctx, fmed_filt *d)
 		}
 		d->flac_vendor = flac_vendor();
 		d->datatype = "flac";
+		if ((int64)d->audio.total != FMED_NULL && d->audio.fmt.sample_rate != 0) {
+			// estimate output file size: ~70% of PCM data
+			uint64 samples = d->audio.total * d->audio.convfmt.sample_rate / d->audio.fmt.sample_rate;
+			d->output.size = samples * ffpcm_size1(&d->audio.convfmt) * 7 / 10;
+		}
 		// break
 
 	case 2:
@@ -17,7 +17,14 @@ typedef struct alsa_mod {
 	audio_out *usedby;
 	const fmed_track *track;
 	uint dev_idx;
+	uint buffer_length_msec;
 	uint init_ok :1;
+	uint handover :1; // the buffer is still playing the data of the previous track
+	struct audio_wait wait;
+
+	/* Protects 'out', 'handover', 'usedby' and 'tmr':
+	 the timer functions run on the main thread while the tracks use the buffer on their workers */
+	fflock lk;
 } alsa_mod;
 
 static alsa_mod *mod;
@@ -123,23 +130,70 @@ static int alsa_sig(uint signo)
 			return -1;
 
 		mod->track = core->getmod("#core.track");
+		fflk_init(&mod->wait.lk);
+		fflk_init(&mod->lk);
 		return 0;
 	}
 	return 0;
 }
 
-void alsa_buf_close(void *param)
+/** The caller holds 'mod->lk' */
+static void alsa_buf_close(void)
 {
 	if (mod->out == NULL)
 		return;
 	dbglog1(NULL, "free buffer");
 	ffalsa.free(mod->out);
 	mod->out = NULL;
+	mod->handover = 0;
+}
+
+/** Thread: main */
+static void alsa_buf_close_tmr(void *param)
+{
+	fflk_lock(&mod->lk);
+	if (mod->usedby == NULL) // a new track hasn't taken the buffer while we were waiting for the lock
+		alsa_buf_close();
+	fflk_unlock(&mod->lk);
+}
+
+/** The track may be closed on its worker (e.g. the real-time one) while the timer is being processed
+Thread: main */
+static void alsa_onplay(void *param)
+{
+	fflk_lock(&mod->lk);
+	if (mod->usedby == param)
+		audio_out_onplay(param);
+	fflk_unlock(&mod->lk);
+}
+
+/** The previous track has passed the buffer to us, but the next track hasn't taken it over.
+Play the remaining data and stop.
+Thread: main */
+static void alsa_handover_expired(void *param)
+{
+	fflk_lock(&mod->lk);
+	if (!mod->handover)
+		goto end; // the next track has just taken the buffer over
+
+	int r = ffalsa.drain(mod->out);
+	if (r == 0) {
+		core->timer(&mod->tmr, -(int)mod->buffer_length_msec, 0);
+		goto end;
+	}
+
+	dbglog1(NULL, "gapless: no next track, stop");
+	if (0 != ffalsa.stop(mod->out))
+		errlog(core, NULL, "alsa", "stop(): %s", ffalsa.error(mod->out));
+	mod->handover = 0;
+
+end:
+	fflk_unlock(&mod->lk);
 }
 
 static void alsa_destroy(void)
 {
-	alsa_buf_close(NULL);
+	alsa_buf_close();
 	ffvec_free(&mod->fmts);
 	ffmem_free(mod);
 	mod = NULL;
@@ -197,25 +251,39 @@ static void* alsa_open(fmed_filt *d)
 	a->audio = &ffalsa;
 	a->trk = d->trk;
 	a->fx = d;
+	a->gapless = 1;
+	a->gapless_wait = (1 == d->track->getval(d->trk, "gapless_wait"));
 	return a;
 }
 
 static void alsa_close(void *ctx)
 {
 	audio_out *a = ctx;
-	if (mod->usedby == a) {
+	audio_out_report(a);
+	fflk_lock(&mod->lk);
+	if (mod->usedby == a && a->handover && !(a->fx->flags & FMED_FSTOP)) {
+		// keep playing while the next track is being opened
+		mod->handover = 1;
+		fmed_timer_set(&mod->tmr, alsa_handover_expired, NULL);
+		core->timer(&mod->tmr, -(int)mod->buffer_length_msec, 0);
+		audio_out_release(&mod->wait, &mod->usedby);
+
+	} else if (mod->usedby == a) {
+		mod->handover = 0;
 		dbglog1(NULL, "stop");
 		if (0 != ffalsa.stop(mod->out))
 			errlog(core, a->trk,  "alsa", "stop(): %s", ffalsa.error(mod->out));
 		if (a->fx->flags & FMED_FSTOP) {
-			fmed_timer_set(&mod->tmr, alsa_buf_close, NULL);
+			fmed_timer_set(&mod->tmr, alsa_buf_close_tmr, NULL);
 			core->timer(&mod->tmr, -ABUF_CLOSE_WAIT, 0);
 		} else {
 			core->timer(&mod->tmr, 0, 0);
 		}
 
-		mod->usedby = NULL;
+		audio_out_release(&mod->wait, &mod->usedby);
 	}
+	fflk_unlock(&mod->lk);
+	audio_out_unwait(a, &mod->wait);
 
 	ffalsa.dev_free(a->dev);
 	ffmem_free(a);
@@ -234,9 +302,10 @@ static int alsa_create(audio_out *a, fmed_filt *d)
 	a->aflags = FFAUDIO_O_HWDEV; // try "hw" device first, then fall back to "plughw"
 	a->try_open = (a->state == I_TRYOPEN);
 
+	fflk_lock(&mod->lk);
 	if (mod->out != NULL) {
 
-		core->timer(&mod->tmr, 0, 0); // stop 'alsa_buf_close' timer
+		core->timer(&mod->tmr, 0, 0); // stop 'alsa_buf_close_tmr' timer
 
 		audio_out *cur = mod->usedby;
 		if (cur != NULL) {
@@ -247,10 +316,16 @@ static int alsa_create(audio_out *a, fmed_filt *d)
 		// Note: we don't support cases when devices are switched
 		if (mod->dev_idx == a->dev_idx) {
 			if (ffpcm_eq(&fmt, &mod->fmt)) {
-				dbglog1(NULL, "stop/clear");
-				ffalsa.stop(mod->out);
-				ffalsa.clear(mod->out);
+				if (mod->handover) {
+					dbglog1(NULL, "gapless: continue playback");
+					mod->handover = 0;
+				} else {
+					dbglog1(NULL, "stop/clear");
+					ffalsa.stop(mod->out);
+					ffalsa.clear(mod->out);
+				}
 				a->stream = mod->out;
+				a->buffer_length_msec = mod->buffer_length_msec;
 
 				ffalsa.dev_free(a->dev);
 				a->dev = NULL;
@@ -259,6 +334,16 @@ static int alsa_create(audio_out *a, fmed_filt *d)
 				goto fin;
 			}
 
+			if (a->try_open && mod->handover) {
+				// Convert audio to the format of the running buffer rather than reopening it
+				dbglog1(NULL, "gapless: converting to %s/%u/%u"
+					, ffpcm_format_str(mod->fmt.format), mod->fmt.sample_rate, mod->fmt.channels);
+				ffpcm_fmtcopy(&d->audio.convfmt, &mod->fmt);
+				a->state = I_OPEN;
+				fflk_unlock(&mod->lk);
+				return FMED_RMORE;
+			}
+
 			const ffpcm *good_fmt;
 			if (a->try_open && NULL != (good_fmt = fmt_conv_find(&mod->fmts, &fmt))
 				&& ffpcm_eq(good_fmt, &mod->fmt)) {
@@ -266,12 +351,14 @@ static int alsa_create(audio_out *a, fmed_filt *d)
 				// Instead, just use the format ffaudio set for us previously.
 				ffpcm_fmtcopy(&d->audio.convfmt, good_fmt);
 				a->state = I_OPEN;
+				fflk_unlock(&mod->lk);
 				return FMED_RMORE;
 			}
 		}
 
-		alsa_buf_close(NULL);
+		alsa_buf_close();
 	}
+	fflk_unlock(&mod->lk);
 
 	r = audio_out_open(a, d, &fmt);
 	if (r == FFAUDIO_EFORMAT) {
@@ -284,9 +371,11 @@ static int alsa_create(audio_out *a, fmed_filt *d)
 	ffalsa.dev_free(a->dev);
 	a->dev = NULL;
 
+	fflk_lock(&mod->lk);
 	mod->out = a->stream;
 	mod->fmt = fmt;
 	mod->dev_idx = a->dev_idx;
+	mod->buffer_length_msec = a->buffer_length_msec;
 
 fin:
 	mod->usedby = a;
@@ -294,10 +383,10 @@ fin:
 		, reused ? "reused" : "opened", a->buffer_length_msec
 		, ffpcm_format_str(mod->fmt.format), mod->fmt.sample_rate, mod->fmt.channels);
 
-	// if (alsa_out_conf.nfy_rate != 0)
-	// 	mod->out.nfy_interval = ffpcm_samples(alsa_out_conf.buflen / alsa_out_conf.nfy_rate, fmt.sample_rate);
-	fmed_timer_set(&mod->tmr, audio_out_onplay, a);
-	if (0 != core->timer(&mod->tmr, a->buffer_length_msec / 3, 0))
+	fmed_timer_set(&mod->tmr, alsa_onplay, a);
+	r = core->timer(&mod->tmr, audio_notify_period(a->buffer_length_msec, alsa_out_conf.nfy_rate), 0);
+	fflk_unlock(&mod->lk);
+	if (r != 0)
 		return FMED_RERR;
 
 	return 0;
@@ -311,6 +400,8 @@ static int alsa_write(void *ctx, fmed_filt *d)
 
 	switch (a->state) {
 	case I_TRYOPEN:
+		if (audio_out_wait(a, &mod->wait, &mod->usedby))
+			return FMED_RASYNC; // the previous track will wake us up
 		d->audio.convfmt.ileaved = 1;
 		// fallthrough
 	case I_OPEN:
@@ -330,9 +421,11 @@ static int alsa_write(void *ctx, fmed_filt *d)
 
 	r = audio_out_write(a, d);
 	if (r == FMED_RERR) {
-		alsa_buf_close(NULL);
+		fflk_lock(&mod->lk);
+		alsa_buf_close();
 		core->timer(&mod->tmr, 0, 0);
-		mod->usedby = NULL;
+		audio_out_release(&mod->wait, &mod->usedby);
+		fflk_unlock(&mod->lk);
 		return FMED_RERR;
 	}
 	return r;
@@ -378,7 +471,7 @@ static void* alsa_in_open(fmed_filt *d)
 		goto fail;
 
 	fmed_timer_set(&al->tmr, audio_oncapt, a);
-	if (0 != core->timer(&al->tmr, a->buffer_length_msec / 3, 0))
+	if (0 != core->timer(&al->tmr, audio_notify_period(a->buffer_length_msec, 0), 0))
 		goto fail;
 
 	return al;
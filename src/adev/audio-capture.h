@@ -17,6 +17,7 @@ typedef struct audio_in {
 	uint64 total_samples;
 	uint frame_size;
 	uint async;
+	uint xruns;
 } audio_in;
 
 /** Return FFAUDIO_E* */
@@ -141,6 +142,8 @@ static int audio_in_read(audio_in *a, fmed_filt *d)
 	for (;;) {
 		r = a->audio->read(a->stream, &buf);
 		if (r == -FFAUDIO_ESYNC) {
+			a->xruns++;
+			a->track->setval(a->trk, "audio_xruns", a->xruns);
 			warnlog1(d->trk, "overrun detected", 0);
 			continue;
 
@@ -193,18 +193,142 @@ struct audio_out {
 	uint aflags;
 	int err_code; // enum FFAUDIO_E
 	int handle_dev_offline;
+	uint gapless :1; // the module is able to pass the running buffer to the next track
+	uint gapless_wait :1; // the previous track may still be writing to the buffer
 
 	// runtime
 	ffaudio_buf *stream;
 	ffaudio_dev *dev;
 	uint async;
+	uint frame_size;
+	uint sample_rate;
 	uint clear :1;
+	uint wait :1; // waiting for free space in buffer
+	uint handover :1; // the last data is in the buffer; the next track will continue writing to it
+
+	// statistics
+	uint xruns;
+	uint min_fill_msec; // the lowest fill level of the buffer when the device asked for more data
+	uint fill_known :1;
+	uint64 written; // frames written since the stream has (re)started
+	fftime wstart; // time of the first write after the stream has (re)started
+	uint latency_msec, max_latency_msec;
 
 	// user's
 	uint state;
 	uint reconnect :1;
 };
 
+/** Get the period of the notification timer for the audio buffer of the specified length */
+static inline uint audio_notify_period(uint buffer_length_msec, uint notify_rate)
+{
+	if (notify_rate == 0)
+		notify_rate = 3;
+	return ffmax(buffer_length_msec / notify_rate, 1);
+}
+
+/** Print statistics for the audio output */
+static inline void audio_out_report(audio_out *a)
+{
+	if (a->frame_size == 0
+		|| !(a->fx->print_time || a->core->loglev == FMED_LOG_DEBUG))
+		return;
+
+	char fill[32] = "-";
+	if (a->fill_known)
+		ffs_fmt(fill, fill + sizeof(fill), "%ums%Z", a->min_fill_msec);
+	a->core->log(FMED_LOG_INFO, a->trk, NULL, "audio output: buffer:%ums  xruns:%u  min fill:%s  latency:%ums (max %ums)"
+		, a->buffer_length_msec, a->xruns, fill, a->latency_msec, a->max_latency_msec);
+}
+
+/** Estimate the latency from the decoder output to the device for the data we're about to write:
+ the frames written but not yet played, which includes the device's own delay.
+ffaudio can't report the device delay, so the played frames are derived
+ from the time elapsed since the first write after the stream has (re)started. */
+static inline void audio_out_latency(audio_out *a)
+{
+	if (a->sample_rate == 0)
+		return;
+
+	uint64 buffered = 0;
+	if (a->written != 0) {
+		fftime t = fftime_monotonic();
+		fftime_sub(&t, &a->wstart);
+		uint64 played = (uint64)fftime_to_msec(&t) * a->sample_rate / 1000;
+		if (a->written > played)
+			buffered = a->written - played;
+	}
+	uint lat = ffpcm_time(buffered, a->sample_rate);
+	a->max_latency_msec = ffmax(a->max_latency_msec, lat);
+	if (lat != a->latency_msec) {
+		a->latency_msec = lat;
+		a->track->setval(a->trk, "audio_latency", lat);
+	}
+}
+
+/** Update fill level statistics after the device has accepted 'n' bytes from us */
+static inline void audio_out_fill(audio_out *a, uint n)
+{
+	if (a->frame_size == 0 || a->sample_rate == 0)
+		return;
+	uint free_msec = ffpcm_time(n / a->frame_size, a->sample_rate);
+	uint fill = (a->buffer_length_msec > free_msec) ? a->buffer_length_msec - free_msec : 0;
+	if (!a->fill_known || fill < a->min_fill_msec) {
+		a->min_fill_msec = fill;
+		a->fill_known = 1;
+	}
+}
+
+/** The next track waits here until the current track passes the running buffer to it */
+struct audio_wait {
+	fflock lk;
+	audio_out *waiting;
+};
+
+/** Suspend the track if it's started before the previous track has finished writing to the buffer.
+usedby: the module's current user of the buffer
+Return TRUE if the track must wait */
+static inline int audio_out_wait(audio_out *a, struct audio_wait *w, audio_out **usedby)
+{
+	if (!a->gapless_wait)
+		return 0;
+	a->gapless_wait = 0;
+
+	int r = 0;
+	fflk_lock(&w->lk);
+	if (*usedby != NULL) {
+		w->waiting = a;
+		r = 1;
+	}
+	fflk_unlock(&w->lk);
+
+	if (r)
+		dbglog1(a->trk, "gapless: waiting for the previous track");
+	return r;
+}
+
+/** Release the buffer and wake the track waiting for it */
+static inline void audio_out_release(struct audio_wait *w, audio_out **usedby)
+{
+	fflk_lock(&w->lk);
+	*usedby = NULL;
+	audio_out *next = w->waiting;
+	w->waiting = NULL;
+	fflk_unlock(&w->lk);
+
+	if (next != NULL)
+		next->track->cmd(next->trk, FMED_TRACK_WAKE);
+}
+
+/** The waiting track is closed */
+static inline void audio_out_unwait(audio_out *a, struct audio_wait *w)
+{
+	fflk_lock(&w->lk);
+	if (w->waiting == a)
+		w->waiting = NULL;
+	fflk_unlock(&w->lk);
+}
+
 /**
 Return FFAUDIO_E* */
 static inline int audio_out_open(audio_out *a, fmed_filt *d, const ffpcm *fmt)
@@ -335,6 +459,7 @@ static inline int audio_out_write(audio_out *a, fmed_filt *d)
 			warnlog1(a->trk, "audio.stop: %s", a->audio->error(a->stream));
 		if (0 != a->audio->clear(a->stream))
 			warnlog1(d->trk, "audio.clear: %s", a->audio->error(a->stream));
+		a->written = 0;
 		if (d->seek_req)
 			return FMED_RMORE;
 	}
@@ -344,20 +469,41 @@ static inline int audio_out_write(audio_out *a, fmed_filt *d)
 		d->track->cmd(d->trk, FMED_TRACK_PAUSE);
 		if (0 != a->audio->stop(a->stream))
 			warnlog1(d->trk, "pause: audio.stop: %s", a->audio->error(a->stream));
+		a->written = 0;
 		return FMED_RASYNC;
 	}
 
+	if (a->frame_size == 0) {
+		a->frame_size = ffpcm_size1(&d->audio.convfmt);
+		a->sample_rate = d->audio.convfmt.sample_rate;
+	}
+
+	if (d->datalen != 0 && !a->wait)
+		audio_out_latency(a); // new data from the decoder
+
 	while (d->datalen != 0) {
 
 		r = a->audio->write(a->stream, d->data, d->datalen);
 		if (r > 0) {
-			//
+			if (a->wait) {
+				a->wait = 0;
+				if ((uint)r < d->datalen)
+					audio_out_fill(a, r); // the buffer was filled up: we know how much space was free
+			}
+			if (a->written == 0)
+				a->wstart = fftime_monotonic();
+			a->written += r / a->frame_size;
+
 		} else if (r == 0) {
+			a->wait = 1;
 			a->async = 1;
 			return FMED_RASYNC;
 
 		} else if (r == -FFAUDIO_ESYNC) {
+			a->xruns++;
+			a->track->setval(a->trk, "audio_xruns", a->xruns);
 			warnlog1(d->trk, "underrun detected", 0);
+			a->written = 0; // the stream restarts
 			continue;
 
 		} else if (r == -FFAUDIO_EDEV_OFFLINE && a->handle_dev_offline) {
@@ -383,6 +529,13 @@ static inline int audio_out_write(audio_out *a, fmed_filt *d)
 
 	if (d->flags & FMED_FLAST) {
 
+		if (a->gapless && 1 == d->track->getval(d->trk, "gapless")) {
+			// Don't wait until the buffer is drained: the next track will append its data
+			dbglog1(d->trk, "gapless: passing the buffer to the next track");
+			a->handover = 1;
+			return FMED_RDONE;
+		}
+
 		r = a->audio->drain(a->stream);
 		if (r == 1)
 			return FMED_RDONE;
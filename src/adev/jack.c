@@ -145,7 +145,7 @@ static void* jack_in_open(fmed_filt *d)
 		goto fail;
 
 	fmed_timer_set(&ji->tmr, audio_oncapt, a);
-	if (0 != core->timer(&ji->tmr, a->buffer_length_msec / 3, 0))
+	if (0 != core->timer(&ji->tmr, audio_notify_period(a->buffer_length_msec, 0), 0))
 		goto fail;
 
 	return ji;
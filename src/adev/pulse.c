@@ -19,7 +19,14 @@ typedef struct pulse_mod {
 	audio_out *usedby;
 	const fmed_track *track;
 	uint dev_idx;
+	uint buffer_length_msec;
 	uint init_ok :1;
+	uint handover :1; // the buffer is still playing the data of the previous track
+	struct audio_wait wait;
+
+	/* Protects 'out', 'handover', 'usedby' and 'tmr':
+	 the timer functions run on the main thread while the tracks use the buffer on their workers */
+	fflock lk;
 } pulse_mod;
 
 static pulse_mod *mod;
@@ -95,11 +102,14 @@ static int pulse_sig(uint signo)
 			return -1;
 
 		mod->track = core->getmod("#core.track");
+		fflk_init(&mod->wait.lk);
+		fflk_init(&mod->lk);
 		return 0;
 	}
 	return 0;
 }
 
+/** The caller holds 'mod->lk' */
 void pulse_buf_close()
 {
 	if (mod->out == NULL)
@@ -107,6 +117,7 @@ void pulse_buf_close()
 	dbglog(NULL, "free");
 	ffpulse.free(mod->out);
 	mod->out = NULL;
+	mod->handover = 0;
 }
 
 static void pulse_destroy(void)
@@ -177,21 +188,71 @@ static void* pulse_open(fmed_filt *d)
 	a->track = mod->track;
 	a->trk = d->trk;
 	a->fx = d;
+	a->gapless = 1;
+	a->gapless_wait = (1 == d->track->getval(d->trk, "gapless_wait"));
 	d->adev = &fmed_pulse_adev;
 	d->adev_ctx = a;
 	return a;
 }
 
+/** Thread: main */
 void pulse_close_tmr(void *param)
 {
-	pulse_buf_close();
+	fflk_lock(&mod->lk);
+	if (mod->usedby == NULL) // a new track hasn't taken the buffer while we were waiting for the lock
+		pulse_buf_close();
+	fflk_unlock(&mod->lk);
+}
+
+/** The track may be closed on its worker (e.g. the real-time one) while the timer is being processed
+Thread: main */
+static void pulse_onplay(void *param)
+{
+	fflk_lock(&mod->lk);
+	if (mod->usedby == param)
+		audio_out_onplay(param);
+	fflk_unlock(&mod->lk);
+}
+
+/** The previous track has passed the buffer to us, but the next track hasn't taken it over.
+Play the remaining data and stop.
+Thread: main */
+static void pulse_handover_expired(void *param)
+{
+	fflk_lock(&mod->lk);
+	if (!mod->handover)
+		goto end; // the next track has just taken the buffer over
+
+	int r = ffpulse.drain(mod->out);
+	if (r == 0) {
+		core->timer(&mod->tmr, -(int)mod->buffer_length_msec, 0);
+		goto end;
+	}
+
+	dbglog(NULL, "gapless: no next track, stop");
+	if (0 != ffpulse.stop(mod->out))
+		errlog(NULL, "stop: %s", ffpulse.error(mod->out));
+	mod->handover = 0;
+
+end:
+	fflk_unlock(&mod->lk);
 }
 
 static void pulse_close(void *ctx)
 {
 	audio_out *a = ctx;
-
-	if (mod->usedby == a) {
+	audio_out_report(a);
+
+	fflk_lock(&mod->lk);
+	if (mod->usedby == a && a->handover && !(a->fx->flags & FMED_FSTOP)) {
+		// keep playing while the next track is being opened
+		mod->handover = 1;
+		fmed_timer_set(&mod->tmr, pulse_handover_expired, NULL);
+		core->timer(&mod->tmr, -(int)mod->buffer_length_msec, 0);
+		audio_out_release(&mod->wait, &mod->usedby);
+
+	} else if (mod->usedby == a) {
+		mod->handover = 0;
 		if (0 != ffpulse.stop(mod->out))
 			errlog(a->trk, "stop: %s", ffpulse.error(mod->out));
 		if (a->fx->flags & FMED_FSTOP) {
@@ -200,8 +261,10 @@ static void pulse_close(void *ctx)
 		} else {
 			core->timer(&mod->tmr, 0, 0);
 		}
-		mod->usedby = NULL;
+		audio_out_release(&mod->wait, &mod->usedby);
 	}
+	fflk_unlock(&mod->lk);
+	audio_out_unwait(a, &mod->wait);
 
 	ffpulse.dev_free(a->dev);
 	ffmem_free(a);
@@ -219,6 +282,7 @@ static int pulse_create(audio_out *a, fmed_filt *d)
 	a->buffer_length_msec = pulse_out_conf.buflen;
 	a->try_open = (a->state == I_TRYOPEN);
 
+	fflk_lock(&mod->lk);
 	if (mod->out != NULL) {
 
 		core->timer(&mod->tmr, 0, 0); // stop 'pulse_close_tmr' timer
@@ -234,10 +298,16 @@ static int pulse_create(audio_out *a, fmed_filt *d)
 			&& fmt.sample_rate == mod->fmt.sample_rate
 			&& a->dev_idx == mod->dev_idx) {
 
-			dbglog(a->trk, "reuse buffer: ffpulse.stop/clear");
-			ffpulse.stop(mod->out);
-			ffpulse.clear(mod->out);
+			if (mod->handover) {
+				dbglog(a->trk, "gapless: continue playback");
+				mod->handover = 0;
+			} else {
+				dbglog(a->trk, "reuse buffer: ffpulse.stop/clear");
+				ffpulse.stop(mod->out);
+				ffpulse.clear(mod->out);
+			}
 			a->stream = mod->out;
+			a->buffer_length_msec = mod->buffer_length_msec;
 
 			ffpulse.dev_free(a->dev);
 			a->dev = NULL;
@@ -246,8 +316,18 @@ static int pulse_create(audio_out *a, fmed_filt *d)
 			goto fin;
 		}
 
+		if (a->try_open && mod->handover && a->dev_idx == mod->dev_idx) {
+			// Convert audio to the format of the running buffer rather than reopening it
+			dbglog(a->trk, "gapless: converting to %uHz", mod->fmt.sample_rate);
+			ffpcm_fmtcopy(&d->audio.convfmt, &mod->fmt);
+			a->state = I_OPEN;
+			fflk_unlock(&mod->lk);
+			return FMED_RMORE;
+		}
+
 		pulse_buf_close();
 	}
+	fflk_unlock(&mod->lk);
 
 	while (0 != (r = audio_out_open(a, d, &fmt))) {
 		if (r == FFAUDIO_EFORMAT) {
@@ -275,9 +355,11 @@ static int pulse_create(audio_out *a, fmed_filt *d)
 	ffpulse.dev_free(a->dev);
 	a->dev = NULL;
 
+	fflk_lock(&mod->lk);
 	mod->out = a->stream;
 	mod->fmt = fmt;
 	mod->dev_idx = a->dev_idx;
+	mod->buffer_length_msec = a->buffer_length_msec;
 
 fin:
 	dbglog(d->trk, "%s buffer %ums, %uHz"
@@ -286,8 +368,10 @@ fin:
 
 	mod->usedby = a;
 
-	fmed_timer_set(&mod->tmr, audio_out_onplay, a);
-	if (0 != core->timer(&mod->tmr, a->buffer_length_msec / 3, 0))
+	fmed_timer_set(&mod->tmr, pulse_onplay, a);
+	r = core->timer(&mod->tmr, audio_notify_period(a->buffer_length_msec, pulse_out_conf.nfy_rate), 0);
+	fflk_unlock(&mod->lk);
+	if (r != 0)
 		return FMED_RERR;
 
 	return 0;
@@ -300,6 +384,8 @@ static int pulse_write(void *ctx, fmed_filt *d)
 
 	switch (a->state) {
 	case I_TRYOPEN:
+		if (audio_out_wait(a, &mod->wait, &mod->usedby))
+			return FMED_RASYNC; // the previous track will wake us up
 		d->audio.convfmt.ileaved = 1;
 		// fallthrough
 	case I_OPEN:
@@ -319,9 +405,11 @@ static int pulse_write(void *ctx, fmed_filt *d)
 
 	r = audio_out_write(a, d);
 	if (r == FMED_RERR) {
+		fflk_lock(&mod->lk);
 		pulse_buf_close();
 		core->timer(&mod->tmr, 0, 0);
-		mod->usedby = NULL;
+		audio_out_release(&mod->wait, &mod->usedby);
+		fflk_unlock(&mod->lk);
 		return FMED_RERR;
 	}
 	return r;
@@ -383,7 +471,7 @@ static void* pulse_in_open(fmed_filt *d)
 	}
 
 	fmed_timer_set(&pi->tmr, audio_oncapt, a);
-	if (0 != core->timer(&pi->tmr, a->buffer_length_msec / 3, 0))
+	if (0 != core->timer(&pi->tmr, audio_notify_period(a->buffer_length_msec, 0), 0))
 		goto fail;
 
 	return pi;
@@ -106,30 +106,15 @@ static int sndmod_conv_prepare(sndmod_conv *c, fmed_filt *d)
 		void *fi = (void*)d->track->cmd(d->trk, FMED_TRACK_FILT_INSTANCE, f);
 		if (fi == NULL)
 			return FMED_RERR;
+		// The next filter will convert channels, format and sample rate in a single pass:
+		// soxr
 		struct fmed_aconv conf = {};
-
-		if (in->channels == out->channels) {
-			// The next filter will convert format and sample rate:
-			// soxr
-			conf.in = *in;
-			conf.out = *out;
-			d->out = d->data;
-			d->outlen = d->datalen;
-			soxr->cmd(fi, 0, &conf);
-			return FMED_RDONE;
-		}
-
-		// This filter will convert channels, the next filter will convert format and sample rate:
-		// conv -> soxr
-		conf.out = c->outpcm;
-
-		c->outpcm.format = FFPCM_FLOAT;
-		c->outpcm.sample_rate = in->sample_rate;
-		c->outpcm.ileaved = 0;
-
-		conf.in = c->outpcm;
-		conf.in.channels = (c->outpcm.channels & FFPCM_CHMASK);
+		conf.in = *in;
+		conf.out = *out;
+		d->out = d->data;
+		d->outlen = d->datalen;
 		soxr->cmd(fi, 0, &conf);
+		return FMED_RDONE;
 	}
 
 	if (c->inpcm.channels > 8)
@@ -141,6 +126,7 @@ static int sndmod_conv_prepare(sndmod_conv *c, fmed_filt *d)
 		if (r != 0)
 			return FMED_RERR;
 	}
+	fmed_aconv_pass(d);
 
 	uint out_ch = c->outpcm.channels & FFPCM_CHMASK;
 	c->out_samp_size = ffpcm_size(c->outpcm.format, out_ch);
@@ -223,6 +209,17 @@ The next filters in chain may set the format they need, and then they ask for ac
 2. The second time the converter is called, it initializes afilter.conv filter if needed, and then deletes itself from chain.
 */
 
+/** Print the result of format negotiation and the planned conversion filters. */
+static void log_plan(const ffpcmex *in, const ffpcmex *out, const char *filters, void *trk)
+{
+	if (core->loglev != FMED_LOG_DEBUG)
+		return;
+	core->log(FMED_LOG_DEBUG, trk, "afilter.autoconv", "format plan: %s/%u/%u/%s -> %s/%u/%u/%s  conversion: %s"
+		, ffpcm_fmtstr(in->format), in->sample_rate, in->channels, (in->ileaved) ? "i" : "ni"
+		, ffpcm_fmtstr(out->format), out->sample_rate, out->channels, (out->ileaved) ? "i" : "ni"
+		, filters);
+}
+
 struct autoconv {
 	uint state;
 	ffpcmex inpcm, outpcm;
@@ -239,13 +236,13 @@ static void* autoconv_open(fmed_filt *d)
 		return FMED_FILT_SKIP;
 	}
 
-	struct autoconv *c = ffmem_new(struct autoconv);
+	struct autoconv *c = (void*)d->track->cmd(d->trk, FMED_TRACK_ALLOC, sizeof(struct autoconv));
 	return c;
 }
 
 static void autoconv_close(void *ctx)
 {
-	ffmem_free(ctx);
+	// the object is in the track's memory
 }
 
 static int autoconv_process(void *ctx, fmed_filt *d)
@@ -283,10 +280,15 @@ static int autoconv_process(void *ctx, fmed_filt *d)
 		&& in->channels == out->channels
 		&& in->sample_rate == out->sample_rate
 		&& in->ileaved == out->ileaved) {
+		log_plan(in, out, "none", d->trk);
 		d->out = d->data,  d->outlen = d->datalen;
 		return FMED_RDONE; //no conversion is needed
 	}
 
+	log_plan(in, out
+		, (in->sample_rate == out->sample_rate) ? "afilter.conv" : "soxr.conv"
+		, d->trk);
+
 	const struct fmed_filter2 *conv = core->getmod("afilter.conv");
 	void *f = (void*)d->track->cmd(d->trk, FMED_TRACK_FILT_ADD, "afilter.conv");
 	if (f == NULL)
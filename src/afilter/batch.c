@@ -0,0 +1,170 @@
+/** Collect decoded audio into larger blocks.
+Copyright (c) 2022 Simon Zolin */
+
+#include <fmedia.h>
+#include <afilter/pcm.h>
+
+
+extern const fmed_core *core;
+
+#undef dbglog
+#define dbglog(trk, ...)  fmed_dbglog(core, trk, "batch", __VA_ARGS__)
+
+static void* batch_open(fmed_filt *d);
+static int batch_process(void *ctx, fmed_filt *d);
+static void batch_close(void *ctx);
+const fmed_filter fmed_sndmod_batch = {
+	&batch_open, &batch_process, &batch_close
+};
+
+
+/*
+afilter.batch is placed right after the decoder in conversion tracks.
+A decoder returns 1 frame per call (e.g. 1152 samples for MPEG, 4096 for FLAC),
+ and for each frame the track passes through all the next filters, encoder and output.
+This filter collects the frames into a block of the configured duration (or size),
+ so the next filters are called once per block.
+
+. An input block that is large enough is passed through without copying.
+. If the input doesn't fit into the free space or isn't contiguous with the buffered data (seek),
+  the buffered data is passed first, and the input is processed on the next call.
+. Interleaved and non-interleaved data is supported.
+*/
+
+static struct batch_conf {
+	uint msec;
+	size_t bytes;
+} conf = {
+	.msec = 100,
+};
+
+static const fmed_conf_arg batch_conf_args[] = {
+	{ "msec",	FMC_INT32,	FMC_O(struct batch_conf, msec) },
+	{ "bytes",	FMC_SIZE,	FMC_O(struct batch_conf, bytes) },
+	{}
+};
+
+int batch_conf(fmed_conf_ctx *ctx)
+{
+	fmed_conf_addctx(ctx, &conf, batch_conf_args);
+	return 0;
+}
+
+struct batch {
+	ffpcmex fmt;
+	uint sampsize;
+	uint cap; // max. samples in buffer
+	uint n; // samples in buffer
+	uint64 pos; // position of the first sample in buffer
+	uint64 inpos; // position of the input data left unprocessed on the previous call
+	uint have_inpos :1;
+	void *buf;
+	void *ni[8];
+};
+
+static void* batch_open(fmed_filt *d)
+{
+	if (conf.msec == 0 && conf.bytes == 0)
+		return FMED_FILT_SKIP;
+	if (d->audio.fmt.channels > FF_COUNT(((struct batch*)NULL)->ni))
+		return FMED_FILT_SKIP;
+
+	struct batch *c = ffmem_new(struct batch);
+	if (c == NULL)
+		return NULL;
+	c->fmt = d->audio.fmt;
+	c->sampsize = ffpcm_size1(&c->fmt);
+	c->cap = ffpcm_samples(conf.msec, c->fmt.sample_rate);
+	if (conf.bytes != 0)
+		c->cap = (conf.msec != 0) ? ffmin(c->cap, conf.bytes / c->sampsize) : conf.bytes / c->sampsize;
+	if (c->cap == 0) {
+		ffmem_free(c);
+		return FMED_FILT_SKIP;
+	}
+
+	if (NULL == (c->buf = ffmem_alloc(c->cap * c->sampsize))) {
+		ffmem_free(c);
+		return NULL;
+	}
+	if (!c->fmt.ileaved) {
+		for (uint i = 0;  i != c->fmt.channels;  i++) {
+			c->ni[i] = (char*)c->buf + c->cap * c->sampsize / c->fmt.channels * i;
+		}
+	}
+	dbglog(d->trk, "block size: %u samples", c->cap);
+	return c;
+}
+
+static void batch_close(void *ctx)
+{
+	struct batch *c = ctx;
+	ffmem_free(c->buf);
+	ffmem_free(c);
+}
+
+/** Copy input data to buffer */
+static void batch_add(struct batch *c, const fmed_filt *d, uint n)
+{
+	if (c->fmt.ileaved) {
+		ffmem_copy((char*)c->buf + c->n * c->sampsize, d->data, n * c->sampsize);
+	} else {
+		uint ssize = c->sampsize / c->fmt.channels;
+		for (uint i = 0;  i != c->fmt.channels;  i++) {
+			ffmem_copy((char*)c->ni[i] + c->n * ssize, d->datani[i], n * ssize);
+		}
+	}
+	c->n += n;
+}
+
+/** Pass the buffered data to the next filter */
+static void batch_out(struct batch *c, fmed_filt *d)
+{
+	if (c->fmt.ileaved)
+		d->out = c->buf;
+	else
+		d->outni = c->ni;
+	d->outlen = c->n * c->sampsize;
+	d->audio.pos = c->pos;
+	c->n = 0;
+}
+
+static int batch_process(void *ctx, fmed_filt *d)
+{
+	struct batch *c = ctx;
+	uint n = d->datalen / c->sampsize;
+	uint64 pos = d->audio.pos;
+	if (c->have_inpos) {
+		// d->audio.pos was set by us for the previous output
+		pos = c->inpos;
+		c->have_inpos = 0;
+	}
+
+	if (n != 0) {
+		if (c->n != 0
+			&& (c->n + n > c->cap || pos != c->pos + c->n)) {
+			batch_out(c, d);
+			c->inpos = pos;
+			c->have_inpos = 1;
+			return FMED_ROK;
+		}
+
+		if (c->n == 0) {
+			c->pos = pos;
+			if (n >= c->cap) {
+				d->out = d->data,  d->outlen = d->datalen;
+				d->datalen = 0;
+				d->audio.pos = pos;
+				return (d->flags & FMED_FLAST) ? FMED_RDONE : FMED_ROK;
+			}
+		}
+
+		batch_add(c, d, n);
+		d->datalen = 0;
+	}
+
+	if (c->n == c->cap || (d->flags & FMED_FLAST)) {
+		batch_out(c, d);
+		return (d->flags & FMED_FLAST) ? FMED_RDONE : FMED_ROK;
+	}
+	return FMED_RMORE;
+}
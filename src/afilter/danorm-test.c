@@ -0,0 +1,210 @@
+/** Test: compare the output of the native Dynamic Audio Normalizer (danorm.h)
+ with libDynamicAudioNormalizer-ff (the original float64 implementation).
+Usage: danorm-test CHANNELS RATE INPUT
+ INPUT: float32 interleaved PCM data
+The data is processed with the default settings:
+ . by libDynamicAudioNormalizer-ff;
+ . by danorm.h on one thread: abs. error must be below 2^-22;
+ . by danorm.h with each channel processed separately (in reverse order): the output must be the same.
+Return 0 on success.
+2022, Simon Zolin */
+
+#include <fmedia.h>
+#include <afilter/danorm.h>
+#include <DynamicAudioNormalizer/DynamicAudioNormalizer-ff.h>
+#include <FFOS/std.h>
+
+
+#define MAX_ERR  (1.0 / (1 << 22))
+
+/** Append interleaved samples from non-interleaved data */
+static int add(ffvec *v, uint channels, const void *const *data, int f64, size_t samples)
+{
+	if (NULL == ffvec_growT(v, samples * channels, double))
+		return -1;
+	double *p = (double*)v->ptr + v->len;
+	for (size_t i = 0;  i != samples;  i++) {
+		for (uint c = 0;  c != channels;  c++) {
+			*p++ = (f64) ? ((double**)data)[c][i] : ((float**)data)[c][i];
+		}
+	}
+	v->len += samples * channels;
+	return 0;
+}
+
+/** Process by libDynamicAudioNormalizer-ff */
+static int ref_process(const struct dan_conf *conf, uint channels, uint rate, const float *data, size_t samples, ffvec *out)
+{
+	int rc = -1;
+	void *ctx = NULL;
+	double **inp = NULL, **outp = NULL;
+	ffvec in = {}, obuf = {};
+
+	struct dynanorm_conf rc_conf = {};
+	rc_conf.channels = channels;
+	rc_conf.sampleRate = rate;
+	rc_conf.frameLenMsec = conf->frame_len_msec;
+	rc_conf.filterSize = conf->filter_size;
+	rc_conf.peakValue = conf->peak_value;
+	rc_conf.maxAmplification = conf->max_amplification;
+	rc_conf.targetRms = conf->target_rms;
+	rc_conf.compressFactor = conf->compress_factor;
+	rc_conf.channelsCoupled = !!conf->channels_coupled;
+	rc_conf.enableDCCorrection = !!conf->dc_correction;
+	rc_conf.altBoundaryMode = !!conf->alt_boundary;
+	if (0 != dynanorm_open(&ctx, &rc_conf)) {
+		ffstderr_fmt("dynanorm_open() failed\n");
+		ctx = NULL;
+		goto end;
+	}
+
+	size_t out_cap = ffmax((uint64)rate * conf->frame_len_msec / 1000, 1);
+	if (NULL == (inp = ffmem_allocT(channels, double*))
+		|| NULL == (outp = ffmem_allocT(channels, double*))
+		|| NULL == ffvec_allocT(&in, samples * channels, double)
+		|| NULL == ffvec_allocT(&obuf, out_cap * channels, double))
+		goto end;
+
+	// float32 -> float64: the values are exactly the same
+	for (uint c = 0;  c != channels;  c++) {
+		double *dst = (double*)in.ptr + c * samples;
+		for (size_t i = 0;  i != samples;  i++) {
+			dst[i] = data[i * channels + c];
+		}
+		inp[c] = dst;
+		outp[c] = (double*)obuf.ptr + c * out_cap;
+	}
+
+	size_t left = samples;
+	for (;;) {
+		size_t n = left;
+		ssize_t k = dynanorm_process(ctx, (left != 0) ? (const double*const*)inp : NULL, (left != 0) ? &n : NULL
+			, outp, out_cap);
+		if (k < 0)
+			goto end;
+		if (0 != add(out, channels, (const void*const*)outp, 1, k))
+			goto end;
+
+		if (left != 0) {
+			for (uint c = 0;  c != channels;  c++) {
+				inp[c] += n;
+			}
+			left -= n;
+		} else if ((size_t)k < out_cap) {
+			break;
+		}
+	}
+	rc = 0;
+
+end:
+	if (ctx != NULL)
+		dynanorm_close(ctx);
+	ffmem_free(inp);
+	ffmem_free(outp);
+	ffvec_free(&in);
+	ffvec_free(&obuf);
+	return rc;
+}
+
+/** Process each channel separately */
+static void run_split(struct dan *d, dan_chan_func func, uint frame)
+{
+	for (uint c = d->channels;  c != 0;  c--) {
+		func(d, frame, c - 1, c);
+	}
+}
+
+/** Process by danorm.h */
+static int our_process(const struct dan_conf *conf, uint channels, uint rate, const float *data, size_t samples, int split, ffvec *out)
+{
+	struct dan *d;
+	if (NULL == (d = dan_open(conf, channels, rate))) {
+		ffstderr_fmt("dan_open() failed\n");
+		return -1;
+	}
+	if (split)
+		d->run = &run_split;
+
+	int rc = -1;
+	size_t off = 0;
+	for (;;) {
+		float **o;
+		ssize_t r = dan_read(d, &o);
+		if (r < 0)
+			break;
+		if (r > 0) {
+			if (0 != add(out, channels, (const void*const*)o, 0, r))
+				goto end;
+			continue;
+		}
+
+		if (off != samples) {
+			size_t n = dan_write(d, data, 1, off, samples - off);
+			if (n == 0)
+				goto end;
+			off += n;
+			continue;
+		}
+		dan_finish(d);
+	}
+	rc = 0;
+
+end:
+	dan_close(d);
+	return rc;
+}
+
+int main(int argc, char **argv)
+{
+	int rc = 1;
+	ffvec data = {}, ref = {}, our = {}, our_split = {};
+	uint channels = 0, rate = 0;
+	ffstr s;
+	if (argc == 4) {
+		ffstr_setz(&s, argv[1]);
+		ffstr_toint(&s, &channels, FFS_INT32);
+		ffstr_setz(&s, argv[2]);
+		ffstr_toint(&s, &rate, FFS_INT32);
+	}
+	if (channels == 0 || rate == 0) {
+		ffstderr_fmt("Usage: danorm-test CHANNELS RATE INPUT\n");
+		return 1;
+	}
+	if (0 != fffile_readwhole(argv[3], &data, (uint64)-1)) {
+		ffstderr_fmt("%s: can't read file\n", argv[3]);
+		return 1;
+	}
+
+	struct dan_conf conf;
+	dan_conf_init(&conf);
+	size_t samples = data.len / (sizeof(float) * channels);
+	if (0 != ref_process(&conf, channels, rate, data.ptr, samples, &ref)
+		|| 0 != our_process(&conf, channels, rate, data.ptr, samples, 0, &our)
+		|| 0 != our_process(&conf, channels, rate, data.ptr, samples, 1, &our_split)) {
+		ffstderr_fmt("processing failed\n");
+		goto end;
+	}
+
+	double max_err = 0;
+	size_t n = ffmin(ref.len, our.len);
+	const double *a = ref.ptr, *b = our.ptr;
+	for (size_t i = 0;  i != n;  i++) {
+		max_err = ffmax(max_err, fabs(a[i] - b[i]));
+	}
+	int same_split = (our.len == our_split.len
+		&& !ffmem_cmp(our.ptr, our_split.ptr, our.len * sizeof(double)));
+
+	int ok = (ref.len == our.len && max_err < MAX_ERR && same_split);
+	ffstderr_fmt("reference check: %s  samples:%L/%L  max abs. error:%.12F  split channels: %s\n"
+		, (ok) ? "OK" : "FAILED"
+		, our.len / channels, ref.len / channels, max_err
+		, (same_split) ? "same" : "different");
+	rc = (ok) ? 0 : 1;
+
+end:
+	ffvec_free(&data);
+	ffvec_free(&ref);
+	ffvec_free(&our);
+	ffvec_free(&our_split);
+	return rc;
+}
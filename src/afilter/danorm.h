@@ -0,0 +1,688 @@
+/** fmedia: Dynamic Audio Normalizer: native float32 implementation
+2022, Simon Zolin */
+
+/*
+The algorithm is the one of DynamicAudioNormalizer by LoRd_MuldeR:
+1. Audio is split into frames (frame_len_msec).
+2. For each frame the local gain factor is computed from its peak (and RMS) value;
+ the factor is limited to max_amplification by the error function.
+3. The gain factors history is passed through a minimum filter and then through a Gaussian filter (filter_size frames),
+ so the output is delayed by filter_size frames.
+4. The samples of a frame are amplified by the gain factor linearly faded from the previous frame's one,
+ and clipped to peak_value.
+
+Samples are float32, gain factors and filter state are float64.
+Compared with the reference float64 implementation,
+ the difference of the output samples is within float32 rounding error (abs. error < 2^-22, i.e. -130dB;
+ see danorm-test.c).
+
+Frames are stored non-interleaved in a ring buffer:
+ [output]... [waiting for gain]... [input]...
+The hot loops (peak, RMS, amplification, DC correction) use SSE2 if available.
+
+The per-channel steps of a frame (DC correction, compression, peak/RMS, amplification)
+ are run via dan.run() which may split the channels between threads.
+Their results are stored per channel and combined in channel order,
+ so the output doesn't depend on how the channels are split.
+*/
+
+#include <math.h>
+#include <float.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+struct dan_conf {
+	uint frame_len_msec;
+	uint filter_size; // odd number
+	double peak_value;
+	double max_amplification;
+	double target_rms; // 0: disabled
+	double compress_factor; // 0: disabled
+	byte channels_coupled;
+	byte dc_correction;
+	byte alt_boundary;
+};
+
+static inline void dan_conf_init(struct dan_conf *conf)
+{
+	conf->frame_len_msec = 500;
+	conf->filter_size = 31;
+	conf->peak_value = 0.95;
+	conf->max_amplification = 10.0;
+	conf->target_rms = 0.0;
+	conf->compress_factor = 0.0;
+	conf->channels_coupled = 1;
+	conf->dc_correction = 0;
+	conf->alt_boundary = 0;
+}
+
+/** Queue of float64 values */
+struct dan_queue {
+	double *v;
+	uint cap, first, len;
+};
+
+static inline double dan_q_peek(const struct dan_queue *q, uint i)
+{
+	return q->v[(q->first + i) % q->cap];
+}
+
+static inline void dan_q_push(struct dan_queue *q, double val)
+{
+	FF_ASSERT(q->len != q->cap);
+	q->v[(q->first + q->len) % q->cap] = val;
+	q->len++;
+}
+
+static inline double dan_q_pop(struct dan_queue *q)
+{
+	double val = q->v[q->first];
+	q->first = (q->first + 1) % q->cap;
+	q->len--;
+	return val;
+}
+
+/** Gain factors history (per channel or one for all coupled channels) */
+struct dan_hist {
+	struct dan_queue orig, min, smooth;
+	double prev_amp;
+	double amp; // gain factor of the frame being amplified
+	double compress_thresh;
+	double ct0, ct1; // compression thresholds of the frame being analyzed
+};
+
+/** Per-channel results of the frame being analyzed */
+struct dan_chstat {
+	double peak;
+	double sumsq; // sum of squares: for compression, then for target_rms
+};
+
+struct dan;
+
+/** Process channels [ch_first..ch_last) of the frame */
+typedef void (*dan_chan_func)(struct dan *d, uint frame, uint ch_first, uint ch_last);
+
+struct dan_frame {
+	uint len; // samples
+	uint synthetic :1; // flush frame: not for output
+};
+
+struct dan {
+	struct dan_conf conf;
+	uint channels;
+	uint frame_len; // samples
+	uint nhist;
+	struct dan_hist *hist;
+	double *dc; // DC correction value per channel
+	double *weights; // Gaussian filter
+	struct dan_chstat *st; // [channels]
+
+	float *data; // frames[nframes][channels][frame_len]
+	struct dan_frame *frames;
+	uint nframes;
+	uint iout; // the oldest frame
+	uint nwait; // frames waiting for gain factor
+	uint nin; // samples in the input frame (0 or 1 frame)
+	uint out_held :1; // the oldest frame is the output data
+	uint flush :1;
+	byte first_frame; // the frame being analyzed is the first one
+	float **ptrs; // output data: float*[channels]
+
+	/** Call func() for channels [0..channels) of the frame and return when it's done for all of them.
+	NULL: call it directly */
+	void (*run)(struct dan *d, dan_chan_func func, uint frame);
+	void *udata;
+};
+
+static inline float* dan_chan(struct dan *d, uint frame, uint ch)
+{
+	return d->data + ((size_t)frame * d->channels + ch) * d->frame_len;
+}
+
+static inline void dan_close(struct dan *d)
+{
+	if (d == NULL)
+		return;
+	for (uint i = 0;  i != d->nhist;  i++) {
+		ffmem_free(d->hist[i].orig.v);
+	}
+	ffmem_free(d->hist);
+	ffmem_free(d->dc);
+	ffmem_free(d->weights);
+	ffmem_free(d->st);
+	ffmem_free(d->data);
+	ffmem_free(d->frames);
+	ffmem_free(d->ptrs);
+	ffmem_free(d);
+}
+
+static inline void dan_hist_reset(struct dan *d)
+{
+	for (uint i = 0;  i != d->nhist;  i++) {
+		struct dan_hist *h = &d->hist[i];
+		h->orig.first = h->orig.len = 0;
+		h->min.first = h->min.len = 0;
+		h->smooth.first = h->smooth.len = 0;
+		h->prev_amp = 1;
+		h->compress_thresh = 0;
+	}
+}
+
+/** Drop all data and state (e.g. after seeking) */
+static inline void dan_reset(struct dan *d)
+{
+	dan_hist_reset(d);
+	ffmem_zero(d->dc, d->channels * sizeof(double));
+	d->iout = 0;
+	d->nwait = 0;
+	d->nin = 0;
+	d->out_held = 0;
+	d->flush = 0;
+}
+
+/**
+Return NULL on error */
+static inline struct dan* dan_open(const struct dan_conf *conf, uint channels, uint rate)
+{
+	struct dan *d;
+	if (channels == 0
+		|| conf->filter_size < 3 || !(conf->filter_size & 1)
+		|| conf->frame_len_msec == 0)
+		return NULL;
+
+	if (NULL == (d = ffmem_new(struct dan)))
+		return NULL;
+	d->conf = *conf;
+	d->channels = channels;
+	d->frame_len = (uint64)rate * conf->frame_len_msec / 1000;
+	d->frame_len = ffmax(d->frame_len, 1);
+	d->nhist = (conf->channels_coupled) ? 1 : channels;
+
+	// pending frames: (filter_size - 1) + input + output
+	uint fs = conf->filter_size;
+	d->nframes = fs + 2;
+
+	if (NULL == (d->hist = ffmem_callocT(d->nhist, struct dan_hist))
+		|| NULL == (d->dc = ffmem_callocT(channels, double))
+		|| NULL == (d->weights = ffmem_allocT(fs, double))
+		|| NULL == (d->st = ffmem_callocT(channels, struct dan_chstat))
+		|| NULL == (d->frames = ffmem_callocT(d->nframes, struct dan_frame))
+		|| NULL == (d->ptrs = ffmem_allocT(channels, float*))
+		|| NULL == (d->data = ffmem_allocT((size_t)d->nframes * channels * d->frame_len, float)))
+		goto err;
+
+	for (uint i = 0;  i != d->nhist;  i++) {
+		struct dan_hist *h = &d->hist[i];
+		if (NULL == (h->orig.v = ffmem_allocT(3 * (fs + 1), double)))
+			goto err;
+		h->orig.cap = h->min.cap = h->smooth.cap = fs + 1;
+		h->min.v = h->orig.v + (fs + 1);
+		h->smooth.v = h->orig.v + 2 * (fs + 1);
+	}
+	dan_hist_reset(d);
+
+	// Gaussian filter weights
+	double sigma = ((fs / 2.0) - 1.0) / 3.0 + 1.0 / 3.0;
+	double c1 = 1.0 / sqrt(2.0 * 3.14159265358979323846 * sigma * sigma);
+	double c2 = 2.0 * sigma * sigma;
+	double total = 0;
+	for (uint i = 0;  i != fs;  i++) {
+		double x = (double)i - (double)(fs / 2);
+		d->weights[i] = c1 * exp(-(x * x) / c2);
+		total += d->weights[i];
+	}
+	for (uint i = 0;  i != fs;  i++) {
+		d->weights[i] /= total;
+	}
+
+	return d;
+
+err:
+	dan_close(d);
+	return NULL;
+}
+
+
+/* Vectorized primitives */
+
+static inline float dan_absmax(const float *p, size_t n)
+{
+	float mx = 0;
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	__m128 m = _mm_setzero_ps();
+	for (;  i + 4 <= n;  i += 4) {
+		m = _mm_max_ps(m, _mm_and_ps(_mm_loadu_ps(p + i), mask));
+	}
+	m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+	m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+	mx = _mm_cvtss_f32(m);
+#endif
+	for (;  i != n;  i++) {
+		mx = ffmax(mx, fabsf(p[i]));
+	}
+	return mx;
+}
+
+/** Sum of squares (float64 accumulator) */
+static inline double dan_sumsq(const float *p, size_t n)
+{
+	double sum = 0;
+	size_t i = 0;
+#ifdef __SSE2__
+	__m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+	for (;  i + 4 <= n;  i += 4) {
+		__m128 v = _mm_loadu_ps(p + i);
+		__m128d lo = _mm_cvtps_pd(v);
+		__m128d hi = _mm_cvtps_pd(_mm_movehl_ps(v, v));
+		s0 = _mm_add_pd(s0, _mm_mul_pd(lo, lo));
+		s1 = _mm_add_pd(s1, _mm_mul_pd(hi, hi));
+	}
+	s0 = _mm_add_pd(s0, s1);
+	sum = _mm_cvtsd_f64(s0) + _mm_cvtsd_f64(_mm_unpackhi_pd(s0, s0));
+#endif
+	for (;  i != n;  i++) {
+		sum += (double)p[i] * p[i];
+	}
+	return sum;
+}
+
+/** Sum of samples (float64 accumulator) */
+static inline double dan_sum(const float *p, size_t n)
+{
+	double sum = 0;
+	for (size_t i = 0;  i != n;  i++) {
+		sum += p[i];
+	}
+	return sum;
+}
+
+/** p[i] *= fade(prev, next, i);  clip to [-peak..peak]
+fade(i) = prev + (next - prev) * (i+1)/n */
+static inline void dan_amplify(float *p, size_t n, double prev, double next, float peak)
+{
+	float step = (float)((next - prev) / n);
+	float a = (float)prev;
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128 vpeak = _mm_set1_ps(peak), vnpeak = _mm_set1_ps(-peak);
+	const __m128 vstep = _mm_set1_ps(step), va = _mm_set1_ps(a);
+	__m128i idx = _mm_setr_epi32(1, 2, 3, 4);
+	const __m128i four = _mm_set1_epi32(4);
+	for (;  i + 4 <= n;  i += 4) {
+		__m128 g = _mm_add_ps(va, _mm_mul_ps(vstep, _mm_cvtepi32_ps(idx)));
+		__m128 v = _mm_mul_ps(_mm_loadu_ps(p + i), g);
+		v = _mm_min_ps(_mm_max_ps(v, vnpeak), vpeak);
+		_mm_storeu_ps(p + i, v);
+		idx = _mm_add_epi32(idx, four);
+	}
+#endif
+	for (;  i != n;  i++) {
+		float v = p[i] * (a + step * (float)(i + 1));
+		p[i] = ffmin(ffmax(v, -peak), peak);
+	}
+}
+
+/** p[i] -= fade(prev, next, i) */
+static inline void dan_sub_fade(float *p, size_t n, double prev, double next)
+{
+	float step = (float)((next - prev) / n);
+	float a = (float)prev;
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128 vstep = _mm_set1_ps(step), va = _mm_set1_ps(a);
+	__m128i idx = _mm_setr_epi32(1, 2, 3, 4);
+	const __m128i four = _mm_set1_epi32(4);
+	for (;  i + 4 <= n;  i += 4) {
+		__m128 f = _mm_add_ps(va, _mm_mul_ps(vstep, _mm_cvtepi32_ps(idx)));
+		_mm_storeu_ps(p + i, _mm_sub_ps(_mm_loadu_ps(p + i), f));
+		idx = _mm_add_epi32(idx, four);
+	}
+#endif
+	for (;  i != n;  i++) {
+		p[i] -= a + step * (float)(i + 1);
+	}
+}
+
+
+/* Analysis */
+
+/** Limit the gain factor smoothly */
+static inline double dan_bound(double threshold, double val)
+{
+	const double CONST = 0.8862269254527580136490837416705725913987747280611935; // sqrt(PI)/2
+	return erf(CONST * (val / threshold)) * threshold;
+}
+
+static inline double dan_fade(double prev, double next, uint pos, uint n)
+{
+	double f0 = 1.0 - (1.0 / n) * (pos + 1.0);
+	return f0 * prev + (1.0 - f0) * next;
+}
+
+static inline void dan_run(struct dan *d, dan_chan_func func, uint frame)
+{
+	if (d->run != NULL)
+		d->run(d, func, frame);
+	else
+		func(d, frame, 0, d->channels);
+}
+
+/** Index of the gain factors history of the channel */
+static inline uint dan_ihist(const struct dan *d, uint ch)
+{
+	return (d->conf.channels_coupled) ? 0 : ch;
+}
+
+/** Channels [ch_first..ch_last) of the frame */
+static double dan_local_gain(struct dan *d, uint ch_first, uint ch_last, uint n)
+{
+	double mx = DBL_EPSILON, sq = 0;
+	for (uint c = ch_first;  c != ch_last;  c++) {
+		mx = ffmax(mx, d->st[c].peak);
+		sq += d->st[c].sumsq;
+	}
+
+	double max_gain = d->conf.peak_value / mx;
+	double rms_gain = DBL_MAX;
+	if (d->conf.target_rms > DBL_EPSILON) {
+		double rms = ffmax(sqrt(sq / ((double)n * (ch_last - ch_first))), DBL_EPSILON);
+		rms_gain = d->conf.target_rms / rms;
+	}
+	return dan_bound(d->conf.max_amplification, ffmin(max_gain, rms_gain));
+}
+
+static void dan_chan_stat(struct dan *d, uint frame, uint c)
+{
+	uint n = d->frames[frame].len;
+	const float *p = dan_chan(d, frame, c);
+	d->st[c].peak = dan_absmax(p, n);
+	d->st[c].sumsq = (d->conf.target_rms > DBL_EPSILON) ? dan_sumsq(p, n) : 0;
+}
+
+static void dan_dc_correct(struct dan *d, uint frame, uint c)
+{
+	uint n = d->frames[frame].len;
+	float *p = dan_chan(d, frame, c);
+	double avg = dan_sum(p, n) / n;
+	double prev = (d->first_frame) ? avg : d->dc[c];
+	d->dc[c] = (d->first_frame) ? avg : 0.1 * avg + 0.9 * d->dc[c];
+	dan_sub_fade(p, n, prev, d->dc[c]);
+}
+
+static double dan_compress_thresh(double threshold)
+{
+	if (!(threshold > DBL_EPSILON && threshold < 1.0 - DBL_EPSILON))
+		return threshold;
+
+	double cur = threshold, step = 1.0;
+	while (step > DBL_EPSILON) {
+		while (cur + step > cur
+			&& dan_bound(cur + step, 1.0) <= threshold)
+			cur += step;
+		step /= 2.0;
+	}
+	return cur;
+}
+
+/** Get the compression thresholds of the frame from the channels' sums of squares */
+static void dan_compress_prepare(struct dan *d, uint frame)
+{
+	uint n = d->frames[frame].len;
+	uint chs = (d->conf.channels_coupled) ? d->channels : 1;
+	for (uint ih = 0;  ih != d->nhist;  ih++) {
+		struct dan_hist *h = &d->hist[ih];
+		uint cfirst = (d->conf.channels_coupled) ? 0 : ih;
+
+		double var = 0;
+		for (uint c = cfirst;  c != cfirst + chs;  c++) {
+			var += d->st[c].sumsq;
+		}
+		var /= ffmax((double)chs * n - 1, 1);
+		double sd = ffmax(sqrt(var), DBL_EPSILON);
+		double thresh = ffmin(1.0, d->conf.compress_factor * sd);
+
+		double prev = (d->first_frame) ? thresh : h->compress_thresh;
+		h->compress_thresh = (d->first_frame) ? thresh : (1.0/3) * thresh + (2.0/3) * h->compress_thresh;
+		h->ct0 = dan_compress_thresh(prev);
+		h->ct1 = dan_compress_thresh(h->compress_thresh);
+	}
+}
+
+static void dan_compress(struct dan *d, uint frame, uint c)
+{
+	uint n = d->frames[frame].len;
+	const struct dan_hist *h = &d->hist[dan_ihist(d, c)];
+	float *p = dan_chan(d, frame, c);
+	for (uint i = 0;  i != n;  i++) {
+		double t = dan_fade(h->ct0, h->ct1, i, n);
+		p[i] = copysign(dan_bound(t, fabs(p[i])), p[i]);
+	}
+}
+
+/** DC correction;  the sums of squares for compression or the peak/RMS values */
+static void dan_analyze_ch1(struct dan *d, uint frame, uint ch_first, uint ch_last)
+{
+	for (uint c = ch_first;  c != ch_last;  c++) {
+		if (d->conf.dc_correction)
+			dan_dc_correct(d, frame, c);
+
+		if (d->conf.compress_factor > DBL_EPSILON)
+			d->st[c].sumsq = dan_sumsq(dan_chan(d, frame, c), d->frames[frame].len);
+		else
+			dan_chan_stat(d, frame, c);
+	}
+}
+
+/** Compression;  the peak/RMS values */
+static void dan_analyze_ch2(struct dan *d, uint frame, uint ch_first, uint ch_last)
+{
+	for (uint c = ch_first;  c != ch_last;  c++) {
+		dan_compress(d, frame, c);
+		dan_chan_stat(d, frame, c);
+	}
+}
+
+static void dan_hist_update(struct dan *d, struct dan_hist *h, double gain)
+{
+	uint fs = d->conf.filter_size;
+	if (h->orig.len == 0) {
+		double initial = (d->conf.alt_boundary) ? gain : 1.0;
+		h->prev_amp = initial;
+		while (h->orig.len < fs / 2)
+			dan_q_push(&h->orig, initial);
+	}
+
+	dan_q_push(&h->orig, gain);
+
+	while (h->orig.len >= fs) {
+		if (h->min.len == 0) {
+			double initial = (d->conf.alt_boundary) ? dan_q_peek(&h->orig, 0) : 1.0;
+			uint input = fs / 2;
+			while (h->min.len < fs / 2) {
+				input++;
+				initial = ffmin(initial, dan_q_peek(&h->orig, input));
+				dan_q_push(&h->min, initial);
+			}
+		}
+
+		double mn = dan_q_peek(&h->orig, 0);
+		for (uint i = 1;  i != h->orig.len;  i++) {
+			mn = ffmin(mn, dan_q_peek(&h->orig, i));
+		}
+		dan_q_push(&h->min, mn);
+		dan_q_pop(&h->orig);
+	}
+
+	while (h->min.len >= fs) {
+		double sm = 0;
+		for (uint i = 0;  i != fs;  i++) {
+			sm += d->weights[i] * dan_q_peek(&h->min, i);
+		}
+		sm = ffmin(sm, dan_q_peek(&h->orig, 0));
+		dan_q_push(&h->smooth, sm);
+		dan_q_pop(&h->min);
+	}
+}
+
+/** The input frame is complete: analyze it */
+static void dan_analyze(struct dan *d, uint frame)
+{
+	d->first_frame = (d->hist[0].orig.len == 0);
+	dan_run(d, &dan_analyze_ch1, frame);
+
+	if (d->conf.compress_factor > DBL_EPSILON) {
+		dan_compress_prepare(d, frame);
+		dan_run(d, &dan_analyze_ch2, frame);
+	}
+
+	uint n = d->frames[frame].len;
+	if (d->conf.channels_coupled) {
+		dan_hist_update(d, &d->hist[0], dan_local_gain(d, 0, d->channels, n));
+	} else {
+		for (uint c = 0;  c != d->channels;  c++) {
+			dan_hist_update(d, &d->hist[c], dan_local_gain(d, c, c + 1, n));
+		}
+	}
+	d->nwait++;
+}
+
+/** Index of the input frame */
+static inline uint dan_iin(struct dan *d)
+{
+	return (d->iout + d->out_held + d->nwait) % d->nframes;
+}
+
+/** Fill the input frame with the values that don't affect the gain of the last real frames */
+static void dan_flush_frame(struct dan *d)
+{
+	uint fi = dan_iin(d);
+	double val = (d->conf.alt_boundary) ? DBL_EPSILON
+		: (d->conf.target_rms > DBL_EPSILON) ? ffmin(d->conf.peak_value, d->conf.target_rms)
+		: d->conf.peak_value;
+	for (uint c = 0;  c != d->channels;  c++) {
+		float *p = dan_chan(d, fi, c);
+		for (uint i = 0;  i != d->frame_len;  i++) {
+			double v = val;
+			if (d->conf.dc_correction) {
+				v *= (i & 1) ? -1 : 1;
+				v += d->dc[c];
+			}
+			p[i] = v;
+		}
+	}
+	d->frames[fi].len = d->frame_len;
+	d->frames[fi].synthetic = 1;
+	dan_analyze(d, fi);
+}
+
+
+/* Interface */
+
+/** Add input samples.
+in: interleaved (ileaved=1) or non-interleaved float32 data
+off: offset (in samples) of the input data
+Return the number of samples consumed;  0 if the output data must be read first */
+static inline size_t dan_write(struct dan *d, const void *in, int ileaved, size_t off, size_t samples)
+{
+	size_t done = 0;
+	while (done != samples) {
+		if (d->out_held + d->nwait + 1 > d->nframes)
+			break;
+
+		uint fi = dan_iin(d);
+		size_t n = ffmin(samples - done, d->frame_len - d->nin);
+		if (ileaved) {
+			const float *src = (float*)in + (off + done) * d->channels;
+			for (uint c = 0;  c != d->channels;  c++) {
+				float *dst = dan_chan(d, fi, c) + d->nin;
+				for (size_t i = 0;  i != n;  i++) {
+					dst[i] = src[i * d->channels + c];
+				}
+			}
+		} else {
+			for (uint c = 0;  c != d->channels;  c++) {
+				ffmem_copy(dan_chan(d, fi, c) + d->nin, ((float**)in)[c] + off + done, n * sizeof(float));
+			}
+		}
+		d->nin += n;
+		done += n;
+
+		if (d->nin == d->frame_len) {
+			d->frames[fi].len = d->frame_len;
+			d->frames[fi].synthetic = 0;
+			d->nin = 0;
+			dan_analyze(d, fi);
+		}
+	}
+	return done;
+}
+
+/** No more input data */
+static inline void dan_finish(struct dan *d)
+{
+	if (d->flush)
+		return;
+	d->flush = 1;
+	if (d->nin != 0) {
+		uint fi = dan_iin(d);
+		d->frames[fi].len = d->nin;
+		d->frames[fi].synthetic = 0;
+		d->nin = 0;
+		dan_analyze(d, fi);
+	}
+}
+
+static void dan_amplify_ch(struct dan *d, uint frame, uint ch_first, uint ch_last)
+{
+	for (uint c = ch_first;  c != ch_last;  c++) {
+		const struct dan_hist *h = &d->hist[dan_ihist(d, c)];
+		dan_amplify(dan_chan(d, frame, c), d->frames[frame].len, h->prev_amp, h->amp, d->conf.peak_value);
+	}
+}
+
+/** Get the next amplified frame.
+The data is valid until the next call to dan_write() or dan_read().
+Return the number of samples (out: float*[channels]);  0: need more input data;  -1: all data is read */
+static inline ssize_t dan_read(struct dan *d, float ***out)
+{
+	if (d->out_held) {
+		d->out_held = 0;
+		d->iout = (d->iout + 1) % d->nframes;
+	}
+
+	for (;;) {
+		// flush frames follow the real ones
+		if (d->nwait == 0 || d->frames[d->iout].synthetic)
+			return (d->flush) ? -1 : 0;
+
+		const struct dan_hist *h0 = &d->hist[0];
+		if (h0->smooth.len == 0) {
+			if (!d->flush)
+				return 0;
+			// feed the filter until the real frames get their gain
+			dan_flush_frame(d);
+			continue;
+		}
+
+		uint fi = d->iout;
+		struct dan_frame *f = &d->frames[fi];
+		for (uint ih = 0;  ih != d->nhist;  ih++) {
+			d->hist[ih].amp = dan_q_pop(&d->hist[ih].smooth);
+		}
+		dan_run(d, &dan_amplify_ch, fi);
+		for (uint ih = 0;  ih != d->nhist;  ih++) {
+			d->hist[ih].prev_amp = d->hist[ih].amp;
+		}
+		for (uint c = 0;  c != d->channels;  c++) {
+			d->ptrs[c] = dan_chan(d, fi, c);
+		}
+		d->nwait--;
+
+		d->out_held = 1;
+		*out = d->ptrs;
+		return f->len;
+	}
+}
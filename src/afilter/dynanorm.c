@@ -2,7 +2,10 @@
 Copyright (c) 2018 Simon Zolin */
 
 #include <fmedia.h>
-#include <DynamicAudioNormalizer/DynamicAudioNormalizer-ff.h>
+#include <afilter/pcm.h>
+#include <afilter/danorm.h>
+#include <util/thpool.h>
+#include <FFOS/semaphore.h>
 
 
 #undef dbglog
@@ -32,25 +35,24 @@ static const fmed_filter fmed_danorm_f = {
 	&danorm_f_open, &danorm_f_process, &danorm_f_close
 };
 
-struct danconf {
-	struct dynanorm_conf conf;
-	byte channels_coupled;
-	byte enable_dc_correction;
-	byte alt_boundary_mode;
+struct danorm_conf {
+	struct dan_conf dan;
+	byte parallel_channels;
 };
-static struct danconf *sconf;
+static struct danorm_conf *sconf;
 
-#define OFF(m)  FMC_O(struct dynanorm_conf, m)
+#define OFF(m)  FMC_O(struct danorm_conf, dan.m)
 static const fmed_conf_arg danorm_conf_args[] = {
-	{ "frame_len_msec",	FMC_INT32, OFF(frameLenMsec) },
-	{ "filter_size",	FMC_INT32, OFF(filterSize) },
-	{ "peak_value",	FMC_FLOAT64S, OFF(peakValue) },
-	{ "max_amplification",	FMC_FLOAT64S, OFF(maxAmplification) },
-	{ "target_rms",	FMC_FLOAT64S, OFF(targetRms) },
-	{ "compress_factor",	FMC_FLOAT64S, OFF(compressFactor) },
-	{ "channels_coupled",	FMC_BOOL8, FMC_O(struct danconf, channels_coupled) },
-	{ "enable_dc_correction",	FMC_BOOL8, FMC_O(struct danconf, enable_dc_correction) },
-	{ "alt_boundary_mode",	FMC_BOOL8, FMC_O(struct danconf, alt_boundary_mode) },
+	{ "frame_len_msec",	FMC_INT32, OFF(frame_len_msec) },
+	{ "filter_size",	FMC_INT32, OFF(filter_size) },
+	{ "peak_value",	FMC_FLOAT64S, OFF(peak_value) },
+	{ "max_amplification",	FMC_FLOAT64S, OFF(max_amplification) },
+	{ "target_rms",	FMC_FLOAT64S, OFF(target_rms) },
+	{ "compress_factor",	FMC_FLOAT64S, OFF(compress_factor) },
+	{ "channels_coupled",	FMC_BOOL8, OFF(channels_coupled) },
+	{ "enable_dc_correction",	FMC_BOOL8, OFF(dc_correction) },
+	{ "alt_boundary_mode",	FMC_BOOL8, OFF(alt_boundary) },
+	{ "parallel_channels",	FMC_INT8, FMC_O(struct danorm_conf, parallel_channels) },
 	{}
 };
 #undef OFF
@@ -89,21 +91,46 @@ static int danorm_conf(const char *name, fmed_conf_ctx *ctx)
 
 static int danorm_f_conf(fmed_conf_ctx *ctx)
 {
-	sconf = ffmem_new(struct danconf);
-	sconf->channels_coupled = 255;
-	sconf->enable_dc_correction = 255;
-	sconf->alt_boundary_mode = 255;
-	dynanorm_init(&sconf->conf);
+	sconf = ffmem_new(struct danorm_conf);
+	dan_conf_init(&sconf->dan);
+	sconf->parallel_channels = 6;
 	fmed_conf_addctx(ctx, sconf, danorm_conf_args);
 	return 0;
 }
 
+/*
+The filter works after afilter.autoconv (see trk_addfilters()):
+1. The first time the filter is called (autoconv's negotiation pass with no data),
+ the next filters set the format they need in audio.convfmt.
+2. When the next filter asks for more data, the filter saves the requested format
+ and asks afilter.autoconv for float32 with the same interleaving instead.
+ If the decoder produces float32 already, no conversion is performed before the filter.
+3. The output of the normalizer (non-interleaved float32) is converted to the requested format
+ right here, while the data is still in cache; this is counted as a conversion pass ("conv_passes").
+ The user's gain is applied in the same step if trk_addconv() has set "dynanorm_gain".
+
+When the output is split into several files (--split, --cue-decode-once), the filter inserts its own converter
+ and passes non-interleaved float32 to the next filters.
+*/
+
 struct danorm {
 	uint state;
-	void *ctx;
-	ffarr buf;
+	struct dan *ctx;
 	uint off;
-	ffpcm fmt;
+	ffpcmex infmt; // input data format
+	ffpcmex fmt; // output data format of the normalizer
+
+	ffpcmex outfmt; // format requested by the next filters
+	ffarr outbuf; // output data in 'outfmt'
+	uint out_samp_size;
+	uint conv :1 // convert output data to 'outfmt'
+		, apply_gain :1
+		;
+	int gain_db;
+	float gain;
+
+	ffthpool *thpool;
+	ffsem sem; // signalled by each finished task
 };
 
 static void* danorm_f_open(fmed_filt *d)
@@ -111,17 +138,162 @@ static void* danorm_f_open(fmed_filt *d)
 	struct danorm *c = ffmem_new(struct danorm);
 	if (c == NULL)
 		return NULL;
+	c->gain_db = 0;
+	c->gain = 1;
+	c->sem = FFSEM_INV;
 	return c;
 }
 
 static void danorm_f_close(void *ctx)
 {
 	struct danorm *c = ctx;
-	dynanorm_close(c->ctx);
-	ffarr_free(&c->buf);
+	dan_close(c->ctx);
+	if (c->sem != FFSEM_INV)
+		ffsem_close(c->sem);
+	ffarr_free(&c->outbuf);
 	ffmem_free(c);
 }
 
+
+/*
+Channel-parallel processing (fmedia.conf::parallel_channels):
+The per-channel steps of a frame are split by channel ranges
+ between the thread pool and the track's worker, which processes the first range itself
+ and then waits until the other ones are finished.
+If a task can't be added to the thread pool, its range is processed by the worker too.
+*/
+
+enum {
+	DANPAR_MAXPARTS = 4,
+};
+
+struct danpar_task {
+	struct dan *ctx;
+	dan_chan_func func;
+	uint frame;
+	uint ch_first, ch_last;
+};
+
+/** Thread: thread pool */
+static void danpar_task_run(ffthpool_task *t)
+{
+	struct danorm *c = t->udata;
+	struct danpar_task *pt = (void*)t->ext;
+	pt->func(pt->ctx, pt->frame, pt->ch_first, pt->ch_last);
+	ffsem_post(c->sem);
+}
+
+/** Implements dan.run() */
+static void danpar_run(struct dan *dan, dan_chan_func func, uint frame)
+{
+	struct danorm *c = dan->udata;
+	uint parts = ffmin(dan->channels, DANPAR_MAXPARTS);
+	uint own = dan->channels / parts, posted = 0;
+
+	for (uint i = 1;  i != parts;  i++) {
+		uint first = dan->channels * i / parts, last = dan->channels * (i + 1) / parts;
+		ffthpool_task *t;
+		if (NULL == (t = ffthpool_task_new(sizeof(struct danpar_task)))) {
+			func(dan, frame, first, last);
+			continue;
+		}
+		struct danpar_task *pt = (void*)t->ext;
+		pt->ctx = dan;
+		pt->func = func;
+		pt->frame = frame;
+		pt->ch_first = first;
+		pt->ch_last = last;
+		t->handler = &danpar_task_run;
+		t->udata = c;
+		if (0 != ffthpool_add(c->thpool, t))
+			func(dan, frame, first, last); // the queue is full
+		else
+			posted++;
+		ffthpool_task_free(t);
+	}
+
+	func(dan, frame, 0, own);
+	for (uint i = 0;  i != posted;  i++) {
+		ffsem_wait(c->sem, -1);
+	}
+}
+
+/** Process the channels in parallel if there are enough of them */
+static void danpar_init(struct danorm *c, uint channels, void *trk)
+{
+	if (sconf->parallel_channels == 0
+		|| channels < sconf->parallel_channels
+		|| NULL == (c->thpool = (void*)core->cmd(FMED_THPOOL)))
+		return;
+	if (FFSEM_INV == (c->sem = ffsem_open(NULL, 0, 0))) {
+		fmed_syserrlog(core, trk, "dynanorm", "ffsem_open");
+		return;
+	}
+	c->ctx->run = &danpar_run;
+	c->ctx->udata = c;
+	dbglog(trk, "processing %u channels in %u threads", channels, ffmin(channels, DANPAR_MAXPARTS));
+}
+
+/** Insert a converter before this filter. */
+static int danorm_addconv(fmed_filt *d)
+{
+	struct fmed_aconv conv;
+	conv.in = d->audio.fmt;
+	conv.out = d->audio.fmt;
+	conv.out.format = FFPCM_FLOAT;
+	if (d->audio.convfmt.format == 0)
+		d->audio.convfmt.format = d->audio.fmt.format;
+	if (d->audio.convfmt.channels == 0)
+		d->audio.convfmt.channels = d->audio.fmt.channels;
+	if (d->audio.convfmt.sample_rate == 0)
+		d->audio.convfmt.sample_rate = d->audio.fmt.sample_rate;
+	d->audio.fmt = conv.out;
+	void *f = (void*)d->track->cmd(d->trk, FMED_TRACK_FILT_ADDPREV, "afilter.conv");
+	if (f == NULL)
+		return FMED_RERR;
+	const struct fmed_filter2 *aconv = core->getmod("afilter.conv");
+	void *fi = (void*)d->track->cmd(d->trk, FMED_TRACK_FILT_INSTANCE, f);
+	if (fi == NULL)
+		return FMED_RERR;
+	aconv->cmd(fi, 0, &conv);
+	d->out = d->data,  d->outlen = d->datalen;
+	return FMED_RBACK;
+}
+
+/** Prepare the output conversion to the format requested by the next filters. */
+static int danorm_outconv_prepare(struct danorm *c, fmed_filt *d)
+{
+	if (c->outfmt.format == c->fmt.format
+		&& c->outfmt.ileaved == c->fmt.ileaved)
+		return 0;
+
+	int r = ffpcm_convert(&c->outfmt, NULL, &c->fmt, NULL, 0);
+	if (r != 0 || core->loglev == FMED_LOG_DEBUG) {
+		core->log((r != 0) ? FMED_LOG_ERR : FMED_LOG_DEBUG, d->trk, "dynanorm"
+			, "%soutput PCM conversion: %s/%s -> %s/%s"
+			, (r != 0) ? "unsupported " : ""
+			, ffpcm_fmtstr(c->fmt.format), (c->fmt.ileaved) ? "i" : "ni"
+			, ffpcm_fmtstr(c->outfmt.format), (c->outfmt.ileaved) ? "i" : "ni");
+		if (r != 0)
+			return -1;
+	}
+
+	uint ch = c->fmt.channels;
+	c->out_samp_size = ffpcm_size(c->outfmt.format, ch);
+	size_t cap = c->ctx->frame_len * c->out_samp_size;
+	if (!c->outfmt.ileaved) {
+		if (NULL == ffarr_alloc(&c->outbuf, sizeof(void*) * ch + cap))
+			return -1;
+		ffarrp_setbuf((void**)c->outbuf.ptr, ch, c->outbuf.ptr + sizeof(void*) * ch, cap / ch);
+	} else {
+		if (NULL == ffarr_alloc(&c->outbuf, cap))
+			return -1;
+	}
+	c->conv = 1;
+	fmed_aconv_pass(d);
+	return 0;
+}
+
 static int danorm_f_process(void *ctx, fmed_filt *d)
 {
 	struct danorm *c = ctx;
@@ -130,108 +302,121 @@ static int danorm_f_process(void *ctx, fmed_filt *d)
 	switch (c->state) {
 
 	case 0:
-		if (d->audio.fmt.format != FFPCM_FLOAT64 || d->audio.fmt.ileaved) {
-			struct fmed_aconv conv;
-			conv.in = d->audio.fmt;
-			conv.out = d->audio.fmt;
-			conv.out.format = FFPCM_FLOAT64;
-			conv.out.ileaved = 0;
-			if (d->audio.convfmt.format == 0)
-				d->audio.convfmt.format = d->audio.fmt.format;
-			if (d->audio.convfmt.channels == 0)
-				d->audio.convfmt.channels = d->audio.fmt.channels;
-			if (d->audio.convfmt.sample_rate == 0)
-				d->audio.convfmt.sample_rate = d->audio.fmt.sample_rate;
-			d->audio.fmt = conv.out;
-			void *f = (void*)d->track->cmd(d->trk, FMED_TRACK_FILT_ADDPREV, "afilter.conv");
-			if (f == NULL)
-				return FMED_RERR;
-			const struct fmed_filter2 *aconv = core->getmod("afilter.conv");
-			void *fi = (void*)d->track->cmd(d->trk, FMED_TRACK_FILT_INSTANCE, f);
-			if (fi == NULL)
-				return FMED_RERR;
-			aconv->cmd(fi, 0, &conv);
-			d->out = d->data,  d->outlen = d->datalen;
-			c->state = 1;
-			return FMED_RBACK;
+		if ((int64)d->audio.split != FMED_NULL
+			|| FMED_PNULL != d->track->getvalstr(d->trk, "cue_tracks")) {
+			c->state = 2;
+			if (d->audio.fmt.format != FFPCM_FLOAT)
+				return danorm_addconv(d);
+			goto open;
 		}
-		// fall through
-
-	case 1: {
-		struct dynanorm_conf conf = sconf->conf;
-		conf.channels = d->audio.fmt.channels;
-		conf.sampleRate = d->audio.fmt.sample_rate;
-		if (sconf->channels_coupled != 255)
-			conf.channelsCoupled = sconf->channels_coupled;
-		if (sconf->enable_dc_correction != 255)
-			conf.enableDCCorrection = sconf->enable_dc_correction;
-		if (sconf->alt_boundary_mode != 255)
-			conf.altBoundaryMode = sconf->alt_boundary_mode;
-
-		if (0 != dynanorm_open(&c->ctx, &conf)) {
-			errlog(d->trk, "dynanorm_open()");
+
+		// let the next filters set the format they need
+		d->out = d->data,  d->outlen = 0;
+		c->state = 1;
+		return FMED_RDATA;
+
+	case 1:
+		c->outfmt = d->audio.convfmt;
+		d->audio.convfmt.format = FFPCM_FLOAT;
+		d->audio.convfmt.ileaved = c->outfmt.ileaved;
+		c->apply_gain = (1 == d->track->getval(d->trk, "dynanorm_gain"));
+		c->state = 3;
+		return FMED_RMORE;
+
+	case 2:
+		break; // the input format is d->audio.fmt
+
+	case 3:
+		if (d->audio.convfmt.format != FFPCM_FLOAT) {
+			errlog(d->trk, "input must be float32 PCM");
 			return FMED_RERR;
 		}
+		d->audio.fmt = d->audio.convfmt;
+		break;
 
-		uint ch = d->audio.fmt.channels;
-		size_t cap = ffpcm_samples(conf.frameLenMsec, d->audio.fmt.sample_rate);
-		if (NULL == ffarr_alloc(&c->buf, sizeof(void*) * ch + cap * sizeof(double) * ch))
-			return FMED_RSYSERR;
-		if (d->audio.fmt.channels > 8)
-			return FMED_RERR;
-		c->buf.len = cap;
-		ffarrp_setbuf((void**)c->buf.ptr, ch, c->buf.ptr + sizeof(void*) * ch, cap * sizeof(double));
-		ffpcm_fmtcopy(&c->fmt, &d->audio.fmt);
-		c->state = 2;
-		// fall through
+	case 4:
+		goto process;
 	}
 
-	case 2:
-		break;
+open:
+	if (NULL == (c->ctx = dan_open(&sconf->dan, d->audio.fmt.channels, d->audio.fmt.sample_rate))) {
+		errlog(d->trk, "dan_open(): bad configuration or audio format");
+		return FMED_RERR;
+	}
+	c->infmt = d->audio.fmt;
+	c->fmt = d->audio.fmt;
+	c->fmt.ileaved = 0;
+
+	danpar_init(c, d->audio.fmt.channels, d->trk);
+
+	if (c->state == 3) {
+		if (0 != danorm_outconv_prepare(c, d))
+			return FMED_RERR;
+		// the next filters get the format they've requested
+		d->audio.convfmt = c->outfmt;
+	} else {
+		d->audio.fmt = c->fmt;
 	}
+	c->state = 4;
 
+process:
 	if (d->seek_req) {
-		dynanorm_reset(c->ctx);
+		dan_reset(c->ctx);
 		return FMED_RMORE;
 	}
 
 	if (d->flags & FMED_FFWD)
 		c->off = 0;
 
-	ffbool done = 0;
-	uint sampsize = ffpcm_size1(&c->fmt);
-	void *in[8];
-	size_t samples;
-	while (d->datalen != 0) {
-		for (uint i = 0;  i != c->fmt.channels;  i++) {
-			in[i] = (char*)d->datani[i] + c->off;
+	uint sampsize = ffpcm_size1(&c->infmt);
+	float **out;
+	for (;;) {
+		r = dan_read(c->ctx, &out);
+		if (r > 0)
+			break;
+		else if (r < 0) {
+			d->outlen = 0;
+			return FMED_RDONE;
 		}
-		samples = d->datalen / sampsize;
-		size_t in_samps = samples;
-		r = dynanorm_process(c->ctx, (const double*const*)in, &samples, (double**)c->buf.ptr, c->buf.len);
-		dbglog(d->trk, "output:%L  input:%L/%L", r, samples, in_samps);
-		d->datalen -= samples * sampsize;
-		c->off += samples * sampsize;
-		if (r < 0) {
-			errlog(d->trk, "dynanorm_process()");
-			return FMED_RERR;
-		} else if (r != 0)
-			goto data;
+
+		if (d->datalen != 0) {
+			const void *in = (c->infmt.ileaved) ? (void*)d->data : (void*)d->datani;
+			size_t samples = d->datalen / sampsize;
+			size_t n = dan_write(c->ctx, in, c->infmt.ileaved, c->off, samples);
+			dbglog(d->trk, "input:%L/%L", n, samples);
+			if (n == 0) {
+				errlog(d->trk, "dan_write(): no free space");
+				return FMED_RERR;
+			}
+			d->datalen -= n * sampsize;
+			c->off += n;
+			continue;
+		}
+
+		if (!(d->flags & FMED_FLAST))
+			return FMED_RMORE;
+		dan_finish(c->ctx);
 	}
 
-	if (!(d->flags & FMED_FLAST))
-		return FMED_RMORE;
+	if (c->apply_gain) {
+		int db = d->audio.gain;
+		if (db != FMED_NULL && db != c->gain_db) {
+			c->gain_db = db;
+			c->gain = ffpcm_db2gain((double)db / 100);
+		}
+		if (c->gain_db != FMED_NULL && c->gain_db != 0)
+			ffpcm_gain(&c->fmt, c->gain, out, out, r);
+	}
 
-	r = dynanorm_process(c->ctx, NULL, NULL, (double**)c->buf.ptr, c->buf.len);
-	if (r < 0) {
-		errlog(d->trk, "dynanorm_process()");
-		return FMED_RERR;
+	if (c->conv) {
+		if (0 != ffpcm_convert(&c->outfmt, c->outbuf.ptr, &c->fmt, out, r))
+			return FMED_RERR;
+		d->out = c->outbuf.ptr;
+		d->outlen = r * c->out_samp_size;
+		return FMED_RDATA;
 	}
-	dbglog(d->trk, "output:%L", r);
-	done = ((size_t)r < c->buf.len);
 
-data:
-	d->outni = (void**)c->buf.ptr;
-	d->outlen = r * sampsize;
-	return (done) ? FMED_RDONE : FMED_RDATA;
+	d->outni = (void**)out;
+	d->outlen = r * ffpcm_size1(&c->fmt);
+	return FMED_RDATA;
 }
@@ -1127,3 +1127,327 @@ ssize_t ffpcm_process(const ffpcmex *fmt, const void *data, size_t samples, ffpc
 done:
 	return i;
 }
+
+
+/* Level scanning.
+The samples are compared with the threshold converted to the sample format,
+ so the data isn't converted to floating point.
+Interleaved data is scanned as a single array in time order.
+For non-interleaved data each next channel is scanned only up to the frame found in the previous channels.
+SSE2 (AMD64): 8 (int16) or 4 (int32, float) samples per step; int24 is processed by scalar code. */
+
+/** Find the first value with |x| > t.
+Return index in [i..n] (n: not found) */
+static size_t _pcm_find16(const short *p, size_t i, size_t n, int t)
+{
+#ifdef FF_AMD64
+	__m128i hi = _mm_set1_epi16(t), lo = _mm_set1_epi16(-t);
+	for (;  i + 8 <= n;  i += 8) {
+		__m128i x = _mm_loadu_si128((void*)(p + i));
+		__m128i m = _mm_or_si128(_mm_cmpgt_epi16(x, hi), _mm_cmpgt_epi16(lo, x));
+		if (_mm_movemask_epi8(m) != 0)
+			break;
+	}
+#endif
+	for (;  i != n;  i++) {
+		if (ffabs((int)p[i]) > t)
+			break;
+	}
+	return i;
+}
+
+static size_t _pcm_find24(const char *p, size_t i, size_t n, int t)
+{
+	for (;  i != n;  i++) {
+		if (ffabs(ffint_ltoh24s(&p[i * 3])) > t)
+			break;
+	}
+	return i;
+}
+
+static size_t _pcm_find32(const int *p, size_t i, size_t n, int t)
+{
+#ifdef FF_AMD64
+	__m128i hi = _mm_set1_epi32(t), lo = _mm_set1_epi32(-t);
+	for (;  i + 4 <= n;  i += 4) {
+		__m128i x = _mm_loadu_si128((void*)(p + i));
+		__m128i m = _mm_or_si128(_mm_cmpgt_epi32(x, hi), _mm_cmpgt_epi32(lo, x));
+		if (_mm_movemask_epi8(m) != 0)
+			break;
+	}
+#endif
+	for (;  i != n;  i++) {
+		if ((int64)ffabs((int64)ffint_le_cpu32_ptr(&p[i])) > t)
+			break;
+	}
+	return i;
+}
+
+static size_t _pcm_findf(const float *p, size_t i, size_t n, float t)
+{
+#ifdef FF_AMD64
+	__m128 th = _mm_set1_ps(t);
+	__m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	for (;  i + 4 <= n;  i += 4) {
+		__m128 x = _mm_and_ps(_mm_loadu_ps(p + i), absmask);
+		if (_mm_movemask_ps(_mm_cmpgt_ps(x, th)) != 0)
+			break;
+	}
+#endif
+	for (;  i != n;  i++) {
+		if (ffabs(p[i]) > t)
+			break;
+	}
+	return i;
+}
+
+/** Convert level (0..1.0) to the integer threshold.
+Return -1 if no sample can be above the level. */
+static int64 _pcm_thresh(double level, double max)
+{
+	if (level < 0)
+		level = 0;
+	double t = level * max;
+	if (t >= max)
+		return -1;
+	return (int64)t;
+}
+
+/** Find the first value above level in array of values [i..n).
+Return index in [i..n] */
+static size_t _pcm_find(uint format, const void *p, size_t i, size_t n, double level)
+{
+	int64 t;
+	switch (format) {
+	case FFPCM_16:
+		if (0 > (t = _pcm_thresh(level, max16f)))
+			return n;
+		return _pcm_find16(p, i, n, t);
+
+	case FFPCM_24:
+		if (0 > (t = _pcm_thresh(level, max24f)))
+			return n;
+		return _pcm_find24(p, i, n, t);
+
+	case FFPCM_32:
+		if (0 > (t = _pcm_thresh(level, max32f)))
+			return n;
+		return _pcm_find32(p, i, n, t);
+
+	case FFPCM_FLOAT:
+		return _pcm_findf(p, i, n, level);
+	}
+	return n;
+}
+
+/** Get absolute value of the sample #i */
+static double _pcm_absval(uint format, const void *p, size_t i)
+{
+	switch (format) {
+	case FFPCM_16:
+		return _ffpcm_16le_flt(ffabs((int)((short*)p)[i]));
+	case FFPCM_24:
+		return _ffpcm_24_flt(ffabs(ffint_ltoh24s((char*)p + i * 3)));
+	case FFPCM_32:
+		return _ffpcm_32_flt(ffabs((int64)ffint_le_cpu32_ptr((int*)p + i)));
+	case FFPCM_FLOAT:
+		return ffabs(((float*)p)[i]);
+	}
+	return 0;
+}
+
+ssize_t ffpcm_find_above(const ffpcmex *fmt, const void *data, size_t off, size_t frames, double level, double *val)
+{
+	uint nch = fmt->channels;
+	size_t r = frames;
+
+	switch (fmt->format) {
+	case FFPCM_16:
+	case FFPCM_24:
+	case FFPCM_32:
+	case FFPCM_FLOAT:
+		break;
+	default:
+		return -2;
+	}
+	if (nch > 8 || off >= frames)
+		return (nch > 8) ? -2 : -1;
+
+	if (fmt->ileaved) {
+		r = _pcm_find(fmt->format, data, off * nch, frames * nch, level) / nch;
+	} else {
+		for (uint ich = 0;  ich != nch;  ich++) {
+			r = _pcm_find(fmt->format, ((void**)data)[ich], off, r, level);
+		}
+	}
+
+	if (r == frames)
+		return -1;
+
+	if (val != NULL) {
+		double max = 0;
+		for (uint ich = 0;  ich != nch;  ich++) {
+			double d = (fmt->ileaved)
+				? _pcm_absval(fmt->format, data, r * nch + ich)
+				: _pcm_absval(fmt->format, ((void**)data)[ich], r);
+			max = ffmax(max, d);
+		}
+		*val = max;
+	}
+	return r;
+}
+
+/** Sum of squares of values [i..n) */
+static double _pcm_sumsq(uint format, const void *data, size_t i, size_t n)
+{
+	double sum = 0;
+
+#ifdef FF_AMD64
+	// accumulate in float for up to 4096 values, then add to double
+	switch (format) {
+	case FFPCM_16: {
+		const short *p = data;
+		const __m128 k = _mm_set1_ps(1 / max16f);
+		while (i + 8 <= n) {
+			__m128 acc = _mm_setzero_ps();
+			size_t end = ffmin(n, i + 4096);
+			for (;  i + 8 <= end;  i += 8) {
+				__m128i x = _mm_loadu_si128((void*)(p + i));
+				__m128 lo = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16)), k);
+				__m128 hi = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16)), k);
+				acc = _mm_add_ps(acc, _mm_add_ps(_mm_mul_ps(lo, lo), _mm_mul_ps(hi, hi)));
+			}
+			float a[4];
+			_mm_storeu_ps(a, acc);
+			sum += (double)a[0] + a[1] + a[2] + a[3];
+		}
+		break;
+	}
+
+	case FFPCM_32: {
+		const int *p = data;
+		const __m128 k = _mm_set1_ps(1 / max32f);
+		while (i + 4 <= n) {
+			__m128 acc = _mm_setzero_ps();
+			size_t end = ffmin(n, i + 4096);
+			for (;  i + 4 <= end;  i += 4) {
+				__m128 x = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((void*)(p + i))), k);
+				acc = _mm_add_ps(acc, _mm_mul_ps(x, x));
+			}
+			float a[4];
+			_mm_storeu_ps(a, acc);
+			sum += (double)a[0] + a[1] + a[2] + a[3];
+		}
+		break;
+	}
+
+	case FFPCM_FLOAT: {
+		const float *p = data;
+		while (i + 4 <= n) {
+			__m128 acc = _mm_setzero_ps();
+			size_t end = ffmin(n, i + 4096);
+			for (;  i + 4 <= end;  i += 4) {
+				__m128 x = _mm_loadu_ps(p + i);
+				acc = _mm_add_ps(acc, _mm_mul_ps(x, x));
+			}
+			float a[4];
+			_mm_storeu_ps(a, acc);
+			sum += (double)a[0] + a[1] + a[2] + a[3];
+		}
+		break;
+	}
+	}
+#endif
+
+	for (;  i != n;  i++) {
+		double d = _pcm_absval(format, data, i);
+		sum += d * d;
+	}
+	return sum;
+}
+
+int ffpcm_sumsq(const ffpcmex *fmt, const void *data, size_t off, size_t frames, double *sum)
+{
+	uint nch = fmt->channels;
+
+	switch (fmt->format) {
+	case FFPCM_16:
+	case FFPCM_24:
+	case FFPCM_32:
+	case FFPCM_FLOAT:
+		break;
+	default:
+		return -1;
+	}
+	if (nch > 8)
+		return -1;
+
+	*sum = 0;
+	if (off >= frames)
+		return 0;
+
+	if (fmt->ileaved) {
+		*sum = _pcm_sumsq(fmt->format, data, off * nch, frames * nch);
+	} else {
+		for (uint ich = 0;  ich != nch;  ich++) {
+			*sum += _pcm_sumsq(fmt->format, ((void**)data)[ich], off, frames);
+		}
+	}
+	return 0;
+}
+
+#define _PCM_MINMAX(val) \
+do { \
+	for (;  i < n;  i += step) { \
+		double d = (val); \
+		if (d < lo) \
+			lo = d; \
+		if (d > hi) \
+			hi = d; \
+		sum += d * d; \
+	} \
+} while (0)
+
+int ffpcm_minmax(const ffpcmex *fmt, const void *data, uint ich, size_t off, size_t frames, float *min, float *max, double *sumsq)
+{
+	uint nch = fmt->channels;
+	if (ich >= nch)
+		return -1;
+
+	const void *p;
+	size_t i, n, step;
+	if (fmt->ileaved) {
+		p = data;
+		i = off * nch + ich;
+		n = frames * nch;
+		step = nch;
+	} else {
+		p = ((void**)data)[ich];
+		i = off;
+		n = frames;
+		step = 1;
+	}
+
+	double lo = *min, hi = *max, sum = *sumsq;
+	switch (fmt->format) {
+	case FFPCM_16:
+		_PCM_MINMAX(_ffpcm_16le_flt(((short*)p)[i]));
+		break;
+	case FFPCM_24:
+		_PCM_MINMAX(_ffpcm_24_flt(ffint_ltoh24s((char*)p + i * 3)));
+		break;
+	case FFPCM_32:
+		_PCM_MINMAX(_ffpcm_32_flt(ffint_le_cpu32_ptr((int*)p + i)));
+		break;
+	case FFPCM_FLOAT:
+		_PCM_MINMAX(((float*)p)[i]);
+		break;
+	default:
+		return -1;
+	}
+
+	*min = lo;
+	*max = hi;
+	*sumsq = sum;
+	return 0;
+}
@@ -0,0 +1,200 @@
+/** fmedia: 2:1 decimator with a half-band FIR filter (96000 -> 48000, 88200 -> 44100)
+2022, Simon Zolin */
+
+/*
+Every other coefficient of a half-band filter is 0 (except the center one = 0.5),
+ so the input is split into 2 polyphase components: even samples E[] and odd samples O[]:
+  y[n] = 0.5 * E[n] + sum(j=0..HB_HALF-1; g[j] * (O[n+j] + O[n-1-j]))
+Both sums run over the contiguous arrays, so they are vectorized with SSE.
+
+Filter: windowed sinc (Kaiser, beta=12.3), HB_TAPS taps:
+ stopband attenuation ~120dB (as soxr "high quality"),
+ passband is flat up to 0.46 of the output Nyquist frequency (22kHz for 96kHz input).
+The filter is zero-phase: output sample #n is aligned with input sample #2n, the output length is ceil(input/2).
+Samples are float32.
+*/
+
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+enum {
+	HB_HALF = 48, // non-zero coefficients on each side of the center
+	HB_TAPS = HB_HALF * 4 - 1,
+	HB_MAXCHANNELS = 8,
+};
+
+struct hb {
+	uint channels;
+	uint cap; // max. samples per phase buffer
+	float *e[HB_MAXCHANNELS], *o[HB_MAXCHANNELS]; // E[n0..], O[n0-HB_HALF..]
+	uint elen, olen; // samples in e[], o[]
+	uint parity; // the next input sample is odd
+	uint fin :1;
+	float g[HB_HALF], grev[HB_HALF];
+};
+
+static inline void hb_close(struct hb *h)
+{
+	if (h == NULL)
+		return;
+	ffmem_alignfree(h->e[0]);
+	ffmem_free(h);
+}
+
+static inline void hb_reset(struct hb *h)
+{
+	h->elen = 0;
+	h->olen = HB_HALF;
+	h->parity = 0;
+	h->fin = 0;
+	for (uint c = 0;  c != h->channels;  c++) {
+		ffmem_zero(h->o[c], HB_HALF * sizeof(float));
+	}
+}
+
+static inline double _hb_bessel_i0(double x)
+{
+	double sum = 1, term = 1;
+	for (uint k = 1;  k != 50;  k++) {
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+		if (term < sum * 1e-17)
+			break;
+	}
+	return sum;
+}
+
+/**
+max_in: max. input samples per hb_write()
+Return NULL on error */
+static inline struct hb* hb_create(uint channels, uint max_in)
+{
+	struct hb *h;
+	if (channels == 0 || channels > HB_MAXCHANNELS)
+		return NULL;
+	if (NULL == (h = ffmem_new(struct hb)))
+		return NULL;
+	h->channels = channels;
+	// the tail of O[] (2*HB_HALF-1) + new data + the padding added by hb_finish()
+	h->cap = max_in / 2 + 1 + 3 * HB_HALF;
+	h->cap = ff_align_ceil2(h->cap, 4);
+
+	float *p;
+	if (NULL == (p = ffmem_align(h->cap * 2 * channels * sizeof(float), 16))) {
+		ffmem_free(h);
+		return NULL;
+	}
+	for (uint c = 0;  c != channels;  c++) {
+		h->e[c] = p + h->cap * 2 * c;
+		h->o[c] = h->e[c] + h->cap;
+	}
+
+	const double beta = 12.3;
+	double i0b = _hb_bessel_i0(beta), sum = 0;
+	for (uint j = 0;  j != HB_HALF;  j++) {
+		int k = 2 * j + 1; // distance from the center
+		double x = (double)k / (HB_TAPS / 2 + 1);
+		double w = _hb_bessel_i0(beta * sqrt(1 - x * x)) / i0b;
+		double v = sin(3.14159265358979323846 * k / 2) / (3.14159265358979323846 * k) * w;
+		h->g[j] = v;
+		sum += v;
+	}
+	// DC gain = 0.5 + 2 * sum(g) = 1
+	for (uint j = 0;  j != HB_HALF;  j++) {
+		h->g[j] *= 0.25 / sum;
+		h->grev[HB_HALF - 1 - j] = h->g[j];
+	}
+
+	hb_reset(h);
+	return h;
+}
+
+/** sum(a[i] * b[i]) */
+static inline float _hb_dot(const float *a, const float *b)
+{
+#ifdef __SSE2__
+	__m128 s = _mm_setzero_ps();
+	for (uint i = 0;  i != HB_HALF;  i += 4) {
+		s = _mm_add_ps(s, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+	}
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+	return _mm_cvtss_f32(s);
+#else
+	float s = 0;
+	for (uint i = 0;  i != HB_HALF;  i++) {
+		s += a[i] * b[i];
+	}
+	return s;
+#endif
+}
+
+/** Add input samples (non-interleaved).
+n: must not exceed 'max_in' */
+static inline void hb_write(struct hb *h, const float *const *in, uint n)
+{
+	uint p = h->parity;
+	for (uint c = 0;  c != h->channels;  c++) {
+		float *e = h->e[c] + h->elen, *o = h->o[c] + h->olen;
+		const float *s = in[c];
+		uint ie = 0, io = 0;
+		for (uint i = 0;  i != n;  i++) {
+			if (((i + p) & 1) == 0)
+				e[ie++] = s[i];
+			else
+				o[io++] = s[i];
+		}
+		if (c == h->channels - 1) {
+			h->elen += ie;
+			h->olen += io;
+		}
+	}
+	h->parity = (p + n) & 1;
+}
+
+/** No more input data */
+static inline void hb_finish(struct hb *h)
+{
+	if (h->fin)
+		return;
+	h->fin = 1;
+	// the odd samples after the last even one
+	for (uint c = 0;  c != h->channels;  c++) {
+		ffmem_zero(h->o[c] + h->olen, HB_HALF * sizeof(float));
+	}
+	h->olen += HB_HALF;
+}
+
+/** Get output samples (non-interleaved).
+All available data must be read before the next hb_write(): 'cap' >= max_in/2 + 2.
+Return the number of samples */
+static inline uint hb_read(struct hb *h, float **out, uint cap)
+{
+	// y[n] needs E[n] and O[n-HB_HALF .. n+HB_HALF-1]
+	uint n = h->elen;
+	if (h->olen < 2 * HB_HALF)
+		n = 0;
+	else
+		n = ffmin(n, h->olen - 2 * HB_HALF + 1);
+	n = ffmin(n, cap);
+	if (n == 0)
+		return 0;
+
+	for (uint c = 0;  c != h->channels;  c++) {
+		const float *e = h->e[c], *o = h->o[c];
+		float *y = out[c];
+		for (uint i = 0;  i != n;  i++) {
+			// o[i + HB_HALF] is O[n]
+			y[i] = 0.5f * e[i]
+				+ _hb_dot(o + i + HB_HALF, h->g)
+				+ _hb_dot(o + i, h->grev);
+		}
+		ffmem_move(h->e[c], e + n, (h->elen - n) * sizeof(float));
+		ffmem_move(h->o[c], o + n, (h->olen - n) * sizeof(float));
+	}
+	h->elen -= n;
+	h->olen -= n;
+	return n;
+}
@@ -0,0 +1,582 @@
+/** Loudness analysis: EBU R128 integrated loudness, loudness range, true peak;  ReplayGain.
+Copyright (c) 2022 Simon Zolin */
+
+#include <fmedia.h>
+#include <afilter/pcm.h>
+
+
+extern const fmed_core *core;
+
+#undef dbglog
+#undef errlog
+#define dbglog(trk, ...)  fmed_dbglog(core, trk, "loudness", __VA_ARGS__)
+#define errlog(trk, ...)  fmed_errlog(core, trk, "loudness", __VA_ARGS__)
+
+static void* loudness_open(fmed_filt *d);
+static int loudness_process(void *ctx, fmed_filt *d);
+static void loudness_close(void *ctx);
+const fmed_filter fmed_sndmod_loudness = {
+	&loudness_open, &loudness_process, &loudness_close
+};
+
+/*
+ITU-R BS.1770-4, EBU Tech 3341, 3342:
+. The audio is filtered by K-weighting filter: high shelf + high pass biquads,
+   the coefficients are computed for the sample rate.
+. Mean square values of the filtered audio are summed for 100ms sub-blocks.
+. Gating blocks (400ms, 75% overlap) above -70 LUFS and above (mean - 10LU) -> integrated loudness.
+. Short-term blocks (3s, 100ms step) above -70 LUFS and above (mean - 20LU):
+   the difference between 10% and 95% of their distribution -> loudness range (LRA).
+. True peak: x4 oversampling (x2 for 88.2-96kHz, none above) by a polyphase windowed-sinc FIR.
+  The samples of a block can't produce an interpolated value higher than max(|sample|) * (sum of |taps|),
+   so the oversampling is skipped for the blocks that can't raise the current peak value.
+. ReplayGain 2.0: gain = -18 LUFS - integrated loudness;  peak = true peak.
+The block loudness values are stored in histograms (0.1LU per bin),
+ so an album's values are computed from the sum of its tracks' histograms.
+Any PCM format is accepted: float interleaved data is processed as is, other formats are converted.
+The channels are processed in lockstep with the filter state arrays indexed by channel,
+ so the inner loop has no dependencies between iterations and is vectorized by the compiler.
+*/
+
+enum {
+	LN_MAXCHAN = 8,
+	LN_BINS = 750, // -70..+5 LUFS
+	LN_SUB = 100, // sub-block duration (msec)
+	LN_MOMENTARY = 4, // sub-blocks in a gating block (400ms)
+	LN_SHORTTERM = 30, // sub-blocks in a short-term block (3s)
+	TP_TAPS = 12, // FIR taps per phase
+	TP_MAXOS = 4, // max. oversampling factor
+	TP_BLOCK = 256, // frames
+};
+
+#define LN_GATE_ABS  (-70.0) // LUFS
+#define LN_GATE_REL  (10.0) // LU
+#define LN_LRA_GATE_REL  (20.0) // LU
+#define RG_REF  (-18.0) // ReplayGain 2.0 reference level (LUFS)
+#define LN_PI  3.14159265358979323846
+
+/** Histogram of block loudness values: 0.1LU per bin */
+struct ln_hist {
+	uint64 n[LN_BINS];
+	double energy[LN_BINS]; // sum of mean square values of the blocks
+};
+
+struct ln_biquad {
+	double b0, b1, b2, a1, a2;
+};
+
+struct loudness {
+	ffpcmex fmt;
+	uint nch;
+	ffvec buf; // float[] interleaved: converted input data
+	uint64 frames;
+
+	struct ln_biquad kw[2];
+	double z[2][2][LN_MAXCHAN]; // [stage][state][channel]
+	double weight[LN_MAXCHAN];
+	double sum[LN_MAXCHAN]; // sum of squares in the current sub-block
+	uint sub_frames, sub_n;
+	double subs[LN_SHORTTERM]; // weighted sums of squares of the last sub-blocks
+	uint isub, nsubs;
+	struct ln_hist hist_m, hist_s; // gating blocks, short-term blocks
+
+	uint os; // oversampling factor
+	float fir[TP_MAXOS][TP_TAPS]; // [phase][tap]
+	double fir_gain; // max. sum of |taps| of a phase
+	float hist[LN_MAXCHAN][TP_TAPS * 2]; // the last input samples (the newest is at 'hpos'), duplicated
+	uint hpos;
+	double tpeak[LN_MAXCHAN], speak[LN_MAXCHAN];
+	uint cancelled :1;
+};
+
+struct ln_result {
+	double integrated; // LUFS
+	double range; // LU
+	double tpeak, speak; // max. values of all channels (linear)
+};
+
+/** Album: the sum of all tracks */
+static struct ln_album {
+	fflock lk;
+	struct ln_hist hist_m, hist_s;
+	double tpeak, speak;
+	uint tracks;
+} ln_album;
+
+
+static double ln_lufs(double energy)
+{
+	return -0.691 + 10 * log10(energy);
+}
+
+static double ln_db(double gain)
+{
+	return ffpcm_gain2db(ffmax(gain, 1e-10));
+}
+
+static void hist_add(struct ln_hist *h, double energy)
+{
+	if (energy <= 0)
+		return;
+	double l = ln_lufs(energy);
+	if (l < LN_GATE_ABS)
+		return;
+	uint i = (l - LN_GATE_ABS) * 10;
+	i = ffmin(i, LN_BINS - 1);
+	h->n[i]++;
+	h->energy[i] += energy;
+}
+
+static void hist_merge(struct ln_hist *dst, const struct ln_hist *src)
+{
+	for (uint i = 0;  i != LN_BINS;  i++) {
+		dst->n[i] += src->n[i];
+		dst->energy[i] += src->energy[i];
+	}
+}
+
+/** Get the bin of the relative gate: 'rel' LU below the mean loudness of all blocks.
+Return -1 if the histogram is empty */
+static int hist_gate(const struct ln_hist *h, double rel)
+{
+	uint64 n = 0;
+	double e = 0;
+	for (uint i = 0;  i != LN_BINS;  i++) {
+		n += h->n[i];
+		e += h->energy[i];
+	}
+	if (n == 0)
+		return -1;
+	int i = (ln_lufs(e / n) - rel - LN_GATE_ABS) * 10;
+	return ffmax(i, 0);
+}
+
+/** Integrated loudness (LUFS) */
+static double hist_integrated(const struct ln_hist *h)
+{
+	int g = hist_gate(h, LN_GATE_REL);
+	if (g < 0)
+		return LN_GATE_ABS;
+
+	uint64 n = 0;
+	double e = 0;
+	for (uint i = g;  i < LN_BINS;  i++) {
+		n += h->n[i];
+		e += h->energy[i];
+	}
+	if (n == 0)
+		return LN_GATE_ABS;
+	return ln_lufs(e / n);
+}
+
+/** Loudness range (LU) */
+static double hist_range(const struct ln_hist *h)
+{
+	int g = hist_gate(h, LN_LRA_GATE_REL);
+	if (g < 0)
+		return 0;
+
+	uint64 n = 0;
+	for (uint i = g;  i < LN_BINS;  i++) {
+		n += h->n[i];
+	}
+	if (n == 0)
+		return 0;
+	uint64 lo_n = n * 10 / 100, hi_n = n * 95 / 100, sum = 0;
+	int lo = -1, hi = LN_BINS - 1;
+	for (uint i = g;  i < LN_BINS;  i++) {
+		sum += h->n[i];
+		if (lo < 0 && sum > lo_n)
+			lo = i;
+		if (sum > hi_n) {
+			hi = i;
+			break;
+		}
+	}
+	return (double)(hi - lo) / 10;
+}
+
+/** K-weighting filter coefficients for the sample rate */
+static void kw_init(struct ln_biquad *f, uint rate)
+{
+	// stage 1: high shelf
+	double f0 = 1681.974450955533, g = 3.999843853973347, q = 0.7071752369554196;
+	double k = tan(LN_PI * f0 / rate);
+	double vh = pow(10, g / 20), vb = pow(vh, 0.4996667741545416);
+	double a0 = 1 + k / q + k * k;
+	f[0].b0 = (vh + vb * k / q + k * k) / a0;
+	f[0].b1 = 2 * (k * k - vh) / a0;
+	f[0].b2 = (vh - vb * k / q + k * k) / a0;
+	f[0].a1 = 2 * (k * k - 1) / a0;
+	f[0].a2 = (1 - k / q + k * k) / a0;
+
+	// stage 2: high pass
+	f0 = 38.13547087602444;
+	q = 0.5003270373238773;
+	k = tan(LN_PI * f0 / rate);
+	a0 = 1 + k / q + k * k;
+	f[1].b0 = 1;
+	f[1].b1 = -2;
+	f[1].b2 = 1;
+	f[1].a1 = 2 * (k * k - 1) / a0;
+	f[1].a2 = (1 - k / q + k * k) / a0;
+}
+
+/** Interpolation filter for true peak: windowed sinc split into 'os' phases.
+The filter length is even, so every phase (including #0) interpolates between the input samples. */
+static void tp_init(struct loudness *l, uint rate)
+{
+	l->os = (rate < 88200) ? 4 : (rate < 176400) ? 2 : 1;
+	if (l->os == 1)
+		return;
+
+	uint n = TP_TAPS * l->os;
+	for (uint p = 0;  p != l->os;  p++) {
+		double sum = 0, abssum = 0;
+		for (uint k = 0;  k != TP_TAPS;  k++) {
+			uint i = p + k * l->os;
+			double t = ((double)i - (double)(n - 1) / 2) / l->os;
+			double sinc = (t == 0) ? 1 : sin(LN_PI * t) / (LN_PI * t);
+			double w = 0.5 - 0.5 * cos(2 * LN_PI * (i + 0.5) / n); // Hann
+			l->fir[p][k] = sinc * w;
+			sum += l->fir[p][k];
+		}
+		for (uint k = 0;  k != TP_TAPS;  k++) {
+			l->fir[p][k] /= sum; // unity gain at DC for each phase
+			abssum += fabs(l->fir[p][k]);
+		}
+		l->fir_gain = ffmax(l->fir_gain, abssum);
+	}
+}
+
+/** Channel weights for the default channel layout (WAVE order) of each number of channels:
+ front L, R, C: 1.0;  LFE (f): ignored;  surround and back (s): +1.5dB */
+static void ln_weights(double *weight, uint nch)
+{
+	static const char layouts[LN_MAXCHAN][LN_MAXCHAN + 1] = {
+		"C", // mono
+		"LR", // stereo
+		"LRC", // 3.0
+		"LRss", // quad
+		"LRCss", // 5.0
+		"LRCfss", // 5.1
+		"LRCfsss", // 6.1: back C, side L, R
+		"LRCfssss", // 7.1
+	};
+	const char *ch = layouts[nch - 1];
+	for (uint i = 0;  i != nch;  i++) {
+		weight[i] = (ch[i] == 'f') ? 0
+			: (ch[i] == 's') ? 1.41
+			: 1;
+	}
+}
+
+static void* loudness_open(fmed_filt *d)
+{
+	if (!d->loudness)
+		return FMED_FILT_SKIP;
+
+	ffpcmex fmt = d->audio.fmt;
+	if (d->stream_copy
+		|| fmt.channels == 0 || fmt.channels > LN_MAXCHAN
+		|| fmt.sample_rate < 8000) {
+		errlog(d->trk, "unsupported audio format: %s %uHz %u channels"
+			, ffpcm_fmtstr(fmt.format), fmt.sample_rate, fmt.channels);
+		return FMED_FILT_SKIP;
+	}
+
+	struct loudness *l = ffmem_new(struct loudness);
+	if (l == NULL)
+		return NULL;
+	l->fmt = fmt;
+	l->nch = fmt.channels;
+	l->sub_frames = ffpcm_samples(LN_SUB, fmt.sample_rate);
+	kw_init(l->kw, fmt.sample_rate);
+	tp_init(l, fmt.sample_rate);
+
+	ln_weights(l->weight, l->nch);
+	return l;
+}
+
+static void loudness_close(void *ctx)
+{
+	struct loudness *l = ctx;
+	ffvec_free(&l->buf);
+	ffmem_free(l);
+}
+
+/** The sub-block is complete: add the gating and short-term blocks ending with it */
+static void ln_sub_done(struct loudness *l)
+{
+	double e = 0;
+	for (uint c = 0;  c != l->nch;  c++) {
+		e += l->weight[c] * l->sum[c];
+		l->sum[c] = 0;
+	}
+	l->subs[l->isub] = e;
+	l->isub = (l->isub + 1) % LN_SHORTTERM;
+	l->nsubs++;
+	l->sub_n = 0;
+
+	if (l->nsubs >= LN_MOMENTARY) {
+		double s = 0;
+		for (uint i = 0;  i != LN_MOMENTARY;  i++) {
+			s += l->subs[(l->isub + LN_SHORTTERM - 1 - i) % LN_SHORTTERM];
+		}
+		hist_add(&l->hist_m, s / ((double)LN_MOMENTARY * l->sub_frames));
+	}
+
+	if (l->nsubs >= LN_SHORTTERM) {
+		double s = 0;
+		for (uint i = 0;  i != LN_SHORTTERM;  i++) {
+			s += l->subs[i];
+		}
+		hist_add(&l->hist_s, s / ((double)LN_SHORTTERM * l->sub_frames));
+	}
+}
+
+/** K-weighting and sums of squares */
+static void kw_process(struct loudness *l, const float *d, size_t frames)
+{
+	const uint nch = l->nch;
+	const struct ln_biquad f1 = l->kw[0], f2 = l->kw[1];
+
+	for (size_t i = 0;  i != frames;  ) {
+		size_t n = ffmin(frames - i, l->sub_frames - l->sub_n);
+		for (size_t j = i;  j != i + n;  j++) {
+			const float *s = d + j * nch;
+			for (uint c = 0;  c != nch;  c++) {
+				double x = s[c];
+				double y = f1.b0 * x + l->z[0][0][c];
+				l->z[0][0][c] = f1.b1 * x - f1.a1 * y + l->z[0][1][c];
+				l->z[0][1][c] = f1.b2 * x - f1.a2 * y;
+
+				x = y;
+				y = f2.b0 * x + l->z[1][0][c];
+				l->z[1][0][c] = f2.b1 * x - f2.a1 * y + l->z[1][1][c];
+				l->z[1][1][c] = f2.b2 * x - f2.a2 * y;
+
+				l->sum[c] += y * y;
+			}
+		}
+		i += n;
+		l->sub_n += n;
+		if (l->sub_n == l->sub_frames)
+			ln_sub_done(l);
+	}
+}
+
+/** Sample peak and true peak */
+static void tp_process(struct loudness *l, const float *d, size_t frames)
+{
+	const uint nch = l->nch;
+
+	for (size_t off = 0;  off != frames;  ) {
+		size_t n = ffmin(frames - off, TP_BLOCK);
+		const float *s = d + off * nch;
+		uint full[LN_MAXCHAN], nfull = 0;
+
+		for (uint c = 0;  c != nch;  c++) {
+			float m = 0, hm = 0;
+			for (size_t i = 0;  i != n;  i++) {
+				m = ffmax(m, fabsf(s[i * nch + c]));
+			}
+			for (uint k = 0;  k != TP_TAPS;  k++) {
+				hm = ffmax(hm, fabsf(l->hist[c][l->hpos + k]));
+			}
+			l->speak[c] = ffmax(l->speak[c], m);
+			l->tpeak[c] = ffmax(l->tpeak[c], m);
+			full[c] = (l->os != 1 && ffmax(m, hm) * l->fir_gain > l->tpeak[c]);
+			nfull += full[c];
+		}
+
+		for (size_t i = 0;  i != n;  i++) {
+			l->hpos = (l->hpos == 0) ? TP_TAPS - 1 : l->hpos - 1;
+			for (uint c = 0;  c != nch;  c++) {
+				float *h = l->hist[c];
+				h[l->hpos] = h[l->hpos + TP_TAPS] = s[i * nch + c];
+				if (!full[c])
+					continue;
+
+				const float *w = h + l->hpos;
+				for (uint p = 0;  p != l->os;  p++) {
+					double y = 0;
+					for (uint k = 0;  k != TP_TAPS;  k++) {
+						y += l->fir[p][k] * w[k];
+					}
+					l->tpeak[c] = ffmax(l->tpeak[c], fabs(y));
+				}
+			}
+		}
+
+		off += n;
+	}
+}
+
+static void ln_result(const struct ln_hist *m, const struct ln_hist *s, double tpeak, double speak, struct ln_result *r)
+{
+	r->integrated = hist_integrated(m);
+	r->range = hist_range(s);
+	r->tpeak = tpeak;
+	r->speak = speak;
+}
+
+/** Add a JSON string value */
+static void ln_json_str(ffvec *buf, const char *s)
+{
+	ffvec_addchar(buf, '"');
+	for (;  *s != '\0';  s++) {
+		uint c = (byte)*s;
+		if (c == '"' || c == '\\')
+			ffvec_addfmt(buf, "\\%c", c);
+		else if (c < 0x20)
+			ffvec_addfmt(buf, "\\u%04xu", c);
+		else
+			ffvec_addchar(buf, c);
+	}
+	ffvec_addchar(buf, '"');
+}
+
+/** Append the results to fmed_props.loudness_json:
+{"input":"...", "integrated":LUFS, "range":LU, "true_peak":dBTP, "sample_peak":dBFS,
+ "replaygain_gain":dB, "replaygain_peak":N}
+Album: {"album":true, "tracks":N, ...} */
+static void ln_json(const char *input, uint tracks, const struct ln_result *r)
+{
+	ffvec buf = {};
+	if (input != NULL) {
+		ffvec_addsz(&buf, "{\"input\":");
+		ln_json_str(&buf, input);
+	} else {
+		ffvec_addfmt(&buf, "{\"album\":true,\"tracks\":%u", tracks);
+	}
+	ffvec_addfmt(&buf, ",\"integrated\":%.2F,\"range\":%.2F,\"true_peak\":%.2F,\"sample_peak\":%.2F"
+		",\"replaygain_gain\":%.2F,\"replaygain_peak\":%.6F}\n"
+		, r->integrated, r->range, ln_db(r->tpeak), ln_db(r->speak)
+		, RG_REF - r->integrated, r->tpeak);
+
+	const char *fn = core->props->loudness_json;
+	fffd f = fffile_open(fn, FFO_CREATE | FFO_APPEND | FFO_WRONLY);
+	if (f == FF_BADFD) {
+		fmed_syserrlog(core, NULL, "loudness", "file open: %s", fn);
+		goto end;
+	}
+	if (buf.len != (size_t)fffile_write(f, buf.ptr, buf.len))
+		fmed_syserrlog(core, NULL, "loudness", "file write: %s", fn);
+	fffile_close(f);
+
+end:
+	ffvec_free(&buf);
+}
+
+static void ln_print(void *trk, const char *title, const struct ln_result *r)
+{
+	double gain = RG_REF - r->integrated;
+	core->log(FMED_LOG_USER, trk, NULL,
+		"%s: integrated: %.1F LUFS, range: %.1F LU, true peak: %.1F dBTP, sample peak: %.1F dBFS."
+		"  ReplayGain: %s%.2F dB, peak %.6F"
+		, title, r->integrated, r->range, ln_db(r->tpeak), ln_db(r->speak)
+		, (gain >= 0) ? "+" : "", gain, r->tpeak);
+}
+
+static void ln_finish(struct loudness *l, fmed_filt *d)
+{
+	double tpeak = 0, speak = 0;
+	for (uint c = 0;  c != l->nch;  c++) {
+		tpeak = ffmax(tpeak, l->tpeak[c]);
+		speak = ffmax(speak, l->speak[c]);
+	}
+
+	struct ln_result r;
+	ln_result(&l->hist_m, &l->hist_s, tpeak, speak, &r);
+	ln_print(d->trk, "Loudness", &r);
+	dbglog(d->trk, "%U samples", l->frames);
+
+	fflk_lock(&ln_album.lk);
+	if (core->props->loudness_album) {
+		hist_merge(&ln_album.hist_m, &l->hist_m);
+		hist_merge(&ln_album.hist_s, &l->hist_s);
+		ln_album.tpeak = ffmax(ln_album.tpeak, tpeak);
+		ln_album.speak = ffmax(ln_album.speak, speak);
+		ln_album.tracks++;
+	}
+	if (core->props->loudness_json != NULL) {
+		const char *input = d->track->getvalstr(d->trk, "input");
+		ln_json((input != FMED_PNULL) ? input : "", 0, &r);
+	}
+	fflk_unlock(&ln_album.lk);
+}
+
+/** Print the album results after all tracks are finished. */
+static void ln_album_finish(void)
+{
+	if (ln_album.tracks == 0)
+		return;
+
+	struct ln_result r;
+	ln_result(&ln_album.hist_m, &ln_album.hist_s, ln_album.tpeak, ln_album.speak, &r);
+	char title[64];
+	ffs_format(title, sizeof(title), "Album loudness (%u tracks)%Z", ln_album.tracks);
+	ln_print(NULL, title, &r);
+	if (core->props->loudness_json != NULL)
+		ln_json(NULL, ln_album.tracks, &r);
+	ln_album.tracks = 0;
+}
+
+void loudness_sig(uint signo)
+{
+	switch (signo) {
+	case FMED_OPEN:
+		fflk_init(&ln_album.lk);
+		break;
+
+	case FMED_STOP:
+		ln_album_finish();
+		break;
+	}
+}
+
+static int loudness_process(void *ctx, fmed_filt *d)
+{
+	struct loudness *l = ctx;
+	size_t frames = d->datalen / ffpcm_size1(&l->fmt);
+
+	if ((int64)d->audio.seek != FMED_NULL && !l->cancelled) {
+		dbglog(d->trk, "seeking: the results won't be valid", 0);
+		l->cancelled = 1;
+	}
+
+	if (frames != 0 && !l->cancelled) {
+		const float *data = (void*)d->data;
+		if (!(l->fmt.format == FFPCM_FLOAT && l->fmt.ileaved)) {
+			ffpcmex f = l->fmt;
+			f.format = FFPCM_FLOAT;
+			f.ileaved = 1;
+			if (l->buf.cap < frames * l->nch) {
+				ffvec_free(&l->buf);
+				if (NULL == ffvec_allocT(&l->buf, frames * l->nch, float))
+					return FMED_RERR;
+			}
+			if (0 != ffpcm_convert(&f, l->buf.ptr, &l->fmt, d->data, frames)) {
+				errlog(d->trk, "unsupported PCM format: %s", ffpcm_fmtstr(l->fmt.format));
+				return FMED_RERR;
+			}
+			data = l->buf.ptr;
+		}
+
+		kw_process(l, data, frames);
+		tp_process(l, data, frames);
+		l->frames += frames;
+	}
+
+	d->out = d->data;
+	d->outlen = d->datalen;
+	d->datalen = 0;
+
+	if (d->flags & FMED_FLAST) {
+		if (!l->cancelled)
+			ln_finish(l, d);
+		return FMED_RDONE;
+	}
+	return FMED_ROK;
+}
@@ -140,6 +140,24 @@ Return sample number at which user stopped;
  <0: error. */
 FF_EXTERN ssize_t ffpcm_process(const ffpcmex *fmt, const void *data, size_t samples, ffpcm_process_func func, void *udata);
 
+/** Find the first frame in which the absolute value of any channel's sample is above 'level' (0..1.0).
+Frames are searched in time order, in range [off..frames).
+val: (optional) the highest absolute value in the found frame
+Return frame number;
+ -1: not found;
+ -2: unsupported format. */
+FF_EXTERN ssize_t ffpcm_find_above(const ffpcmex *fmt, const void *data, size_t off, size_t frames, double level, double *val);
+
+/** Get the sum of squares of the samples (-1.0..1.0) of all channels in frames [off..frames).
+Use it to get the RMS level of a window: sqrt(sum / (frames * channels)).
+Return 0 on success;  !=0: unsupported format. */
+FF_EXTERN int ffpcm_sumsq(const ffpcmex *fmt, const void *data, size_t off, size_t frames, double *sum);
+
+/** Update the lowest and the highest values and the sum of squares
+ with the samples (-1.0..1.0) of channel 'ich' in frames [off..frames).
+Return 0 on success;  !=0: unsupported format. */
+FF_EXTERN int ffpcm_minmax(const ffpcmex *fmt, const void *data, uint ich, size_t off, size_t frames, float *min, float *max, double *sumsq);
+
 static FFINL int ffint_ltoh24s(const void *p)
 {
 	const byte *b = (byte*)p;
@@ -0,0 +1,104 @@
+/** fmedia: find the tracks separated by silence
+2022, Simon Zolin */
+
+/*
+The audio is scanned in consecutive windows of SILDET_WINDOW msec:
+ the RMS level of all channels is computed by ffpcm_sumsq() for the whole window at once.
+A window is quiet if its level isn't above the threshold.
+The track ends when the silence has lasted for 'min_silence' frames
+ (but not before the track has lasted for 'min_track' frames).
+The next track starts at the first loud window.
+The audio before the first loud window is a gap too.
+*/
+
+#include <afilter/pcm.h>
+
+enum {
+	SILDET_WINDOW = 20, // msec
+};
+
+struct silence_det {
+	ffpcmex fmt;
+	double level; // max. RMS level of silence
+	uint window; // frames per window
+	uint64 min_silence, min_track; // frames
+
+	uint n; // frames in the current window
+	double sum;
+	uint64 total; // frames scanned
+	uint64 track_start; // start of the current track
+	uint64 sil_start; // start of the current silence;  -1: sound
+	uint64 event; // SILDET_SOUND: the track starts at this frame
+	uint gap :1; // between the tracks
+};
+
+enum SILDET_R {
+	SILDET_MORE, // all data is scanned
+	SILDET_SILENCE, // the track ends at the frame '*off'
+	SILDET_SOUND, // the next track starts at the frame 'event'
+};
+
+/**
+level: dB (<0)
+min_silence, min_track: msec
+Return 0 on success;  !=0: unsupported format */
+static inline int silence_init(struct silence_det *s, const ffpcmex *fmt, double level, uint min_silence, uint min_track)
+{
+	double t;
+	if (0 != ffpcm_sumsq(fmt, NULL, 0, 0, &t))
+		return -1;
+
+	ffmem_zero_obj(s);
+	s->fmt = *fmt;
+	s->level = ffpcm_db2gain(level);
+	s->window = ffmax(ffpcm_samples(SILDET_WINDOW, fmt->sample_rate), 1);
+	s->min_silence = ffmax(ffpcm_samples(min_silence, fmt->sample_rate), s->window);
+	s->min_track = ffpcm_samples(min_track, fmt->sample_rate);
+	s->sil_start = 0;
+	s->gap = 1;
+	return 0;
+}
+
+/** Scan frames [*off..frames) until the next event.
+The frame '*off' corresponds to the absolute position 'total'.
+Return enum SILDET_R;  *off: the frame after the last scanned window */
+static inline int silence_scan(struct silence_det *s, const void *data, size_t *off, size_t frames)
+{
+	while (*off != frames) {
+		size_t n = ffmin(s->window - s->n, frames - *off);
+		double sum;
+		ffpcm_sumsq(&s->fmt, data, *off, *off + n, &sum);
+		s->sum += sum;
+		s->n += n;
+		s->total += n;
+		*off += n;
+		if (s->n != s->window)
+			break;
+
+		double rms = sqrt(s->sum / ((double)s->window * s->fmt.channels));
+		uint64 wstart = s->total - s->window;
+		s->n = 0;
+		s->sum = 0;
+
+		if (rms <= s->level) {
+			if (s->sil_start == (uint64)-1)
+				s->sil_start = wstart;
+			if (!s->gap
+				&& s->total - s->sil_start >= s->min_silence
+				&& s->sil_start - s->track_start >= s->min_track) {
+				s->gap = 1;
+				return SILDET_SILENCE;
+			}
+			continue;
+		}
+
+		s->sil_start = (uint64)-1;
+		if (s->gap) {
+			s->gap = 0;
+			s->track_start = wstart;
+			s->event = wstart;
+			return SILDET_SOUND;
+		}
+	}
+	return SILDET_MORE;
+}
@@ -24,10 +24,19 @@ static const void* sndmod_iface(const char *name);
 static int sndmod_sig(uint signo);
 static void sndmod_destroy(void);
 int mix_out_conf(fmed_conf_ctx *ctx);
+int batch_conf(fmed_conf_ctx *ctx);
+int startlev_config(fmed_conf_ctx *ctx);
+int stoplev_config(fmed_conf_ctx *ctx);
 static int sndmod_conf(const char *name, fmed_conf_ctx *ctx)
 {
 	if (ffsz_eq(name, "mixer-out"))
 		return mix_out_conf(ctx);
+	else if (ffsz_eq(name, "batch"))
+		return batch_conf(ctx);
+	else if (ffsz_eq(name, "startlevel"))
+		return startlev_config(ctx);
+	else if (ffsz_eq(name, "stoplevel"))
+		return stoplev_config(ctx);
 	return -1;
 }
 static const fmed_mod fmed_sndmod_mod = {
@@ -82,12 +91,19 @@ struct submod {
 extern const struct fmed_filter2 fmed_sndmod_conv;
 extern const fmed_filter fmed_sndmod_autoconv;
 extern const fmed_filter fmed_sndmod_split;
+extern const fmed_filter fmed_sndmod_silencecue;
+extern const fmed_filter fmed_sndmod_tee;
+extern const fmed_filter fmed_sndmod_teein;
 extern const fmed_filter fmed_sndmod_peaks;
+extern const fmed_filter fmed_sndmod_wavepeaks;
+extern const fmed_filter fmed_sndmod_loudness;
+extern void loudness_sig(uint signo);
 extern const fmed_filter sndmod_startlev;
 extern const fmed_filter sndmod_stoplev;
 extern const fmed_filter fmed_auto_attenuator;
 extern const fmed_filter fmed_mix_in;
 extern const fmed_filter fmed_mix_out;
+extern const fmed_filter fmed_sndmod_batch;
 
 static const struct submod submods[] = {
 	{ "conv", (fmed_filter*)&fmed_sndmod_conv },
@@ -95,7 +111,12 @@ static const struct submod submods[] = {
 	{ "gain", &fmed_sndmod_gain },
 	{ "until", &fmed_sndmod_until },
 	{ "split", &fmed_sndmod_split },
+	{ "silencecue", &fmed_sndmod_silencecue },
+	{ "tee", &fmed_sndmod_tee },
+	{ "tee-in", &fmed_sndmod_teein },
 	{ "peaks", &fmed_sndmod_peaks },
+	{ "wavepeaks", &fmed_sndmod_wavepeaks },
+	{ "loudness", &fmed_sndmod_loudness },
 	{ "rtpeak", &fmed_sndmod_rtpeak },
 	{ "silgen", &sndmod_silgen },
 	{ "startlevel", &sndmod_startlev },
@@ -104,6 +125,7 @@ static const struct submod submods[] = {
 	{ "auto-attenuator", &fmed_auto_attenuator },
 	{ "mixer-in", &fmed_mix_in },
 	{ "mixer-out", &fmed_mix_out },
+	{ "batch", &fmed_sndmod_batch },
 };
 
 static const void* sndmod_iface(const char *name)
@@ -123,6 +145,7 @@ static int sndmod_sig(uint signo)
 		track = core->getmod("#core.track");
 		break;
 	}
+	loudness_sig(signo);
 	return 0;
 }
 
@@ -248,10 +271,39 @@ static int sndmod_rtpeak_process(void *ctx, fmed_filt *d)
 }
 
 
+/*
+afilter.silgen generates audio data:
+. silence in the format requested by the next filters (WASAPI loopback recording)
+. a test signal for the input "@gen:SIGNAL" (benchmarks, tests):
+  silence | tone (1kHz sine, -6dB) | noise (white noise, -6dB)
+  The data is deterministic: the same parameters always produce the same samples.
+  Format: --format, --rate, --channels (default: int16/44100/stereo).
+  Length: --until (default: 10 sec).
+*/
+
+enum SILGEN_SIG {
+	SILGEN_NONE,
+	SILGEN_SILENCE,
+	SILGEN_TONE,
+	SILGEN_NOISE,
+};
+
+static const char *const silgen_sigs[] = {
+	"", "silence", "tone", "noise",
+};
+
 struct silgen {
 	uint state;
 	void *buf;
 	size_t cap;
+
+	uint sig; // enum SILGEN_SIG
+	ffpcmex fmt;
+	float *fbuf;
+	uint samples; // samples per block
+	uint64 pos;
+	double phase, phase_inc;
+	uint rnd;
 };
 
 static void* silgen_open(fmed_filt *d)
@@ -259,6 +311,34 @@ static void* silgen_open(fmed_filt *d)
 	struct silgen *c;
 	if (NULL == (c = ffmem_new(struct silgen)))
 		return NULL;
+
+	const char *input = d->track->getvalstr(d->trk, "input");
+	if (input != FMED_PNULL && ffsz_matchz(input, "@gen:")) {
+		const char *name = input + FFSLEN("@gen:");
+		int i = ffszarr_find(silgen_sigs, FF_COUNT(silgen_sigs), name, ffsz_len(name));
+		if (i <= 0) {
+			errlog(core, d->trk, "silgen", "unknown signal: %s", name);
+			ffmem_free(c);
+			return NULL;
+		}
+		c->sig = i;
+
+		ffpcmex *f = &d->audio.fmt;
+		if (f->format == 0)
+			f->format = FFPCM_16;
+		if (f->sample_rate == 0)
+			f->sample_rate = 44100;
+		if (f->channels == 0)
+			f->channels = 2;
+		f->ileaved = 1;
+		c->fmt = *f;
+		d->datatype = "pcm";
+		if ((int64)d->audio.until == FMED_NULL)
+			d->audio.until = 10000;
+		d->audio.total = ffpcm_samples(d->audio.until, f->sample_rate);
+		c->phase_inc = 2 * 3.14159265358979323846 * 1000 / f->sample_rate;
+		c->rnd = 0x12345678;
+	}
 	return c;
 }
 
@@ -266,9 +346,50 @@ static void silgen_close(void *ctx)
 {
 	struct silgen *c = ctx;
 	ffmem_safefree(c->buf);
+	ffmem_safefree(c->fbuf);
 	ffmem_free(c);
 }
 
+/** Fill the block with the next portion of the test signal */
+static int silgen_gen(struct silgen *c)
+{
+	uint nch = c->fmt.channels;
+	float *p = c->fbuf;
+
+	switch (c->sig) {
+	case SILGEN_TONE:
+		for (uint i = 0;  i != c->samples;  i++) {
+			float v = sin(c->phase) * 0.5;
+			c->phase += c->phase_inc;
+			if (c->phase >= 2 * 3.14159265358979323846)
+				c->phase -= 2 * 3.14159265358979323846;
+			for (uint ich = 0;  ich != nch;  ich++) {
+				*p++ = v;
+			}
+		}
+		break;
+
+	case SILGEN_NOISE:
+		for (uint i = 0;  i != c->samples * nch;  i++) {
+			// xorshift32
+			uint x = c->rnd;
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			c->rnd = x;
+			p[i] = (float)((double)x / 0xffffffffU - 0.5);
+		}
+		break;
+
+	default:
+		return 0; // the buffer is zero-filled
+	}
+
+	ffpcmex ffmt = c->fmt;
+	ffmt.format = FFPCM_FLOAT;
+	return ffpcm_convert(&c->fmt, c->buf, &ffmt, c->fbuf, c->samples);
+}
+
 static int silgen_process(void *ctx, fmed_filt *d)
 {
 	struct silgen *c = ctx;
@@ -281,6 +402,16 @@ static int silgen_process(void *ctx, fmed_filt *d)
 	switch (c->state) {
 
 	case 0:
+		if (c->sig != SILGEN_NONE) {
+			c->samples = ffpcm_samples(SILGEN_BUF_MSEC, c->fmt.sample_rate);
+			c->cap = c->samples * ffpcm_size1(&c->fmt);
+			if (NULL == (c->buf = ffmem_calloc(1, c->cap))
+				|| NULL == (c->fbuf = ffmem_allocT(c->samples * c->fmt.channels, float)))
+				return FMED_RSYSERR;
+			c->state = 3;
+			goto gen;
+		}
+
 		d->audio.convfmt = d->audio.fmt;
 		d->datatype = "pcm";
 		c->state = 1;
@@ -296,10 +427,21 @@ static int silgen_process(void *ctx, fmed_filt *d)
 
 	case 2:
 		break;
+
+	case 3:
+		goto gen;
 	}
 
 	d->out = c->buf,  d->outlen = c->cap;
 	return FMED_RDATA;
+
+gen:
+	if (0 != silgen_gen(c))
+		return FMED_RERR;
+	d->audio.pos = c->pos;
+	c->pos += c->samples;
+	d->out = c->buf,  d->outlen = c->cap;
+	return FMED_RDATA;
 }
 
 struct membuf {
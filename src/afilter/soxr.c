@@ -12,9 +12,10 @@ static const fmed_core *core;
 static const void* soxr_mod_iface(const char *name);
 static int soxr_mod_sig(uint signo);
 static void soxr_mod_destroy(void);
+static int soxr_mod_conf(const char *name, fmed_conf_ctx *ctx);
 static const fmed_mod soxr_mod = {
 	.ver = FMED_VER_FULL, .ver_core = FMED_VER_CORE,
-	&soxr_mod_iface, &soxr_mod_sig, &soxr_mod_destroy
+	&soxr_mod_iface, &soxr_mod_sig, &soxr_mod_destroy, &soxr_mod_conf
 };
 
 //CONVERTER-SOXR
@@ -27,9 +28,62 @@ static const struct fmed_filter2 fmed_soxr = {
 };
 
 
+struct soxr_conf {
+	uint quality;
+	uint threads;
+	uint pool_size;
+	byte int_ratio;
+};
+static struct soxr_conf soxr_conf;
+
+/*
+Resampler objects whose stream has finished are reset and kept in a pool,
+ so the next track with the same input & output formats doesn't create a new one.
+The pool is used by the tracks running on different workers.
+*/
+struct soxr_pool {
+	fflock lk;
+	ffvec items; // ffsoxr[]
+};
+static struct soxr_pool soxr_pool;
+
+static int soxr_conf_quality(fmed_conf *fc, void *obj, const ffstr *val)
+{
+	static const char *const names[] = {
+		"quick", "low", "medium", "", "high", "", "very_high",
+	};
+	int i = ffszarr_find(names, FF_COUNT(names), val->ptr, val->len);
+	if (i < 0 || val->len == 0)
+		return FMC_EBADVAL;
+	soxr_conf.quality = i;
+	return 0;
+}
+
+static const fmed_conf_arg soxr_conf_args[] = {
+	{ "quality",	FMC_STR, FMC_F(soxr_conf_quality) },
+	{ "threads",	FMC_INT32, FMC_O(struct soxr_conf, threads) },
+	{ "pool_size",	FMC_INT32, FMC_O(struct soxr_conf, pool_size) },
+	{ "int_ratio",	FMC_BOOL8, FMC_O(struct soxr_conf, int_ratio) },
+	{}
+};
+
+static int soxr_mod_conf(const char *name, fmed_conf_ctx *ctx)
+{
+	if (ffsz_eq(name, "conv")) {
+		fmed_conf_addctx(ctx, &soxr_conf, soxr_conf_args);
+		return 0;
+	}
+	return -1;
+}
+
 FF_EXP const fmed_mod* fmed_getmod(const fmed_core *_core)
 {
 	core = _core;
+	soxr_conf.quality = SOXR_HQ;
+	soxr_conf.threads = 1;
+	soxr_conf.pool_size = 4;
+	soxr_conf.int_ratio = 0;
+	fflk_init(&soxr_pool.lk);
 	return &soxr_mod;
 }
 
@@ -48,6 +102,50 @@ static int soxr_mod_sig(uint signo)
 
 static void soxr_mod_destroy(void)
 {
+	ffsoxr *s;
+	FFSLICE_WALK(&soxr_pool.items, s) {
+		ffsoxr_destroy(s);
+	}
+	ffvec_free(&soxr_pool.items);
+}
+
+/** Take the object with the same parameters from the pool.
+Return 0 if found */
+static int soxr_pool_get(ffsoxr *dst, const ffpcmex *in, const ffpcmex *out, uint threads)
+{
+	int r = -1;
+	fflk_lock(&soxr_pool.lk);
+	ffsoxr *s;
+	FFSLICE_WALK(&soxr_pool.items, s) {
+		if (ffsoxr_match(s, in, out)
+			&& s->quality == soxr_conf.quality
+			&& s->threads == threads) {
+			*dst = *s;
+			ffslice_rmT((ffslice*)&soxr_pool.items, s - (ffsoxr*)soxr_pool.items.ptr, 1, ffsoxr);
+			r = 0;
+			break;
+		}
+	}
+	fflk_unlock(&soxr_pool.lk);
+	return r;
+}
+
+/** Put the object into the pool.
+Return 0 on success */
+static int soxr_pool_put(ffsoxr *src)
+{
+	int r = -1;
+	if (0 != ffsoxr_reset(src))
+		return -1;
+	fflk_lock(&soxr_pool.lk);
+	ffsoxr *p;
+	if (soxr_pool.items.len < soxr_conf.pool_size
+		&& NULL != (p = ffvec_pushT(&soxr_pool.items, ffsoxr))) {
+		*p = *src;
+		r = 0;
+	}
+	fflk_unlock(&soxr_pool.lk);
+	return r;
 }
 
 
@@ -55,6 +153,7 @@ typedef struct soxr {
 	uint state;
 	ffsoxr soxr;
 	ffpcmex inpcm, outpcm;
+	uint reusable :1; // the stream is finished, the object may be reused
 } soxr;
 
 static void* soxr_open(fmed_filt *d)
@@ -69,7 +168,8 @@ static void* soxr_open(fmed_filt *d)
 static void soxr_close(void *ctx)
 {
 	soxr *c = ctx;
-	ffsoxr_destroy(&c->soxr);
+	if (!(c->reusable && 0 == soxr_pool_put(&c->soxr)))
+		ffsoxr_destroy(&c->soxr);
 	ffmem_free(c);
 }
 
@@ -109,8 +209,7 @@ static void log_pcmconv(const char *module, int r, const ffpcmex *in, const ffpc
 }
 
 /*
-This filter converts both format and sample rate.
-Previous filter must deal with channel conversion.
+This filter converts channels, format and sample rate.
 */
 static int soxr_conv(void *ctx, fmed_filt *d)
 {
@@ -123,13 +222,26 @@ static int soxr_conv(void *ctx, fmed_filt *d)
 		inpcm = c->inpcm;
 		outpcm = c->outpcm;
 
-		// c->soxr.dither = 1;
-		if (0 != (val = ffsoxr_create(&c->soxr, &inpcm, &outpcm))
-			|| (core->loglev == FMED_LOG_DEBUG)) {
-			log_pcmconv("soxr", val, &inpcm, &outpcm, d->trk);
-			if (val != 0)
-				return FMED_RERR;
+		// the tracks running in parallel already occupy all workers
+		uint threads = (core->props->parallel) ? 1 : soxr_conf.threads;
+
+		if (0 == soxr_pool_get(&c->soxr, &inpcm, &outpcm, threads)) {
+			dbglog(core, d->trk, "soxr", "using the resampler from pool");
+		} else {
+			// c->soxr.dither = 1;
+			c->soxr.quality = soxr_conf.quality;
+			c->soxr.threads = threads;
+			c->soxr.int_ratio = soxr_conf.int_ratio;
+			if (0 != (val = ffsoxr_create(&c->soxr, &inpcm, &outpcm))
+				|| (core->loglev == FMED_LOG_DEBUG)) {
+				log_pcmconv("soxr", val, &inpcm, &outpcm, d->trk);
+				if (val != 0)
+					return FMED_RERR;
+			}
+			if (c->soxr.hb != NULL)
+				dbglog(core, d->trk, "soxr", "using half-band decimator");
 		}
+		fmed_aconv_pass(d);
 
 		c->state = 3;
 		break;
@@ -151,8 +263,10 @@ static int soxr_conv(void *ctx, fmed_filt *d)
 	d->outlen = c->soxr.outlen;
 
 	if (c->soxr.outlen == 0) {
-		if (d->flags & FMED_FLAST)
+		if (d->flags & FMED_FLAST) {
+			c->reusable = 1;
 			return FMED_RDONE;
+		}
 	}
 
 	d->data = c->soxr.in_i;
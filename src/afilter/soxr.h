@@ -2,8 +2,23 @@
 Copyright (c) 2015 Simon Zolin */
 
 #include <afilter/pcm.h>
+#include <afilter/halfband.h>
 #include <soxr/soxr.h>
 
+/*
+libsoxr supports int16, int32 and float32.
+24-bit data is converted to/from int32 here, block by block, so no additional conversion filter is needed.
+If the number of channels is different, the input data is mixed into float32 block by block
+ before resampling, so the channels, format and sample rate are converted in a single pass.
+
+For 2:1 ratio (96000 -> 48000, 88200 -> 44100) the data is resampled by the half-band decimator (halfband.h)
+ instead of libsoxr, unless very high quality is requested.
+*/
+
+enum {
+	FFSOXR_BLOCK = 4096, // max. samples per block converted from/to 24-bit or float32
+};
+
 typedef struct ffsoxr {
 	soxr_t soxr;
 	soxr_error_t err;
@@ -25,19 +40,31 @@ typedef struct ffsoxr {
 	uint outlen;
 	uint outcap;
 
-	uint quality; // 0..4. default:3 (High quality)
+	ffpcmex inpcm, outpcm;
+	uint ochannels; // output channels, including FFPCM_CHMASK flags
+	ffpcmex einpcm, eoutpcm; // formats of the engine's input & output data
+	void *ebuf; // engine's input & output data
+	void *ein[8], *eout[8];
+	struct hb *hb;
+
+	uint quality; // 0..6. default:4 (High quality)
+	uint threads; // libsoxr worker threads (0:auto)
 	uint in_ileaved :1
+		, in_conv :1 // convert input data to the engine's format
 		, dither :1
-		, fin :1; // the last block of input data
+		, fin :1 // the last block of input data
+		, int_ratio :1 // use the half-band decimator for 2:1 ratio (up to HB_MAXCHANNELS channels)
+		;
 } ffsoxr;
 
 static inline void ffsoxr_init(ffsoxr *soxr)
 {
 	ffmem_tzero(soxr);
 	soxr->quality = SOXR_HQ;
+	soxr->threads = 1;
 }
 
-#define ffsoxr_errstr(soxr)  soxr_strerror((soxr)->err)
+#define ffsoxr_errstr(soxr)  (((soxr)->err != NULL) ? soxr_strerror((soxr)->err) : "")
 
 static const byte soxr_fmts[2][3] = {
 	{ SOXR_INT16_S, SOXR_INT32_S, SOXR_FLOAT32_S },
@@ -49,6 +76,7 @@ static int _ffsoxr_getfmt(int fmt, int ileaved)
 	switch (fmt) {
 	case FFPCM_16:
 		return soxr_fmts[ileaved][0];
+	case FFPCM_24:
 	case FFPCM_32:
 		return soxr_fmts[ileaved][1];
 	case FFPCM_FLOAT:
@@ -58,17 +86,109 @@ static int _ffsoxr_getfmt(int fmt, int ileaved)
 	return -1;
 }
 
+/** Set the pointers for non-interleaved data */
+static void _ffsoxr_setni(void **ni, void *buf, const ffpcmex *fmt, uint samples)
+{
+	for (uint i = 0;  i != fmt->channels;  i++) {
+		ni[i] = (char*)buf + ffpcm_bits(fmt->format) / 8 * samples * i;
+	}
+}
+
+/** Allocate buffers for the data converted to/from the engine's format */
+static int _ffsoxr_ebuf(ffsoxr *soxr, uint in_samples, uint out_samples)
+{
+	size_t isize = ffpcm_size1(&soxr->einpcm) * in_samples;
+	size_t osize = ffpcm_size1(&soxr->eoutpcm) * out_samples;
+	if (NULL == (soxr->ebuf = ffmem_align(isize + osize, 16)))
+		return -1;
+	if (!soxr->einpcm.ileaved)
+		_ffsoxr_setni(soxr->ein, soxr->ebuf, &soxr->einpcm, in_samples);
+	if (!soxr->eoutpcm.ileaved)
+		_ffsoxr_setni(soxr->eout, (char*)soxr->ebuf + isize, &soxr->eoutpcm, out_samples);
+	else
+		soxr->eout[0] = (char*)soxr->ebuf + isize;
+	return 0;
+}
+
+/** Convert input data to the engine's format, mixing the channels if needed */
+static int _ffsoxr_inconv(ffsoxr *soxr, void *ein, const void *in, size_t samples)
+{
+	ffpcmex f = soxr->einpcm;
+	f.channels = soxr->ochannels;
+	return ffpcm_convert(&f, ein, &soxr->inpcm, in, samples);
+}
+
+static int _ffsoxr_create_hb(ffsoxr *soxr)
+{
+	soxr->einpcm = soxr->inpcm;
+	soxr->einpcm.format = FFPCM_FLOAT;
+	soxr->einpcm.channels = soxr->outpcm.channels;
+	soxr->einpcm.ileaved = 0;
+	soxr->in_conv = 1;
+	soxr->eoutpcm = soxr->einpcm;
+	soxr->eoutpcm.sample_rate = soxr->outpcm.sample_rate;
+	if (0 != _ffsoxr_inconv(soxr, NULL, NULL, 0)
+		|| 0 != ffpcm_convert(&soxr->outpcm, NULL, &soxr->eoutpcm, NULL, 0))
+		return -1;
+
+	if (NULL == (soxr->hb = hb_create(soxr->outpcm.channels, FFSOXR_BLOCK)))
+		return -1;
+	if (0 != _ffsoxr_ebuf(soxr, FFSOXR_BLOCK, soxr->hb->cap))
+		return -1;
+	return 0;
+}
+
 int ffsoxr_create(ffsoxr *soxr, const ffpcmex *inpcm, const ffpcmex *outpcm)
 {
 	soxr_io_spec_t io;
 	soxr_quality_spec_t qual;
+	soxr_runtime_spec_t rt;
+
+	uint och = outpcm->channels & FFPCM_CHMASK;
+	soxr->inpcm = *inpcm;
+	soxr->outpcm = *outpcm;
+	soxr->outpcm.channels = och;
+	soxr->ochannels = outpcm->channels;
+	soxr->isampsize = ffpcm_size1(inpcm);
+	soxr->osampsize = ffpcm_size1(&soxr->outpcm);
+	soxr->in_ileaved = inpcm->ileaved;
+	soxr->nchannels = inpcm->channels;
 
-	if (inpcm->channels != outpcm->channels)
+	soxr->outcap = outpcm->sample_rate;
+	if (NULL == (soxr->out = ffmem_alloc(sizeof(void*) * och + soxr->outcap * soxr->osampsize)))
 		return -1;
+	if (!outpcm->ileaved) {
+		ffstr s;
+		ffstr_set(&s, (char*)soxr->out + sizeof(void*) * och, soxr->outcap * ffpcm_bits(outpcm->format) / 8);
+		// soxr->outni = soxr->out;
+		ffarrp_setbuf(soxr->outni, och, s.ptr, s.len);
+	}
 
+	if (soxr->int_ratio
+		&& inpcm->sample_rate == outpcm->sample_rate * 2
+		&& och <= HB_MAXCHANNELS
+		&& soxr->quality <= SOXR_HQ
+		&& !soxr->dither)
+		return _ffsoxr_create_hb(soxr);
+
+	soxr->einpcm = *inpcm;
+	soxr->eoutpcm = soxr->outpcm;
+	if (inpcm->channels != outpcm->channels) {
+		soxr->einpcm.format = FFPCM_FLOAT;
+		soxr->einpcm.channels = och;
+		soxr->einpcm.ileaved = 0;
+		if (0 != _ffsoxr_inconv(soxr, NULL, NULL, 0))
+			return -1;
+	} else if (inpcm->format == FFPCM_24) {
+		soxr->einpcm.format = FFPCM_32;
+	}
+	if (outpcm->format == FFPCM_24)
+		soxr->eoutpcm.format = FFPCM_32;
+	soxr->in_conv = (soxr->einpcm.format != inpcm->format
+		|| soxr->einpcm.channels != inpcm->channels);
 
-	int itype = _ffsoxr_getfmt(inpcm->format, inpcm->ileaved);
-	int otype = _ffsoxr_getfmt(outpcm->format, outpcm->ileaved);
+	int itype = _ffsoxr_getfmt(soxr->einpcm.format, soxr->einpcm.ileaved);
+	int otype = _ffsoxr_getfmt(soxr->eoutpcm.format, soxr->eoutpcm.ileaved);
 	if (itype == -1 || otype == -1)
 		return -1;
 	io.itype = itype;
@@ -78,43 +198,130 @@ int ffsoxr_create(ffsoxr *soxr, const ffpcmex *inpcm, const ffpcmex *outpcm)
 	io.flags = soxr->dither ? SOXR_TPDF : SOXR_NO_DITHER;
 
 	qual = soxr_quality_spec(soxr->quality, SOXR_ROLLOFF_SMALL);
+	rt = soxr_runtime_spec(soxr->threads);
 
-	soxr->soxr = soxr_create(inpcm->sample_rate, outpcm->sample_rate, inpcm->channels, &soxr->err
-		, &io, &qual, NULL);
+	soxr->soxr = soxr_create(inpcm->sample_rate, outpcm->sample_rate, och, &soxr->err
+		, &io, &qual, &rt);
 	if (soxr->err != NULL)
 		return -1;
 
-	soxr->isampsize = ffpcm_size1(inpcm);
-	soxr->osampsize = ffpcm_size1(outpcm);
-	soxr->outcap = outpcm->sample_rate;
-	if (NULL == (soxr->out = ffmem_alloc(sizeof(void*) * outpcm->channels + soxr->outcap * soxr->osampsize)))
-		return -1;
-	if (!outpcm->ileaved) {
-		ffstr s;
-		ffstr_set(&s, (char*)soxr->out + sizeof(void*) * outpcm->channels, soxr->outcap * ffpcm_bits(outpcm->format) / 8);
-		// soxr->outni = soxr->out;
-		ffarrp_setbuf(soxr->outni, outpcm->channels, s.ptr, s.len);
+	if (soxr->in_conv || soxr->eoutpcm.format != soxr->outpcm.format) {
+		if (0 != _ffsoxr_ebuf(soxr, FFSOXR_BLOCK, FFSOXR_BLOCK))
+			return -1;
 	}
-	soxr->in_ileaved = inpcm->ileaved;
-	soxr->nchannels = inpcm->channels;
 	return 0;
 }
 
 void ffsoxr_destroy(ffsoxr *soxr)
 {
 	ffmem_safefree(soxr->out);
+	if (soxr->ebuf != NULL)
+		ffmem_alignfree(soxr->ebuf);
+	hb_close(soxr->hb);
 	soxr_delete(soxr->soxr);
 }
 
+/** Prepare for a new stream with the same parameters.
+Return 0 on success */
+static inline int ffsoxr_reset(ffsoxr *soxr)
+{
+	if (soxr->hb != NULL)
+		hb_reset(soxr->hb);
+	else if (NULL != (soxr->err = soxr_clear(soxr->soxr)))
+		return -1;
+	soxr->in_i = NULL;
+	soxr->inlen = 0;
+	soxr->inoff = 0;
+	soxr->outlen = 0;
+	soxr->fin = 0;
+	return 0;
+}
+
+/** Compare the audio formats field by field (the padding bytes of ffpcmex are undefined) */
+static inline int _ffsoxr_fmt_eq(const ffpcmex *a, const ffpcmex *b)
+{
+	return a->format == b->format
+		&& a->channels == b->channels
+		&& a->sample_rate == b->sample_rate
+		&& a->ileaved == b->ileaved;
+}
+
+/** Return TRUE if the object was created with these parameters */
+static inline int ffsoxr_match(const ffsoxr *soxr, const ffpcmex *inpcm, const ffpcmex *outpcm)
+{
+	return _ffsoxr_fmt_eq(&soxr->inpcm, inpcm)
+		&& soxr->outpcm.format == outpcm->format
+		&& soxr->outpcm.sample_rate == outpcm->sample_rate
+		&& soxr->outpcm.ileaved == outpcm->ileaved
+		&& soxr->ochannels == outpcm->channels;
+}
+
+/** Get pointer to the input data at the current offset */
+static const void* _ffsoxr_input(ffsoxr *soxr, const void **inarr)
+{
+	if (soxr->in_ileaved)
+		return (char*)soxr->in_i + soxr->inoff * soxr->isampsize;
+
+	for (uint i = 0;  i != soxr->nchannels;  i++) {
+		inarr[i] = (char*)soxr->in[i] + soxr->inoff * soxr->isampsize / soxr->nchannels;
+	}
+	return inarr;
+}
+
+static int _ffsoxr_convert_hb(ffsoxr *soxr)
+{
+	const void *inarr[8];
+	for (;;) {
+		uint n = 0;
+		if (soxr->inlen != 0) {
+			n = ffmin(soxr->inlen / soxr->isampsize, FFSOXR_BLOCK);
+			if (0 != _ffsoxr_inconv(soxr, soxr->ein, _ffsoxr_input(soxr, inarr), n))
+				return -1;
+			hb_write(soxr->hb, (const float**)soxr->ein, n);
+			soxr->inoff += n;
+			soxr->inlen -= n * soxr->isampsize;
+			if (soxr->inlen == 0)
+				soxr->inoff = 0;
+
+		} else if (soxr->fin) {
+			hb_finish(soxr->hb);
+
+		} else {
+			soxr->outlen = 0;
+			return 0;
+		}
+
+		uint r = hb_read(soxr->hb, (float**)soxr->eout, soxr->hb->cap);
+		if (0 != ffpcm_convert(&soxr->outpcm, soxr->out, &soxr->eoutpcm, soxr->eout, r))
+			return -1;
+		soxr->outlen = r * soxr->osampsize;
+
+		if (r != 0 || n == 0)
+			break;
+	}
+	return 0;
+}
+
 int ffsoxr_convert(ffsoxr *soxr)
 {
 	size_t idone, odone;
-	uint i, fin = 0;
-	void *in = soxr->in;
+	uint fin = 0;
+	const void *in;
 	const void *inarr[8];
 
+	if (soxr->hb != NULL)
+		return _ffsoxr_convert_hb(soxr);
+
+	size_t ocap = soxr->outcap;
+	void *out = soxr->out;
+	if (soxr->eoutpcm.format != soxr->outpcm.format) {
+		ocap = ffmin(ocap, FFSOXR_BLOCK);
+		out = (soxr->eoutpcm.ileaved) ? soxr->eout[0] : (void*)soxr->eout;
+	}
+
 	for (;;) {
 
+		size_t ilen = soxr->inlen / soxr->isampsize;
 		if (soxr->inlen == 0) {
 			if (!soxr->fin) {
 				soxr->outlen = 0;
@@ -123,18 +330,20 @@ int ffsoxr_convert(ffsoxr *soxr)
 			in = NULL;
 			fin = 1;
 
-		} else if (soxr->in_ileaved)
-			in = (char*)soxr->in_i + soxr->inoff * soxr->isampsize;
+		} else {
+			in = _ffsoxr_input(soxr, inarr);
 
-		else {
-			for (i = 0;  i != soxr->nchannels;  i++) {
-				inarr[i] = (char*)soxr->in[i] + soxr->inoff * soxr->isampsize / soxr->nchannels;
+			if (soxr->in_conv) {
+				ilen = ffmin(ilen, FFSOXR_BLOCK);
+				void *ein = (soxr->einpcm.ileaved) ? soxr->ebuf : (void*)soxr->ein;
+				if (0 != _ffsoxr_inconv(soxr, ein, in, ilen))
+					return -1;
+				in = ein;
 			}
-			in = inarr;
 		}
 
-		soxr->err = soxr_process(soxr->soxr, in, soxr->inlen / soxr->isampsize, &idone
-			, soxr->out, soxr->outcap, &odone);
+		soxr->err = soxr_process(soxr->soxr, in, ilen, &idone
+			, out, ocap, &odone);
 		if (soxr->err != NULL)
 			return -1;
 
@@ -142,6 +351,10 @@ int ffsoxr_convert(ffsoxr *soxr)
 		soxr->inlen -= idone * soxr->isampsize;
 		if (soxr->inlen == 0)
 			soxr->inoff = 0;
+
+		if (out != soxr->out
+			&& 0 != ffpcm_convert(&soxr->outpcm, soxr->out, &soxr->eoutpcm, out, odone))
+			return -1;
 		soxr->outlen = odone * soxr->osampsize;
 
 		if (odone != 0 || fin)
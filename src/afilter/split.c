@@ -2,6 +2,7 @@
 Copyright (c) 2019 Simon Zolin */
 
 #include <fmedia.h>
+#include <afilter/silence.h>
 #include <util/path.h>
 
 
@@ -20,6 +21,31 @@ const fmed_filter fmed_sndmod_split = {
 	&sndmod_split_open, &sndmod_split_process, &sndmod_split_close
 };
 
+// SILENCE -> CUE
+static void* silcue_open(fmed_filt *d);
+static int silcue_process(void *ctx, fmed_filt *d);
+static void silcue_close(void *ctx);
+const fmed_filter fmed_sndmod_silencecue = {
+	&silcue_open, &silcue_process, &silcue_close
+};
+
+
+/*
+Split by time (--split):  the piece length is 'splitby'.
+Split by CUE tracks (--cue-decode-once):  the source file is decoded once,
+ and "cue_tracks" value contains the list of tracks:
+ "FROM\tTO[\tNAME\tVALUE]...\n"...  (FROM, TO: CD frames, TO=0: until the end)
+ Audio data between the tracks (skipped pregaps) is dropped.
+ Meta data of the track is set before its output filters are added.
+Split by silence (--split-silence):  the track ends after 'a_split_silence_time' of silence,
+ the rest of the silence is dropped and the next track starts with the sound (silence.h).
+*/
+
+struct split_piece {
+	uint64 from, to; // samples, relative to the first track.  to=-1: until the end
+	char *meta; // NAME\0VALUE\0...
+	char *meta_end;
+};
 
 struct sndmod_split {
 	uint state;
@@ -28,11 +54,81 @@ struct sndmod_split {
 	uint sampsize;
 	const fmed_modinfo *mi;
 	const char *datatype;
+
+	ffvec pieces; // struct split_piece[]
+	uint ipiece;
+
+	struct silence_det sil;
+	size_t sil_scanned; // frames at the beginning of the current data already scanned by 'sil'
+	uint sil_tracks;
+	uint silence :1;
 };
 
+/** Parse track list.
+The names and values are stored in the track's memory, because track meta references them. */
+static int split_pieces_parse(struct sndmod_split *s, fmed_filt *d, const char *cue_tracks)
+{
+	ffsize n = ffsz_len(cue_tracks);
+	char *buf = (void*)d->track->cmd(d->trk, FMED_TRACK_ALLOC, n + 1);
+	if (buf == NULL)
+		return -1;
+	ffmem_copy(buf, cue_tracks, n + 1);
+
+	uint rate = d->audio.fmt.sample_rate;
+	uint64 first = 0;
+	ffstr in = FFSTR_INITN(buf, n), line, val;
+	while (in.len != 0) {
+		ffstr_splitby(&in, '\n', &line, &in);
+		if (line.len == 0)
+			continue;
+
+		uint from, to;
+		ffstr_splitby(&line, '\t', &val, &line);
+		if (!ffstr_toint(&val, &from, FFS_INT32))
+			goto err;
+		ffstr_splitby(&line, '\t', &val, &line);
+		if (!ffstr_toint(&val, &to, FFS_INT32))
+			goto err;
+
+		if (s->pieces.len == 0)
+			first = from;
+		if (from < first || (to != 0 && to <= from))
+			goto err;
+
+		struct split_piece *p;
+		if (NULL == (p = ffvec_pushT(&s->pieces, struct split_piece)))
+			goto err;
+		p->from = (uint64)(from - first) * rate / 75;
+		p->to = (to != 0) ? (uint64)(to - first) * rate / 75 : (uint64)-1;
+		p->meta = p->meta_end = NULL;
+		if (line.len == 0)
+			continue;
+
+		// "NAME\tVALUE\t..." -> "NAME\0VALUE\0..."
+		p->meta = line.ptr;
+		p->meta_end = line.ptr + line.len;
+		for (char *c = line.ptr;  c != p->meta_end;  c++) {
+			if (*c == '\t')
+				*c = '\0';
+		}
+		*p->meta_end = '\0';
+	}
+
+	if (s->pieces.len == 0)
+		goto err;
+	return 0;
+
+err:
+	errlog("bad track list: %s", cue_tracks);
+	return -1;
+}
+
 static void* sndmod_split_open(fmed_filt *d)
 {
-	if (d->audio.split == (uint64)FMED_NULL)
+	const char *cue_tracks = FMED_PNULL;
+	if (d->audio.split == (uint64)FMED_NULL
+		&& d->a_split_silence == 0
+		&& FMED_PNULL == (cue_tracks = d->track->getvalstr(d->trk, "cue_tracks")))
 		return FMED_FILT_SKIP;
 
 	const char *ofn = d->out_filename;
@@ -53,6 +149,31 @@ static void* sndmod_split_open(fmed_filt *d)
 		return NULL;
 
 	s->mi = mi;
+	s->sampsize = ffpcm_size(d->audio.fmt.format, d->audio.fmt.channels);
+	s->datatype = d->datatype;
+
+	if (cue_tracks != FMED_PNULL) {
+		if (0 != split_pieces_parse(s, d, cue_tracks)) {
+			sndmod_split_close(s);
+			return NULL;
+		}
+		dbglog("tracks: %L", s->pieces.len);
+		return s;
+	}
+
+	if (d->a_split_silence != 0) {
+		if (d->stream_copy
+			|| !d->audio.fmt.ileaved
+			|| 0 != silence_init(&s->sil, &d->audio.fmt, -d->a_split_silence
+				, d->a_split_silence_time, d->a_split_silence_mintrack)) {
+			errlog("split by silence: unsupported audio format", 0);
+			sndmod_split_close(s);
+			return NULL;
+		}
+		s->silence = 1;
+		return s;
+	}
+
 	s->splitby = ffpcm_samples(d->audio.split, d->audio.fmt.sample_rate);
 	s->until = s->splitby;
 	if (s->splitby == 0) {
@@ -60,24 +181,145 @@ static void* sndmod_split_open(fmed_filt *d)
 		sndmod_split_close(s);
 		return NULL;
 	}
-	s->sampsize = ffpcm_size(d->audio.fmt.format, d->audio.fmt.channels);
-	s->datatype = d->datatype;
 	return s;
 }
 
 static void sndmod_split_close(void *ctx)
 {
 	struct sndmod_split *s = ctx;
+	ffvec_free(&s->pieces);
 	ffmem_free(s);
 }
 
+/** Prepare for the next CUE track: skip the data before it, set meta.
+Return 0 if the track starts within the current data */
+static int split_piece_start(struct sndmod_split *s, fmed_filt *d)
+{
+	if (s->ipiece == s->pieces.len) {
+		dbglog("all tracks are written");
+		d->outlen = 0;
+		return FMED_RDONE;
+	}
+
+	const struct split_piece *p = (struct split_piece*)s->pieces.ptr + s->ipiece;
+	uint64 pos = d->audio.pos;
+	if ((int64)pos != FMED_NULL && pos < p->from) {
+		uint64 skip = p->from - pos;
+		if (d->stream_copy) {
+			d->datalen = 0;
+		} else {
+			skip = ffmin(skip, d->datalen / s->sampsize);
+			d->data += skip * s->sampsize;
+			d->datalen -= skip * s->sampsize;
+			d->audio.pos += skip;
+		}
+		if (d->datalen == 0) {
+			if (d->flags & FMED_FLAST) {
+				d->outlen = 0;
+				return FMED_RDONE;
+			}
+			return FMED_RMORE;
+		}
+	}
+
+	dbglog("track #%u: %U..%U", s->ipiece + 1, p->from, p->to);
+	s->until = p->to;
+	d->audio.total = (p->to != (uint64)-1) ? p->to - p->from : (uint64)FMED_NULL;
+
+	d->track->cmd(d->trk, FMED_TRACK_META_CLEAR);
+	for (const char *m = p->meta;  m < p->meta_end;  ) {
+		const char *name = m;
+		m += ffsz_len(m) + 1;
+		if (m > p->meta_end)
+			break;
+		d->track->setvalstr4(d->trk, name, m, FMED_TRK_META);
+		m += ffsz_len(m) + 1;
+	}
+	d->meta_changed = 1;
+	return 0;
+}
+
+/** Skip the silence before the next track.
+Return 0 if the track starts within the current data */
+static int split_silence_start(struct sndmod_split *s, fmed_filt *d)
+{
+	size_t frames = d->datalen / s->sampsize, off = s->sil_scanned;
+	uint64 base = s->sil.total - off; // absolute position of the first frame of data
+	int r = silence_scan(&s->sil, d->data, &off, frames);
+	if (r != SILDET_SOUND) {
+		s->sil_scanned = 0;
+		d->datalen = 0;
+		if (d->flags & FMED_FLAST) {
+			dbglog("tracks: %u", s->sil_tracks);
+			d->outlen = 0;
+			return FMED_RDONE;
+		}
+		return FMED_RMORE;
+	}
+
+	// the first window of the track may have started in the previous data, which is already dropped
+	size_t skip = (s->sil.event > base) ? s->sil.event - base : 0;
+	d->data += skip * s->sampsize;
+	d->datalen -= skip * s->sampsize;
+	if ((int64)d->audio.pos != FMED_NULL)
+		d->audio.pos += skip;
+	s->sil_scanned = off - skip;
+
+	s->sil_tracks++;
+	dbglog("track #%u: from %U", s->sil_tracks, s->sil.event);
+	d->audio.total = FMED_NULL;
+	return 0;
+}
+
+/** Pass the data until the silence is long enough to finish the current track */
+static int split_silence_process(struct sndmod_split *s, fmed_filt *d)
+{
+	size_t frames = d->datalen / s->sampsize, off = s->sil_scanned;
+	s->sil_scanned = 0;
+	d->out = d->data;
+
+	if (SILDET_SILENCE == silence_scan(&s->sil, d->data, &off, frames)) {
+		dbglog("track #%u: until %U", s->sil_tracks, s->sil.total);
+		d->outlen = off * s->sampsize;
+		d->data += d->outlen;
+		d->datalen -= d->outlen;
+		if ((int64)d->audio.pos != FMED_NULL)
+			d->audio.pos += off;
+		s->state = 0;
+		return FMED_RNEXTDONE;
+	}
+
+	d->outlen = d->datalen;
+	d->datalen = 0;
+	if (d->flags & FMED_FLAST)
+		return FMED_RDONE;
+	return FMED_RDATA;
+}
+
+/** The current piece is finished */
+static void split_next(struct sndmod_split *s)
+{
+	if (s->pieces.len != 0)
+		s->ipiece++;
+	else
+		s->until += s->splitby;
+}
+
 static int sndmod_split_process(void *ctx, fmed_filt *d)
 {
 	struct sndmod_split *s = ctx;
 	uint64 pos;
+	int r;
 
 	switch (s->state) {
 	case 0:
+		if (s->pieces.len != 0
+			&& 0 != (r = split_piece_start(s, d)))
+			return r;
+		if (s->silence
+			&& 0 != (r = split_silence_start(s, d)))
+			return r;
+
 		d->datatype = s->datatype; // the audio output filter needs input data type, but overwrites this value afterwards
 		if (0 == d->track->cmd(d->trk, FMED_TRACK_FILT_ADDLAST, "afilter.autoconv")
 			|| 0 == d->track->cmd(d->trk, FMED_TRACK_FILT_ADDLAST, s->mi->name)
@@ -93,6 +335,9 @@ static int sndmod_split_process(void *ctx, fmed_filt *d)
 		break;
 	}
 
+	if (s->silence)
+		return split_silence_process(s, d);
+
 	d->out = d->data;
 	d->outlen = d->datalen;
 
@@ -103,7 +348,7 @@ static int sndmod_split_process(void *ctx, fmed_filt *d)
 		dbglog("at %U", pos);
 		if (d->audio.pos >= s->until) {
 			dbglog("reached sample #%U", s->until);
-			s->until += s->splitby;
+			split_next(s);
 			d->outlen = 0;
 			s->state = 0;
 			return FMED_RNEXTDONE;
@@ -122,7 +367,7 @@ static int sndmod_split_process(void *ctx, fmed_filt *d)
 			d->outlen = (s->until - pos) * s->sampsize;
 			if (pos > s->until)
 				d->outlen = 0;
-			s->until += s->splitby;
+			split_next(s);
 			d->datalen -= d->outlen;
 			d->audio.pos += d->outlen / s->sampsize;
 			s->state = 0;
@@ -135,3 +380,117 @@ static int sndmod_split_process(void *ctx, fmed_filt *d)
 	d->datalen = 0;
 	return FMED_RDATA;
 }
+
+
+/* Find the tracks separated by silence and write them as CUE sheet next to the input file:
+ "FILE.cue" for "FILE.EXT". */
+
+struct silcue {
+	struct silence_det sil;
+	uint sampsize;
+	uint64 gap_start; // start of the pregap of the next track
+	uint ntracks;
+	ffvec buf; // CUE sheet
+	char *fn;
+	uint overwrite :1;
+};
+
+static void* silcue_open(fmed_filt *d)
+{
+	if (d->a_split_silence == 0)
+		return FMED_FILT_SKIP;
+
+	const char *input = d->track->getvalstr(d->trk, "input");
+	if (input == FMED_PNULL)
+		return FMED_FILT_SKIP;
+
+	struct silcue *c = ffmem_new(struct silcue);
+	if (c == NULL)
+		return NULL;
+	if (d->stream_copy
+		|| 0 != silence_init(&c->sil, &d->audio.fmt, -d->a_split_silence
+			, d->a_split_silence_time, d->a_split_silence_mintrack)) {
+		errlog("split by silence: unsupported audio format", 0);
+		silcue_close(c);
+		return NULL;
+	}
+	c->sampsize = ffpcm_size1(&d->audio.fmt);
+	c->overwrite = d->out_overwrite;
+
+	ffstr dir, name, ext;
+	ffpath_split3(input, ffsz_len(input), &dir, &name, &ext);
+	if (dir.len != 0)
+		c->fn = ffsz_allocfmt("%S/%S.cue", &dir, &name);
+	else
+		c->fn = ffsz_allocfmt("%S.cue", &name);
+
+	ffvec_addfmt(&c->buf, "FILE \"%S%s%S\" WAVE\n"
+		, &name, (ext.len != 0) ? "." : "", &ext);
+	return c;
+}
+
+static void silcue_close(void *ctx)
+{
+	struct silcue *c = ctx;
+	ffvec_free(&c->buf);
+	ffmem_free(c->fn);
+	ffmem_free(c);
+}
+
+/** Add "mm:ss:ff" (ff: CD frames) */
+static void silcue_addtime(struct silcue *c, uint64 samples)
+{
+	uint64 f = samples * 75 / c->sil.fmt.sample_rate;
+	ffvec_addfmt(&c->buf, "%02U:%02U:%02U\n", f / 75 / 60, f / 75 % 60, f % 75);
+}
+
+static int silcue_save(struct silcue *c, void *trk)
+{
+	if (!c->overwrite && fffile_exists(c->fn)) {
+		fmed_errlog(core, trk, "split", "%s: file exists.  Use --overwrite to overwrite it.", c->fn);
+		return -1;
+	}
+	if (0 != fffile_writewhole(c->fn, c->buf.ptr, c->buf.len, 0)) {
+		fmed_syserrlog(core, trk, "split", "%s: %s", fffile_write_S, c->fn);
+		return -1;
+	}
+	fmed_infolog(core, trk, "split", "saved %u tracks to %s", c->ntracks, c->fn);
+	return 0;
+}
+
+static int silcue_process(void *ctx, fmed_filt *d)
+{
+	struct silcue *c = ctx;
+	size_t off = 0, frames = d->datalen / c->sampsize;
+
+	for (;;) {
+		int r = silence_scan(&c->sil, d->data, &off, frames);
+		if (r == SILDET_MORE)
+			break;
+
+		if (r == SILDET_SILENCE) {
+			c->gap_start = c->sil.sil_start;
+			continue;
+		}
+
+		c->ntracks++;
+		ffvec_addfmt(&c->buf, "  TRACK %02u AUDIO\n", c->ntracks);
+		if (c->gap_start < c->sil.event) {
+			ffvec_addfmt(&c->buf, "    INDEX 00 ");
+			silcue_addtime(c, c->gap_start);
+		}
+		ffvec_addfmt(&c->buf, "    INDEX 01 ");
+		silcue_addtime(c, c->sil.event);
+	}
+
+	d->out = d->data;
+	d->outlen = d->datalen;
+	d->datalen = 0;
+
+	if (d->flags & FMED_FLAST) {
+		if (c->ntracks != 0)
+			silcue_save(c, d->trk);
+		return FMED_RDONE;
+	}
+	return FMED_ROK;
+}
@@ -2,6 +2,7 @@
 Copyright (c) 2019 Simon Zolin */
 
 #include <fmedia.h>
+#include <afilter/pcm.h>
 
 extern const fmed_core *core;
 
@@ -24,6 +25,75 @@ const struct fmed_filter sndmod_stoplev = {
 };
 
 
+/*
+The level is measured either by peak (any channel's sample is above the level)
+ or by RMS of all channels in a window of 'rms_window' msec.
+Frames are processed in time order;
+ the data is scanned by ffpcm_find_above() and ffpcm_sumsq() without calling a function per sample.
+*/
+
+struct lev_conf {
+	uint rms_window; // msec;  0: use peak level
+};
+static struct lev_conf startlev_conf, stoplev_conf;
+
+static const fmed_conf_arg lev_conf_args[] = {
+	{ "rms_window",	FMC_INT32,	FMC_O(struct lev_conf, rms_window) },
+	{}
+};
+
+int startlev_config(fmed_conf_ctx *ctx)
+{
+	fmed_conf_addctx(ctx, &startlev_conf, lev_conf_args);
+	return 0;
+}
+
+int stoplev_config(fmed_conf_ctx *ctx)
+{
+	fmed_conf_addctx(ctx, &stoplev_conf, lev_conf_args);
+	return 0;
+}
+
+/** RMS level of the consecutive windows */
+struct lev_rms {
+	uint window; // frames per window
+	uint n; // frames in the current window
+	double sum;
+};
+
+/** Add frames [*off..frames) to the current window.
+Return 1 if the window is complete: *off is the frame after the window, *rms is its level. */
+static int rms_next(struct lev_rms *w, const ffpcmex *fmt, const void *data, size_t *off, size_t frames, double *rms)
+{
+	size_t n = ffmin(w->window - w->n, frames - *off);
+	double sum;
+	ffpcm_sumsq(fmt, data, *off, *off + n, &sum);
+	w->sum += sum;
+	w->n += n;
+	*off += n;
+	if (w->n != w->window)
+		return 0;
+
+	*rms = sqrt(w->sum / ((double)w->window * fmt->channels));
+	w->n = 0;
+	w->sum = 0;
+	return 1;
+}
+
+static int lev_open(const ffpcmex *fmt, const struct lev_conf *conf, struct lev_rms *w, void *trk)
+{
+	double t;
+	if (fmt->channels > 8
+		|| 0 != ffpcm_sumsq(fmt, NULL, 0, 0, &t)) {
+		errlog(core, trk, "afilter.level", "unsupported audio format");
+		return -1;
+	}
+	if (conf->rms_window != 0)
+		w->window = ffmax(ffpcm_samples(conf->rms_window, fmt->sample_rate), 1);
+	return 0;
+}
+
+
 #define FILT_NAME "soundmod.startlevel"
 
 struct startlev {
@@ -31,18 +101,21 @@ struct startlev {
 	double level;
 	double val;
 	uint64 offset; //number of skipped samples
+	struct lev_rms rms;
 	void *ni[8];
 };
 
 static void* startlev_open(fmed_filt *d)
 {
-	if (d->audio.fmt.channels > 8)
-		return NULL;
 	struct startlev *c = ffmem_new(struct startlev);
 	if (c == NULL)
 		return NULL;
 	c->fmt = d->audio.fmt;
 	c->level = ffpcm_db2gain(-d->a_start_level);
+	if (0 != lev_open(&c->fmt, &startlev_conf, &c->rms, d->trk)) {
+		ffmem_free(c);
+		return NULL;
+	}
 	return c;
 }
 
@@ -52,14 +125,22 @@ static void startlev_close(void *ctx)
 	ffmem_free(c);
 }
 
-static int startlev_cb(void *ctx, double val)
+/** Find the first frame of the first loud enough window.
+Return -1 if not found */
+static ssize_t startlev_rms(struct startlev *c, const void *data, size_t frames)
 {
-	struct startlev *c = ctx;
-	if (val > c->level) {
-		c->val = val;
-		return 1;
+	size_t off = 0;
+	double rms;
+	while (off != frames) {
+		if (!rms_next(&c->rms, &c->fmt, data, &off, frames, &rms))
+			break;
+		if (rms > c->level) {
+			c->val = rms;
+			// the window may have started in the previous data, which is already skipped
+			return (off >= c->rms.window) ? off - c->rms.window : 0;
+		}
 	}
-	return 0;
+	return -1;
 }
 
 /** Skip audio until the signal level becomes loud enough, and then exit. */
@@ -67,7 +148,11 @@ static int startlev_process(void *ctx, fmed_filt *d)
 {
 	struct startlev *c = ctx;
 	size_t samples = d->datalen / ffpcm_size1(&c->fmt);
-	ssize_t r = ffpcm_process(&c->fmt, d->data, samples, &startlev_cb, c);
+	ssize_t r;
+	if (c->rms.window != 0)
+		r = startlev_rms(c, d->data, samples);
+	else
+		r = ffpcm_find_above(&c->fmt, d->data, 0, samples, c->level, &c->val);
 	if (r == -1) {
 		c->offset += samples;
 		return FMED_RMORE;
@@ -78,8 +163,9 @@ static int startlev_process(void *ctx, fmed_filt *d)
 
 	double db = ffpcm_gain2db(c->val);
 	uint64 tms = ffpcm_time(c->offset, c->fmt.sample_rate);
-	infolog(d->trk, "found %.2FdB peak at %u:%02u.%03u (%,U samples)"
-		, db, (uint)((tms / 1000) / 60), (uint)((tms / 1000) % 60), (uint)(tms % 1000), c->offset);
+	infolog(d->trk, "found %.2FdB %s at %u:%02u.%03u (%,U samples)"
+		, db, (c->rms.window != 0) ? "RMS" : "peak"
+		, (uint)((tms / 1000) / 60), (uint)((tms / 1000) % 60), (uint)(tms % 1000), c->offset);
 
 	if (c->fmt.ileaved) {
 		d->out = (void*)(d->data + r * ffpcm_size1(&c->fmt));
@@ -100,13 +186,12 @@ static int startlev_process(void *ctx, fmed_filt *d)
 
 struct stoplev {
 	ffpcmex fmt;
-	uint state;
-	uint all_samples;
-	uint max_samples;
-	uint min_stop_samples;
-	uint nsamples;
+	uint64 all_samples; // frames processed before the current block
+	uint64 max_samples; // frames of silence to stop after
+	uint64 min_stop_samples; // don't stop before this frame
+	uint64 nsamples; // frames of the current silence
 	double level;
-	double val;
+	struct lev_rms rms;
 };
 
 #define STOPLEV_DEF_TIME  5000
@@ -119,10 +204,12 @@ static void* stoplev_open(fmed_filt *d)
 	c->fmt = d->audio.fmt;
 	c->level = ffpcm_db2gain(-d->a_stop_level);
 	uint t = (d->a_stop_level_time != 0) ? d->a_stop_level_time : STOPLEV_DEF_TIME;
-	c->max_samples = c->fmt.channels * ffpcm_samples(t, c->fmt.sample_rate);
-	c->min_stop_samples = (d->a_stop_level_mintime != 0)
-		? c->fmt.channels * ffpcm_samples(d->a_stop_level_mintime, c->fmt.sample_rate)
-		: 0;
+	c->max_samples = ffpcm_samples(t, c->fmt.sample_rate);
+	c->min_stop_samples = ffpcm_samples(d->a_stop_level_mintime, c->fmt.sample_rate);
+	if (0 != lev_open(&c->fmt, &stoplev_conf, &c->rms, d->trk)) {
+		ffmem_free(c);
+		return NULL;
+	}
 	return c;
 }
 
@@ -132,38 +219,39 @@ static void stoplev_close(void *ctx)
 	ffmem_free(c);
 }
 
-static int stoplev_cb(void *ctx, double val)
+/** Measure the silence in frames [off..frames).
+Return the frame at which the silence becomes long enough;  -1: not yet */
+static ssize_t stoplev_scan(struct stoplev *c, const void *data, size_t off, size_t frames)
 {
-	struct stoplev *c = ctx;
-
-	c->all_samples++;
+	while (off != frames) {
+		if (c->rms.window != 0) {
+			double rms;
+			if (!rms_next(&c->rms, &c->fmt, data, &off, frames, &rms))
+				break; // the window continues in the next block
+			if (rms > c->level) {
+				c->nsamples = 0;
+				continue;
+			}
+			c->nsamples += c->rms.window;
+			if (c->nsamples >= c->max_samples)
+				return off;
+			continue;
+		}
 
-	switch (c->state) {
-	case 0:
-		if (val > c->level)
-			break;
-		c->val = val;
-		c->state = 1;
-		//fallthrough
+		ssize_t r = ffpcm_find_above(&c->fmt, data, off, frames, c->level, NULL);
+		size_t quiet_end = (r >= 0) ? (size_t)r : frames;
+		size_t n = quiet_end - off;
+		if (c->nsamples + n >= c->max_samples)
+			return off + (c->max_samples - c->nsamples);
+		c->nsamples += n;
+		off = quiet_end;
 
-	case 1:
-		if (val > c->level) {
+		if (r >= 0) {
 			c->nsamples = 0;
-			c->state = 0;
-			break;
+			off++;
 		}
-		if (++c->nsamples != c->max_samples)
-			break;
-		c->state = 2;
-		//fallthrough
-
-	case 2:
-		if (c->min_stop_samples == 0
-			|| c->all_samples == c->min_stop_samples)
-			return 1;
-		break;
 	}
-	return 0;
+	return -1;
 }
 
 static int stoplev_process(void *ctx, fmed_filt *d)
@@ -175,21 +263,34 @@ static int stoplev_process(void *ctx, fmed_filt *d)
 	if (!(d->flags & FMED_FFWD))
 		return FMED_RMORE;
 
-	r = ffpcm_process(&c->fmt, d->data, samples, &stoplev_cb, c);
-	if (r == -1) {
+	if (c->nsamples < c->max_samples) {
+		r = stoplev_scan(c, d->data, 0, samples);
+		if (r >= 0) {
+			c->nsamples = c->max_samples;
+			uint64 maxsamp = c->max_samples;
+			infolog(d->trk, "signal went below %.2FdB %s level for %ums (%,U samples)"
+				, (double)d->a_stop_level, (c->rms.window != 0) ? "RMS" : "peak"
+				, (int)ffpcm_time(maxsamp, c->fmt.sample_rate), maxsamp);
+		}
+	} else {
+		r = 0;
+	}
+
+	if (r >= 0 && c->all_samples + r < c->min_stop_samples) {
+		// silence is long enough, but the minimum time hasn't passed yet
+		r = c->min_stop_samples - c->all_samples;
+		if ((size_t)r > samples)
+			r = -1;
+	}
+
+	if (r < 0) {
+		c->all_samples += samples;
 		d->out = d->data;
 		d->outlen = d->datalen;
 		d->datalen = 0;
 		return (d->flags & FMED_FLAST) ? FMED_RDONE : FMED_RDATA;
-	} else if (r < 0) {
-		return FMED_RERR;
 	}
 
-	double db = ffpcm_gain2db(c->val);
-	uint maxsamp = c->max_samples / c->fmt.channels;
-	infolog(d->trk, "signal went below %.2FdB level (at %.2FdB) for %ums (%,L samples)"
-		, (double)d->a_stop_level, db, (int)ffpcm_time(maxsamp, c->fmt.sample_rate), (size_t)maxsamp);
-
 	d->out = d->data;
 	d->outlen = r * ffpcm_size1(&c->fmt);
 	return FMED_RLASTOUT;
@@ -0,0 +1,377 @@
+/** Decode once, write to several outputs.
+Copyright (c) 2022 Simon Zolin */
+
+#include <fmedia.h>
+#include <afilter/pcm.h>
+
+
+extern const fmed_core *core;
+
+#undef errlog
+#undef dbglog
+#define errlog(trk, ...)  fmed_errlog(core, trk, "tee", __VA_ARGS__)
+#define dbglog(trk, ...)  fmed_dbglog(core, trk, "tee", __VA_ARGS__)
+
+// TEE
+static void* tee_open(fmed_filt *d);
+static int tee_process(void *ctx, fmed_filt *d);
+static void tee_close(void *ctx);
+const fmed_filter fmed_sndmod_tee = {
+	&tee_open, &tee_process, &tee_close
+};
+
+// TEE-IN
+static void* teein_open(fmed_filt *d);
+static int teein_process(void *ctx, fmed_filt *d);
+static void teein_close(void *ctx);
+const fmed_filter fmed_sndmod_teein = {
+	&teein_open, &teein_process, &teein_close
+};
+
+
+/*
+afilter.tee is in the chain of the main track before gain and format conversion.
+The main track writes to the first --out.
+For each additional output, "tee_out" value contains a line "GAIN\tFILENAME\n"
+ (GAIN: dB*100, empty: same as the main track).
+For each line a branch track (FMED_TRK_TYPE_TEE) is created:
+ afilter.tee-in -> afilter.gain -> afilter.autoconv -> ENCODER -> file.out
+PCM data is copied into the branch's buffer, the branch takes it from there.
+The main track waits (FMED_RASYNC) while a branch's buffer is full,
+ and the branch waits while its buffer is empty.
+With --parallel the branch tracks run on separate workers.
+
+The buffer is shared by 2 tracks that may run on different threads, so it's protected by a lock.
+
+If the main track is stopped or fails before the end of data,
+ the branch tracks fail too, so their incomplete output files are discarded
+ (file.out deletes an incomplete file).
+*/
+
+enum {
+	TEE_BUF_MSEC = 1000, // max. buffered data per branch
+};
+
+struct tee_branch {
+	fflock lk;
+	uint refs;
+	ffvec buf; // data from the main track, interleaved
+	const fmed_track *track;
+	void *trk; // branch track
+	void *main_trk;
+	uint fin :1 // the main track has no more data
+		, err :1 // the main track is closed before the end of data
+		, closed :1 // the branch track is closed
+		, branch_wait :1 // the branch track waits for data
+		, main_wait :1 // the main track waits for free space
+		;
+};
+
+static void branch_unref(struct tee_branch *b)
+{
+	fflk_lock(&b->lk);
+	uint refs = --b->refs;
+	fflk_unlock(&b->lk);
+	if (refs != 0)
+		return;
+
+	ffvec_free(&b->buf);
+	ffmem_free(b);
+}
+
+/** The branch track is closed: the main track must not wait for it anymore */
+static void branch_close(struct tee_branch *b)
+{
+	fflk_lock(&b->lk);
+	b->closed = 1;
+	b->trk = NULL;
+	b->branch_wait = 0;
+	if (b->main_wait) {
+		b->main_wait = 0;
+		b->track->cmd(b->main_trk, FMED_TRACK_WAKE);
+	}
+	fflk_unlock(&b->lk);
+	branch_unref(b);
+}
+
+struct tee {
+	uint state;
+	ffvec branches; // struct tee_branch*[]
+	uint ibranch; // the branch to write the current data to
+	ffpcmex fmt, ifmt;
+	size_t bufmax;
+	const char *tee_out;
+};
+
+static void* tee_open(fmed_filt *d)
+{
+	const char *tee_out = d->track->getvalstr(d->trk, "tee_out");
+	if (tee_out == FMED_PNULL)
+		return FMED_FILT_SKIP;
+
+	if (!ffsz_eq(d->datatype, "pcm")) {
+		errlog(d->trk, "decoder doesn't produce PCM data", 0);
+		return NULL;
+	}
+
+	struct tee *c = ffmem_new(struct tee);
+	if (c == NULL)
+		return NULL;
+	c->tee_out = tee_out;
+	c->fmt = d->audio.fmt;
+	c->ifmt = d->audio.fmt;
+	c->ifmt.ileaved = 1;
+	c->bufmax = ffpcm_bytes(&c->ifmt, TEE_BUF_MSEC);
+	return c;
+}
+
+static void tee_close(void *ctx)
+{
+	struct tee *c = ctx;
+	struct tee_branch **pb;
+	FFSLICE_WALK(&c->branches, pb) {
+		struct tee_branch *b = *pb;
+		fflk_lock(&b->lk);
+		b->main_trk = NULL;
+		b->main_wait = 0;
+		if (!b->fin) {
+			b->fin = 1;
+			b->err = 1;
+			if (b->branch_wait) {
+				b->branch_wait = 0;
+				b->track->cmd(b->trk, FMED_TRACK_WAKE);
+			}
+		}
+		fflk_unlock(&b->lk);
+		branch_unref(b);
+	}
+	ffvec_free(&c->branches);
+	ffmem_free(c);
+}
+
+/** Create and start a branch track */
+static int branch_create(struct tee *c, fmed_filt *d, const ffstr *fn, const ffstr *gain)
+{
+	const fmed_track *track = d->track;
+	fmed_track_obj *trk;
+	struct tee_branch *b;
+	if (NULL == (b = ffmem_new(struct tee_branch)))
+		return -1;
+	fflk_init(&b->lk);
+	b->refs = 2;
+	b->track = track;
+	b->main_trk = d->trk;
+
+	if (NULL == (trk = track->create(FMED_TRK_TYPE_TEE, "")))
+		goto fail;
+	b->trk = trk;
+
+	if (0 == track->cmd(trk, FMED_TRACK_FILT_ADDLAST, "afilter.tee-in"))
+		goto fail;
+
+	fmed_track_info *ti = track->conf(trk);
+	track->copy_info(ti, d);
+	ffmem_free(ti->out_filename);
+	ti->out_filename = ffsz_dupstr(fn);
+	ti->datatype = "pcm";
+	ti->audio.fmt = c->ifmt;
+	ti->audio.pos = 0;
+	ti->audio.seek = FMED_NULL;
+	ti->audio.until = FMED_NULL;
+	ti->audio.split = FMED_NULL;
+	ti->audio.abs_seek = 0;
+	ti->a_prebuffer = 0;
+	ti->a_start_level = 0;
+	ti->a_stop_level = 0;
+	ti->input_info = 0;
+	ti->build_index = 0;
+
+	int gain_db;
+	if (gain->len != 0 && ffstr_toint(gain, &gain_db, FFS_INT32 | FFS_INTSIGN))
+		ti->audio.gain = gain_db;
+
+	const char *input = track->getvalstr(d->trk, "input");
+	if (input != FMED_PNULL)
+		track->setvalstr4(trk, "input", ffsz_dup(input), FMED_TRK_FACQUIRE);
+	track->setval(trk, "tee_ptr", (size_t)b);
+	track->cmd(trk, FMED_TRACK_META_COPYFROM, d->trk);
+
+	struct tee_branch **pb;
+	if (NULL == (pb = ffvec_pushT(&c->branches, struct tee_branch*)))
+		goto fail;
+	*pb = b;
+
+	dbglog(d->trk, "branch %p: %s  gain:%d"
+		, trk, ti->out_filename, ti->audio.gain);
+
+	uint cmd = (core->props->parallel) ? FMED_TRACK_XSTART : FMED_TRACK_START;
+	if (0 != track->cmd(trk, cmd)) {
+		// the track is destroyed, teein_close() won't be called
+		b->closed = 1;
+		b->refs = 1;
+		return -1;
+	}
+	return 0;
+
+fail:
+	if (b->trk != NULL)
+		track->cmd(b->trk, FMED_TRACK_STOP); // the track isn't started: just destroy it
+	ffmem_free(b);
+	return -1;
+}
+
+static int branches_create(struct tee *c, fmed_filt *d)
+{
+	ffstr in, line, gain;
+	ffstr_setz(&in, c->tee_out);
+	while (in.len != 0) {
+		ffstr_splitby(&in, '\n', &line, &in);
+		if (line.len == 0)
+			continue;
+		ffstr_splitby(&line, '\t', &gain, &line);
+		if (line.len == 0) {
+			errlog(d->trk, "bad output list: %s", c->tee_out);
+			return -1;
+		}
+		if (0 != branch_create(c, d, &line, &gain)) {
+			errlog(d->trk, "can't start the track for %S", &line);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/** Copy data to the branch's buffer.
+Return 0 on success;  1 if the buffer is full */
+static int branch_write(struct tee *c, struct tee_branch *b, fmed_filt *d, uint samples)
+{
+	int r = 0;
+	fflk_lock(&b->lk);
+
+	if (b->closed) {
+		goto end;
+
+	} else if (b->buf.len >= c->bufmax) {
+		b->main_wait = 1;
+		r = 1;
+		goto end;
+	}
+
+	if (samples != 0) {
+		size_t n = samples * ffpcm_size1(&c->ifmt);
+		if (NULL == ffvec_grow(&b->buf, n, 1))
+			goto end;
+		if (c->fmt.ileaved)
+			ffmem_copy(b->buf.ptr + b->buf.len, d->data, n);
+		else
+			ffpcm_convert(&c->ifmt, b->buf.ptr + b->buf.len, &c->fmt, d->datani, samples);
+		b->buf.len += n;
+	}
+
+	if (d->flags & FMED_FLAST)
+		b->fin = 1;
+
+	if (b->branch_wait) {
+		b->branch_wait = 0;
+		b->track->cmd(b->trk, FMED_TRACK_WAKE);
+	}
+
+end:
+	fflk_unlock(&b->lk);
+	return r;
+}
+
+static int tee_process(void *ctx, fmed_filt *d)
+{
+	struct tee *c = ctx;
+
+	switch (c->state) {
+	case 0:
+		if (0 != branches_create(c, d))
+			return FMED_RERR;
+		c->state = 1;
+		break;
+	}
+
+	uint samples = d->datalen / ffpcm_size1(&c->fmt);
+	struct tee_branch **branches = c->branches.ptr;
+	for (;  c->ibranch != c->branches.len;  c->ibranch++) {
+		if (0 != branch_write(c, branches[c->ibranch], d, samples))
+			return FMED_RASYNC; // the branch will wake us up
+	}
+	c->ibranch = 0;
+
+	d->out = d->data,  d->outlen = d->datalen;
+	d->datalen = 0;
+	if (d->flags & FMED_FLAST)
+		return FMED_RDONE;
+	return FMED_ROK;
+}
+
+
+struct teein {
+	struct tee_branch *b;
+	ffvec buf;
+};
+
+static void* teein_open(fmed_filt *d)
+{
+	struct tee_branch *b = (void*)d->track->getval(d->trk, "tee_ptr");
+	if ((int64)(size_t)b == FMED_NULL)
+		return NULL;
+
+	struct teein *c = ffmem_new(struct teein);
+	if (c == NULL) {
+		branch_close(b); // teein_close() won't be called
+		return NULL;
+	}
+	c->b = b;
+	return c;
+}
+
+static void teein_close(void *ctx)
+{
+	struct teein *c = ctx;
+	branch_close(c->b);
+	ffvec_free(&c->buf);
+	ffmem_free(c);
+}
+
+static int teein_process(void *ctx, fmed_filt *d)
+{
+	struct teein *c = ctx;
+	struct tee_branch *b = c->b;
+
+	c->buf.len = 0;
+	fflk_lock(&b->lk);
+
+	if (b->buf.len == 0 && !b->fin) {
+		b->branch_wait = 1;
+		fflk_unlock(&b->lk);
+		return FMED_RASYNC; // the main track will wake us up
+	}
+
+	// take the data, give the empty buffer back to the main track
+	if (b->err) {
+		fflk_unlock(&b->lk);
+		errlog(d->trk, "the main track is stopped before the end of data");
+		return FMED_RERR;
+	}
+
+	ffvec tmp = b->buf;
+	b->buf = c->buf;
+	c->buf = tmp;
+	uint fin = b->fin;
+
+	if (b->main_wait) {
+		b->main_wait = 0;
+		b->track->cmd(b->main_trk, FMED_TRACK_WAKE);
+	}
+
+	fflk_unlock(&b->lk);
+
+	d->out = c->buf.ptr,  d->outlen = c->buf.len;
+	if (fin)
+		return FMED_RDONE;
+	return FMED_RDATA;
+}
@@ -0,0 +1,369 @@
+/** Record waveform peaks at several zoom levels.
+Copyright (c) 2022 Simon Zolin */
+
+#include <fmedia.h>
+#include <afilter/pcm.h>
+#include <util/path.h>
+#include <util/svar.h>
+#include <FFOS/dir.h>
+#include <FFOS/dirscan.h>
+#include <FFOS/thread.h>
+
+
+extern const fmed_core *core;
+
+#undef dbglog
+#undef errlog
+#define dbglog(trk, ...)  fmed_dbglog(core, trk, "wavepeaks", __VA_ARGS__)
+#define errlog(trk, ...)  fmed_errlog(core, trk, "wavepeaks", __VA_ARGS__)
+
+#include <afilter/wavepeaks.h>
+
+static void* wavepeaks_open(fmed_filt *d);
+static int wavepeaks_process(void *ctx, fmed_filt *d);
+static void wavepeaks_close(void *ctx);
+const fmed_filter fmed_sndmod_wavepeaks = {
+	&wavepeaks_open, &wavepeaks_process, &wavepeaks_close
+};
+
+/*
+The filter is added:
+ . by --peaks-file (the track's "peaks_file" value);
+ . by UI for a file that has no cached waveform yet ("peaks_file" is set to the cache file).
+Data is passed through as is, any PCM format supported by ffpcm_minmax() is accepted.
+The file is written only when the whole input has passed from the beginning without seeking
+ (not with --until, not when the track is stopped).
+The file is written via a temporary file, so a reader never sees a partial file.
+The blocks of level N+1 are computed from the exact (not quantized) values of level N blocks.
+*/
+
+struct wp_acc {
+	float min, max;
+	double sumsq;
+};
+
+struct wavepeaks {
+	char *fn;
+	ffpcmex fmt;
+	uint64 total;
+	uint64 file_size;
+	int64 file_mtime;
+	ffvec blocks[WAVEPEAKS_LEVELS]; // struct wavepeaks_blk[]
+	struct wp_acc acc[WAVEPEAKS_LEVELS][WAVEPEAKS_MAXCHAN];
+	uint nacc[WAVEPEAKS_LEVELS]; // samples in the current block
+	uint cancelled :1
+		, in_cache :1 // 'fn' is in the user's cache directory
+		;
+};
+
+/** Expand $filename and $filepath with the input file name */
+static char* wp_filename(const char *val, const char *input)
+{
+	ffstr fn = FFSTR_INITZ(val), v, dir = {}, name = {}, ext;
+	ffvec buf = {};
+	if (input != FMED_PNULL)
+		ffpath_split3(input, ffsz_len(input), &dir, &name, &ext);
+
+	while (fn.len != 0) {
+		if (FFSVAR_TEXT == svar_split(&fn, &v))
+			ffvec_addstr(&buf, &v);
+		else if (ffstr_eqz(&v, "filename"))
+			ffvec_addstr(&buf, &name);
+		else if (ffstr_eqz(&v, "filepath"))
+			ffvec_addstr(&buf, &dir);
+		else
+			ffvec_addfmt(&buf, "$%S", &v);
+	}
+	ffvec_addchar(&buf, '\0');
+	return buf.ptr;
+}
+
+static void acc_reset(struct wp_acc *a, uint nch)
+{
+	for (uint i = 0;  i != nch;  i++) {
+		a[i].min = 1;
+		a[i].max = -1;
+		a[i].sumsq = 0;
+	}
+}
+
+static void* wavepeaks_open(fmed_filt *d)
+{
+	const char *val = d->track->getvalstr(d->trk, "peaks_file");
+	if (val == FMED_PNULL)
+		return FMED_FILT_SKIP;
+
+	if (d->stream_copy) {
+		errlog(d->trk, "PCM data is required", 0);
+		return FMED_FILT_SKIP;
+	}
+
+	ffpcmex fmt = d->audio.fmt;
+	switch (fmt.format) {
+	case FFPCM_16:
+	case FFPCM_24:
+	case FFPCM_32:
+	case FFPCM_FLOAT:
+		break;
+	default:
+		errlog(d->trk, "unsupported PCM format: %s", ffpcm_fmtstr(fmt.format));
+		return FMED_FILT_SKIP;
+	}
+	if (fmt.channels == 0 || fmt.channels > WAVEPEAKS_MAXCHAN) {
+		errlog(d->trk, "unsupported channels: %u", fmt.channels);
+		return FMED_FILT_SKIP;
+	}
+	if ((int64)d->audio.until != FMED_NULL) {
+		dbglog(d->trk, "--until is set: the waveform won't be complete", 0);
+		return FMED_FILT_SKIP;
+	}
+
+	struct wavepeaks *w = ffmem_new(struct wavepeaks);
+	if (w == NULL)
+		return NULL;
+	w->fmt = fmt;
+	w->fn = wp_filename(val, d->track->getvalstr(d->trk, "input"));
+	char *cdir = ffsz_alfmt(WAVEPEAKS_CACHE_DIR "/", core->props->user_path);
+	w->in_cache = (cdir != NULL && ffsz_matchz(w->fn, cdir));
+	ffmem_free(cdir);
+	if ((int64)d->input.size != FMED_NULL)
+		w->file_size = d->input.size;
+	int64 mtime = d->track->getval(d->trk, "input_mtime");
+	if (mtime != FMED_NULL)
+		w->file_mtime = mtime;
+	for (uint i = 0;  i != WAVEPEAKS_LEVELS;  i++) {
+		acc_reset(w->acc[i], fmt.channels);
+	}
+	return w;
+}
+
+static void wavepeaks_close(void *ctx)
+{
+	struct wavepeaks *w = ctx;
+	for (uint i = 0;  i != WAVEPEAKS_LEVELS;  i++) {
+		ffvec_free(&w->blocks[i]);
+	}
+	ffmem_free(w->fn);
+	ffmem_free(w);
+}
+
+static int blk_val(double d)
+{
+	int i = d * 32768;
+	return ffmax(ffmin(i, 32767), -32768);
+}
+
+/** The block of level 'l' is complete: store it and add it to the next level's block. */
+static void wp_block_done(struct wavepeaks *w, uint l)
+{
+	uint nch = w->fmt.channels;
+	ffvec *v = &w->blocks[l];
+	if (NULL == ffvec_growtwiceT(v, nch, struct wavepeaks_blk)) {
+		w->cancelled = 1;
+		return;
+	}
+	struct wavepeaks_blk *b = (struct wavepeaks_blk*)v->ptr + v->len;
+	v->len += nch;
+
+	for (uint i = 0;  i != nch;  i++) {
+		const struct wp_acc *a = &w->acc[l][i];
+		b[i].min = blk_val(a->min);
+		b[i].max = blk_val(a->max);
+		b[i].rms = blk_val(sqrt(a->sumsq / w->nacc[l]));
+
+		if (l + 1 != WAVEPEAKS_LEVELS) {
+			struct wp_acc *n = &w->acc[l + 1][i];
+			n->min = ffmin(n->min, a->min);
+			n->max = ffmax(n->max, a->max);
+			n->sumsq += a->sumsq;
+		}
+	}
+
+	if (l + 1 != WAVEPEAKS_LEVELS)
+		w->nacc[l + 1] += w->nacc[l];
+	acc_reset(w->acc[l], nch);
+	w->nacc[l] = 0;
+
+	if (l + 1 != WAVEPEAKS_LEVELS
+		&& w->nacc[l + 1] == wavepeaks_steps[l + 1])
+		wp_block_done(w, l + 1);
+}
+
+static void wp_add(struct wavepeaks *w, const void *data, size_t frames)
+{
+	const uint step = wavepeaks_steps[0];
+	for (size_t off = 0;  off != frames;  ) {
+		size_t n = ffmin(frames - off, step - w->nacc[0]);
+		for (uint i = 0;  i != w->fmt.channels;  i++) {
+			struct wp_acc *a = &w->acc[0][i];
+			ffpcm_minmax(&w->fmt, data, i, off, off + n, &a->min, &a->max, &a->sumsq);
+		}
+		w->nacc[0] += n;
+		off += n;
+		w->total += n;
+		if (w->nacc[0] == step)
+			wp_block_done(w, 0);
+		if (w->cancelled)
+			return;
+	}
+}
+
+static int wp_save(struct wavepeaks *w, void *trk)
+{
+	// complete the partial blocks
+	for (uint l = 0;  l != WAVEPEAKS_LEVELS;  l++) {
+		if (w->nacc[l] != 0)
+			wp_block_done(w, l);
+	}
+
+	struct wavepeaks_hdr h = {};
+	ffmem_copy(h.magic, WAVEPEAKS_MAGIC, 4);
+	h.ver = WAVEPEAKS_VER;
+	h.file_size = w->file_size;
+	h.file_mtime = w->file_mtime;
+	h.total = w->total;
+	h.sample_rate = w->fmt.sample_rate;
+	h.channels = w->fmt.channels;
+	h.nlevels = WAVEPEAKS_LEVELS;
+
+	ffvec buf = {};
+	uint64 off = sizeof(h);
+	for (uint l = 0;  l != WAVEPEAKS_LEVELS;  l++) {
+		h.level[l].step = wavepeaks_steps[l];
+		h.level[l].n = w->blocks[l].len / w->fmt.channels;
+		h.level[l].off = off;
+		off += w->blocks[l].len * sizeof(struct wavepeaks_blk);
+	}
+	if (NULL == ffvec_alloc(&buf, off, 1))
+		return -1;
+	ffvec_add(&buf, &h, sizeof(h), 1);
+	for (uint l = 0;  l != WAVEPEAKS_LEVELS;  l++) {
+		ffvec_add(&buf, w->blocks[l].ptr, w->blocks[l].len * sizeof(struct wavepeaks_blk), 1);
+	}
+
+	int rc = -1;
+	char *tmp = ffsz_alfmt("%s.%u-%U.tmp", w->fn, (int)ffps_curid(), (int64)ffthread_curid());
+	if (0 != ffdir_make_path(w->fn, 0) && fferr_last() != EEXIST) {
+		fmed_syserrlog(core, trk, "wavepeaks", "%s: %s", ffdir_make_S, w->fn);
+		goto end;
+	}
+	if (0 != fffile_writewhole(tmp, buf.ptr, buf.len, 0)) {
+		fmed_syserrlog(core, trk, "wavepeaks", "%s: %s", fffile_write_S, tmp);
+		goto end;
+	}
+	if (0 != fffile_rename(tmp, w->fn)) {
+		fmed_syserrlog(core, trk, "wavepeaks", "%s: %s", fffile_rename_S, w->fn);
+		fffile_rm(tmp);
+		goto end;
+	}
+
+	dbglog(trk, "saved %U samples (%L bytes) to %s", w->total, buf.len, w->fn);
+	rc = 0;
+
+end:
+	ffmem_free(tmp);
+	ffvec_free(&buf);
+	return rc;
+}
+
+struct wp_cfile {
+	char *name;
+	uint64 size;
+	int64 mtime;
+};
+
+static int wp_cfile_cmp(const void *a, const void *b, void *udata)
+{
+	const struct wp_cfile *fa = a, *fb = b;
+	return (fa->mtime < fb->mtime) ? -1 : (fa->mtime > fb->mtime);
+}
+
+/** Delete the oldest files from the cache directory until its size is within the limit */
+static void wp_cache_trim(void *trk)
+{
+	ffdirscan ds = {};
+	ffvec files = {}; // struct wp_cfile[]
+	struct wp_cfile *f;
+	uint64 total = 0;
+	const char *name;
+	char *dir = ffsz_alfmt(WAVEPEAKS_CACHE_DIR, core->props->user_path);
+	if (dir == NULL || 0 != ffdirscan_open(&ds, dir, FFDIRSCAN_NOSORT)) {
+		ffmem_free(dir);
+		return;
+	}
+
+	while (NULL != (name = ffdirscan_next(&ds))) {
+		fffileinfo fi;
+		char *fn = ffsz_alfmt("%s/%s", dir, name);
+		if (fn == NULL)
+			goto end;
+		if (0 != fffile_infofn(fn, &fi)
+			|| fffile_isdir(fffile_infoattr(&fi))) {
+			ffmem_free(fn);
+			continue;
+		}
+		if (NULL == (f = ffvec_pushT(&files, struct wp_cfile))) {
+			ffmem_free(fn);
+			goto end;
+		}
+		f->name = fn;
+		f->size = fffile_infosize(&fi);
+		fftime mt = fffile_infomtime(&fi);
+		f->mtime = fftime_sec(&mt);
+		total += f->size;
+	}
+
+	if (total <= WAVEPEAKS_CACHE_MAXSIZE)
+		goto end;
+
+	ffsort(files.ptr, files.len, sizeof(struct wp_cfile), wp_cfile_cmp, NULL);
+	FFSLICE_WALK(&files, f) {
+		if (total <= WAVEPEAKS_CACHE_MAXSIZE)
+			break;
+		if (0 != fffile_rm(f->name)) {
+			fmed_syserrlog(core, trk, "wavepeaks", "%s: %s", fffile_rm_S, f->name);
+			continue;
+		}
+		dbglog(trk, "cache: deleted %s", f->name);
+		total -= f->size;
+	}
+
+end:
+	FFSLICE_WALK(&files, f) {
+		ffmem_free(f->name);
+	}
+	ffvec_free(&files);
+	ffdirscan_close(&ds);
+	ffmem_free(dir);
+}
+
+static int wavepeaks_process(void *ctx, fmed_filt *d)
+{
+	struct wavepeaks *w = ctx;
+
+	if (!w->cancelled) {
+		if ((int64)d->audio.seek != FMED_NULL
+			|| (w->total == 0 && d->datalen != 0 && (int64)d->audio.pos > 0)) {
+			dbglog(d->trk, "not starting from the beginning or seeking: waveform won't be saved", 0);
+			w->cancelled = 1;
+		} else {
+			wp_add(w, d->data, d->datalen / ffpcm_size1(&w->fmt));
+		}
+	}
+
+	d->out = d->data;
+	d->outlen = d->datalen;
+	d->datalen = 0;
+
+	if (d->flags & FMED_FSTOP)
+		w->cancelled = 1; // the input isn't complete
+
+	if (d->flags & FMED_FLAST) {
+		if (!w->cancelled && w->total != 0
+			&& 0 == wp_save(w, d->trk)
+			&& w->in_cache)
+			wp_cache_trim(d->trk);
+		return FMED_RDONE;
+	}
+	return FMED_ROK;
+}
@@ -0,0 +1,121 @@
+/** fmedia: multi-resolution waveform peaks file
+2022, Simon Zolin */
+
+/*
+afilter.wavepeaks records the waveform of the audio data that passes through it
+ at several zoom levels: min/max/RMS values of each channel for every 256, 4096 and 65536 samples.
+The file is stored either in the user's cache "{USER_PATH}cache/peaks/HASH.peaks"
+ (valid only while the input file's size and modification time are the same)
+ or in the file set by --peaks-file.
+The cache size is limited: after a new file is saved the oldest ones are deleted.
+
+File format (host byte order, can be mapped into memory as is):
+HDR BLOCK[level[0].n * channels] BLOCK[level[1].n * channels] ...
+Blocks of one level follow in time order, the channels of one block are interleaved.
+*/
+
+#include <ffbase/murmurhash3.h>
+
+#define WAVEPEAKS_MAGIC  "FMWP"
+#define WAVEPEAKS_VER  1
+
+enum {
+	WAVEPEAKS_LEVELS = 3,
+	WAVEPEAKS_MAXCHAN = 8,
+	WAVEPEAKS_CACHE_MAXSIZE = 100*1024*1024, // max. total size of the files in the cache directory
+};
+
+/** Samples per block of each level */
+static const uint wavepeaks_steps[WAVEPEAKS_LEVELS] = { 256, 4096, 65536 };
+
+struct wavepeaks_level {
+	uint step; // samples per block
+	uint reserved;
+	uint64 n; // number of blocks
+	uint64 off; // file offset of the first block
+};
+
+struct wavepeaks_hdr {
+	char magic[4];
+	uint ver;
+	uint64 file_size; // input file size;  0: unknown
+	int64 file_mtime; // input file modification time (sec);  0: unknown
+	uint64 total; // total number of samples
+	uint sample_rate;
+	ushort channels;
+	ushort nlevels;
+	struct wavepeaks_level level[WAVEPEAKS_LEVELS];
+};
+
+/** Waveform of one channel within one block:
+ min and max sample values (-32768..32767) and RMS (0..32767) */
+struct wavepeaks_blk {
+	short min, max;
+	ushort rms;
+};
+
+#define WAVEPEAKS_CACHE_DIR  "%scache/peaks"
+
+/** Get the name of the cache file for the input file */
+static inline char* wavepeaks_cache_name(const char *input)
+{
+	uint hash = murmurhash3(input, ffsz_len(input), 0x12345678);
+	return ffsz_alfmt(WAVEPEAKS_CACHE_DIR "/%08xu.peaks", core->props->user_path, hash);
+}
+
+/** Return TRUE if the waveform covers the whole track:
+ the track length may be an estimate, so 1% difference is allowed */
+static inline int wavepeaks_total_match(uint64 wave_total, uint64 total)
+{
+	uint64 d = (wave_total > total) ? wave_total - total : total - wave_total;
+	return d <= total / 100;
+}
+
+/** Load the blocks of one level.
+The finest level which doesn't have more than 'max_blocks' blocks is chosen
+ (or the coarsest one if all have more).
+file_size, file_mtime: the properties of the input file to check the cache file against;  0: don't check
+blocks: struct wavepeaks_blk[n * channels]
+Return level index;  <0: the file can't be used */
+static inline int wavepeaks_load(const char *fn, uint64 file_size, int64 file_mtime, uint64 max_blocks
+	, struct wavepeaks_hdr *h, ffvec *blocks)
+{
+	int rc = -1;
+	fffd f;
+	if (FF_BADFD == (f = fffile_open(fn, FFO_RDONLY | FFO_NOATIME | FFO_NODOSNAME)))
+		return -1;
+
+	uint64 fsize = fffile_size(f);
+	if (sizeof(*h) != fffile_read(f, h, sizeof(*h))
+		|| ffmem_cmp(h->magic, WAVEPEAKS_MAGIC, 4)
+		|| h->ver != WAVEPEAKS_VER
+		|| (file_size != 0 && h->file_size != file_size)
+		|| (file_mtime != 0 && h->file_mtime != file_mtime)
+		|| h->channels == 0 || h->channels > WAVEPEAKS_MAXCHAN
+		|| h->nlevels == 0 || h->nlevels > WAVEPEAKS_LEVELS)
+		goto end;
+
+	uint i;
+	for (i = 0;  i + 1 < h->nlevels;  i++) {
+		if (h->level[i].n <= max_blocks)
+			break;
+	}
+
+	const struct wavepeaks_level *l = &h->level[i];
+	uint64 size = l->n * h->channels * sizeof(struct wavepeaks_blk);
+	if (l->n == 0
+		|| l->off + size > fsize)
+		goto end;
+
+	ffvec_free(blocks);
+	if (NULL == ffvec_allocT(blocks, l->n * h->channels, struct wavepeaks_blk))
+		goto end;
+	if ((ssize_t)size != fffile_pread(f, blocks->ptr, size, l->off))
+		goto end;
+	blocks->len = l->n * h->channels;
+	rc = i;
+
+end:
+	fffile_close(f);
+	return rc;
+}
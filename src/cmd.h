@@ -4,6 +4,13 @@ Copyright (c) 2016 Simon Zolin */
 #include <util/array.h>
 
 
+/** Additional --out */
+struct cmd_out {
+	char *fn;
+	float gain; //dB
+	byte gain_set;
+};
+
 typedef struct fmed_cmd {
 	ffarr in_files; //char*[]
 	fftask tsk_start;
@@ -27,9 +34,13 @@ typedef struct fmed_cmd {
 	byte mix;
 	byte tags;
 	byte info;
+	byte build_index;
 	uint seek_time;
 	uint until_time;
 	uint split_time;
+	float split_silence; //dB
+	uint split_silence_time; //msec
+	uint split_silence_mintrack; //msec
 	uint prebuffer;
 	float start_level; //dB
 	float stop_level; //dB
@@ -47,6 +58,10 @@ typedef struct fmed_cmd {
 	byte pcm_peaks;
 	byte pcm_crc;
 	byte dynanorm;
+	char *peaks_fn;
+	byte loudness;
+	byte loudness_album;
+	char *loudness_json;
 
 	float vorbis_qual;
 	uint opus_brate;
@@ -64,15 +79,19 @@ typedef struct fmed_cmd {
 	byte notui;
 	byte gui;
 	byte print_time;
+	char *bench_fn;
 	byte cue_gaps;
+	byte cue_decode_once;
 
 	ffstr outfn;
 	char *outfnz;
+	ffvec outs; // struct cmd_out[]
 	byte overwrite;
 	byte out_copy;
 	byte preserve_date;
 	byte parallel;
 	byte edittags;
+	int edittags_padding; // -1:default
 
 	ffstr dummy;
 
@@ -90,6 +109,7 @@ static inline int cmd_init(fmed_cmd *cmd)
 	cmd->lbdev_name = (uint)-1;
 	cmd->volume = 100;
 	cmd->cue_gaps = 255;
+	cmd->edittags_padding = -1;
 	return 0;
 }
 
@@ -100,12 +120,20 @@ static inline void cmd_destroy(fmed_cmd *cmd)
 
 	FFARR_FREE_ALL_PTR(&cmd->in_files, ffmem_free, char*);
 	ffmem_free(cmd->outfnz);
+	struct cmd_out *o;
+	FFSLICE_WALK(&cmd->outs, o) {
+		ffmem_free(o->fn);
+	}
+	ffvec_free(&cmd->outs);
 
 	ffstr_free(&cmd->meta);
 	ffstr_free(&cmd->meta_from_filename);
 	ffmem_safefree(cmd->aac_profile);
+	ffmem_safefree(cmd->peaks_fn);
+	ffmem_safefree(cmd->loudness_json);
 	ffmem_safefree(cmd->trackno);
 	ffmem_safefree(cmd->conf_fn);
+	ffmem_safefree(cmd->bench_fn);
 
 	ffmem_safefree(cmd->globcmd_pipename);
 	ffstr_free(&cmd->globcmd);
@@ -290,6 +290,39 @@ static int arg_split(ffcmdarg_scheme *as, void *obj, const ffstr *val)
 	return 0;
 }
 
+/** DB[;SILENCE_TIME[;MIN_TRACK_TIME]] */
+static int arg_split_silence(ffcmdarg_scheme *as, void *obj, const ffstr *val)
+{
+	fmed_cmd *cmd = obj;
+	ffstr db, time, mintime;
+	ffdatetime dt;
+	fftime t;
+	ffstr_splitby(val, ';', &db, &time);
+	ffstr_splitby(&time, ';', &time, &mintime);
+
+	double f;
+	if (db.len == 0 || db.len != ffs_tofloat(db.ptr, db.len, &f, 0) || f == 0)
+		return FFCMDARG_ERROR;
+	cmd->split_silence = ffabs(f);
+
+	cmd->split_silence_time = 2000;
+	if (time.len != 0) {
+		if (time.len != fftime_fromstr1(&dt, time.ptr, time.len, FFTIME_HMS_MSEC_VAR))
+			return FFCMDARG_ERROR;
+		fftime_join1(&t, &dt);
+		cmd->split_silence_time = fftime_ms(&t);
+	}
+
+	cmd->split_silence_mintrack = 10000;
+	if (mintime.len != 0) {
+		if (mintime.len != fftime_fromstr1(&dt, mintime.ptr, mintime.len, FFTIME_HMS_MSEC_VAR))
+			return FFCMDARG_ERROR;
+		fftime_join1(&t, &dt);
+		cmd->split_silence_mintrack = fftime_ms(&t);
+	}
+	return 0;
+}
+
 static int arg_install(ffcmdarg_scheme *as, void *obj)
 {
 #ifdef FF_WIN
@@ -324,6 +357,40 @@ static int arg_out_chk(ffcmdarg_scheme *as, void *obj, const ffstr *val)
 	return 0;
 }
 
+/** The first --out is the main output;  each next one is written by a separate track. */
+static int arg_out(ffcmdarg_scheme *as, void *obj, const char *fn)
+{
+	fmed_cmd *cmd = obj;
+	if (cmd->outfnz == NULL) {
+		cmd->outfnz = ffsz_dup(fn);
+		return 0;
+	}
+
+	struct cmd_out *o = ffvec_zpushT(&cmd->outs, struct cmd_out);
+	o->fn = ffsz_dup(fn);
+	return 0;
+}
+
+/** Set gain for the preceding --out */
+static int arg_out_gain(ffcmdarg_scheme *as, void *obj, double val)
+{
+	fmed_cmd *cmd = obj;
+	if (cmd->outfnz == NULL) {
+		errlog0("--out-gain must follow --out", 0);
+		return FFCMDARG_ERROR;
+	}
+
+	if (cmd->outs.len == 0) {
+		cmd->gain = val;
+		return 0;
+	}
+
+	struct cmd_out *o = ffslice_lastT(&cmd->outs, struct cmd_out);
+	o->gain = val;
+	o->gain_set = 1;
+	return 0;
+}
+
 static int arg_debug(ffcmdarg_scheme *as, void *obj)
 {
 	core->loglev = FMED_LOG_DEBUG;
@@ -387,21 +454,28 @@ static const ffcmdarg_arg fmed_cmdline_args[] = {
 	{ 0, "stop-dblevel",	TSTR,	F(arg_astoplev) },
 	{ 0, "fseek",	FFCMDARG_TINT64,	O(fseek) },
 	{ 'i', "info",	TSWITCH,	O(info) },
+	{ 0, "build-index",	TSWITCH,	O(build_index) },
 
 	// TAGS
 	{ 0, "tags",	TSWITCH,	O(tags) },
 	{ 0, "meta",	FFCMDARG_TSTR,	O(meta) },
 	{ 0, "meta-from-filename",	FFCMDARG_TSTR,	O(meta_from_filename) },
 	{ 0, "edit-tags",	TSWITCH,	O(edittags) },
+	{ 0, "edit-tags-padding",	TINT32,	O(edittags_padding) },
 
 	//FILTERS
 	{ 0, "volume",	FFCMDARG_TINT8,	O(volume) },
 	{ 0, "gain",	TFLOAT32,	O(gain) },
 	{ 0, "auto-attenuate",	TFLOAT32,	F(arg_auto_attenuate) },
 	{ 0, "split",	TSTR,	F(arg_split) },
+	{ 0, "split-silence",	TSTR,	F(arg_split_silence) },
 	{ 0, "dynanorm",	TSWITCH,	O(dynanorm) },
 	{ 'P', "pcm-peaks",	TSWITCH,	O(pcm_peaks) },
 	{ 0, "pcm-crc",	TSWITCH,	O(pcm_crc) },
+	{ 0, "peaks-file",	TSTRZ,	O(peaks_fn) },
+	{ 0, "loudness",	TSWITCH,	O(loudness) },
+	{ 0, "loudness-album",	TSWITCH,	O(loudness_album) },
+	{ 0, "loudness-json",	TSTRZ,	O(loudness_json) },
 
 	//ENCODING
 	{ 0, "vorbis.quality",	TFLOAT32,	O(vorbis_qual) }, // obsolete
@@ -415,7 +489,8 @@ static const ffcmdarg_arg fmed_cmdline_args[] = {
 	{ 0, "stream-copy",	TSWITCH,	O(stream_copy) },
 
 	//OUTPUT
-	{ 'o', "out",	TSTRZ,	O(outfnz) },
+	{ 'o', "out",	TSTRZ | FFCMDARG_FMULTI,	F(arg_out) },
+	{ 0, "out-gain",	TFLOAT32 | FFCMDARG_FMULTI,	F(arg_out_gain) },
 	{ 'y', "overwrite",	TSWITCH,	O(overwrite) },
 	{ 0, "out-copy",	TSWITCH,	O(out_copy) },
 	{ 0, "out-copy-cmd",	TSWITCH,	F(arg_out_copycmd) },
@@ -432,9 +507,11 @@ static const ffcmdarg_arg fmed_cmdline_args[] = {
 	{ 0, "notui",	TSWITCH,	O(notui) },
 	{ 0, "gui",	TSWITCH,	O(gui) },
 	{ 0, "print-time",	TSWITCH,	O(print_time) },
+	{ 0, "bench",	TSTRZ,	O(bench_fn) },
 	{ 'D', "debug",	TSWITCH,	F(arg_debug) },
 	{ 'h', "help",	TSWITCH,	F(arg_usage) },
 	{ 0, "cue-gaps",	FFCMDARG_TINT8,	O(cue_gaps) },
+	{ 0, "cue-decode-once",	TSWITCH,	O(cue_decode_once) },
 	{ 0, "parallel",	TSWITCH,	O(parallel) },
 
 	//INSTALL
@@ -445,7 +522,7 @@ static const ffcmdarg_arg fmed_cmdline_args[] = {
 
 static const ffcmdarg_arg fmed_cmdline_main_args[] = {
 	{ 0, "",	TSTR,	F(arg_input_chk) },
-	{ 'o', "out",	TSTR,	F(arg_out_chk) },
+	{ 'o', "out",	TSTR | FFCMDARG_FMULTI,	F(arg_out_chk) },
 	{ 0, "conf",	TSTRZ,	O(conf_fn) },
 	{ 0, "notui",	TSWITCH,	O(notui) },
 	{ 0, "gui",	TSWITCH,	O(gui) },
@@ -463,6 +540,17 @@ int cmdline_validate(fmed_cmd *cmd)
 		errlog0("cmd line: --out-copy requires --out");
 		return 1;
 	}
+	if (cmd->outs.len != 0
+		&& (cmd->rec || cmd->mix || cmd->out_copy != 0 || cmd->stream_copy
+			|| cmd->split_time != 0 || cmd->split_silence != 0 || cmd->cue_decode_once)) {
+		errlog0("cmd line: several --out can't be used with --record, --mix, --out-copy, --stream-copy, --split, --split-silence, --cue-decode-once");
+		return 1;
+	}
+	if (cmd->split_silence != 0
+		&& (cmd->split_time != 0 || cmd->cue_decode_once || cmd->stream_copy)) {
+		errlog0("cmd line: --split-silence can't be used with --split, --cue-decode-once, --stream-copy");
+		return 1;
+	}
 	return 0;
 }
 
@@ -7,6 +7,7 @@ Copyright (c) 2019 Simon Zolin */
 int conf_init(fmed_config *conf)
 {
 	conf->codepage = FFUNICODE_WIN1252;
+	conf->batch_quantum = 0;
 	return 0;
 }
 
@@ -230,6 +231,13 @@ static int conf_codepage(fmed_conf *fc, fmed_config *conf, ffstr *val)
 	return 0;
 }
 
+static int conf_cpu_affinity(fmed_conf *fc, fmed_config *conf, ffstr *val)
+{
+	if (0 != ffcpuset_parse(&conf->cpu_affinity, *val))
+		return FMC_EBADVAL;
+	return 0;
+}
+
 static int conf_portable(fmed_conf *fc, fmed_config *conf, int64 val)
 {
 	if (val == 0)
@@ -269,6 +277,9 @@ end:
 
 static const fmed_conf_arg conf_args[] = {
 	{ "workers",	FMC_INT8, FMC_O(fmed_config, workers) },
+	{ "rt_worker",	FMC_BOOL8, FMC_O(fmed_config, rt_worker) },
+	{ "batch_quantum",	FMC_INT16, FMC_O(fmed_config, batch_quantum) },
+	{ "cpu_affinity",	FMC_STR, FMC_F(conf_cpu_affinity) },
 	{ "mod",	FMC_STRNE | FFCONF_FMULTI, FMC_F(conf_mod) },
 	{ "mod_conf",	FMC_OBJ | FFCONF_FNOTEMPTY | FFCONF_FMULTI, FMC_F(conf_modconf) },
 	{ "output",	FMC_STRNE | FFCONF_FMULTI, FMC_F(conf_output) },
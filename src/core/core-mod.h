@@ -138,6 +138,27 @@ static core_mod* mod_createiface(ffstr name)
 	return mod;
 }
 
+static int mods_index_keyeq(void *opaque, const void *key, ffsize keylen, void *val)
+{
+	const core_mod *m = val;
+	return !ffs_cmpz(key, keylen, m->name);
+}
+
+/** Module name index: the filters are looked up by name each time a track is created */
+static void mods_index_init(ffmap *map)
+{
+	ffmap_init(map, mods_index_keyeq);
+}
+
+/** Add module to the list and the index */
+static void mods_add(core_mod *mod)
+{
+	fflk_lock(&fmed->mods_lock);
+	fflist_ins(&fmed->mods, &mod->sib);
+	ffmap_add(&fmed->mods_index, mod->name, ffsz_len(mod->name), mod);
+	fflk_unlock(&fmed->mods_lock);
+}
+
 static void mod_freeiface(core_mod *m)
 {
 	ffstr_free(&m->conf_data);
@@ -217,7 +238,7 @@ const fmed_modinfo* core_insmod(ffstr name, ffconf_scheme *fc)
 		ffconf_scheme_addctx(fc, ctx.args, ctx.obj);
 	}
 
-	fflist_ins(&fmed->mods, &mod->sib);
+	mods_add(mod);
 	return (fmed_modinfo*)mod;
 
 fail:
@@ -250,18 +271,18 @@ const fmed_modinfo* core_insmod_delayed(ffstr name)
 	}
 
 	core_mod *mod = mod_createiface(name);
-	fflist_ins(&fmed->mods, &mod->sib);
+	if (mod == NULL)
+		return NULL;
+	mods_add(mod);
 	return (void*)mod;
 }
 
 const fmed_modinfo* core_getmodinfo(ffstr name)
 {
-	core_mod *mod;
-	_FFLIST_WALK(&fmed->mods, mod, sib) {
-		if (ffstr_eqz(&name, mod->name))
-			return (fmed_modinfo*)mod;
-	}
-	return NULL;
+	fflk_lock(&fmed->mods_lock);
+	const fmed_modinfo *mi = ffmap_find(&fmed->mods_index, name.ptr, name.len, NULL);
+	fflk_unlock(&fmed->mods_lock);
+	return mi;
 }
 
 /** Read module's configuration parameters. */
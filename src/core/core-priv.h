@@ -3,6 +3,7 @@ Copyright (c) 2019 Simon Zolin */
 
 #include <core/core.h>
 #include <util/conf-copy.h>
+#include <util/cpuset.h>
 #include <FFOS/process.h>
 #include <ffbase/map.h>
 
@@ -12,6 +13,9 @@ typedef struct fmed_config {
 	byte instance_mode;
 	byte prevent_sleep;
 	byte workers;
+	byte rt_worker;
+	ushort batch_quantum; //msec
+	ffcpuset cpu_affinity; // CPUs for worker threads;  empty: don't bind
 	ffpcm inp_pcm;
 	const fmed_modinfo *output;
 	const fmed_modinfo *input;
@@ -1,6 +1,19 @@
 /** fmedia: core: workers
 2015,2021, Simon Zolin */
 
+#ifdef FF_UNIX
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#endif
+#ifdef FF_LINUX
+#include <sys/syscall.h>
+#endif
+
+enum {
+	WRK_MAX_TASKS = 64, // max. tasks to run per kqueue loop iteration
+};
+
 static void wrk_destroy(struct worker *w);
 static int FFTHDCALL work_loop(void *param);
 static void on_timer(void *param);
@@ -14,6 +27,7 @@ static int wrk_init(struct worker *w, uint thread)
 		return 1;
 	}
 	fftimerqueue_init(&w->timerq);
+	fflk_init(&w->timer_lk);
 
 	if (FF_BADFD == (w->kq = ffkqu_create())) {
 		syserrlog("%s", ffkqu_create_S);
@@ -42,6 +56,41 @@ static int wrk_init(struct worker *w, uint thread)
 	return 0;
 }
 
+/** Get the number of workers for 'workers 0':
+ the CPUs the process may run on (or the CPUs set by 'cpu_affinity'),
+ but no more than cgroup CPU quota allows */
+static uint wrk_auto_count(void)
+{
+	ffcpuset cpus;
+	if (ffcpuset_count(&fmed->conf.cpu_affinity) != 0)
+		cpus = fmed->conf.cpu_affinity;
+	else
+		ffcpuset_process(&cpus);
+	uint ncpu = ffcpuset_count(&cpus);
+	uint quota = ffcpu_quota();
+	uint n = ncpu;
+	if (quota != 0)
+		n = ffmin(n, quota);
+	n = ffmax(n, 1);
+	dbglog0("workers: %u  CPUs:%u  CPU quota:%u", n, ncpu, quota);
+	return n;
+}
+
+/** Bind the current thread to the worker's CPU.
+Memory allocated and first touched by the worker is then placed on the CPU's NUMA node. */
+static void wrk_bind(struct worker *w)
+{
+	if (w->cpu < 0)
+		return;
+	ffcpuset s = {};
+	ffcpuset_add(&s, w->cpu);
+	if (0 != ffcpuset_bind(&s)) {
+		syswarnlog(NULL, "bind thread to CPU %d", w->cpu);
+		return;
+	}
+	dbglog0("thread bound to CPU %d  NUMA node:%d", w->cpu, ffcpu_numa_node(w->cpu));
+}
+
 /** Destroy worker object */
 static void wrk_destroy(struct worker *w)
 {
@@ -58,21 +107,66 @@ static void wrk_destroy(struct worker *w)
 	}
 }
 
+/** Set real-time scheduling class for the current thread.
+Fall back to a higher priority within the normal class if the user isn't permitted to do that. */
+static void wrk_prio_rt(void)
+{
+#ifdef FF_WIN
+	if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL))
+		syswarnlog(NULL, "SetThreadPriority");
+	else
+		dbglog0("real-time worker: THREAD_PRIORITY_TIME_CRITICAL", 0);
+
+#else
+	struct sched_param sp = {};
+	sp.sched_priority = sched_get_priority_min(SCHED_FIFO) + 1;
+	int e = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+	if (e == 0) {
+		dbglog0("real-time worker: SCHED_FIFO priority %d", sp.sched_priority);
+		return;
+	}
+	dbglog0("pthread_setschedparam(SCHED_FIFO): %s", strerror(e));
+
+#ifdef FF_LINUX
+	// nice value is per-thread on Linux
+	if (0 != setpriority(PRIO_PROCESS, syscall(SYS_gettid), -10))
+		syswarnlog(NULL, "real-time worker: setpriority");
+	else
+		dbglog0("real-time worker: nice -10", 0);
+#endif
+#endif
+}
+
+/** The number of workers for regular jobs */
+static inline uint work_n(void)
+{
+	return (fmed->rt_wid != 0) ? fmed->rt_wid : fmed->workers.len;
+}
+
 /** Find the worker with the least number of active jobs.
 Initialize data and create a thread if necessary.
+Real-time jobs are assigned to the dedicated worker (if enabled),
+ the other non-parallel jobs - to the main worker.
 Return worker ID */
 static uint work_assign(uint flags)
 {
 	struct worker *w, *ww = (void*)fmed->workers.ptr;
 	uint id = 0, j = -1;
 
-	if (flags == 0) {
+	if ((flags & FMED_WORKER_FRT) && fmed->rt_wid != 0) {
+		id = fmed->rt_wid;
+		w = &ww[id];
+		goto init;
+	}
+
+	if (!(flags & FMED_WORKER_FPARALLEL)) {
 		id = 0;
 		w = &ww[0];
 		goto done;
 	}
 
-	FFSLICE_WALK(&fmed->workers, w) {
+	for (uint i = 0;  i != work_n();  i++) {
+		w = &ww[i];
 		uint nj = ffatom_get(&w->njobs);
 		if (nj < j) {
 			id = w - ww;
@@ -83,6 +177,7 @@ static uint work_assign(uint flags)
 	}
 	w = &ww[id];
 
+init:
 	if (!w->init
 		&& 0 != wrk_init(w, 1)) {
 		id = 0;
@@ -109,26 +204,34 @@ static void work_release(uint wid, uint flags)
 /** Get the number of available workers */
 static uint work_avail()
 {
-	struct worker *w;
-	FFSLICE_WALK(&fmed->workers, w) {
-		if (ffatom_get(&w->njobs) == 0)
+	struct worker *ww = (void*)fmed->workers.ptr;
+	for (uint i = 0;  i != work_n();  i++) {
+		if (ffatom_get(&ww[i].njobs) == 0)
 			return 1;
 	}
 	return 0;
 }
 
-void core_job_enter(uint id, size_t *ctx)
+/** A job starts running on the worker.
+Batch (non real-time) jobs get a time quantum (fmedia.conf::batch_quantum):
+ after it expires the job yields even if there are no other tasks waiting,
+ so that the worker can process kernel events (e.g. audio device timers). */
+void core_job_enter(uint id, uint flags, struct core_job *j)
 {
 	struct worker *w = ffslice_itemT(&fmed->workers, id, struct worker);
 	FF_ASSERT(w->id == ffthd_curid());
-	*ctx = w->taskmgr.tasks.len;
+	j->ntasks = w->taskmgr.tasks.len;
+	j->deadline = 0;
+	if (!(flags & FMED_WORKER_FRT) && fmed->conf.batch_quantum != 0)
+		j->deadline = core_mono_usec() + fmed->conf.batch_quantum * 1000;
 }
 
-ffbool core_job_shouldyield(uint id, size_t *ctx)
+ffbool core_job_shouldyield(uint id, struct core_job *j)
 {
 	struct worker *w = ffslice_itemT(&fmed->workers, id, struct worker);
 	FF_ASSERT(w->id == ffthd_curid());
-	return (*ctx != w->taskmgr.tasks.len);
+	return (j->ntasks != w->taskmgr.tasks.len)
+		|| (j->deadline != 0 && core_mono_usec() >= j->deadline);
 }
 
 ffbool core_ismainthr(void)
@@ -186,11 +289,32 @@ static void core_task(fftask *task, uint cmd)
 	}
 }
 
+/*
+Timers are processed by the main worker, but they may be set and removed by any thread
+ (e.g. an audio device filter on the real-time worker), so the timer queue is protected by a lock.
+The timer handlers are called with the lock held by the main thread:
+ core_timer() called from a handler doesn't take the lock again.
+A timer removed by core_timer() won't be called after the function returns.
+*/
+
+static void timer_lock(struct worker *w)
+{
+	if (FF_READONCE(w->timer_owner) != ffthd_curid())
+		fflk_lock(&w->timer_lk);
+}
+
+static void timer_unlock(struct worker *w)
+{
+	if (FF_READONCE(w->timer_owner) != ffthd_curid())
+		fflk_unlock(&w->timer_lk);
+}
+
 static int core_timer(fftimerqueue_node *t, int64 _interval, uint flags)
 {
 	struct worker *w = (void*)fmed->workers.ptr;
 	int interval = _interval;
 	uint period = ffmin((uint)ffabs(interval), TMR_INT);
+	int r = 0;
 	dbglog0("timer:%p  interval:%d  handler:%p  param:%p"
 		, t, interval, t->func, t->param);
 
@@ -199,9 +323,11 @@ static int core_timer(fftimerqueue_node *t, int64 _interval, uint flags)
 		return -1;
 	}
 
+	timer_lock(w);
+
 	if (interval == 0) {
 		fftimerqueue_remove(&w->timerq, t);
-		return 0;
+		goto end;
 	}
 
 	if (period < w->timer_period) {
@@ -215,7 +341,8 @@ static int core_timer(fftimerqueue_node *t, int64 _interval, uint flags)
 		w->timer_kev.udata = w;
 		if (0 != fftimer_start(w->timer, w->kq, &w->timer_kev, period)) {
 			syserrlog("%s", "fftimer_start()");
-			return -1;
+			r = -1;
+			goto end;
 		}
 		w->timer_period = period;
 		dbglog0("started kernel timer  interval:%u", period);
@@ -224,7 +351,10 @@ static int core_timer(fftimerqueue_node *t, int64 _interval, uint flags)
 	fftime now = fftime_monotonic();
 	ffuint now_msec = now.sec*1000 + now.nsec/1000000;
 	fftimerqueue_add(&w->timerq, t, now_msec, interval, t->func, t->param);
-	return 0;
+
+end:
+	timer_unlock(w);
+	return r;
 }
 
 static void on_timer(void *param)
@@ -232,7 +362,11 @@ static void on_timer(void *param)
 	struct worker *w = param;
 	fftime now = fftime_monotonic();
 	ffuint now_msec = now.sec*1000 + now.nsec/1000000;
+	fflk_lock(&w->timer_lk);
+	FF_WRITEONCE(w->timer_owner, ffthd_curid());
 	fftimerqueue_process(&w->timerq, now_msec);
+	FF_WRITEONCE(w->timer_owner, 0);
+	fflk_unlock(&w->timer_lk);
 	fftimer_consume(w->timer);
 }
 
@@ -241,15 +375,25 @@ static int FFTHDCALL work_loop(void *param)
 {
 	struct worker *w = param;
 	w->id = ffthd_curid();
+	wrk_bind(w);
+	if (w->rt)
+		wrk_prio_rt();
 	ffkq_event *ents = ffmem_callocT(FMED_KQ_EVS, ffkq_event);
 	if (ents == NULL)
 		return -1;
 
 	dbglog0("entering kqueue loop", 0);
 
+	ffkqu_time tm_nowait;
+	ffkqu_settm(&tm_nowait, 0);
+	uint more = 0;
+
 	while (!FF_READONCE(fmed->stopped)) {
 
-		uint nevents = ffkqu_wait(w->kq, ents, FMED_KQ_EVS, &fmed->kqutime);
+		// If some tasks are left from the previous iteration (a job has yielded),
+		//  just check for the pending kernel events without waiting
+		//  (no need to signal the kernel queue and then consume the signal)
+		uint nevents = ffkqu_wait(w->kq, ents, FMED_KQ_EVS, (more) ? &tm_nowait : &fmed->kqutime);
 
 		if ((int)nevents < 0) {
 			if (fferr_last() != EINTR) {
@@ -262,9 +406,14 @@ static int FFTHDCALL work_loop(void *param)
 		for (uint i = 0;  i != nevents;  i++) {
 			ffkq_event *ev = &ents[i];
 			ffkev_call(ev);
-
-			fftask_run(&w->taskmgr);
 		}
+
+		// Run only the tasks queued before this moment:
+		//  a task that posts itself again (a job that yields) runs after the next kernel events
+		uint n = FF_READONCE(w->taskmgr.tasks.len);
+		w->taskmgr.max_run = ffmin(n, WRK_MAX_TASKS);
+		fftask_run(&w->taskmgr);
+		more = (FF_READONCE(w->taskmgr.tasks.len) != 0);
 	}
 
 	ffmem_free(ents);
@@ -5,6 +5,7 @@ Copyright (c) 2015 Simon Zolin */
 #include <core/format-detector.h>
 #include <util/path.h>
 #include <util/taskqueue.h>
+#include <util/thpool.h>
 #ifdef FF_WIN
 #include <util/wohandler.h>
 #endif
@@ -16,12 +17,15 @@ Copyright (c) 2015 Simon Zolin */
 
 typedef struct fmedia {
 	ffvec workers; //worker[]
+	uint rt_wid; // the dedicated worker for real-time jobs;  0: disabled
 	ffkqu_time kqutime;
 
 	uint stopped;
 
 	ffvec bmods; //core_modinfo[]
 	fflist mods; //core_mod[]
+	ffmap mods_index; // module name -> core_mod*
+	fflock mods_lock; // protects 'mods' and 'mods_index': a module may be added (core.insmod()) while the workers look up the filters
 
 	ffenv env;
 	ffstr root;
@@ -50,9 +54,13 @@ struct worker {
 	fftimerqueue timerq;
 	uint timer_period;
 	ffkevent timer_kev;
+	fflock timer_lk; // core_timer() may be called from any thread, e.g. the real-time worker
+	ffthd_id timer_owner; // the thread that processes the timer queue now (holds 'timer_lk')
 
 	ffatomic njobs;
+	int cpu; // CPU to which the thread is bound;  -1: not bound
 	uint init :1;
+	uint rt :1; // real-time worker
 };
 
 typedef struct core_modinfo {
@@ -82,6 +90,7 @@ extern void tracks_destroy(void);
 
 static const fmed_mod* fmed_getmod_core(const fmed_core *_core);
 extern const fmed_mod* fmed_getmod_file(const fmed_core *_core);
+extern ffthpool* thpool_create();
 extern const fmed_mod* fmed_getmod_queue(const fmed_core *_core);
 extern const fmed_mod* fmed_getmod_globcmd(const fmed_core *_core);
 #ifdef FF_WIN
@@ -159,6 +168,8 @@ fmed_core* core_init(char **argv, char **env)
 	fftime_local(&fmed->tz);
 
 	fflist_init(&fmed->mods);
+	mods_index_init(&fmed->mods_index);
+	fflk_init(&fmed->mods_lock);
 	core_insmodz("#core.core", NULL);
 	core_insmodz("#core.track", NULL);
 	core_insmodz("#core.format-detector", NULL);
@@ -207,6 +218,7 @@ void core_free(void)
 	FFLIST_WALKSAFE(&fmed->mods, mod, sib, next) {
 		mod_freeiface(mod);
 	}
+	ffmap_free(&fmed->mods_index);
 
 	core_modinfo *minfo;
 	FFSLICE_WALK(&fmed->bmods, minfo) {
@@ -229,17 +241,25 @@ void core_free(void)
 static int core_open(void)
 {
 	uint n = fmed->conf.workers;
-	if (n == 0) {
-		ffsysconf sc;
-		ffsc_init(&sc);
-		n = ffsc_get(&sc, FFSYSCONF_NPROCESSORS_ONLN);
-	}
-	if (NULL == ffvec_zallocT(&fmed->workers, n, struct worker))
+	if (n == 0)
+		n = wrk_auto_count();
+	uint nrt = (fmed->conf.rt_worker) ? 1 : 0;
+	if (NULL == ffvec_zallocT(&fmed->workers, n + nrt, struct worker))
 		return 1;
-	fmed->workers.len = n;
+	fmed->workers.len = n + nrt;
 	struct worker *w = (void*)fmed->workers.ptr;
+	for (uint i = 0;  i != n + nrt;  i++) {
+		w[i].cpu = ffcpuset_nth(&fmed->conf.cpu_affinity, i);
+	}
+	fmed->props.cpu_affinity = (w[0].cpu >= 0);
+	fmed->props.workers = n;
+	if (nrt != 0) {
+		fmed->rt_wid = n;
+		w[n].rt = 1;
+	}
 	if (0 != wrk_init(w, 0))
 		return 1;
+	wrk_bind(w);
 	core->kq = w->kq;
 
 	fmed->qu = core->getmod("#queue.queue");
@@ -437,6 +457,10 @@ static ssize_t core_cmd(uint signo, ...)
 			r = (ffssize)file_ext[r-1];
 		break;
 	}
+
+	case FMED_THPOOL:
+		r = (ffssize)thpool_create();
+		break;
 	}
 
 	va_end(va);
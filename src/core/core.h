@@ -2,14 +2,29 @@
 Copyright (c) 2015 Simon Zolin */
 
 #include <fmedia.h>
+#include <FFOS/time.h>
 
 
 extern fmed_core *core;
 extern const fmed_track _fmed_track;
 
 
-extern void core_job_enter(uint id, size_t *ctx);
+struct core_job {
+	size_t ntasks;
+	uint64 deadline; // monotonic time (usec) when the job must yield;  0: not limited
+};
 
-extern ffbool core_job_shouldyield(uint id, size_t *ctx);
+/**
+flags: enum FMED_WORKER_F */
+extern void core_job_enter(uint id, uint flags, struct core_job *j);
+
+extern ffbool core_job_shouldyield(uint id, struct core_job *j);
+
+/** Monotonic time (usec) */
+static inline uint64 core_mono_usec(void)
+{
+	fftime t = fftime_monotonic();
+	return fftime_mcs(&t);
+}
 
 extern ffbool core_ismainthr(void);
@@ -7,6 +7,9 @@ Copyright (c) 2019 Simon Zolin */
 #include <util/svar.h>
 #include <FFOS/file.h>
 #include <FFOS/dir.h>
+#include <FFOS/thread.h>
+#include <FFOS/timer.h>
+#include <FFOS/semaphore.h>
 
 
 extern const fmed_core *core;
@@ -19,6 +22,7 @@ extern const fmed_core *core;
 #define syserrlog(trk, ...)  fmed_syserrlog(core, trk, "file", __VA_ARGS__)
 
 extern ffthpool* thpool_create();
+extern ffiosched* iosched_get();
 
 
 //OUTPUT
@@ -38,6 +42,12 @@ struct file_out_conf_t {
 	uint file_del :1;
 	uint prealloc_grow :1;
 	byte use_thread_pool;
+	byte direct_io;
+	size_t direct_io_bsize;
+	size_t direct_io_min_size;
+	size_t write_behind;
+	size_t parallel_bsize;
+	byte async_close;
 };
 static struct file_out_conf_t out_conf;
 
@@ -45,9 +55,42 @@ static const fmed_conf_arg file_out_conf_args[] = {
 	{ "use_thread_pool",	FMC_BOOL8,  FMC_O(struct file_out_conf_t, use_thread_pool) },
 	{ "buffer_size",  FMC_SIZENZ,  FMC_O(struct file_out_conf_t, bsize) }
 	, { "preallocate",  FMC_SIZENZ,  FMC_O(struct file_out_conf_t, prealloc) },
+	{ "direct_io",	FMC_BOOL8,  FMC_O(struct file_out_conf_t, direct_io) },
+	{ "direct_io_buffer_size",	FMC_SIZENZ,  FMC_O(struct file_out_conf_t, direct_io_bsize) },
+	{ "direct_io_min_size",	FMC_SIZE,  FMC_O(struct file_out_conf_t, direct_io_min_size) },
+	{ "write_behind",	FMC_SIZE,  FMC_O(struct file_out_conf_t, write_behind) },
+	{ "parallel_buffer_size",	FMC_SIZE,  FMC_O(struct file_out_conf_t, parallel_bsize) },
+	{ "async_close",	FMC_BOOL8,  FMC_O(struct file_out_conf_t, async_close) },
 	{}
 };
 
+/*
+Finalizing an output file (writing the last data and the rewritten header, flushing,
+ truncating the preallocated space, closing the descriptor, setting modification time, deleting)
+ may block for a long time on a slow or network storage.
+This happens on the track's worker, which may also be capturing audio (--split, --out-copy).
+With async_close the last data block is kept by the file object (the writer switches to synchronous I/O),
+ the file object is passed to the thread pool to be finalized there,
+ and the track's filter chain continues immediately.
+A track that opens a file being finalized waits until it's complete (see fileout_wait()).
+FMED_STOP waits until all finalizations are complete.
+*/
+struct fo_finisher {
+	fflock lk;
+	uint npending; // N of files being finalized in thread pool
+	ffvec pending; // fmed_fileout*[]: files being finalized in thread pool
+	ffsem sem; // signalled for each waiter when a file is finalized
+	uint nwaiters;
+	uint stopped :1; // finalize synchronously from now on
+
+	// statistics:
+	uint nfiles;
+	uint nasync;
+	uint64 total_usec;
+	uint64 max_usec;
+};
+static struct fo_finisher fofin;
+
 
 typedef struct fmed_fileout {
 	fffilewrite *fw;
@@ -56,10 +99,16 @@ typedef struct fmed_fileout {
 	ffstr fname;
 	uint64 wr;
 	fftime modtime;
+	uint64 t_close; // usec
+	ffstr tail; // the last data to be written by fo_finish()
+	int64 tail_off; // file offset of 'tail';  -1: current
 	uint ok :1;
+	uint del :1; // delete the file after it's closed
+	uint fin_async :1; // the last data is written in thread pool
 } fmed_fileout;
 
 static char* fileout_getname(fmed_fileout *f, fmed_filt *d);
+void fileout_wait(const char *fn);
 
 int fileout_config(fmed_conf_ctx *ctx)
 {
@@ -67,6 +116,11 @@ int fileout_config(fmed_conf_ctx *ctx)
 	out_conf.prealloc = 1 * 1024 * 1024;
 	out_conf.prealloc_grow = 1;
 	out_conf.file_del = 1;
+	out_conf.direct_io_bsize = 4 * 1024 * 1024;
+	out_conf.direct_io_min_size = 64 * 1024 * 1024;
+	out_conf.async_close = 1;
+	fflk_init(&fofin.lk);
+	fofin.sem = ffsem_open(NULL, 0, 0);
 	fmed_conf_addctx(ctx, &out_conf, file_out_conf_args);
 	return 0;
 }
@@ -313,7 +367,25 @@ static void* fileout_open(fmed_filt *d)
 	conf.prealloc = ((int64)d->output.size != FMED_NULL) ? d->output.size : out_conf.prealloc;
 	conf.prealloc_grow = out_conf.prealloc_grow;
 	conf.del_on_err = out_conf.file_del;
+	conf.writebehind = out_conf.write_behind;
+
+	/* Large output: write directly from the aligned buffers bypassing page cache.
+	The size estimated by the encoder/muxer is used as the size of reserved disk space. */
+	if (out_conf.direct_io
+		&& (int64)d->output.size != FMED_NULL
+		&& d->output.size >= out_conf.direct_io_min_size) {
+		conf.directio = 1;
+		conf.bufsize = ff_align_ceil(out_conf.direct_io_bsize, conf.align);
+		dbglog(d->trk, "direct I/O: buffer:%L  reserve:%U", (size_t)conf.bufsize, d->output.size);
+	}
+
+	// parallel conversion: schedule writes per device, write larger blocks
+	if (conf.thpool != NULL && core->props->parallel
+		&& NULL != (conf.iosched = iosched_get())
+		&& !conf.directio && out_conf.parallel_bsize != 0)
+		conf.bufsize = ff_align_ceil(out_conf.parallel_bsize, conf.align);
 	conf.overwrite = d->out_overwrite;
+	fileout_wait(filename);
 	if (NULL == (f->fw = fffilewrite_create(filename, &conf)))
 		goto done;
 
@@ -327,17 +399,45 @@ done:
 	return NULL;
 }
 
-static void fileout_close(void *ctx)
+static uint64 fo_usec(void)
 {
-	fmed_fileout *f = ctx;
+	fftime t = fftime_monotonic();
+	return fftime_mcs(&t);
+}
 
+/** Write the last data kept by fileout_write().
+Return 0 on success */
+static int fo_write_tail(fmed_fileout *f)
+{
+	int64 off = f->tail_off;
+	for (;;) {
+		ssize_t r = fffilewrite_write(f->fw, f->tail, off, FFFILEWRITE_FFLUSH);
+		if (r < 0)
+			return -1; // the writer is synchronous: no FFFILEWRITE_RASYNC
+		if (r == 0)
+			return 0;
+		ffstr_shift(&f->tail, r);
+		f->wr += r;
+		off = -1;
+	}
+}
+
+/** Write the last data, close file, set its properties.
+Thread: worker or thread pool */
+static void fo_finish(fmed_fileout *f)
+{
 	if (f->fw != NULL) {
+		if (f->fin_async
+			&& 0 != fo_write_tail(f))
+			f->ok = 0;
+
 		fffilewrite_stat st;
 		fffilewrite_getstat(f->fw, &st);
 		fffilewrite_free(f->fw);
+		f->fw = NULL;
 
 		if (f->ok) {
-			if (f->d->out_file_del) {
+			if (f->del) {
 				if (0 == fffile_rm(f->fname.ptr))
 					dbglog(NULL, "removed file %S", &f->fname);
 			} else {
@@ -348,19 +448,216 @@ static void fileout_close(void *ctx)
 					, &f->fname, f->wr / 1024);
 			}
 
-			dbglog(NULL, "%S: mem write#:%u  file write#:%u  prealloc#:%u"
-				, &f->fname, st.nmwrite, st.nfwrite, st.nprealloc);
+			uint64 t = fo_usec() - f->t_close;
+			dbglog(NULL, "%S: mem write#:%u  file write#:%u  prealloc#:%u  direct write#:%u  close:%Uus"
+				, &f->fname, st.nmwrite, st.nfwrite, st.nprealloc, st.ndirect, t);
+
+			fflk_lock(&fofin.lk);
+			fofin.nfiles++;
+			fofin.total_usec += t;
+			fofin.max_usec = ffmax(fofin.max_usec, t);
+			fflk_unlock(&fofin.lk);
 		}
 	}
+}
 
+static void fo_free(fmed_fileout *f)
+{
+	ffstr_free(&f->tail);
 	ffstr_free(&f->fname);
 	ffmem_free(f);
 }
 
+/** Thread: thread pool */
+static void fo_finish_task(ffthpool_task *t)
+{
+	fmed_fileout *f = t->udata;
+	fo_finish(f);
+
+	fflk_lock(&fofin.lk);
+	fmed_fileout **pf;
+	FFSLICE_WALK(&fofin.pending, pf) {
+		if (*pf == f) {
+			ffslice_rmT((ffslice*)&fofin.pending, pf - (fmed_fileout**)fofin.pending.ptr, 1, fmed_fileout*);
+			break;
+		}
+	}
+	fofin.npending--;
+	uint n = fofin.nwaiters;
+	fofin.nwaiters = 0;
+	fflk_unlock(&fofin.lk);
+
+	for (uint i = 0;  i != n;  i++) {
+		ffsem_post(fofin.sem);
+	}
+	fo_free(f);
+}
+
+/** Return TRUE if the file may be finalized in thread pool */
+static int fo_async_allowed(void)
+{
+	/* Benchmark results include the complete time to close the file
+	 and need the final size of the output file */
+	return out_conf.async_close && out_conf.use_thread_pool
+		&& core->props->bench_file == NULL
+		&& fofin.sem != FFSEM_INV;
+}
+
+/** Pass the file to thread pool.
+Return 0 on success */
+static int fo_finish_async(fmed_fileout *f)
+{
+	ffthpool *thpool;
+	ffthpool_task *t;
+	if (NULL == (thpool = thpool_create())
+		|| NULL == (t = ffthpool_task_new(0)))
+		return -1;
+	t->handler = &fo_finish_task;
+	t->udata = f;
+
+	int r = -1;
+	fmed_fileout **pf;
+	fflk_lock(&fofin.lk);
+	if (!fofin.stopped
+		&& NULL != (pf = ffvec_pushT(&fofin.pending, fmed_fileout*))) {
+		*pf = f;
+		fofin.npending++;
+		fofin.nasync++;
+		r = 0;
+	}
+	fflk_unlock(&fofin.lk);
+
+	if (r == 0 && 0 != ffthpool_add(thpool, t)) {
+		// the queue is full
+		fflk_lock(&fofin.lk);
+		fofin.pending.len--;
+		fofin.npending--;
+		fofin.nasync--;
+		fflk_unlock(&fofin.lk);
+		r = -1;
+	}
+	ffthpool_task_free(t);
+	return r;
+}
+
+/** Wait until the file is finalized in thread pool.
+fn: NULL: wait for all files
+Thread: any except thread pool */
+static void fo_wait(const char *fn)
+{
+	for (;;) {
+		ffbool busy = 0;
+		fflk_lock(&fofin.lk);
+		if (fn == NULL) {
+			busy = (fofin.npending != 0);
+		} else {
+			fmed_fileout **pf;
+			FFSLICE_WALK(&fofin.pending, pf) {
+				if (ffsz_eq((*pf)->fname.ptr, fn)) {
+					busy = 1;
+					break;
+				}
+			}
+		}
+		if (busy)
+			fofin.nwaiters++;
+		fflk_unlock(&fofin.lk);
+
+		if (!busy)
+			break;
+		ffsem_wait(fofin.sem, -1);
+	}
+}
+
+/** Wait until the file written by a previous track is finalized.
+Thread: worker */
+void fileout_wait(const char *fn)
+{
+	if (FF_READONCE(fofin.npending) == 0)
+		return;
+	dbglog(NULL, "%s: waiting until the file is closed", fn);
+	fo_wait(fn);
+}
+
+/** Wait until all files are finalized; finalize synchronously from now on.
+Thread: main */
+void fileout_finish_wait(void)
+{
+	fflk_lock(&fofin.lk);
+	fofin.stopped = 1;
+	uint n = fofin.npending;
+	fflk_unlock(&fofin.lk);
+	if (n != 0)
+		dbglog(NULL, "waiting for %u files to be closed", n);
+
+	fo_wait(NULL);
+
+	if (fofin.nfiles != 0)
+		dbglog(NULL, "output files closed: %u (in background: %u)  close time avg:%Uus  max:%Uus"
+			, fofin.nfiles, fofin.nasync, fofin.total_usec / fofin.nfiles, fofin.max_usec);
+}
+
+static void fileout_close(void *ctx)
+{
+	fmed_fileout *f = ctx;
+	fmed_trk *d = f->d;
+	f->t_close = fo_usec();
+	if (d != NULL)
+		f->del = d->out_file_del;
+	// the track is being closed: the writer must not refer to it from now on
+	f->d = NULL;
+	f->trk = NULL;
+
+	if (f->fw != NULL
+		&& fo_async_allowed()
+		&& 0 == fo_finish_async(f))
+		return;
+
+	uint64 t = f->t_close;
+	ffbool report = (d != NULL && f->ok);
+	fo_finish(f);
+	fo_free(f);
+	if (report)
+		d->track->setval(d->trk, "out_close_usec", fo_usec() - t);
+}
+
+/** Keep the last data (e.g. the rewritten header) to be written with the final flush in thread pool.
+Return enum FMED_R */
+static int fo_write_last(fmed_fileout *f, fmed_filt *d)
+{
+	switch (fffilewrite_setsync(f->fw)) {
+	case 0:
+		break;
+	case FFFILEWRITE_RASYNC:
+		return FMED_RASYNC; // wait until the previous data is written
+	default:
+		return FMED_RERR;
+	}
+
+	f->tail_off = -1;
+	if ((int64)d->output.seek != FMED_NULL) {
+		f->tail_off = d->output.seek;
+		d->output.seek = FMED_NULL;
+	}
+	if (d->datalen != 0
+		&& NULL == ffstr_dup(&f->tail, d->data, d->datalen)) {
+		syserrlog(d->trk, "%s", ffmem_alloc_S);
+		return FMED_RERR;
+	}
+	d->datalen = 0;
+	f->fin_async = 1;
+	f->ok = 1;
+	d->outlen = 0;
+	return FMED_RDONE;
+}
+
 static int fileout_write(void *ctx, fmed_filt *d)
 {
 	fmed_fileout *f = ctx;
 
+	if ((d->flags & FMED_FLAST) && fo_async_allowed())
+		return fo_write_last(f, d);
+
 	int64 seek = -1;
 	if ((int64)d->output.seek != FMED_NULL) {
 		seek = d->output.seek;
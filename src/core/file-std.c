@@ -2,6 +2,15 @@
 Copyright (c) 2019 Simon Zolin */
 
 #include <fmedia.h>
+#ifdef FF_UNIX
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
+#ifdef FF_LINUX
+#include <sys/epoll.h>
+#elif defined FF_UNIX
+#include <sys/event.h>
+#endif
 
 
 extern const fmed_core *core;
@@ -31,24 +40,174 @@ const fmed_filter file_stdout = {
 };
 
 
+/*
+When stdin/stdout is a pipe or a socket, it's switched to non-blocking mode
+ and is attached to the track's kernel queue:
+ if the peer process is slow, the track is suspended (FMED_RASYNC) rather than the worker thread.
+The original file status flags are restored when the filter is closed,
+ because the file description is shared with the parent and the peer processes.
+*/
+
+/** Prepare a descriptor for asynchronous I/O.
+oflags: [output] the original file status flags
+Return 1 if the descriptor is now in non-blocking mode */
+static int std_nblock(fffd fd, size_t pipe_size, int *oflags, void *trk)
+{
+#ifdef FF_UNIX
+	struct stat st;
+	if (0 != fstat(fd, &st)
+		|| !(S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode)))
+		return 0;
+
+	int fl = fcntl(fd, F_GETFL);
+	if (fl < 0) {
+		syserrlog(trk, "fcntl(F_GETFL)");
+		return 0;
+	}
+	*oflags = fl;
+
+#if defined FF_LINUX && defined F_SETPIPE_SZ
+	if (pipe_size != 0 && S_ISFIFO(st.st_mode)) {
+		int r = fcntl(fd, F_SETPIPE_SZ, (int)pipe_size);
+		if (r < 0)
+			dbglog(trk, "fcntl(F_SETPIPE_SZ, %L): %E", pipe_size, fferr_last());
+		else
+			dbglog(trk, "pipe buffer: %u", r);
+	}
+#endif
+
+	if (!(fl & O_NONBLOCK)
+		&& 0 != ffpipe_nonblock(fd, 1)) {
+		syserrlog(trk, "%s", fffile_nblock_S);
+		return 0;
+	}
+	return 1;
+
+#else
+	return 0;
+#endif
+}
+
+/** Restore the file status flags saved by std_nblock() */
+static void std_restore(fffd fd, int flags)
+{
+#ifdef FF_UNIX
+	fcntl(fd, F_SETFL, flags);
+#endif
+}
+
+static int std_attach(fffd fd, ffkevent *kev, uint flags, void *udata, ffkev_handler handler, fmed_filt *d)
+{
+	ffkev_init(kev);
+	kev->oneshot = 0;
+	kev->fd = fd;
+	kev->handler = handler;
+	kev->udata = udata;
+	fffd kq = (fffd)d->track->cmd(d->trk, FMED_TRACK_KQ);
+	if (0 != ffkev_attach(kev, kq, flags)) {
+		syserrlog(d->trk, "%s", ffkqu_attach_S);
+		return -1;
+	}
+	return 0;
+}
+
+/** Remove the descriptor from kernel queue and restore its original file status flags.
+Note: the descriptor isn't closed, so it must be removed from kqueue explicitly. */
+static void std_detach(fffd fd, ffkevent *kev, fffd kq, int flags)
+{
+#ifdef FF_UNIX
+	if (kev->fd == FF_BADFD)
+		return;
+#ifdef FF_LINUX
+	epoll_ctl(kq, EPOLL_CTL_DEL, fd, NULL);
+#else
+	struct kevent evs[2];
+	EV_SET(&evs[0], fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+	EV_SET(&evs[1], fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+	kevent(kq, evs, 2, NULL, 0, NULL);
+#endif
+	ffkev_fin(kev);
+	std_restore(fd, flags);
+#endif
+}
+
+
+struct std_conf {
+	size_t bufsize;
+	size_t pipe_size; // Linux: pipe buffer size (F_SETPIPE_SZ)
+};
+static struct std_conf in_conf = { 64 * 1024, 1 * 1024 * 1024 };
+static struct std_conf out_conf = { 64 * 1024, 1 * 1024 * 1024 };
+
+static const fmed_conf_arg std_conf_args[] = {
+	{ "buffer_size",  FMC_SIZENZ,  FMC_O(struct std_conf, bufsize) },
+	{ "pipe_size",  FMC_SIZE,  FMC_O(struct std_conf, pipe_size) },
+	{}
+};
+
+int stdin_config(fmed_conf_ctx *ctx)
+{
+	fmed_conf_addctx(ctx, &in_conf, std_conf_args);
+	return 0;
+}
+
+int stdout_config(fmed_conf_ctx *ctx)
+{
+	fmed_conf_addctx(ctx, &out_conf, std_conf_args);
+	return 0;
+}
+
+
 typedef struct stdin_ctx {
 	fffd fd;
 	uint64 total;
+	uint64 seek;
 	ffarr buf;
+
+	void *trk;
+	fmed_handler handler;
+	fffd kq;
+	ffkevent kev;
+	int oflags; // original file status flags
+	uint nblock :1
+		, async :1
+		;
+	uint nasync;
 } stdin_ctx;
 
+static void stdin_onevent(void *udata)
+{
+	stdin_ctx *f = udata;
+	if (!f->async)
+		return;
+	f->async = 0;
+	f->handler(f->trk);
+}
+
 static void* file_stdin_open(fmed_filt *d)
 {
 	stdin_ctx *f = ffmem_tcalloc1(stdin_ctx);
 	if (f == NULL)
 		return NULL;
 	f->fd = ffstdin;
+	f->kev.fd = FF_BADFD;
+	f->trk = d->trk;
+	f->handler = d->handler;
 
-	if (NULL == ffarr_alloc(&f->buf, 64 * 1024)) {
+	if (NULL == ffarr_alloc(&f->buf, in_conf.bufsize)) {
 		syserrlog(d->trk, "%s", ffmem_alloc_S);
 		goto done;
 	}
 
+	if (std_nblock(f->fd, in_conf.pipe_size, &f->oflags, d->trk)) {
+		f->kq = (fffd)d->track->cmd(d->trk, FMED_TRACK_KQ);
+		if (0 != std_attach(f->fd, &f->kev, FFKQU_READ, f, &stdin_onevent, d)) {
+			std_restore(f->fd, f->oflags);
+			goto done;
+		}
+		f->nblock = 1;
+	}
+
 	return f;
 
 done:
@@ -59,6 +218,10 @@ done:
 static void file_stdin_close(void *ctx)
 {
 	stdin_ctx *f = ctx;
+	if (f->nblock) {
+		dbglog(f->trk, "async#:%u", f->nasync);
+		std_detach(f->fd, &f->kev, f->kq, f->oflags);
+	}
 	ffarr_free(&f->buf);
 	ffmem_free(f);
 }
@@ -67,26 +230,38 @@ static int file_stdin_read(void *ctx, fmed_filt *d)
 {
 	stdin_ctx *f = ctx;
 	ssize_t r;
-	uint64 seek = 0;
 	ffstr buf;
 
+	f->async = 0;
+
 	if ((int64)d->input.seek != FMED_NULL) {
 		uint64 off = f->total - f->buf.len;
 		if (d->input.seek < off) {
 			errlog(d->trk, "can't seek backward on stdin.  offset:%U", d->input.seek);
 			return FMED_RERR;
 		}
-		seek = d->input.seek;
+		f->seek = d->input.seek;
 		d->input.seek = FMED_NULL;
-		if (f->total > seek) {
+		if (f->total > f->seek) {
 			ffstr_set(&buf, f->buf.ptr, f->buf.len);
-			ffstr_shift(&buf, seek - off);
+			ffstr_shift(&buf, f->seek - off);
+			f->seek = 0;
 			goto data;
 		}
 	}
 
 	for (;;) {
-		r = ffstd_fread(f->fd, f->buf.ptr, f->buf.cap);
+		if (f->nblock) {
+			r = ffpipe_read(f->fd, f->buf.ptr, f->buf.cap);
+			if (r < 0 && fferr_again(fferr_last())) {
+				f->async = 1;
+				f->nasync++;
+				return FMED_RASYNC; // wait until the pipe is readable
+			}
+		} else {
+			r = ffstd_fread(f->fd, f->buf.ptr, f->buf.cap);
+		}
+
 		if (r == 0) {
 			d->outlen = 0;
 			return FMED_RDONE;
@@ -99,11 +274,12 @@ static int file_stdin_read(void *ctx, fmed_filt *d)
 		f->total += r;
 		f->buf.len = r;
 		ffstr_set(&buf, f->buf.ptr, f->buf.len);
-		if (seek == 0)
+		if (f->seek == 0)
 			break;
-		else if (f->total > seek) {
+		else if (f->total > f->seek) {
 			uint64 off = f->total - f->buf.len;
-			ffstr_shift(&buf, seek - off);
+			ffstr_shift(&buf, f->seek - off);
+			f->seek = 0;
 			break;
 		}
 	}
@@ -114,46 +290,61 @@ data:
 }
 
 
-struct stdout_conf {
-	size_t bufsize;
-};
-static struct stdout_conf out_conf;
-
-static const fmed_conf_arg stdout_conf_args[] = {
-	{ "buffer_size",  FMC_SIZENZ,  FMC_O(struct stdout_conf, bufsize) },
-	{}
-};
-
-int stdout_config(fmed_conf_ctx *ctx)
-{
-	out_conf.bufsize = 64 * 1024;
-	fmed_conf_addctx(ctx, &out_conf, stdout_conf_args);
-	return 0;
-}
-
 typedef struct stdout_ctx {
 	fffd fd;
 	ffarr buf;
 	uint64 fsize;
+	ffstr pending; // data to write: points to 'buf' or to the input data
+
+	void *trk;
+	fmed_handler handler;
+	fffd kq;
+	ffkevent kev;
+	int oflags; // original file status flags
+	uint nblock :1
+		, async :1
+		;
 
 	struct {
 		uint nmwrite;
 		uint nfwrite;
+		uint nasync;
 	} stat;
 } stdout_ctx;
 
+static void stdout_onevent(void *udata)
+{
+	stdout_ctx *f = udata;
+	if (!f->async)
+		return;
+	f->async = 0;
+	f->handler(f->trk);
+}
+
 static void* file_stdout_open(fmed_filt *d)
 {
 	stdout_ctx *f = ffmem_tcalloc1(stdout_ctx);
 	if (f == NULL)
 		return NULL;
 	f->fd = ffstdout;
+	f->kev.fd = FF_BADFD;
+	f->trk = d->trk;
+	f->handler = d->handler;
 
 	if (NULL == ffarr_alloc(&f->buf, out_conf.bufsize)) {
 		syserrlog(d->trk, "%s", ffmem_alloc_S);
 		goto done;
 	}
 
+	if (std_nblock(f->fd, out_conf.pipe_size, &f->oflags, d->trk)) {
+		f->kq = (fffd)d->track->cmd(d->trk, FMED_TRACK_KQ);
+		if (0 != std_attach(f->fd, &f->kev, FFKQU_WRITE, f, &stdout_onevent, d)) {
+			std_restore(f->fd, f->oflags);
+			goto done;
+		}
+		f->nblock = 1;
+	}
+
 	return f;
 
 done:
@@ -164,17 +355,34 @@ done:
 static void file_stdout_close(void *ctx)
 {
 	stdout_ctx *f = ctx;
+	dbglog(f->trk, "mem write#:%u  file write#:%u  async#:%u"
+		, f->stat.nmwrite, f->stat.nfwrite, f->stat.nasync);
+	if (f->nblock)
+		std_detach(f->fd, &f->kev, f->kq, f->oflags);
 	ffarr_free(&f->buf);
 	ffmem_free(f);
 }
 
-static int file_stdout_writedata(stdout_ctx *f, const char *data, size_t len, fmed_filt *d)
+/**
+Return the number of bytes written (may be less than 'len' in non-blocking mode);
+ -1 on error */
+static ssize_t file_stdout_writedata(stdout_ctx *f, const char *data, size_t len, fmed_filt *d)
 {
-	size_t r;
-	r = fffile_write(f->fd, data, len);
-	if (r != len) {
-		syserrlog(d->trk, "%s", fffile_write_S);
-		return -1;
+	ssize_t r;
+	if (f->nblock) {
+		r = ffpipe_write(f->fd, data, len);
+		if (r < 0) {
+			if (fferr_again(fferr_last()))
+				return 0;
+			syserrlog(d->trk, "%s", fffile_write_S);
+			return -1;
+		}
+	} else {
+		r = fffile_write(f->fd, data, len);
+		if ((size_t)r != len) {
+			syserrlog(d->trk, "%s", fffile_write_S);
+			return -1;
+		}
 	}
 	f->stat.nfwrite++;
 
@@ -189,6 +397,8 @@ static int file_stdout_write(void *ctx, fmed_filt *d)
 	ssize_t r;
 	ffstr dst;
 
+	f->async = 0;
+
 	if ((int64)d->output.seek != FMED_NULL) {
 
 		if (f->buf.len != 0) {
@@ -203,6 +413,20 @@ static int file_stdout_write(void *ctx, fmed_filt *d)
 
 	for (;;) {
 
+		if (f->pending.len != 0) {
+			if (-1 == (r = file_stdout_writedata(f, f->pending.ptr, f->pending.len, d)))
+				return FMED_RERR;
+			ffstr_shift(&f->pending, r);
+			if (f->pending.len != 0) {
+				f->async = 1;
+				f->stat.nasync++;
+				return FMED_RASYNC; // wait until the pipe is writable
+			}
+
+			if (d->datalen == 0)
+				break;
+		}
+
 		r = ffstr_gather((ffstr*)&f->buf, &f->buf.cap, d->data, d->datalen, f->buf.cap, &dst);
 		d->data += r;
 		d->datalen -= r;
@@ -213,12 +437,7 @@ static int file_stdout_write(void *ctx, fmed_filt *d)
 			ffstr_set(&dst, f->buf.ptr, f->buf.len);
 		}
 		f->buf.len = 0;
-
-		if (-1 == file_stdout_writedata(f, dst.ptr, dst.len, d))
-			return FMED_RERR;
-
-		if (d->datalen == 0)
-			break;
+		f->pending = dst;
 	}
 
 	if (d->flags & FMED_FLAST) {
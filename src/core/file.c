@@ -7,9 +7,11 @@ Copyright (c) 2015 Simon Zolin */
 
 
 #undef dbglog
+#undef infolog
 #undef errlog
 #undef syserrlog
 #define dbglog(trk, ...)  fmed_dbglog(core, trk, "file", __VA_ARGS__)
+#define infolog(trk, ...)  fmed_infolog(core, trk, "file", __VA_ARGS__)
 #define errlog(trk, ...)  fmed_errlog(core, trk, "file", __VA_ARGS__)
 #define syserrlog(trk, ...)  fmed_syserrlog(core, trk, "file", __VA_ARGS__)
 
@@ -18,14 +20,21 @@ struct file_in_conf_t {
 	uint nbufs;
 	size_t bsize;
 	size_t align;
+	size_t shared_cache;
 	byte directio;
 	byte use_thread_pool;
+	byte thpool_threads;
+	ffcpuset thpool_cpus;
+	byte io_depth;
+	size_t parallel_bsize;
 };
 
 typedef struct filemod {
 	struct file_in_conf_t in_conf;
 	fflock lk;
 	ffthpool *thpool;
+	fffileread_cache *cache; // blocks shared by all tracks
+	ffiosched *iosched; // file.in & file.out: thread pool requests from parallel tracks
 	const fmed_track *track;
 } filemod;
 
@@ -56,6 +65,7 @@ static const void* file_iface(const char *name);
 static int file_conf(const char *name, fmed_conf_ctx *ctx);
 static int file_sig(uint signo);
 static void file_destroy(void);
+static void iosched_printstat(void);
 static const fmed_mod fmed_file_mod = {
 	.ver = FMED_VER_FULL, .ver_core = FMED_VER_CORE,
 	&file_iface, &file_sig, &file_destroy, &file_conf
@@ -70,12 +80,25 @@ static const fmed_filter fmed_file_input = {
 	&file_open, &file_getdata, &file_close
 };
 
+static int conf_thpool_cpus(fmed_conf *fc, void *obj, ffstr *val)
+{
+	struct file_in_conf_t *c = obj;
+	if (0 != ffcpuset_parse(&c->thpool_cpus, *val))
+		return FMC_EBADVAL;
+	return 0;
+}
+
 static const fmed_conf_arg file_in_conf_args[] = {
 	{ "use_thread_pool",	FMC_BOOL8,  FMC_O(struct file_in_conf_t, use_thread_pool) },
+	{ "thread_pool_threads",	FMC_INT8,  FMC_O(struct file_in_conf_t, thpool_threads) },
+	{ "thread_pool_cpu_affinity",	FMC_STR,  FMC_F(conf_thpool_cpus) },
 	{ "buffer_size",  FMC_SIZENZ,  FMC_O(struct file_in_conf_t, bsize) }
 	, { "buffers",  FMC_INT8,  FMC_O(struct file_in_conf_t, nbufs) }
 	, { "align",  FMC_SIZENZ,  FMC_O(struct file_in_conf_t, align) }
 	, { "direct_io",  FMC_BOOL8,  FMC_O(struct file_in_conf_t, directio) },
+	{ "shared_cache",	FMC_SIZE,	FMC_O(struct file_in_conf_t, shared_cache) },
+	{ "io_sched_depth",	FMC_INT8,	FMC_O(struct file_in_conf_t, io_depth) },
+	{ "parallel_buffer_size",	FMC_SIZE,	FMC_O(struct file_in_conf_t, parallel_bsize) },
 	{}
 };
 
@@ -94,6 +117,9 @@ const fmed_mod* fmed_getmod_file(const fmed_core *_core)
 
 extern const fmed_filter fmed_file_output;
 extern int fileout_config(fmed_conf_ctx *ctx);
+extern void fileout_finish_wait(void);
+extern void fileout_wait(const char *fn);
+extern int stdin_config(fmed_conf_ctx *ctx);
 extern int stdout_config(fmed_conf_ctx *ctx);
 extern const fmed_filter file_stdin;
 extern const fmed_filter file_stdout;
@@ -117,6 +143,8 @@ static int file_conf(const char *name, fmed_conf_ctx *ctx)
 		return file_in_conf(ctx);
 	else if (!ffsz_cmp(name, "out"))
 		return fileout_config(ctx);
+	else if (ffsz_eq(name, "stdin"))
+		return stdin_config(ctx);
 	else if (ffsz_eq(name, "stdout"))
 		return stdout_config(ctx);
 	return -1;
@@ -127,9 +155,20 @@ static int file_sig(uint signo)
 	switch (signo) {
 	case FMED_OPEN:
 		mod->track = core->getmod("#core.track");
+		if (mod->in_conf.shared_cache != 0
+			&& NULL == (mod->cache = fffileread_cache_create(mod->in_conf.shared_cache)))
+			syserrlog(NULL, "fffileread_cache_create", 0);
 		break;
 
 	case FMED_STOP:
+		if (mod->cache != NULL) {
+			struct fffileread_cache_stat st;
+			fffileread_cache_stat(mod->cache, &st);
+			dbglog(NULL, "shared cache: hits:%U  misses:%U  evicted:%U  blocks:%u  size:%Uk"
+				, st.hits, st.misses, st.evicted, st.nblocks, st.size / 1024);
+		}
+		fileout_finish_wait();
+		iosched_printstat();
 		if (0 != ffthpool_free(mod->thpool))
 			syserrlog(NULL, "ffthpool_free", 0);
 		mod->thpool = NULL;
@@ -140,11 +179,14 @@ static int file_sig(uint signo)
 
 static void file_destroy(void)
 {
+	ffiosched_free(mod->iosched);
+	fffileread_cache_free(mod->cache);
 	ffaio_fctxclose();
 	ffmem_free0(mod);
 }
 
-/** Create thread pool. */
+/** Create thread pool.
+The number of threads is 'thread_pool_threads', or (if 0) the number of workers, but at least 2. */
 ffthpool* thpool_create()
 {
 	if (mod->thpool != NULL)
@@ -153,8 +195,13 @@ ffthpool* thpool_create()
 	fflk_lock(&mod->lk);
 	if (mod->thpool == NULL) {
 		ffthpoolconf ioconf = {};
-		ioconf.maxthreads = 2;
-		ioconf.maxqueue = 64;
+		ioconf.maxthreads = mod->in_conf.thpool_threads;
+		if (ioconf.maxthreads == 0)
+			ioconf.maxthreads = ffmax(core->props->workers, 2);
+		ioconf.maxqueue = ffmax(64, ioconf.maxthreads * 16);
+		ioconf.cpus = mod->in_conf.thpool_cpus;
+		dbglog(NULL, "creating thread pool: threads:%u  CPUs:%u"
+			, ioconf.maxthreads, ffcpuset_count(&ioconf.cpus));
 		if (NULL == (mod->thpool = ffthpool_create(&ioconf)))
 			syserrlog(NULL, "ffthpool_create", 0);
 	}
@@ -162,6 +209,46 @@ ffthpool* thpool_create()
 	return mod->thpool;
 }
 
+/** Get I/O scheduler for parallel tracks.
+Return NULL if disabled */
+ffiosched* iosched_get()
+{
+	if (mod->iosched != NULL || mod->in_conf.io_depth == 0)
+		return mod->iosched;
+
+	ffthpool *thpool;
+	if (NULL == (thpool = thpool_create()))
+		return NULL;
+
+	fflk_lock(&mod->lk);
+	if (mod->iosched == NULL) {
+		ffiosched_conf conf = {};
+		conf.thpool = thpool;
+		conf.depth = mod->in_conf.io_depth;
+		if (NULL == (mod->iosched = ffiosched_create(&conf)))
+			syserrlog(NULL, "ffiosched_create", 0);
+	}
+	fflk_unlock(&mod->lk);
+	return mod->iosched;
+}
+
+/** Print throughput of each device. */
+static void iosched_printstat(void)
+{
+	if (mod->iosched == NULL)
+		return;
+	struct ffiosched_devstat st[8];
+	uint n = ffiosched_stat(mod->iosched, st, FF_COUNT(st));
+	for (uint i = 0;  i != n;  i++) {
+		const struct ffiosched_devstat *s = &st[i];
+		infolog(NULL, "I/O device %xU: requests:%U  %UKB  busy:%Ums  %UKB/s  avg wait:%Uus  max queue:%u"
+			, s->dev, s->nreq, s->bytes / 1024, s->busy_usec / 1000
+			, (s->busy_usec != 0) ? s->bytes * 1000000 / 1024 / s->busy_usec : 0
+			, (s->nreq != 0) ? s->wait_usec / s->nreq : 0
+			, s->max_queue);
+	}
+}
+
 
 static int file_in_conf(fmed_conf_ctx *ctx)
 {
@@ -216,6 +303,14 @@ static void* file_open(fmed_filt *d)
 	conf.bufsize = mod->in_conf.bsize;
 	conf.nbufs = mod->in_conf.nbufs;
 	conf.bufalign = mod->in_conf.align;
+	conf.cache = mod->cache;
+	conf.prefault = core->props->cpu_affinity;
+	// parallel conversion: schedule reads per device, read larger blocks
+	if (conf.thpool != NULL && core->props->parallel
+		&& NULL != (conf.iosched = iosched_get())
+		&& mod->in_conf.parallel_bsize != 0)
+		conf.bufsize = ff_align_ceil(mod->in_conf.parallel_bsize, conf.bufalign);
+	fileout_wait(f->fn); // the file may be being finalized after a previous track has written it
 	f->fr = fffileread_create(f->fn, &conf);
 	if (f->fr == NULL) {
 		d->e_no_source = fferr_notexist(fferr_last());
@@ -232,8 +327,16 @@ static void* file_open(fmed_filt *d)
 
 	d->input.size = f->fsize;
 
+	fftime mt = fffile_infomtime(&fi);
+	d->track->setval(d->trk, "input_mtime", fftime_sec(&mt));
+#ifdef FF_WIN
+	d->track->setval(d->trk, "input_dev", fi.dwVolumeSerialNumber);
+#else
+	d->track->setval(d->trk, "input_dev", fi.st_dev);
+#endif
+	d->track->setval(d->trk, "input_ino", fffile_infoid(&fi));
 	if (d->out_preserve_date) {
-		d->mtime = fffile_infomtime(&fi);
+		d->mtime = mt;
 	}
 
 	f->handler = d->handler;
@@ -251,8 +354,8 @@ static void file_close(void *ctx)
 	if (f->fr != NULL) {
 		struct fffileread_stat stat;
 		fffileread_stat(f->fr, &stat);
-		dbglog(f->trk, "cache-hit#:%u  read#:%u  async#:%u  seek#:%u"
-			, stat.ncached, stat.nread, stat.nasync, f->nseek);
+		dbglog(f->trk, "cache-hit#:%u  shared-cache-hit#:%u  read#:%u  async#:%u  seek#:%u"
+			, stat.ncached, stat.nshared, stat.nread, stat.nasync, f->nseek);
 		fffileread_free(f->fr);
 	}
 
@@ -19,6 +19,8 @@ struct entry {
 		, trk_stopped :1
 		, trk_err :1
 		, trk_mixed :1
+		, prefetched :1 // the file has been prefetched;  reset when a track starts
+		, next_started :1 // the next item has been started before this one has finished
 		;
 
 	char url[0];
@@ -0,0 +1,208 @@
+/** fmedia: prefetch the next items in queue
+2022, Simon Zolin */
+
+/*
+The next track normally starts only after the current one is finished,
+ and the first read of its file may block on a spun-down disk or a network storage.
+When an active track is about to end (conf.prefetch_before msec before its end),
+ the beginning of the next conf.prefetch_next items is read into the system's page cache
+ in the thread pool.
+The input module for their file extension is resolved (and loaded) at the same time.
+The positions of the tracks are checked by a timer on the main thread.
+The same timer starts the next item conf.gapless_preopen msec before the end of a gapless playback track.
+*/
+
+extern ffthpool* thpool_create();
+
+enum {
+	PREFETCH_TIMER_INTERVAL = 1000, // msec
+};
+
+struct prefetch_task {
+	uint64 size;
+	char fn[0];
+};
+
+/** Read the beginning of file into page cache.
+Thread: thread pool */
+static void prefetch_read(ffthpool_task *t)
+{
+	struct prefetch_task *pt = (void*)t->ext;
+	fffd f;
+	if (FF_BADFD == (f = fffile_open(pt->fn, FFO_RDONLY | FFO_NOATIME | FFO_NODOSNAME)))
+		return;
+
+#if defined FF_LINUX && defined POSIX_FADV_WILLNEED
+	posix_fadvise(f, 0, pt->size, POSIX_FADV_WILLNEED);
+
+#else
+	size_t cap = 64 * 1024;
+	void *buf;
+	if (NULL != (buf = ffmem_alloc(cap))) {
+		for (uint64 off = 0;  off < pt->size;  ) {
+			ssize_t r = fffile_read(f, buf, ffmin(cap, pt->size - off));
+			if (r <= 0)
+				break;
+			off += r;
+		}
+		ffmem_free(buf);
+	}
+#endif
+
+	fffile_close(f);
+}
+
+/** Prefetch the file of the queue item.
+Thread: main */
+static void prefetch_entry(entry *e)
+{
+	const char *fn = e->e.url.ptr;
+	e->prefetched = 1;
+	if (ffsz_matchz(fn, "http://")
+		|| fn[0] == '@') // @stdin, @gen
+		return;
+
+	ffstr name, ext;
+	ffpath_split2(fn, ffsz_len(fn), NULL, &name);
+	ffpath_splitname(name.ptr, name.len, &name, &ext);
+	core->getmod2(FMED_MOD_INEXT | FMED_MOD_NOLOG, ext.ptr, ext.len);
+
+	ffthpool *thpool;
+	ffthpool_task *t;
+	if (NULL == (thpool = thpool_create())
+		|| NULL == (t = ffthpool_task_new(sizeof(struct prefetch_task) + e->e.url.len + 1)))
+		return;
+	struct prefetch_task *pt = (void*)t->ext;
+	pt->size = qu->conf.prefetch_size;
+	ffsz_fcopy(pt->fn, e->e.url.ptr, e->e.url.len);
+	t->handler = &prefetch_read;
+	dbglog0("prefetching %S", &e->e.url);
+	if (0 != ffthpool_add(thpool, t))
+		syserrlog("ffthpool_add", 0);
+	ffthpool_task_free(t);
+}
+
+/** Prefetch the items that will be started after this one. */
+static void prefetch_next(entry *e)
+{
+	if ((e->plist->allow_random && qu->random)
+		|| qu->repeat == FMED_QUE_REPEAT_TRACK)
+		return;
+
+	if (e->plist->parallel && e->plist->xcursor != NULL)
+		e = e->plist->xcursor; // the items up to here are already started
+
+	entry *n = e;
+	for (uint i = 0;  i != qu->conf.prefetch_next;  i++) {
+		n = pl_next(n);
+		if (n == NULL && qu->repeat == FMED_QUE_REPEAT_ALL)
+			n = pl_first(e->plist);
+		if (n == NULL || n == e)
+			break;
+		if (!n->rm && !n->prefetched)
+			prefetch_entry(n);
+	}
+}
+
+/** Check the position of active tracks.
+The entries are collected under the lock, but prefetched after it's released:
+ prefetching may load a module and add a task to the thread pool,
+ while the workers wait for the same lock in que_trk_open/close().
+An entry stays valid until que_ontrkfin() which runs on this thread too.
+Thread: main */
+static void prefetch_ontimer(void *param)
+{
+	que_trk *t;
+	ffvec ents = {}, opens = {}; // entry*[]
+	entry **pe;
+	fflk_lock(&qu->prefetch_lock);
+	_FFLIST_WALK(&qu->prefetch_trks, t, prefetch_sib) {
+		const fmed_filt *d = t->d;
+		if ((t->prefetched && (t->preopened || !t->gapless))
+			|| (int64)d->audio.total == FMED_NULL
+			|| (int64)d->audio.pos == FMED_NULL
+			|| d->audio.fmt.sample_rate == 0)
+			continue;
+
+		uint64 left = d->audio.total - ffmin(d->audio.pos, d->audio.total);
+		uint64 left_msec = ffpcm_time(left, d->audio.fmt.sample_rate);
+
+		if (!t->prefetched && qu->conf.prefetch_next != 0
+			&& left_msec <= qu->conf.prefetch_before) {
+			if (NULL == (pe = ffvec_pushT(&ents, entry*)))
+				break;
+			*pe = t->e;
+			t->prefetched = 1;
+		}
+
+		if (t->gapless && !t->preopened
+			&& left_msec <= qu->conf.gapless_preopen) {
+			if (NULL == (pe = ffvec_pushT(&opens, entry*)))
+				break;
+			*pe = t->e;
+			t->preopened = 1;
+		}
+	}
+	ffbool empty = fflist_empty(&qu->prefetch_trks);
+	fflk_unlock(&qu->prefetch_lock);
+
+	FFSLICE_WALK(&ents, pe) {
+		prefetch_next(*pe);
+	}
+	ffvec_free(&ents);
+
+	FFSLICE_WALK(&opens, pe) {
+		que_gapless_preopen(*pe);
+	}
+	ffvec_free(&opens);
+
+	if (empty) {
+		core->timer(&qu->prefetch_timer, 0, 0);
+		qu->prefetch_timer_active = 0;
+	}
+}
+
+/** Thread: main */
+static void prefetch_timer_start(void)
+{
+	if (qu->prefetch_timer_active)
+		return;
+	fmed_timer_set(&qu->prefetch_timer, &prefetch_ontimer, NULL);
+	core->timer(&qu->prefetch_timer, PREFETCH_TIMER_INTERVAL, 0);
+	qu->prefetch_timer_active = 1;
+}
+
+/** Start watching the track's position.
+Thread: worker */
+static void prefetch_trk_add(que_trk *t)
+{
+	switch (t->d->type) {
+	case FMED_TRK_TYPE_PLAYBACK:
+	case FMED_TRK_TYPE_CONVERT:
+	case FMED_TRK_TYPE_PCMINFO:
+		break;
+	default:
+		return;
+	}
+
+	fflk_lock(&qu->prefetch_lock);
+	fflist_add(&qu->prefetch_trks, &t->prefetch_sib);
+	fflk_unlock(&qu->prefetch_lock);
+
+	struct quetask *qt;
+	if (NULL == (qt = ffmem_new(struct quetask))) {
+		syserrlog("%s", ffmem_alloc_S);
+		return;
+	}
+	qt->cmd = CMD_PREFETCH_START;
+	que_task_add(qt);
+}
+
+static void prefetch_trk_rm(que_trk *t)
+{
+	if (t->prefetch_sib.next == NULL)
+		return;
+	fflk_lock(&qu->prefetch_lock);
+	fflist_rm(&qu->prefetch_trks, &t->prefetch_sib);
+	fflk_unlock(&qu->prefetch_lock);
+}
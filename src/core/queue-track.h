@@ -3,10 +3,19 @@
 
 static void que_ontrkfin(entry *e);
 static void que_trk_close(void *ctx);
+typedef struct que_trk que_trk;
+static void prefetch_trk_add(que_trk *t);
+static void prefetch_trk_rm(que_trk *t);
+static void prefetch_timer_start(void);
+
+enum QUE_PLAY {
+	QUE_PLAY_GAPLESS_WAIT = 2, // the audio output waits until the previous track passes the running buffer to it
+};
 
 enum CMD {
 	CMD_TRKFIN = 0x010000,
 	CMD_TRKFIN_EXPAND,
+	CMD_PREFETCH_START,
 };
 
 struct quetask {
@@ -32,6 +41,10 @@ static void que_taskfunc(void *udata)
 		break;
 	}
 
+	case CMD_PREFETCH_START:
+		prefetch_timer_start();
+		break;
+
 	default:
 		que_cmd(qt->cmd, (void*)qt->param);
 	}
@@ -96,7 +109,8 @@ static void que_play2(entry *ent, uint flags)
 {
 	fmed_que_entry *e = &ent->e;
 	int type = FMED_TRK_TYPE_PLAYBACK;
-	if (ent->trk != NULL && ent->trk->pcm_peaks)
+	if (ent->trk != NULL
+		&& (ent->trk->pcm_peaks || (ent->trk->loudness && ent->trk->out_filename == NULL)))
 		type = FMED_TRK_TYPE_PCMINFO;
 	else if (ent->trk != NULL && ent->trk->input_info)
 		type = FMED_TRK_TYPE_METAINFO;
@@ -111,7 +125,8 @@ static void que_play2(entry *ent, uint flags)
 		return;
 	else if (trk == FMED_TRK_EFMT) {
 		entry *next;
-		if (NULL != (next = que_getnext(ent))) {
+		if (!(flags & QUE_PLAY_GAPLESS_WAIT)
+			&& NULL != (next = que_getnext(ent))) {
 			struct quetask *qt = ffmem_new(struct quetask);
 			FF_ASSERT(qt != NULL);
 			qt->cmd = FMED_QUE_PLAY;
@@ -142,6 +157,13 @@ static void que_play2(entry *ent, uint flags)
 			qu->track->setval(trk, dict[i].ptr, *(int64*)dict[i + 1].ptr); //FMED_QUE_NUM
 	}
 
+	if (type == FMED_TRK_TYPE_PLAYBACK && qu->conf.gapless) {
+		if (que_hasnext(ent))
+			qu->track->setval(trk, "gapless", 1);
+		if (flags & QUE_PLAY_GAPLESS_WAIT)
+			qu->track->setval(trk, "gapless_wait", 1);
+	}
+
 	const char *smeta = qu->track->getvalstr(trk, "meta");
 	if (smeta != FMED_PNULL && 0 != que_setmeta(ent, smeta, trk)) {
 		que_cmd(FMED_QUE_RM, e);
@@ -173,12 +195,16 @@ static void que_mix(void)
 }
 
 
-typedef struct que_trk {
+struct que_trk {
 	entry *e;
 	const fmed_track *track;
 	void *trk;
 	fmed_filt *d;
-} que_trk;
+	fflist_item prefetch_sib;
+	uint prefetched :1;
+	uint gapless :1; // the next item continues writing to our audio buffer
+	uint preopened :1; // the next item has been started
+};
 
 static void* que_trk_open(fmed_filt *d)
 {
@@ -202,6 +228,11 @@ static void* que_trk_open(fmed_filt *d)
 		que_trk_close(t);
 		return NULL;
 	}
+
+	t->gapless = (1 == d->track->getval(d->trk, "gapless"));
+	if (qu->conf.prefetch_next != 0
+		|| (t->gapless && qu->conf.gapless_preopen != 0))
+		prefetch_trk_add(t);
 	return t;
 }
 
@@ -210,6 +241,8 @@ static void que_trk_close(void *ctx)
 	que_trk *t = ctx;
 	entry *e = t->e;
 
+	prefetch_trk_rm(t);
+
 	if ((int64)t->d->audio.total != FMED_NULL && t->d->audio.fmt.sample_rate != 0)
 		t->e->e.dur = ffpcm_time(t->d->audio.total, t->d->audio.fmt.sample_rate);
 
@@ -256,7 +289,9 @@ static void que_ontrkfin(entry *e)
 
 	if (qu->mixing) {
 		qu->track->cmd(NULL, FMED_TRACK_LAST);
-	} else if (e->stop_after)
+	} else if (e->next_started)
+		e->next_started = 0;
+	else if (e->stop_after)
 		e->stop_after = 0;
 	else if (e->trk_stopped)
 	{}
@@ -282,6 +317,29 @@ end:
 	ent_unref(e);
 }
 
+/** Start the next item while the current one is still playing:
+ its file is opened and the first data is decoded before the audio buffer is drained,
+ so a slow storage or a small buffer doesn't cause a gap.
+The audio output of the new track waits until the current track passes the running buffer to it.
+Thread: main */
+static void que_gapless_preopen(entry *e)
+{
+	plist *pl = e->plist;
+	entry *next;
+	if (pl->cur != e
+		|| e->next_started
+		|| qu->mixing
+		|| pl->parallel
+		|| !que_hasnext(e)
+		|| NULL == (next = que_getnext(e)))
+		return;
+
+	dbglog0("gapless: starting %S before the end of %S", &next->e.url, &e->e.url);
+	e->next_started = 1;
+	pl->cur = next;
+	que_play2(next, QUE_PLAY_GAPLESS_WAIT);
+}
+
 static const fmed_filter fmed_que_trk = {
 	que_trk_open, que_trk_process, que_trk_close
 };
@@ -2,6 +2,8 @@
 Copyright (c) 2015 Simon Zolin */
 
 #include <fmedia.h>
+#include <util/path.h>
+#include <util/thpool.h>
 #include <FFOS/dir.h>
 #include <FFOS/random.h>
 #include <avpack/m3u.h>
@@ -49,6 +51,11 @@ static struct entry* plist_ent(struct plist *pl, size_t idx);
 
 struct que_conf {
 	byte next_if_err;
+	byte gapless;
+	uint gapless_preopen; // msec
+	byte prefetch_next;
+	uint prefetch_before; // msec
+	size_t prefetch_size;
 };
 
 typedef struct que {
@@ -59,6 +66,12 @@ typedef struct que {
 	fflock plist_lock;
 
 	struct que_conf conf;
+
+	fflock prefetch_lock;
+	fflist prefetch_trks; // que_trk[]: active tracks that may trigger prefetching of the next items
+	fftimerqueue_node prefetch_timer;
+	uint prefetch_timer_active :1;
+
 	uint list_random;
 	uint repeat;
 	uint quit_if_done :1
@@ -102,18 +115,32 @@ static void ent_start_prepare(entry *e, void *trk);
 static void rnd_init();
 static void plist_remove_entry(entry *e, ffbool from_index, ffbool remove);
 static entry* que_getnext(entry *from);
+static entry* pl_first(plist *pl);
+static entry* pl_next(entry *from);
+static ffbool que_hasnext(entry *e);
 static void pl_expand_next(plist *pl, entry *e);
 
 #include <core/queue-entry.h>
 #include <core/queue-track.h>
+#include <core/queue-prefetch.h>
 
 static const fmed_conf_arg que_conf_args[] = {
 	{ "next_if_error",	FMC_BOOL8,  FMC_O(struct que_conf, next_if_err) },
+	{ "gapless",	FMC_BOOL8,  FMC_O(struct que_conf, gapless) },
+	{ "gapless_preopen",	FMC_INT32,  FMC_O(struct que_conf, gapless_preopen) },
+	{ "prefetch_next",	FMC_INT8,  FMC_O(struct que_conf, prefetch_next) },
+	{ "prefetch_before",	FMC_INT32,  FMC_O(struct que_conf, prefetch_before) },
+	{ "prefetch_size",	FMC_SIZE,  FMC_O(struct que_conf, prefetch_size) },
 	{}
 };
 static int que_config(fmed_conf_ctx *ctx)
 {
 	qu->conf.next_if_err = 1;
+	qu->conf.gapless = 0;
+	qu->conf.gapless_preopen = 0;
+	qu->conf.prefetch_next = 1;
+	qu->conf.prefetch_before = 10000;
+	qu->conf.prefetch_size = 1 * 1024 * 1024;
 	fmed_conf_addctx(ctx, &qu->conf, que_conf_args);
 	return 0;
 }
@@ -150,6 +177,8 @@ static int que_sig(uint signo)
 			return 1;
 		fflist_init(&qu->plists);
 		fflk_init(&qu->plist_lock);
+		fflist_init(&qu->prefetch_trks);
+		fflk_init(&qu->prefetch_lock);
 		break;
 
 	case FMED_OPEN:
@@ -169,6 +198,7 @@ static void ent_start_prepare(entry *e, void *trk)
 	ffslice_free(&e->tmeta);
 	qu->track->setval(trk, "queue_item", (int64)e);
 	ent_ref(e);
+	e->prefetched = 0;
 }
 
 static void plist_remove_entry(entry *e, ffbool from_index, ffbool remove)
@@ -372,6 +402,16 @@ static entry* que_getnext(entry *from)
 	return from;
 }
 
+/** Return TRUE if the next item will be started automatically after this one. */
+static ffbool que_hasnext(entry *e)
+{
+	if (e->stop_after)
+		return 0;
+	if (e->plist->allow_random && qu->random && e->plist->indexes.len != 0)
+		return 1;
+	return (qu->repeat != FMED_QUE_REPEAT_NONE || pl_next(e) != NULL);
+}
+
 /** Expand the next (or the first) item in list.
 e: the last expanded item
  NULL: expand the first item */
@@ -804,7 +844,10 @@ static ssize_t que_cmd2(uint cmd, void *param, size_t param2)
 		}
 		if (NULL != (e = que_getnext(e))) {
 			pl->cur = e;
-			que_play(pl->cur);
+			if (param != NULL && !pl->parallel)
+				que_play2(pl->cur, QUE_PLAY_GAPLESS_WAIT); // the previous track may still be playing
+			else
+				que_play(pl->cur);
 		}
 		break;
 
@@ -4,10 +4,12 @@ Copyright (c) 2016 Simon Zolin */
 #include <core/core.h>
 
 #include <util/path.h>
+#include <util/arena.h>
 #include <FFOS/error.h>
 #include <FFOS/process.h>
 #include <FFOS/timer.h>
 #include <ffbase/murmurhash3.h>
+#include <ffbase/map.h>
 
 
 #undef dbglog
@@ -18,6 +20,29 @@ Copyright (c) 2016 Simon Zolin */
 
 enum {
 	N_FILTERS = 32, //allow up to this number of filters to be added while track is running
+	TRK_ARENA_BLOCK = 8*1024, // enough for the filters array and the typical number of track values
+	TRK_POOL_MAX = 8, // max. number of freed track objects kept for reuse
+	TRK_TMPL_MAX = 256, // max. number of chain templates
+	TRK_TMPL_EXT_MAX = 16, // don't create templates for longer file extensions
+};
+
+typedef struct fm_trk fm_trk;
+
+/** Track priority class */
+enum TRK_PRIO {
+	TRK_PRIO_BATCH, // conversion, analysis: time-sliced
+	TRK_PRIO_RT, // audio I/O: a dedicated worker with real-time priority
+};
+
+static const char *const prio_str[] = {
+	"batch", "real-time",
+};
+
+/** Time between waking a track up and running it on the worker */
+struct trk_waitstat {
+	uint64 n;
+	uint64 total; //usec
+	uint64 max; //usec
 };
 
 struct tracks {
@@ -25,6 +50,18 @@ struct tracks {
 	fflist trks; //fm_trk[]
 	const struct fmed_trk_mon *mon;
 	const fmed_queue *qu;
+
+	fflock pool_lock;
+	fm_trk *pool[TRK_POOL_MAX]; // freed track objects with their memory arena
+	uint pool_n;
+
+	fflock wait_lock;
+	struct trk_waitstat wait[2]; // enum TRK_PRIO
+
+	fflock tmpl_lock;
+	ffmap tmpls; // key -> struct chain_tmpl*
+	uint tmpls_n;
+
 	uint stop_sig :1;
 	uint last :1;
 };
@@ -60,6 +97,7 @@ typedef struct dict_ent {
 		void *pval;
 	};
 	uint acq :1;
+	uint heap :1; // the entry itself is allocated on heap, not in the track's arena
 } dict_ent;
 
 enum TRK_ST {
@@ -71,7 +109,7 @@ enum TRK_ST {
 
 typedef fflist_item* fflist_cursor;
 
-typedef struct fm_trk {
+struct fm_trk {
 	fflist_item sib;
 	fmed_trk props;
 	ffchain filt_chain;
@@ -90,7 +128,24 @@ typedef struct fm_trk {
 
 	uint state; //enum TRK_ST
 	uint wflags;
-} fm_trk;
+	uint prio; //enum TRK_PRIO
+	ffatomic t_posted; // when the track was woken up (usec, truncated to size_t);  0: the task isn't posted
+	struct trk_waitstat wait;
+	uint out_added :1; // trk_setout_file() has added the output filters
+
+	// --bench: the samples produced by the filter that outputs PCM data (decoder)
+	struct {
+		const fmed_f *src;
+		uint sampsize;
+		uint rate;
+		uint64 samples;
+	} bench;
+
+	/** Memory for the objects that live until the track is destroyed:
+	 filters array, track values, meta, filter contexts (FMED_TRACK_ALLOC).
+	The object is preserved when the track is recycled. */
+	ffarena arena;
+};
 
 
 static int trk_setout_file(fm_trk *t);
@@ -110,6 +165,7 @@ static char* chain_print(fm_trk *t, const ffchain_item *mark, char *buf, size_t
 static fmed_f* addfilter(fm_trk *t, const char *modname);
 static fmed_f* addfilter1(fm_trk *t, const fmed_modinfo *mod);
 static fmed_f* filt_add(fm_trk *t, uint cmd, const char *name);
+static fmed_f* filt_insert(fm_trk *t, uint cmd, const char *name, const fmed_filter *filt);
 static int filt_call(fm_trk *t, fmed_f *f);
 static void filt_close(fm_trk *t, fmed_f *f);
 
@@ -126,28 +182,177 @@ static int64 trk_setval4(void *trk, const char *name, int64 val, uint flags);
 static char* trk_setvalstr4(void *trk, const char *name, const char *val, uint flags);
 
 
+static int tmpl_keyeq(void *opaque, const void *key, ffsize keylen, void *val);
+
 int tracks_init(void)
 {
 	if (NULL == (g = ffmem_new(struct tracks)))
 		return -1;
 	g->qu = core->getmod("#queue.queue");
 	fflist_init(&g->trks);
+	fflk_init(&g->pool_lock);
+	fflk_init(&g->wait_lock);
+	fflk_init(&g->tmpl_lock);
+	ffmap_init(&g->tmpls, tmpl_keyeq);
 	return 0;
 }
 
+/** Get a track object from the pool, or allocate a new one.
+Return zero-filled object */
+static fm_trk* trk_alloc(void)
+{
+	fm_trk *t = NULL;
+	fflk_lock(&g->pool_lock);
+	if (g->pool_n != 0)
+		t = g->pool[--g->pool_n];
+	fflk_unlock(&g->pool_lock);
+
+	if (t != NULL) {
+		ffarena a = t->arena;
+		ffmem_zero_obj(t);
+		t->arena = a;
+		return t;
+	}
+
+	if (NULL == (t = ffmem_new(fm_trk)))
+		return NULL;
+	ffarena_init(&t->arena, TRK_ARENA_BLOCK);
+	return t;
+}
+
+/** Release all memory allocated from the track's arena and put the object to the pool for reuse */
+static void trk_release(fm_trk *t)
+{
+	ffarena_reset(&t->arena);
+
+	fflk_lock(&g->pool_lock);
+	if (g->pool_n != TRK_POOL_MAX) {
+		g->pool[g->pool_n++] = t;
+		t = NULL;
+	}
+	fflk_unlock(&g->pool_lock);
+
+	if (t != NULL) {
+		ffarena_free(&t->arena);
+		ffmem_free(t);
+	}
+}
+
 void tracks_destroy(void)
 {
 	if (g == NULL)
 		return;
 	g->stop_sig = 0;
+
+	for (uint i = 0;  i != FF_COUNT(g->wait);  i++) {
+		const struct trk_waitstat *ws = &g->wait[i];
+		if (ws->n != 0)
+			dbglog(NULL, "%s tracks: queue wait: %U times, avg:%Uus, max:%Uus"
+				, prio_str[i], ws->n, ws->total / ws->n, ws->max);
+	}
+
 	fm_trk *t;
 	fflist_item *next;
 	FFLIST_WALKSAFE(&g->trks, t, sib, next) {
 		trk_free(t);
 	}
+	for (uint i = 0;  i != g->pool_n;  i++) {
+		ffarena_free(&g->pool[i]->arena);
+		ffmem_free(g->pool[i]);
+	}
+
+	struct _ffmap_item *it;
+	FFMAP_WALK(&g->tmpls, it) {
+		if (!_ffmap_item_occupied(it))
+			continue;
+		ffmem_free(it->val);
+	}
+	ffmap_free(&g->tmpls);
 	ffmem_free0(g);
 }
 
+
+/*
+Chain templates.
+The filters added by trk_open() and trk_addfilters() depend only on the track type,
+ the input/output file extension and the track options,
+ but each filter is resolved by its name via core.
+The first track with the given parameters builds the chain as usual,
+ and the result (filter names with their interfaces) is saved as a template.
+The next tracks with the same key just copy the template.
+The global settings (GUI/TUI, audio device modules) don't change at runtime
+ and aren't a part of the key.
+The track values the chain builder sets for the filters ("dynanorm_gain") are saved too.
+*/
+struct chain_tmpl {
+	uint n;
+	int out_seekable; // -1: the template has no output filters
+	int64 dynanorm_gain; // FMED_NULL: not set
+	struct {
+		const char *name;
+		const fmed_filter *filt;
+	} f[N_FILTERS];
+	char key[0];
+};
+
+static int tmpl_keyeq(void *opaque, const void *key, ffsize keylen, void *val)
+{
+	const struct chain_tmpl *tp = val;
+	return !ffs_cmpz(key, keylen, tp->key);
+}
+
+static const struct chain_tmpl* tmpl_find(ffstr key)
+{
+	fflk_lock(&g->tmpl_lock);
+	const struct chain_tmpl *tp = ffmap_find(&g->tmpls, key.ptr, key.len, NULL);
+	fflk_unlock(&g->tmpl_lock);
+	return tp;
+}
+
+/** Save the filters added to chain starting at index 'first' as a template. */
+static void tmpl_save(ffstr key, const fm_trk *t, uint first, int out_seekable)
+{
+	struct chain_tmpl *tp;
+	if (NULL == (tp = ffmem_alloc(sizeof(struct chain_tmpl) + key.len + 1)))
+		return;
+	tp->n = 0;
+	tp->out_seekable = out_seekable;
+	tp->dynanorm_gain = trk_getval((void*)t, "dynanorm_gain");
+	const fmed_f *f = (fmed_f*)t->filters.ptr;
+	for (uint i = first;  i != t->filters.len;  i++) {
+		tp->f[tp->n].name = f[i].name;
+		tp->f[tp->n].filt = f[i].filt;
+		tp->n++;
+	}
+	ffsz_fcopy(tp->key, key.ptr, key.len);
+
+	fflk_lock(&g->tmpl_lock);
+	if (g->tmpls_n == TRK_TMPL_MAX
+		|| NULL != ffmap_find(&g->tmpls, key.ptr, key.len, NULL)) {
+		// the limit is reached, or another thread has just added the same template
+		fflk_unlock(&g->tmpl_lock);
+		ffmem_free(tp);
+		return;
+	}
+	ffmap_add(&g->tmpls, tp->key, key.len, tp);
+	g->tmpls_n++;
+	fflk_unlock(&g->tmpl_lock);
+
+	dbglog(NULL, "new chain template '%S': %u filters", &key, tp->n);
+}
+
+/** Add filters from template to chain. */
+static void tmpl_apply(fm_trk *t, const struct chain_tmpl *tp)
+{
+	for (uint i = 0;  i != tp->n;  i++) {
+		filt_insert(t, FMED_TRACK_FILT_ADDLAST, tp->f[i].name, tp->f[i].filt);
+	}
+	if (tp->out_seekable >= 0)
+		t->props.out_seekable = tp->out_seekable;
+	if (tp->dynanorm_gain != FMED_NULL)
+		trk_setval(t, "dynanorm_gain", tp->dynanorm_gain);
+}
+
 static fmed_f* addfilter1(fm_trk *t, const fmed_modinfo *mod)
 {
 	return filt_add(t, FMED_TRACK_FILT_ADDLAST, mod->name);
@@ -172,37 +377,76 @@ static fmed_f* trk_modbyext(fm_trk *t, uint flags, const ffstr *ext)
 	return addfilter1(t, mi);
 }
 
+enum TRK_SRC {
+	TRK_SRC_DIR,
+	TRK_SRC_HTTP,
+	TRK_SRC_GEN,
+	TRK_SRC_STDIN,
+	TRK_SRC_FILE,
+};
+
 static int trk_open(fm_trk *t, const char *fn)
 {
-	ffstr name, ext;
+	ffstr name, ext = {};
 	fffileinfo fi;
+	uint src;
 
 	trk_setvalstr(t, "input", fn);
+
+	if (0 == fffile_infofn(fn, &fi) && fffile_isdir(fffile_infoattr(&fi))) {
+		src = TRK_SRC_DIR;
+	} else if (ffsz_matchz(fn, "http://")) {
+		src = TRK_SRC_HTTP;
+	} else if (ffsz_matchz(fn, "@gen:")) {
+		src = TRK_SRC_GEN;
+	} else {
+		uint have_path = (NULL != ffpath_split2(fn, ffsz_len(fn), NULL, &name));
+		ffpath_splitname(name.ptr, name.len, &name, &ext);
+		src = (!have_path && ffstr_eqcz(&name, "@stdin")) ? TRK_SRC_STDIN : TRK_SRC_FILE;
+	}
+
+	char buf[64];
+	ffstr key = {};
+	if (ext.len <= TRK_TMPL_EXT_MAX) {
+		ffstr_set(&key, buf, ffs_fmt(buf, buf + sizeof(buf), "in:%u:%S", src, &ext));
+		const struct chain_tmpl *tp;
+		if (NULL != (tp = tmpl_find(key))) {
+			tmpl_apply(t, tp);
+			return 0;
+		}
+	}
+
+	uint first = t->filters.len;
 	filt_add_optional(t, "#winsleep.sleep");
 	filt_add_optional(t, "dbus.sleep");
 	addfilter(t, "#queue.track");
 
-	if (0 == fffile_infofn(fn, &fi) && fffile_isdir(fffile_infoattr(&fi))) {
+	switch (src) {
+	case TRK_SRC_DIR:
 		addfilter(t, "plist.dir");
-		return 0;
-	}
+		break;
 
-	if (ffsz_matchz(fn, "http://")) {
+	case TRK_SRC_HTTP:
 		addfilter(t, "net.http");
-	} else {
-		uint have_path = (NULL != ffpath_split2(fn, ffsz_len(fn), NULL, &name));
-		ffpath_splitname(name.ptr, name.len, &name, &ext);
-		if (!have_path && ffstr_eqcz(&name, "@stdin"))
-			addfilter(t, "#file.stdin");
-		else
-			addfilter(t, "#file.in");
+		break;
+
+	case TRK_SRC_GEN:
+		addfilter(t, "afilter.silgen"); // test signal generator
+		break;
+
+	case TRK_SRC_STDIN:
+	case TRK_SRC_FILE:
+		addfilter(t, (src == TRK_SRC_STDIN) ? "#file.stdin" : "#file.in");
 
 		if (NULL == trk_modbyext(t, FMED_MOD_INEXT, &ext)) {
 			errlog(t, "can't open file: \"%s\"", fn);
 			return 1;
 		}
+		break;
 	}
 
+	if (key.len != 0)
+		tmpl_save(key, t, first, -1);
 	return 0;
 }
 
@@ -223,6 +467,86 @@ static void trk_open_capt(fm_trk *t)
 	addfilter(t, "afilter.rtpeak");
 }
 
+/** Add the format conversion point.
+afilter.autoconv lets the next filters declare the format they need (audio.convfmt),
+ then converts in a single pass.
+dynanorm.filter needs float32 input: it's placed after afilter.autoconv
+ and writes its output in the format requested by the next filters,
+ applying the user's gain in the same step.
+Without it the chain would be: conv(->float32) -> dynanorm -> gain -> conv.
+gain: whether the user's gain is applied here
+ (passed to dynanorm.filter via "dynanorm_gain") */
+static void trk_addconv(fm_trk *t, ffbool gain)
+{
+	if (t->props.use_dynanorm) {
+		trk_setval(t, "dynanorm_gain", gain);
+		addfilter(t, "afilter.autoconv");
+		addfilter(t, "dynanorm.filter");
+		return;
+	}
+
+	if (gain)
+		addfilter(t, "afilter.gain");
+	addfilter(t, "afilter.autoconv");
+}
+
+/** Split output file name.
+Return 1 if it's "@stdout" */
+static int trk_outname(const char *ofn, ffstr *ext)
+{
+	ffstr name;
+	ffbool have_path = (NULL != ffpath_split2(ofn, ffsz_len(ofn), NULL, &name));
+	ffstr_rsplitby(&name, '.', &name, ext);
+	return (!have_path && ffstr_eqcz(&name, "@stdout"));
+}
+
+/** Get chain template key: the track type and the options trk_chain_build() depends on.
+Return empty string if a template can't be used */
+static ffstr trk_chain_key(fm_trk *t, char *buf, size_t cap)
+{
+	ffstr key = {}, ext = {};
+	uint f = 0, i = 0;
+
+	if (t->props.out_filename != NULL) {
+		f |= trk_outname(t->props.out_filename, &ext);
+		f |= 2;
+	}
+	if (ext.len > TRK_TMPL_EXT_MAX)
+		return key;
+
+	i = 2;
+	f |= t->props.stream_copy << i++;
+	f |= (t->props.a_start_level != 0) << i++;
+	f |= (t->props.a_stop_level != 0) << i++;
+	f |= (t->props.a_prebuffer != 0) << i++;
+	f |= (FMED_PNULL != trk_getvalstr(t, "tee_out")) << i++;
+	f |= ((int64)t->props.audio.split != FMED_NULL
+		|| t->props.a_split_silence != 0
+		|| FMED_PNULL != trk_getvalstr(t, "cue_tracks")) << i++;
+	f |= t->props.use_dynanorm << i++;
+	f |= (t->props.audio.auto_attenuate_ceiling != 0.0) << i++;
+	f |= (FMED_PNULL != trk_getvalstr(t, "peaks_file")) << i++;
+	f |= t->props.loudness << i++;
+	f |= t->props.pcm_peaks << i++;
+
+	ffstr_set(&key, buf, ffs_fmt(buf, buf + cap, "chain:%u:%xu:%S", t->props.type, f, &ext));
+	return key;
+}
+
+static int trk_chain_build(fm_trk *t);
+
+/** --build-index: only .mp3 reader can build seek index (see format/seek-index.h) */
+static int trk_build_index_check(fm_trk *t)
+{
+	const fmed_f *pf;
+	FFSLICE_WALK(&t->filters, pf) {
+		if (ffsz_eq(pf->name, "fmt.mp3"))
+			return 0;
+	}
+	errlog(t, "--build-index: seek index is supported only for .mp3 files");
+	return -1;
+}
+
 static int trk_addfilters(fm_trk *t)
 {
 	switch (t->props.type) {
@@ -245,8 +569,36 @@ static int trk_addfilters(fm_trk *t)
 		if ((int64)t->props.audio.seek != FMED_NULL)
 			t->props.seek_req = 1;
 		break;
+
+	case FMED_TRK_TYPE_METAINFO:
+		if (t->props.build_index && 0 != trk_build_index_check(t))
+			return -1;
+		// fallthrough
+	case FMED_TRK_TYPE_EXPAND:
+		t->props.input_info = 1;
+		break;
 	}
 
+	char buf[64];
+	ffstr key = trk_chain_key(t, buf, sizeof(buf));
+	const struct chain_tmpl *tp;
+	if (key.len != 0 && NULL != (tp = tmpl_find(key))) {
+		tmpl_apply(t, tp);
+		return 0;
+	}
+
+	uint first = t->filters.len;
+	int r;
+	if (0 != (r = trk_chain_build(t)))
+		return r;
+	if (key.len != 0)
+		tmpl_save(key, t, first, (t->out_added) ? (int)t->props.out_seekable : -1);
+	return 0;
+}
+
+/** Add filters to chain according to the track type and options. */
+static int trk_chain_build(fm_trk *t)
+{
 	switch (t->props.type) {
 	case FMED_TRK_TYPE_NONE:
 		return 0;
@@ -262,7 +614,6 @@ static int trk_addfilters(fm_trk *t)
 
 	case FMED_TRK_TYPE_METAINFO:
 	case FMED_TRK_TYPE_EXPAND:
-		t->props.input_info = 1;
 		if (core->props->gui)
 			addfilter(t, "gui.gui");
 		else if (core->props->tui)
@@ -270,6 +621,7 @@ static int trk_addfilters(fm_trk *t)
 		return 0;
 
 	case FMED_TRK_TYPE_PCMINFO:
+		addfilter(t, "afilter.batch");
 		addfilter(t, "afilter.until");
 
 		if (core->props->gui)
@@ -277,20 +629,29 @@ static int trk_addfilters(fm_trk *t)
 		else if (core->props->tui)
 			addfilter(t, "tui.tui");
 
-		if (t->props.use_dynanorm)
-			addfilter(t, "dynanorm.filter");
-		addfilter(t, "afilter.gain");
-		addfilter(t, "afilter.autoconv");
+		if (FMED_PNULL != trk_getvalstr(t, "peaks_file"))
+			addfilter(t, "afilter.wavepeaks");
+		if (t->props.a_split_silence != 0)
+			addfilter(t, "afilter.silencecue");
+		if (t->props.loudness) {
+			addfilter(t, "afilter.loudness");
+			if (!t->props.pcm_peaks)
+				return 0; // loudness analysis only
+		}
+
+		trk_addconv(t, 1);
 		addfilter(t, "afilter.peaks");
 		return 0;
 
 	case FMED_TRK_TYPE_MIXIN:
-		if (t->props.use_dynanorm)
-			addfilter(t, "dynanorm.filter");
-		addfilter(t, "afilter.autoconv");
+		trk_addconv(t, 0);
 		addfilter(t, "afilter.mixer-in");
 		return 0;
 
+	case FMED_TRK_TYPE_TEE:
+		trk_addconv(t, 1);
+		goto output;
+
 	case FMED_TRK_TYPE_REC:
 		if (core->props->gui)
 			addfilter(t, "gui.gui");
@@ -310,6 +671,9 @@ static int trk_addfilters(fm_trk *t)
 		goto output;
 	}
 
+	if (t->props.type == FMED_TRK_TYPE_CONVERT && !t->props.stream_copy)
+		addfilter(t, "afilter.batch");
+
 	if (t->props.type != FMED_TRK_TYPE_NETIN) {
 		addfilter(t, "afilter.until");
 		if (core->props->gui)
@@ -318,28 +682,40 @@ static int trk_addfilters(fm_trk *t)
 			addfilter(t, "tui.tui");
 	}
 
+	if (FMED_PNULL != trk_getvalstr(t, "peaks_file"))
+		addfilter(t, "afilter.wavepeaks");
+	if (t->props.loudness)
+		addfilter(t, "afilter.loudness");
+
 	if (t->props.a_start_level != 0)
 		addfilter(t, "afilter.startlevel");
 	if (t->props.a_stop_level != 0)
 		addfilter(t, "afilter.stoplevel");
 
-	if (t->props.use_dynanorm)
-		addfilter(t, "dynanorm.filter");
+	if (FMED_PNULL != trk_getvalstr(t, "tee_out"))
+		addfilter(t, "afilter.tee");
 
+	ffbool gain = 0;
 	if (t->props.type != FMED_TRK_TYPE_MIXOUT && !t->props.stream_copy) {
 		ffbool playback = (t->props.type == FMED_TRK_TYPE_PLAYBACK
 			&& core->props->playback_module != NULL);
 
-		if (!(playback && t->props.audio.auto_attenuate_ceiling != 0.0))
-			addfilter(t, "afilter.gain");
+		gain = !(playback && t->props.audio.auto_attenuate_ceiling != 0.0);
 	}
 
-	if ((int64)t->props.audio.split != FMED_NULL) {
+	if ((int64)t->props.audio.split != FMED_NULL
+		|| t->props.a_split_silence != 0
+		|| FMED_PNULL != trk_getvalstr(t, "cue_tracks")) {
+		// the tracks created by afilter.split convert the format themselves
+		if (t->props.use_dynanorm)
+			addfilter(t, "dynanorm.filter");
+		if (gain)
+			addfilter(t, "afilter.gain");
 		addfilter(t, "afilter.split");
 		return 0;
 	}
 
-	addfilter(t, "afilter.autoconv");
+	trk_addconv(t, gain);
 
 output:
 	if (t->props.out_filename != NULL) {
@@ -372,10 +748,21 @@ Example of a typical chain:
  -> INPUT
  -> DECODER -> (afilter.until) -> UI -> afilter.gain -> (afilter.conv/conv-soxr) -> (ENCODER)
  -> OUTPUT
+
+Conversion: DECODER -> afilter.batch -> (afilter.until) -> ...
+
+With --dynanorm:
+ ... -> UI -> (afilter.conv/conv-soxr) -> dynanorm.filter -> (ENCODER)
+ -> OUTPUT
+
+With several --out:
+ ... -> UI -> afilter.tee -> afilter.gain -> ...
+ and for each additional output a separate track:
+ afilter.tee-in -> afilter.gain -> (afilter.conv/conv-soxr) -> ENCODER -> OUTPUT
 */
 static void* trk_create(uint cmd, const char *fn)
 {
-	fm_trk *t = ffmem_tcalloc1(fm_trk);
+	fm_trk *t = trk_alloc();
 	if (t == NULL)
 		return NULL;
 	ffchain_init(&t->filt_chain);
@@ -394,8 +781,11 @@ static void* trk_create(uint cmd, const char *fn)
 
 	dbglog(t, "new track:%p  cmd:%u", t, cmd);
 
-	if (NULL == ffvec_allocT(&t->filters, N_FILTERS, fmed_f))
+	fmed_f *filters;
+	if (NULL == (filters = ffarena_alloc(&t->arena, N_FILTERS * sizeof(fmed_f))))
 		goto err;
+	ffslice_set(&t->filters, filters, 0);
+	t->filters.cap = N_FILTERS;
 
 	switch (cmd) {
 
@@ -442,20 +832,19 @@ err:
 /** Set output module and file. */
 static int trk_setout_file(fm_trk *t)
 {
-	const char *ofn = t->props.out_filename;
-	ffstr name, ext;
-	ffbool have_path = (NULL != ffpath_split2(ofn, ffsz_len(ofn), NULL, &name));
-	ffstr_rsplitby(&name, '.', &name, &ext);
+	ffstr ext;
+	int std = trk_outname(t->props.out_filename, &ext);
 	if (NULL == trk_modbyext(t, FMED_MOD_OUTEXT, &ext))
 		return 1;
 
-	if (!have_path && ffstr_eqcz(&name, "@stdout")) {
+	if (std) {
 		addfilter(t, "#file.stdout");
 		t->props.out_seekable = 0;
 	} else {
 		addfilter(t, "#file.out");
 		t->props.out_seekable = 1;
 	}
+	t->out_added = 1;
 	return 0;
 }
 
@@ -488,6 +877,9 @@ static void trk_copy_info(fmed_trk *dst, const fmed_trk *src)
 	dst->a_stop_level = src->a_stop_level;
 	dst->a_stop_level_time = src->a_stop_level_time;
 	dst->a_stop_level_mintime = src->a_stop_level_mintime;
+	dst->a_split_silence = src->a_split_silence;
+	dst->a_split_silence_time = src->a_split_silence_time;
+	dst->a_split_silence_mintrack = src->a_split_silence_mintrack;
 	dst->include_files = src->include_files;
 	dst->exclude_files = src->exclude_files;
 	if (src->out_filename != NULL)
@@ -512,6 +904,17 @@ static void trk_stop(fm_trk *t, uint flags)
 	core->cmd(FMED_TASK_XPOST, &t->tsk_stop, t->wid);
 }
 
+/** Audio I/O tracks are real-time: a delay causes audible dropouts */
+static uint trk_prio(fm_trk *t)
+{
+	switch (t->props.type) {
+	case FMED_TRK_TYPE_PLAYBACK:
+	case FMED_TRK_TYPE_REC:
+		return TRK_PRIO_RT;
+	}
+	return TRK_PRIO_BATCH;
+}
+
 static void trk_printtime(fm_trk *t)
 {
 	fmed_f *pf;
@@ -537,11 +940,96 @@ static void trk_printtime(fm_trk *t)
 	ffarr_free(&s);
 }
 
+/** Add a JSON string value */
+static void json_addstr(ffvec *buf, const char *s)
+{
+	ffvec_addchar(buf, '"');
+	for (;  *s != '\0';  s++) {
+		uint c = (byte)*s;
+		if (c == '"' || c == '\\') {
+			ffvec_addchar(buf, '\\');
+			ffvec_addchar(buf, c);
+		} else if (c < 0x20) {
+			ffvec_addfmt(buf, "\\u%04xu", c);
+		} else {
+			ffvec_addchar(buf, c);
+		}
+	}
+	ffvec_addchar(buf, '"');
+}
+
+/** Append the track's benchmark results to fmed_props.bench_file:
+{"input":"...", "output":"...", "error":false, "samples":N, "duration_msec":N,
+ "real_usec":N, "cpu_usec":N, "samples_per_sec":N,
+ "in_bytes":N, "out_bytes":N, "bytes_per_sec":N, "maxrss_kb":N, "out_close_usec":N,
+ "filters":{"NAME":USEC, ...}}
+samples: the number of samples produced by the decoder (or the generator).
+bytes_per_sec: input (or output, for a generated input) bytes per second of real time.
+Must be called after the filters are closed so the output file size is final. */
+static void trk_bench(fm_trk *t, const struct ffps_perf *perf, uint maxrss)
+{
+	ffvec buf = {};
+	fmed_f *pf;
+	const char *input = trk_getvalstr(t, "input");
+	const char *output = (t->props.out_filename != NULL) ? t->props.out_filename : "";
+	if (input == FMED_PNULL)
+		input = "";
+
+	uint64 samples = t->bench.samples;
+	uint64 in_bytes = ((int64)t->props.input.size != FMED_NULL) ? t->props.input.size : 0;
+	uint64 out_bytes = 0;
+	fffileinfo fi;
+	if (output[0] != '\0' && 0 == fffile_infofn(output, &fi))
+		out_bytes = fffile_infosize(&fi);
+	int64 out_close = trk_getval(t, "out_close_usec");
+	if (out_close == FMED_NULL)
+		out_close = 0;
+	uint64 real = fftime_mcs(&perf->realtime);
+	uint64 cpu = fftime_mcs(&perf->cputime);
+	uint64 r = ffmax(real, 1);
+	uint rate = ffmax(t->bench.rate, 1);
+
+	ffvec_addsz(&buf, "{\"input\":");
+	json_addstr(&buf, input);
+	ffvec_addsz(&buf, ",\"output\":");
+	json_addstr(&buf, output);
+	ffvec_addfmt(&buf, ",\"error\":%s,\"samples\":%U,\"duration_msec\":%U"
+		",\"real_usec\":%U,\"cpu_usec\":%U,\"samples_per_sec\":%U"
+		",\"in_bytes\":%U,\"out_bytes\":%U,\"bytes_per_sec\":%U,\"maxrss_kb\":%u,\"out_close_usec\":%U"
+		",\"filters\":{"
+		, (t->props.err) ? "true" : "false", samples, samples * 1000 / rate
+		, real, cpu, samples * 1000000 / r
+		, in_bytes, out_bytes, ((in_bytes != 0) ? in_bytes : out_bytes) * 1000000 / r, maxrss, out_close);
+
+	FFSLICE_WALK(&t->filters, pf) {
+		if (pf != (fmed_f*)t->filters.ptr)
+			ffvec_addchar(&buf, ',');
+		json_addstr(&buf, pf->name);
+		ffvec_addfmt(&buf, ":%U", fftime_mcs(&pf->clk));
+	}
+	ffvec_addsz(&buf, "}}\n");
+
+	fffd f = fffile_open(core->props->bench_file, FFO_APPEND | FFO_WRONLY);
+	if (f == FF_BADFD) {
+		fmed_syserrlog(core, t, "track", "file open: %s", core->props->bench_file);
+		goto end;
+	}
+	if (buf.len != (size_t)fffile_write(f, buf.ptr, buf.len))
+		fmed_syserrlog(core, t, "track", "file write: %s", core->props->bench_file);
+	fffile_close(f);
+
+end:
+	ffvec_free(&buf);
+}
+
+/** Free the value acquired by the track.
+A track value entry is in the track's arena; a meta entry is on heap. */
 static void dict_ent_free(dict_ent *e)
 {
 	if (e->acq)
 		ffmem_free(e->pval);
-	ffmem_free(e);
+	if (e->heap)
+		ffmem_free(e);
 }
 
 static void trk_free_tsk(void *param)
@@ -584,9 +1072,11 @@ static void trk_free(fm_trk *t)
 	if (t->state == TRK_ST_ERR)
 		t->props.err = 1;
 
+	struct ffps_perf i2 = {};
+	uint maxrss = 0;
 	if (t->props.print_time) {
-		struct ffps_perf i2 = {};
 		ffps_perf(&i2, FFPS_PERF_REALTIME | FFPS_PERF_CPUTIME | FFPS_PERF_RUSAGE);
+		maxrss = i2.maxrss; // peak value, not a counter
 		ffps_perf_diff(&t->psperf, &i2);
 		core->log(FMED_LOG_INFO, t, "track", "processing time: real:%u.%06u  cpu:%u.%06u (user:%u.%06u system:%u.%06u)"
 			"  resources: pagefaults:%u  maxrss:%u  I/O:%u  ctxsw:%u"
@@ -607,10 +1097,20 @@ static void trk_free(fm_trk *t)
 	}
 	t->cur = NULL;
 
-	if (core->loglev == FMED_LOG_DEBUG)
+	if (core->props->bench_file != NULL && t->props.print_time)
+		trk_bench(t, &i2, maxrss);
+
+	if (core->loglev == FMED_LOG_DEBUG) {
 		trk_printtime(t);
+		if (t->wait.n != 0)
+			dbglog(t, "queue wait (%s): %U times, avg:%Uus, max:%Uus"
+				, prio_str[t->prio], t->wait.n, t->wait.total / t->wait.n, t->wait.max);
+		int64 n = trk_getval(t, "conv_passes");
+		if (n != FMED_NULL)
+			dbglog(t, "PCM conversion passes: %U", n);
+	}
 
-	ffvec_free(&t->filters);
+	ffvec_null(&t->filters); // memory is in arena
 
 	ffrbt_freeall(&t->dict, (ffrbt_free_t)&dict_ent_free, FFOFF(dict_ent, nod));
 	ffrbt_freeall(&t->meta, (ffrbt_free_t)&dict_ent_free, FFOFF(dict_ent, nod));
@@ -628,7 +1128,7 @@ static void trk_free(fm_trk *t)
 
 	ffmem_free(t->props.out_filename);
 	dbglog(t, "closed");
-	ffmem_free(t);
+	trk_release(t);
 
 	if (g->stop_sig && g->trks.len == 0)
 		core->sig(FMED_STOP);
@@ -680,12 +1180,28 @@ do { \
 		*(pn) &= ~(mask); \
 } while (0)
 
+/** Count the samples output by the filter that has produced PCM data first */
+static void trk_bench_count(fm_trk *t, const fmed_f *f)
+{
+	if (t->bench.src == NULL) {
+		if (t->props.datatype == NULL || !ffsz_eq(t->props.datatype, "pcm"))
+			return;
+		t->bench.src = f;
+		t->bench.sampsize = ffpcm_size1(&t->props.audio.fmt);
+		t->bench.rate = t->props.audio.fmt.sample_rate;
+	}
+
+	if (f == t->bench.src && t->bench.sampsize != 0)
+		t->bench.samples += t->props.outlen / t->bench.sampsize;
+}
+
 static int filt_call(fm_trk *t, fmed_f *f)
 {
 	int r;
 	fftime t1 = {}, t2;
+	ffbool clk = (core->loglev == FMED_LOG_DEBUG || t->props.print_time);
 
-	if (core->loglev == FMED_LOG_DEBUG) {
+	if (clk) {
 		ffclk_get(&t1);
 	}
 
@@ -723,7 +1239,10 @@ static int filt_call(fm_trk *t, fmed_f *f)
 	r = f->filt->process(f->ctx, &t->props);
 	f->d.data = t->props.data,  f->d.datalen = t->props.datalen;
 
-	if (core->loglev == FMED_LOG_DEBUG) {
+	if (core->props->bench_file != NULL && t->props.outlen != 0)
+		trk_bench_count(t, f);
+
+	if (clk) {
 		ffclk_get(&t2);
 		ffclk_diff(&t1, &t2);
 		fftime_add(&f->clk, &t2);
@@ -803,14 +1322,37 @@ uint fflist_curshift(fflist_cursor *cur, uint cmd, void *sentl)
 	return r;
 }
 
+/** Account the time the track has been waiting in the worker's queue */
+static void trk_waited(fm_trk *t)
+{
+	// the value is set by FMED_TRACK_WAKE from any thread, but is reset only here
+	size_t posted = ffatom_get(&t->t_posted);
+	if (posted == 0
+		|| !ffatom_cmpset(&t->t_posted, posted, 0))
+		return;
+	uint64 d = (size_t)core_mono_usec() - posted;
+
+	t->wait.n++;
+	t->wait.total += d;
+	t->wait.max = ffmax(t->wait.max, d);
+
+	struct trk_waitstat *ws = &g->wait[t->prio];
+	fflk_lock(&g->wait_lock);
+	ws->n++;
+	ws->total += d;
+	ws->max = ffmax(ws->max, d);
+	fflk_unlock(&g->wait_lock);
+}
+
 static void trk_process(void *udata)
 {
 	fm_trk *t = udata;
 	fmed_f *nf;
 	fmed_f *f;
 	int r, e;
-	size_t jobdata;
-	core_job_enter(t->wid, &jobdata);
+	struct core_job job;
+	trk_waited(t);
+	core_job_enter(t->wid, t->wflags, &job);
 
 	for (;;) {
 
@@ -826,7 +1368,7 @@ static void trk_process(void *udata)
 			goto fin;
 		}
 
-		if (core_job_shouldyield(t->wid, &jobdata)) {
+		if (core_job_shouldyield(t->wid, &job)) {
 			trk_cmd(t, FMED_TRACK_WAKE);
 			return;
 		}
@@ -1037,7 +1579,14 @@ static dict_ent* dict_add(fm_trk *t, const char *name, uint *f)
 		*f = 1;
 
 	} else {
-		ent = ffmem_tcalloc1(dict_ent);
+		/* Meta may be cleared and set again many times during the track (ICY, CUE splitting),
+		 so it's kept out of the arena which is freed only when the track is destroyed */
+		if (*f & FMED_TRK_META) {
+			ent = ffmem_new(dict_ent);
+			if (ent != NULL)
+				ent->heap = 1;
+		} else
+			ent = ffarena_alloc(&t->arena, sizeof(dict_ent));
 		if (ent == NULL) {
 			syserrlog(core, t, "track", "mem alloc", 0);
 			t->state = TRK_ST_ERR;
@@ -1125,6 +1674,13 @@ static int trk_meta_copy(fm_trk *t, fm_trk *src)
 
 /** Add filter to chain. */
 static fmed_f* filt_add(fm_trk *t, uint cmd, const char *name)
+{
+	return filt_insert(t, cmd, name, NULL);
+}
+
+/** Add filter to chain.
+filt: filter interface;  NULL: get by name */
+static fmed_f* filt_insert(fm_trk *t, uint cmd, const char *name, const fmed_filter *filt)
 {
 	uint optional = cmd & 0x80000000;
 	cmd &= ~0x80000000;
@@ -1137,11 +1693,13 @@ static fmed_f* filt_add(fm_trk *t, uint cmd, const char *name)
 
 	f = ffslice_endT(&t->filters, fmed_f);
 	ffmem_zero_obj(f);
-	if (NULL == (f->filt = core->getmod2(FMED_MOD_IFACE | FMED_MOD_NOLOG, name, -1))) {
+	if (filt == NULL
+		&& NULL == (filt = core->getmod2(FMED_MOD_IFACE | FMED_MOD_NOLOG, name, -1))) {
 		if (!optional)
 			errlog(t, "no such interface %s", name);
 		return NULL;
 	}
+	f->filt = filt;
 
 	switch (cmd) {
 	case FMED_TRACK_FILT_ADDFIRST:
@@ -1249,6 +1807,8 @@ static const char* const cmd_str[] = {
 	"FMED_TRACK_KQ",
 	"FMED_TRACK_XSTART",
 	"FMED_TRACK_STOPPED",
+	"FMED_TRACK_ALLOC",
+	"FMED_TRACK_META_CLEAR",
 };
 
 static ssize_t trk_cmd(void *trk, uint cmd, ...)
@@ -1283,7 +1843,8 @@ static ssize_t trk_cmd(void *trk, uint cmd, ...)
 		break;
 
 	case FMED_TRACK_STOP:
-		FF_ASSERT(core_ismainthr());
+		// a track that isn't started yet may be destroyed from any thread
+		FF_ASSERT(core_ismainthr() || t->cur == NULL);
 		trk_stop(t, FMED_TRACK_STOP);
 		break;
 
@@ -1309,9 +1870,13 @@ static ssize_t trk_cmd(void *trk, uint cmd, ...)
 			ffps_perf(&t->psperf, FFPS_PERF_REALTIME | FFPS_PERF_CPUTIME | FFPS_PERF_RUSAGE);
 
 		t->wflags = (cmd == FMED_TRACK_XSTART) ? FMED_WORKER_FPARALLEL : 0;
+		t->prio = trk_prio(t);
+		if (t->prio == TRK_PRIO_RT)
+			t->wflags |= FMED_WORKER_FRT;
 		t->wid = core->cmd(FMED_WORKER_ASSIGN, &t->kq, t->wflags);
+		dbglog(t, "class:%s  worker:%u", prio_str[t->prio], t->wid);
 
-		core->cmd(FMED_TASK_XPOST, &t->tsk, t->wid);
+		trk_cmd(t, FMED_TRACK_WAKE);
 		break;
 
 	case FMED_TRACK_PAUSE:
@@ -1332,7 +1897,7 @@ static ssize_t trk_cmd(void *trk, uint cmd, ...)
 			FFLIST_WALKSAFE(&g->trks, t, sib, next) {
 				if (t->state == TRK_ST_PAUSED) {
 					t->state = TRK_ST_ACTIVE;
-					trk_process(t);
+					trk_cmd(t, FMED_TRACK_WAKE); // the track may belong to another worker
 				}
 			}
 			break;
@@ -1340,7 +1905,7 @@ static ssize_t trk_cmd(void *trk, uint cmd, ...)
 
 		if (t->state == TRK_ST_PAUSED) {
 			t->state = TRK_ST_ACTIVE;
-			trk_process(t);
+			trk_cmd(t, FMED_TRACK_WAKE);
 		}
 		break;
 
@@ -1353,6 +1918,7 @@ static ssize_t trk_cmd(void *trk, uint cmd, ...)
 		break;
 
 	case FMED_TRACK_WAKE:
+		ffatom_cmpset(&t->t_posted, 0, (size_t)core_mono_usec());
 		core->cmd(FMED_TASK_XPOST, &t->tsk, t->wid);
 		break;
 
@@ -1437,6 +2003,17 @@ static ssize_t trk_cmd(void *trk, uint cmd, ...)
 		r = (size_t)t->kq;
 		break;
 
+	case FMED_TRACK_ALLOC: {
+		size_t size = va_arg(va, size_t);
+		r = (size_t)ffarena_alloc(&t->arena, size);
+		break;
+	}
+
+	case FMED_TRACK_META_CLEAR:
+		ffrbt_freeall(&t->meta, (ffrbt_free_t)&dict_ent_free, FFOFF(dict_ent, nod));
+		ffrbt_init(&t->meta);
+		break;
+
 	default:
 		errlog(t, "invalid command:%u", cmd);
 	}
@@ -1562,6 +2139,7 @@ static char* trk_setvalstr4(void *trk, const char *name, const char *val, uint f
 
 		if (ent->acq)
 			ffmem_free(ent->pval);
+		ent->acq = 0;
 
 		if (flags & FMED_TRK_VALSTR) {
 			const ffstr *sval = (void*)val;
@@ -1571,8 +2149,8 @@ static char* trk_setvalstr4(void *trk, const char *name, const char *val, uint f
 
 		if (ent->pval == NULL)
 			return NULL;
-
 		ent->acq = 1;
+
 		dbglog(trk, "set meta: %s = %s", name, ent->pval);
 		return ent->pval;
 
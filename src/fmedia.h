@@ -133,10 +133,17 @@ enum FMED_CMD {
 	Return char* - file extension
 	 NULL: unknown */
 	FMED_DATA_FORMAT,
+
+	/** Get the thread pool (created on first use).
+	ffthpool* thpool()
+	Return NULL on error */
+	FMED_THPOOL,
 };
 
 enum FMED_WORKER_F {
 	FMED_WORKER_FPARALLEL = 1,
+	/** Real-time job (audio I/O): use the dedicated worker if it's enabled (fmedia.conf::rt_worker) */
+	FMED_WORKER_FRT = 2,
 };
 
 enum FMED_FT {
@@ -240,6 +247,9 @@ struct fmed_props {
 	uint prevent_sleep :1;
 	uint gui :1; // GUI is enabled
 	uint tui :1; // TUI is enabled
+	uint cpu_affinity :1; // worker threads are bound to CPUs
+	uint loudness_album :1; // afilter.loudness: print the values for all tracks together
+	uint workers; // number of workers for parallel jobs
 	char *version_str; // "X.XX[.XX]"
 
 	/** Path to user configuration directory (with the trailing slash).
@@ -254,6 +264,12 @@ struct fmed_props {
 	ffpcm record_format;
 
 	char language[8];
+
+	/** Append benchmark results for each track to this file (JSON, one object per line) */
+	const char *bench_file;
+
+	/** Append loudness analysis results for each track to this file (JSON, one object per line) */
+	const char *loudness_json;
 };
 
 typedef ffconf_arg fmed_conf_arg;
@@ -378,6 +394,15 @@ enum FMED_TRACK_CMD {
 	/** Mark the track as stopped (as if user has pressed Stop button).
 	'queue' module won't start the next track. */
 	FMED_TRACK_STOPPED,
+
+	/** Allocate zero-filled memory that is valid until the track is destroyed.
+	The memory must not be freed by user.
+	@param: size_t size
+	Return pointer;  NULL on error. */
+	FMED_TRACK_ALLOC,
+
+	/** Remove all meta data set for this track (but not for its queue item). */
+	FMED_TRACK_META_CLEAR,
 };
 
 enum FMED_TRK_TYPE {
@@ -396,6 +421,8 @@ enum FMED_TRK_TYPE {
 	FMED_TRK_TYPE_CONVERT,
 	/** Just print meta data */
 	FMED_TRK_TYPE_METAINFO,
+	/** Encode PCM data received from another track (afilter.tee) */
+	FMED_TRK_TYPE_TEE,
 
 	_FMED_TRK_TYPE_END,
 };
@@ -549,6 +576,9 @@ struct fmed_track_info {
 	float a_stop_level; //dB
 	uint a_stop_level_time; //msec
 	uint a_stop_level_mintime; //msec
+	float a_split_silence; // split by silence: max. level (dB)
+	uint a_split_silence_time; // split by silence: min. silence duration (msec)
+	uint a_split_silence_mintrack; // split by silence: min. track duration (msec)
 	ushort a_in_buf_time; // buffer size for audio input (msec)  0:default
 	/** Output file name.
 	core free()s it automatically when track is destroyed.
@@ -626,6 +656,10 @@ struct fmed_track_info {
 		uint mpg_lametag :1;
 		uint ogg_flush :1;
 		uint ogg_gen_opus_tag :1; // ogg.write must generate Opus-tag packet
+		uint build_index :1; // demuxer must read the whole file and save seek index
+		/** .cue: decode the source file once and split the audio into tracks (afilter.split) */
+		uint cue_decode_once :1;
+		uint loudness :1; // afilter.loudness: analyze loudness
 	};
 	};
 
@@ -725,6 +759,16 @@ struct fmed_aconv {
 	ffpcmex in, out;
 };
 
+/** Count one more full pass of PCM conversion over the track's audio data ("conv_passes").
+Return the number of passes */
+static FFINL int64 fmed_aconv_pass(fmed_filt *d)
+{
+	int64 n = d->track->getval(d->trk, "conv_passes");
+	n = (n == FMED_NULL) ? 1 : n + 1;
+	d->track->setval(d->trk, "conv_passes", n);
+	return n;
+}
+
 static FFINL int64 fmed_popval_def(fmed_filt *d, const char *name, int64 def)
 {
 	int64 n;
@@ -1160,6 +1204,7 @@ typedef struct fmed_net_http {
 struct fmed_edittags_conf {
 	const char *fn;
 	ffstr meta, meta_from_filename;
+	int padding; // bytes to reserve in a new tag when it doesn't fit in the old one.  -1:default
 	uint preserve_date :1;
 };
 
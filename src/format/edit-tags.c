@@ -7,6 +7,9 @@
 #include <avpack/id3v1.h>
 #include <avpack/id3v2.h>
 #include <FFOS/path.h>
+#ifdef FF_LINUX
+#include <sys/syscall.h>
+#endif
 
 extern const fmed_core *core;
 #undef syserrlog
@@ -50,18 +53,48 @@ void edittags_close(struct edittags *c)
 	ffvec_free(&c->meta2);
 }
 
+/** Copy data from one file to another.
+Linux: copy inside the kernel (the filesystem may share data blocks instead of copying them);
+ fall back to read/write if the files are on different filesystems or the kernel is too old.
+Return 0 if all 'size' bytes are copied;
+ !=0: error (the source file ended before 'size' bytes: EIO) */
 int file_copydata(fffd src, ffuint64 offsrc, fffd dst, ffuint64 offdst, ffuint64 size)
 {
-	int rc = -1, r;
+	int rc = -1;
+	ffssize r;
 	ffvec v = {};
-	ffvec_alloc(&v, 64*1024, 1);
+
+#if defined FF_LINUX && defined SYS_copy_file_range
+	while (size != 0) {
+		loff_t in = offsrc, out = offdst;
+		r = syscall(SYS_copy_file_range, src, &in, dst, &out, (size_t)ffmin(size, 1*1024*1024*1024), 0);
+		if (r <= 0)
+			break; // EOF, or the operation isn't supported
+		offsrc += r;
+		offdst += r;
+		size -= r;
+	}
+	if (size == 0)
+		return 0;
+#endif
+
+	ffvec_alloc(&v, 1*1024*1024, 1);
 
 	while (size != 0) {
 		ffuint n = ffmin(size, v.cap);
 		if (0 > (r = fffile_readat(src, v.ptr, n, offsrc)))
 			goto end;
+		if (r == 0) {
+			fferr_set(EIO); // the file has been truncated while we're copying it
+			goto end;
+		}
+		n = r;
 		if (0 > (r = fffile_writeat(dst, v.ptr, n, offdst)))
 			goto end;
+		if ((ffuint)r != n) {
+			fferr_set(EIO);
+			goto end;
+		}
 		offsrc += n;
 		offdst += n;
 		size -= n;
@@ -153,7 +186,7 @@ int mp3_id3v2(struct edittags *c)
 		}
 	}
 
-	int padding = 1000;
+	int padding = (c->conf.padding >= 0) ? c->conf.padding : 1000;
 	if (id3v2_size >= w.buf.len)
 		padding = id3v2_size - w.buf.len;
 	if (0 != (r = id3v2write_finish(&w, padding))) {
@@ -186,7 +219,7 @@ int mp3_id3v2(struct edittags *c)
 		}
 
 		ffint64 sz = fffile_size(c->fd);
-		if (0 != file_copydata(c->fd, id3v2_size, c->fdw, c->buf.len, sz)) {
+		if (0 != file_copydata(c->fd, id3v2_size, c->fdw, c->buf.len, sz - id3v2_size)) {
 			syserrlog("file read/write");
 			goto end;
 		}
@@ -89,12 +89,15 @@ void mod_destroy()
 extern int ogg_in_conf(fmed_conf_ctx *ctx);
 extern int ogg_out_conf(fmed_conf_ctx *ctx);
 extern int mpeg_out_config(fmed_conf_ctx *ctx);
+extern int mp3_in_config(fmed_conf_ctx *ctx);
 int mod_conf(const char *name, fmed_conf_ctx *ctx)
 {
 	if (ffsz_eq(name, "ogg"))
 		return ogg_in_conf(ctx);
 	else if (ffsz_eq(name, "ogg-write"))
 		return ogg_out_conf(ctx);
+	else if (ffsz_eq(name, "mp3"))
+		return mp3_in_config(ctx);
 	else if (ffsz_eq(name, "mp3-write"))
 		return mpeg_out_config(ctx);
 	return -1;
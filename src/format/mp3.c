@@ -16,6 +16,23 @@ extern const fmed_queue *qu;
 
 #include <format/mp3-write.h>
 #include <format/mp3-copy.h>
+#include <format/seek-index.h>
+
+struct mp3_in_conf_t {
+	byte seek_index;
+} mp3_in_conf;
+
+const fmed_conf_arg mp3_in_conf_args[] = {
+	{ "seek_index",  FMC_BOOL8,  FMC_O(struct mp3_in_conf_t, seek_index) },
+	{}
+};
+
+int mp3_in_config(fmed_conf_ctx *ctx)
+{
+	mp3_in_conf.seek_index = 0;
+	fmed_conf_addctx(ctx, &mp3_in_conf, mp3_in_conf_args);
+	return 0;
+}
 
 typedef struct mp3_in {
 	mp3read mpg;
@@ -23,7 +40,15 @@ typedef struct mp3_in {
 	uint sample_rate;
 	uint nframe;
 	char codec_name[9];
+	struct seekidx idx;
+	uint64 idx_sample, idx_offset; // the reader was restarted at this position
+	uint64 total_size;
+	uint64 reseek_sample;
 	uint have_id32tag :1
+		, hdr :1 // the header is processed
+		, restarted :1
+		, reseek :1 // seek to 'reseek_sample' after the header is read again
+		, reopened :1 // the tags have already been read
 		;
 } mp3_in;
 
@@ -41,8 +66,15 @@ void* mp3_open(fmed_filt *d)
 	if ((int64)d->input.size != FMED_NULL) {
 		total_size = d->input.size;
 	}
+	m->total_size = total_size;
 	mp3read_open(&m->mpg, total_size);
 	m->mpg.id3v2.codepage = core->getval("codepage");
+
+	if ((int64)d->input.seek > 0) {
+		// not reading from the beginning: offsets would be wrong
+	} else if (0 == seekidx_init(&m->idx, d)
+		&& 0 == seekidx_load(&m->idx))
+		dbglog1(d->trk, "seek index: loaded %L entries from %s", m->idx.ents.len, m->idx.fn);
 	return m;
 }
 
@@ -50,9 +82,57 @@ void mp3_close(void *ctx)
 {
 	mp3_in *m = ctx;
 	mp3read_close(&m->mpg);
+	seekidx_close(&m->idx);
 	ffmem_free(m);
 }
 
+/** Restart the reader at the frame found in seek index.
+Note: the restarted reader knows nothing about the data before the frame,
+ so it doesn't look for the tags at the end of file and counts samples and offsets from 0. */
+static int mp3_seek_index(mp3_in *m, fmed_filt *d, uint64 sample)
+{
+	const struct seekidx_ent *e = seekidx_find(&m->idx, sample);
+	if (e == NULL)
+		return -1;
+
+	mp3read_close(&m->mpg);
+	mp3read_open(&m->mpg, 0);
+	m->mpg.id3v2.codepage = core->getval("codepage");
+	m->restarted = 1;
+	m->idx_sample = e->sample;
+	m->idx_offset = e->offset;
+	ffstr_null(&m->in);
+	d->input.seek = e->offset;
+	dbglog1(d->trk, "seek: %Ums: using index: sample:%U offset:%xU"
+		, d->audio.seek, e->sample, e->offset);
+	return 0;
+}
+
+/** Seek without index.
+The reader restarted by mp3_seek_index() doesn't know the file size and the header,
+ so it's reopened at the beginning of file and the seek is performed after the header is read.
+Return 1 if the reader is reopened */
+static int mp3_seek(mp3_in *m, fmed_filt *d, uint64 sample)
+{
+	if (!m->restarted) {
+		mp3read_seek(&m->mpg, sample);
+		return 0;
+	}
+
+	mp3read_close(&m->mpg);
+	mp3read_open(&m->mpg, m->total_size);
+	m->mpg.id3v2.codepage = core->getval("codepage");
+	m->restarted = 0;
+	m->idx_sample = 0;
+	m->idx_offset = 0;
+	m->reseek = 1;
+	m->reseek_sample = sample;
+	m->reopened = 1;
+	ffstr_null(&m->in);
+	d->input.seek = 0;
+	return 1;
+}
+
 void mp3_meta(mp3_in *m, fmed_filt *d, uint type)
 {
 	if (type == MP3READ_ID32) {
@@ -92,28 +172,47 @@ int mp3_process(void *ctx, fmed_filt *d)
 
 		if (d->seek_req && (int64)d->audio.seek != FMED_NULL && m->sample_rate != 0) {
 			d->seek_req = 0;
-			mp3read_seek(&m->mpg, ffpcm_samples(d->audio.seek, m->sample_rate));
+			uint64 sample = ffpcm_samples(d->audio.seek, m->sample_rate);
+			seekidx_cancel(&m->idx);
+			if (0 == mp3_seek_index(m, d, sample))
+				return FMED_RMORE;
 			dbglog1(d->trk, "seek: %Ums", d->audio.seek);
+			if (0 != mp3_seek(m, d, sample))
+				return FMED_RMORE;
 		}
 
 		r = mp3read_process(&m->mpg, &m->in, &out);
 
 		switch (r) {
 		case MPEG1READ_DATA:
+			seekidx_add(&m->idx, mp3read_cursample(&m->mpg), mp3read_offset(&m->mpg) - out.len);
+			if (d->build_index)
+				continue;
 			goto data;
 
 		case MPEG1READ_MORE:
 			if (d->flags & FMED_FLAST) {
+				seekidx_save(&m->idx, d);
 				d->outlen = 0;
 				return FMED_RDONE;
 			}
 			return FMED_RMORE;
 
 		case MP3READ_DONE:
+			seekidx_save(&m->idx, d);
 			d->outlen = 0;
 			return FMED_RLASTOUT;
 
 		case MPEG1READ_HEADER: {
+			if (m->reseek) {
+				m->reseek = 0;
+				mp3read_seek(&m->mpg, m->reseek_sample);
+				break;
+			}
+			if (m->restarted || m->hdr)
+				break;
+			m->hdr = 1;
+
 			const struct mpeg1read_info *info = mp3read_info(&m->mpg);
 			d->audio.fmt.format = FFPCM_16;
 			m->sample_rate = info->sample_rate;
@@ -128,7 +227,10 @@ int mp3_process(void *ctx, fmed_filt *d)
 			d->mpeg1_padding = info->padding;
 			fmed_setval("mpeg.vbr_scale", info->vbr_scale);
 
-			if (d->input_info)
+			if (!d->seek_req && (d->build_index || mp3_in_conf.seek_index))
+				seekidx_build(&m->idx, info->sample_rate);
+
+			if (d->input_info && !(d->build_index && m->idx.building))
 				return FMED_RDONE;
 
 			if (!d->stream_copy
@@ -141,11 +243,12 @@ int mp3_process(void *ctx, fmed_filt *d)
 		case MP3READ_ID31:
 		case MP3READ_ID32:
 		case MP3READ_APETAG:
-			mp3_meta(m, d, r);
+			if (!m->reopened)
+				mp3_meta(m, d, r);
 			break;
 
 		case MPEG1READ_SEEK:
-			d->input.seek = mp3read_offset(&m->mpg);
+			d->input.seek = m->idx_offset + mp3read_offset(&m->mpg);
 			return FMED_RMORE;
 
 		case MP3READ_WARN:
@@ -162,10 +265,10 @@ int mp3_process(void *ctx, fmed_filt *d)
 	}
 
 data:
-	d->audio.pos = mp3read_cursample(&m->mpg);
+	d->audio.pos = m->idx_sample + mp3read_cursample(&m->mpg);
 	dbglog1(d->trk, "passing frame #%u  samples:%u[%U]  size:%u  br:%u  off:%xU"
 		, ++m->nframe, mpeg1_samples(out.ptr), d->audio.pos, (uint)out.len
-		, mpeg1_bitrate(out.ptr), (ffint64)mp3read_offset(&m->mpg) - out.len);
+		, mpeg1_bitrate(out.ptr), m->idx_offset + mp3read_offset(&m->mpg) - out.len);
 	d->data_out = out;
 	return FMED_RDATA;
 }
@@ -0,0 +1,217 @@
+/** fmedia: persistent seek index for the formats without a native seek table
+2022, Simon Zolin */
+
+/*
+The index is built while the demuxer reads the whole file from the beginning
+ (via --build-index, or on the first full read if "seek_index" is enabled in the reader's config)
+ and is stored in "{USER_PATH}cache/seek/DEV-INODE.idx",
+ so a renamed file or a hard link uses the same index.
+The file is valid only while the input file's device, inode, size and modification time are the same.
+It's written into a temporary file which is then renamed,
+ so a reader never sees a partially written index.
+
+Only .mp3 is supported: it's a plain stream of frames,
+ so the reader can be restarted at any frame.
+.mkv, .avi, .caf and .mpc readers (avpack) keep their state from the headers
+ and can't be restarted at an arbitrary offset.
+
+File format (host byte order, can be mapped into memory as is):
+HDR ENTRY[n]
+*/
+
+#define SEEKIDX_MAGIC  "FMSI"
+#define SEEKIDX_VER  2
+
+struct seekidx_hdr {
+	char magic[4];
+	uint ver;
+	uint64 file_dev, file_ino;
+	uint64 file_size;
+	int64 file_mtime;
+	uint n;
+	uint reserved;
+};
+
+struct seekidx_ent {
+	uint64 sample;
+	uint64 offset;
+};
+
+struct seekidx {
+	ffvec ents; // struct seekidx_ent[]
+	char *fn; // index file name
+	uint64 file_dev, file_ino;
+	uint64 file_size;
+	int64 file_mtime;
+	uint interval; // min. number of samples between 2 entries
+	uint building :1
+		, loaded :1
+		;
+};
+
+/** Prepare index for the input file.
+Return 0 if the file can be indexed */
+static inline int seekidx_init(struct seekidx *si, fmed_filt *d)
+{
+	int64 mtime = d->track->getval(d->trk, "input_mtime");
+	int64 dev = d->track->getval(d->trk, "input_dev");
+	int64 ino = d->track->getval(d->trk, "input_ino");
+	if (mtime == FMED_NULL
+		|| dev == FMED_NULL
+		|| ino == FMED_NULL
+		|| (int64)d->input.size == FMED_NULL)
+		return -1;
+
+	si->fn = ffsz_alfmt("%scache/seek/%xU-%xU.idx", core->props->user_path, dev, ino);
+	si->file_dev = dev;
+	si->file_ino = ino;
+	si->file_size = d->input.size;
+	si->file_mtime = mtime;
+	return 0;
+}
+
+static inline void seekidx_close(struct seekidx *si)
+{
+	ffvec_free(&si->ents);
+	ffmem_free(si->fn);
+	si->fn = NULL;
+}
+
+/** Load index from file.
+Return 0 on success */
+static inline int seekidx_load(struct seekidx *si)
+{
+	ffvec buf = {};
+	int rc = -1;
+	if (si->fn == NULL
+		|| 0 != fffile_readwhole(si->fn, &buf, 64*1024*1024))
+		goto end;
+
+	const struct seekidx_hdr *h = (void*)buf.ptr;
+	if (buf.len < sizeof(*h)
+		|| ffmem_cmp(h->magic, SEEKIDX_MAGIC, 4)
+		|| h->ver != SEEKIDX_VER
+		|| h->file_dev != si->file_dev
+		|| h->file_ino != si->file_ino
+		|| h->file_size != si->file_size
+		|| h->file_mtime != si->file_mtime
+		|| h->n == 0
+		|| buf.len != sizeof(*h) + h->n * sizeof(struct seekidx_ent))
+		goto end;
+
+	ffvec_free(&si->ents);
+	ffvec_addT(&si->ents, buf.ptr + sizeof(*h), h->n, struct seekidx_ent);
+	si->loaded = 1;
+	rc = 0;
+
+end:
+	ffvec_free(&buf);
+	return rc;
+}
+
+/** Start building a new index from the beginning of the file.
+interval: min. number of samples between 2 entries */
+static inline void seekidx_build(struct seekidx *si, uint interval)
+{
+	if (si->fn == NULL || si->loaded)
+		return;
+	si->ents.len = 0;
+	si->interval = interval;
+	si->building = 1;
+}
+
+/** Add the position of the next packet */
+static inline void seekidx_add(struct seekidx *si, uint64 sample, uint64 offset)
+{
+	if (!si->building)
+		return;
+
+	if (si->ents.len != 0) {
+		const struct seekidx_ent *last = (struct seekidx_ent*)si->ents.ptr + si->ents.len - 1;
+		if (sample < last->sample + si->interval)
+			return;
+	}
+
+	struct seekidx_ent *e;
+	if (NULL == (e = ffvec_pushT(&si->ents, struct seekidx_ent))) {
+		si->building = 0;
+		return;
+	}
+	e->sample = sample;
+	e->offset = offset;
+}
+
+/** The reader has jumped to another position: the index being built isn't contiguous anymore */
+static inline void seekidx_cancel(struct seekidx *si)
+{
+	si->building = 0;
+}
+
+/** The whole file has been read: store the index.
+Return 0 on success */
+static inline int seekidx_save(struct seekidx *si, fmed_filt *d)
+{
+	if (!si->building || si->ents.len == 0)
+		return -1;
+	si->building = 0;
+
+	ffvec buf = {};
+	struct seekidx_hdr h = {};
+	ffmem_copy(h.magic, SEEKIDX_MAGIC, 4);
+	h.ver = SEEKIDX_VER;
+	h.file_dev = si->file_dev;
+	h.file_ino = si->file_ino;
+	h.file_size = si->file_size;
+	h.file_mtime = si->file_mtime;
+	h.n = si->ents.len;
+	ffvec_add(&buf, &h, sizeof(h), 1);
+	ffvec_add(&buf, si->ents.ptr, si->ents.len * sizeof(struct seekidx_ent), 1);
+
+	int rc = -1;
+	char *tmp = ffsz_alfmt("%s.%u-%U.tmp", si->fn, (int)ffps_curid(), (int64)ffthread_curid());
+	if (0 != ffdir_make_path(si->fn, 0) && fferr_last() != EEXIST) {
+		fmed_syserrlog(core, d->trk, NULL, "%s: %s", ffdir_make_S, si->fn);
+		goto end;
+	}
+	if (0 != fffile_writewhole(tmp, buf.ptr, buf.len, 0)) {
+		fmed_syserrlog(core, d->trk, NULL, "%s: %s", fffile_write_S, tmp);
+		goto end;
+	}
+	if (0 != fffile_rename(tmp, si->fn)) {
+		fmed_syserrlog(core, d->trk, NULL, "%s: %s", fffile_rename_S, si->fn);
+		fffile_rm(tmp);
+		goto end;
+	}
+
+	fmed_dbglog(core, d->trk, NULL, "seek index: saved %L entries to %s"
+		, si->ents.len, si->fn);
+	si->loaded = 1;
+	rc = 0;
+
+end:
+	ffmem_free(tmp);
+	ffvec_free(&buf);
+	return rc;
+}
+
+/** Find the last entry at or before the target sample (binary search).
+Return NULL if not found */
+static inline const struct seekidx_ent* seekidx_find(const struct seekidx *si, uint64 sample)
+{
+	if (!si->loaded || si->ents.len == 0)
+		return NULL;
+
+	const struct seekidx_ent *e = si->ents.ptr;
+	ffsize lo = 0, hi = si->ents.len;
+	while (lo != hi) {
+		ffsize mid = lo + (hi - lo) / 2;
+		if (e[mid].sample <= sample)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == 0)
+		return NULL;
+	return &e[lo - 1];
+}
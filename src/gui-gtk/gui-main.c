@@ -2,9 +2,16 @@
 Copyright (c) 2019 Simon Zolin */
 
 #include <gui-gtk/gui.h>
+#include <afilter/wavepeaks.h>
 #include <util/path.h>
 
 
+/** Waveform of the active track */
+struct wmain_wave {
+	const void *owner; // the track object
+	ffvec peaks; // byte[]: max. absolute sample value of all channels in each block (0..255)
+};
+
 struct gui_wmain {
 	ffui_wnd wnd;
 	ffui_menu mm;
@@ -21,6 +28,7 @@ struct gui_wmain {
 	ffui_trayicon tray_icon;
 
 	fmed_que_entry *active_qent;
+	struct wmain_wave *wave;
 
 	ffstr exp_path; // path with trailing '/'
 	ffvec exp_files; // struct exp_file[]
@@ -79,12 +87,111 @@ void wmain_init()
 	w->wnd.onclose_id = A_ONCLOSE;
 }
 
+static void wave_free(struct wmain_wave *wv)
+{
+	if (wv == NULL)
+		return;
+	ffvec_free(&wv->peaks);
+	ffmem_free(wv);
+}
+
 void wmain_destroy()
 {
 	exp_free();
+	wave_free(gg->wmain->wave);
 	ffmem_free(gg->wmain);
 }
 
+/** Draw the waveform over the position bar.
+Thread: GUI */
+static gboolean wmain_tpos_draw(GtkWidget *widget, cairo_t *cr, gpointer udata)
+{
+	struct gui_wmain *w = gg->wmain;
+	const struct wmain_wave *wv = w->wave;
+	if (wv == NULL)
+		return FALSE;
+
+	int width = gtk_widget_get_allocated_width(widget);
+	int height = gtk_widget_get_allocated_height(widget);
+	const byte *p = wv->peaks.ptr;
+	size_t n = wv->peaks.len;
+
+	cairo_set_source_rgba(cr, 0.2, 0.4, 0.8, 0.4);
+	cairo_set_line_width(cr, 1);
+	for (int x = 0;  x < width;  x++) {
+		size_t i = (size_t)x * n / width, end = ffmax((size_t)(x + 1) * n / width, i + 1);
+		uint peak = 0;
+		for (;  i < end && i < n;  i++) {
+			peak = ffmax(peak, p[i]);
+		}
+		double h = (double)peak / 255 * height / 2;
+		cairo_move_to(cr, x + 0.5, height / 2.0 - h);
+		cairo_line_to(cr, x + 0.5, height / 2.0 + h);
+	}
+	cairo_stroke(cr);
+	return FALSE;
+}
+
+/** Set the new waveform or clear the current one (if it's still the same track's).
+Thread: GUI */
+static void wmain_wave_apply(void *param)
+{
+	struct gui_wmain *w = gg->wmain;
+	struct wmain_wave *wv = param;
+	if (wv->peaks.len == 0) {
+		if (w->wave != NULL && w->wave->owner == wv->owner) {
+			wave_free(w->wave);
+			w->wave = NULL;
+			gtk_widget_queue_draw(w->tpos.h);
+		}
+		wave_free(wv);
+		return;
+	}
+
+	wave_free(w->wave);
+	w->wave = wv;
+	gtk_widget_queue_draw(w->tpos.h);
+}
+
+/** Pass the waveform loaded from cache to GUI.
+Thread: worker */
+void wmain_wave_set(const void *owner, const struct wavepeaks_hdr *h, const ffvec *blocks)
+{
+	struct wmain_wave *wv = ffmem_new(struct wmain_wave);
+	if (wv == NULL)
+		return;
+	wv->owner = owner;
+	uint64 n = blocks->len / h->channels;
+	if (NULL == ffvec_alloc(&wv->peaks, n, 1)) {
+		ffmem_free(wv);
+		return;
+	}
+
+	const struct wavepeaks_blk *b = blocks->ptr;
+	byte *p = wv->peaks.ptr;
+	for (uint64 i = 0;  i != n;  i++) {
+		int peak = 0;
+		for (uint ich = 0;  ich != h->channels;  ich++) {
+			const struct wavepeaks_blk *k = &b[i * h->channels + ich];
+			peak = ffmax(peak, ffmax(-(int)k->min, (int)k->max));
+		}
+		p[i] = ffmin(peak, 32767) * 255 / 32767;
+	}
+	wv->peaks.len = n;
+	ffui_thd_post(&wmain_wave_apply, wv, 0);
+}
+
+/** The track is closed: clear its waveform.
+Thread: worker */
+void wmain_wave_clear(const void *owner)
+{
+	struct wmain_wave *wv = ffmem_new(struct wmain_wave);
+	if (wv == NULL)
+		return;
+	wv->owner = owner;
+	ffui_thd_post(&wmain_wave_apply, wv, 0);
+}
+
 void wmain_show()
 {
 	struct gui_wmain *w = gg->wmain;
@@ -94,6 +201,7 @@ void wmain_show()
 	ffui_dlg_multisel(&gg->dlg, 1);
 	ffui_view_dragdrop(&w->vlist, A_ONDROPFILE);
 	ffui_view_popupmenu(&w->vlist, &gg->mpopup);
+	g_signal_connect_after(w->tpos.h, "draw", G_CALLBACK(&wmain_tpos_draw), NULL);
 	exp_tab_new();
 	tab_new(0);
 	ffui_tab_setactive(&w->tabs, (w->exp_tab+1));
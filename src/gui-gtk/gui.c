@@ -21,6 +21,7 @@ static const fmed_mod fmed_gui_mod = {
 	&gui_iface, &gui_sig, &gui_destroy, &gui_conf
 };
 
+#include <afilter/wavepeaks.h>
 #include <gui-gtk/track.h>
 
 static FFTHDCALL int gui_worker(void *param);
@@ -90,6 +91,7 @@ static const fmed_conf_arg gui_conf_args[] = {
 	{ "seek_leap",	FMC_INT8NZ, FMC_O(struct gui_conf, seek_leap_delta) },
 	{ "autosave_playlists",	FMC_BOOL8, FMC_O(struct gui_conf, autosave_playlists) },
 	{ "random",	FMC_BOOL8, FMC_O(struct gui_conf, list_random) },
+	{ "waveform",	FMC_BOOL8, FMC_O(struct gui_conf, waveform) },
 	{ "list_repeat",	FMC_INT8, FMC_O(struct gui_conf, list_repeat) },
 	{ "auto_attenuate_ceiling",	FMC_FLOAT32S, FMC_O(struct gui_conf, auto_attenuate_ceiling) },
 	{ "list_columns_width",	FMC_INT16_LIST, FMC_F(conf_list_col_width) },
@@ -116,6 +118,7 @@ static int gui_conf(const char *name, fmed_conf_ctx *ctx)
 		gg->conf.seek_step_delta = 5;
 		gg->conf.seek_leap_delta = 60;
 		gg->conf.autosave_playlists = 1;
+		gg->conf.waveform = 1;
 		fmed_conf_addctx(ctx, &gg->conf, gui_conf_args);
 		return 0;
 	}
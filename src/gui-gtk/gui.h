@@ -38,6 +38,7 @@ struct gui_conf {
 	uint file_delete_method; // enum FILE_DEL_METHOD
 	byte list_random;
 	byte list_repeat;
+	byte waveform;
 	ushort list_col_width[16];
 	uint list_col_width_idx;
 	uint list_actv_trk_idx;
@@ -138,6 +139,9 @@ void wmain_destroy();
 void wmain_show();
 void wmain_cmd(int id);
 void wmain_newtrack(fmed_que_entry *ent, uint time_total, fmed_filt *d);
+struct wavepeaks_hdr;
+void wmain_wave_set(const void *owner, const struct wavepeaks_hdr *h, const ffvec *blocks);
+void wmain_wave_clear(const void *owner);
 void wmain_fintrack();
 void wmain_update(uint playtime, uint time_total);
 void wmain_update_convert(fmed_que_entry *plid, uint playtime, uint time_total);
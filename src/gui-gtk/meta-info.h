@@ -56,6 +56,7 @@ void winfo_write__tcore(void *param)
 		return;
 	ffvec m = {};
 	struct fmed_edittags_conf etc = {};
+	etc.padding = -1;
 	etc.preserve_date = 1;
 
 	fmed_que_entry *qe = (void*)gg->qu->fmed_queue_item(-1, w->list_idx);
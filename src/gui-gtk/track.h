@@ -6,6 +6,10 @@ gtrk_seek
 gtrk_vol
 */
 
+enum {
+	GTRK_WAVE_MAXBLOCKS = 8 * 1024, // waveform resolution to load from cache
+};
+
 typedef struct gtrk {
 	void *trk;
 	fmed_que_entry *qent;
@@ -84,6 +88,43 @@ use_delta:
 		t->d->adev->cmd(FMED_ADEV_CMD_CLEAR, t->d->adev_ctx);
 }
 
+/** Load the waveform from cache and pass it to the main window.
+The cached waveform must have the same length as the track (not with --until or a .cue track).
+If there's no valid cache, record the waveform while playing the whole file from the beginning. */
+static void gtrk_wave_open(gtrk *t, fmed_filt *d)
+{
+	const char *input = d->track->getvalstr(d->trk, "input");
+	int64 mtime = d->track->getval(d->trk, "input_mtime");
+	if (input == FMED_PNULL
+		|| (int64)d->input.size == FMED_NULL || d->input.size == 0
+		|| mtime == FMED_NULL)
+		return; // not a regular file: the cache can't be validated
+
+	char *fn = wavepeaks_cache_name(input);
+	struct wavepeaks_hdr h;
+	ffvec blocks = {};
+	if (0 <= wavepeaks_load(fn, d->input.size, mtime, GTRK_WAVE_MAXBLOCKS, &h, &blocks)) {
+		if ((int64)d->audio.total != FMED_NULL
+			&& !wavepeaks_total_match(h.total, d->audio.total)) {
+			fmed_dbglog(core, d->trk, "gui", "waveform: %s: length %U doesn't match the track length %U"
+				, fn, h.total, d->audio.total);
+		} else {
+			fmed_dbglog(core, d->trk, "gui", "waveform: %s", fn);
+			wmain_wave_set(t, &h, &blocks);
+		}
+		ffmem_free(fn);
+
+	} else if (FMED_PNULL == d->track->getvalstr(d->trk, "peaks_file")
+		&& (int64)d->audio.until == FMED_NULL) {
+		d->track->setvalstr4(d->trk, "peaks_file", fn, FMED_TRK_FACQUIRE);
+		d->track->cmd(d->trk, FMED_TRACK_FILT_ADD, "afilter.wavepeaks");
+
+	} else {
+		ffmem_free(fn);
+	}
+	ffvec_free(&blocks);
+}
+
 static void* gtrk_open(fmed_filt *d)
 {
 	fmed_que_entry *ent = (void*)d->track->getval(d->trk, "queue_item");
@@ -109,6 +150,9 @@ static void* gtrk_open(fmed_filt *d)
 			d->audio.auto_attenuate_ceiling = gg->conf.auto_attenuate_ceiling;
 		}
 		gg->curtrk = t;
+
+		if (gg->conf.waveform && !core->props->parallel)
+			gtrk_wave_open(t, d);
 	}
 
 	t->trk = d->trk;
@@ -125,6 +169,8 @@ static void gtrk_close(void *ctx)
 		gg->curtrk = NULL;
 		wmain_fintrack();
 	}
+	if (!t->conversion)
+		wmain_wave_clear(t);
 	ffmem_free(t);
 }
 
@@ -9,6 +9,8 @@ Copyright (c) 2015 Simon Zolin */
 #include <FFOS/process.h>
 #include <FFOS/dirscan.h>
 #include <FFOS/signal.h>
+#include <FFOS/thread.h>
+#include <FFOS/sysconf.h>
 
 
 #define dbglog0(...)  fmed_dbglog(core, NULL, "main", __VA_ARGS__)
@@ -231,11 +233,31 @@ static void qu_setprops(fmed_cmd *fmed, const fmed_queue *qu, fmed_que_entry *qe
 
 	if (fmed->meta.len != 0)
 		qu->meta_set(qe, FFSTR("meta"), fmed->meta.ptr, fmed->meta.len, FMED_QUE_TRKDICT);
+
+	if (fmed->outs.len != 0) {
+		// "GAIN\tFILENAME\n"...
+		ffvec v = {};
+		const struct cmd_out *o;
+		FFSLICE_WALK(&fmed->outs, o) {
+			if (o->gain_set)
+				ffvec_addfmt(&v, "%d", (int)(o->gain * 100));
+			ffvec_addfmt(&v, "\t%s\n", o->fn);
+		}
+		qu->meta_set(qe, FFSTR("tee_out"), v.ptr, v.len, FMED_QUE_TRKDICT);
+		ffvec_free(&v);
+	}
+
+	if (fmed->peaks_fn != NULL)
+		qu->meta_set(qe, FFSTR("peaks_file"), fmed->peaks_fn, ffsz_len(fmed->peaks_fn), FMED_QUE_TRKDICT);
 }
 
 static void trk_prep(fmed_cmd *fmed, fmed_trk *trk)
 {
 	trk->input_info = fmed->info;
+	if (fmed->build_index) {
+		trk->input_info = 1;
+		trk->build_index = 1;
+	}
 	trk->show_tags = fmed->tags;
 	trk->include_files = fmed->include_files;
 	trk->exclude_files = fmed->exclude_files;
@@ -247,6 +269,9 @@ static void trk_prep(fmed_cmd *fmed, fmed_trk *trk)
 		trk->audio.until = fmed->until_time;
 	if (fmed->split_time != 0)
 		trk->audio.split = fmed->split_time;
+	trk->a_split_silence = fmed->split_silence;
+	trk->a_split_silence_time = fmed->split_silence_time;
+	trk->a_split_silence_mintrack = fmed->split_silence_mintrack;
 	if (fmed->prebuffer != 0)
 		trk->a_prebuffer = fmed->prebuffer;
 
@@ -261,7 +286,12 @@ static void trk_prep(fmed_cmd *fmed, fmed_trk *trk)
 	trk->audio.convfmt = trk->audio.fmt;
 
 	trk->pcm_peaks = fmed->pcm_peaks;
+	if (fmed->peaks_fn != NULL && fmed->outfn.len == 0)
+		trk->pcm_peaks = 1; // export waveform without playback
+	if (fmed->split_silence != 0 && fmed->outfn.len == 0)
+		trk->pcm_peaks = 1; // write CUE sheet without playback
 	trk->pcm_peaks_crc = fmed->pcm_crc;
+	trk->loudness = (fmed->loudness || fmed->loudness_album || fmed->loudness_json != NULL);
 	trk->use_dynanorm = fmed->dynanorm;
 	trk->a_start_level = ffabs(fmed->start_level);
 	trk->a_stop_level = ffabs(fmed->stop_level);
@@ -295,6 +325,7 @@ static void trk_prep(fmed_cmd *fmed, fmed_trk *trk)
 		trk->flac.compression = fmed->flac_complevel;
 	if (fmed->cue_gaps != 0xff)
 		trk->cue.gaps = fmed->cue_gaps;
+	trk->cue_decode_once = fmed->cue_decode_once;
 
 	if (fmed->stream_copy && fmed->out_copy == 0)
 		trk->stream_copy = 1;
@@ -308,6 +339,8 @@ static void trk_prep(fmed_cmd *fmed, fmed_trk *trk)
 	}
 
 	trk->print_time = fmed->print_time;
+	if (fmed->bench_fn != NULL)
+		trk->print_time = 1;
 }
 
 static void open_input(void *udata)
@@ -479,11 +512,41 @@ static void rec_lpback_new_track(fmed_cmd *cmd)
 	track->cmd(trk, FMED_TRACK_START);
 }
 
+struct edittags_batch {
+	fmed_cmd *cmd;
+	const struct fmed_edittags *et;
+	ffsize next; // index of the next file to process
+};
+
+/** Process files from the list until there are no more left.
+Thread: main or edittags thread */
+static int FFTHREAD_PROCCALL edittags_worker(void *param)
+{
+	struct edittags_batch *b = param;
+	fmed_cmd *c = b->cmd;
+	for (;;) {
+		ffsize i = ffint_fetch_add(&b->next, 1);
+		if (i >= c->in_files.len)
+			break;
+
+		struct fmed_edittags_conf conf = {};
+		conf.fn = ((char**)c->in_files.ptr)[i];
+		conf.meta = c->meta;
+		conf.meta_from_filename = c->meta_from_filename;
+		conf.padding = c->edittags_padding;
+		conf.preserve_date = c->preserve_date;
+		b->et->edit(&conf);
+	}
+	return 0;
+}
+
 void edittags(void *obj)
 {
 	fmed_cmd *c = obj;
-	const struct fmed_edittags *et = core->getmod("fmt.edit-tags");
-	if (et == NULL)
+	ffvec threads = {}; // ffthread[]
+	struct edittags_batch b = {};
+	b.cmd = c;
+	if (NULL == (b.et = core->getmod("fmt.edit-tags")))
 		goto end;
 
 	if (c->outfn.len != 0) {
@@ -494,17 +557,32 @@ void edittags(void *obj)
 	if (0 != expand_input_wcard(c))
 		goto end;
 
-	char **fn;
-	FFSLICE_WALK(&c->in_files, fn) {
-		struct fmed_edittags_conf conf = {};
-		conf.fn = *fn;
-		conf.meta = c->meta;
-		conf.meta_from_filename = c->meta_from_filename;
-		conf.preserve_date = c->preserve_date;
-		et->edit(&conf);
+	if (c->parallel) {
+		// Files are independent of each other: edit them in several threads
+		ffsysconf sc;
+		ffsysconf_init(&sc);
+		uint n = ffmin(ffsysconf_get(&sc, FFSYSCONF_NPROCESSORS_ONLN), c->in_files.len);
+		ffvec_allocT(&threads, n, ffthread);
+		for (uint i = 1;  i < n;  i++) {
+			ffthread th;
+			if (FFTHREAD_NULL == (th = ffthread_create(edittags_worker, &b, 0))) {
+				syserrlog0("thread create");
+				break;
+			}
+			*ffvec_pushT(&threads, ffthread) = th;
+		}
+		dbglog0("editing tags in %L threads", threads.len + 1);
+	}
+
+	edittags_worker(&b);
+
+	ffthread *th;
+	FFSLICE_WALK(&threads, th) {
+		ffthread_join(*th, -1, NULL);
 	}
 
 end:
+	ffvec_free(&threads);
 	core->cmd(FMED_STOP);
 }
 
@@ -635,6 +713,9 @@ int main(int argc, char **argv, char **env)
 	}
 	core->props->gui = gcmd->gui;
 	core->props->tui = !gcmd->notui;
+	core->props->bench_file = gcmd->bench_fn;
+	core->props->loudness_album = gcmd->loudness_album;
+	core->props->loudness_json = gcmd->loudness_json;
 
 	if (0 != core->cmd(FMED_CONF, gcmd->conf_fn))
 		goto end;
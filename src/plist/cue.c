@@ -56,8 +56,14 @@ typedef struct cue {
 	ffarr trackno;
 	uint curtrk;
 
+	// --cue-decode-once: the tracks of the current source file
+	ffvec once; // "FROM\tTO[\tNAME\tVALUE]...\n"...
+	ffstr once_url;
+	uint once_from, once_to;
+
 	uint have_gmeta :1;
 	uint utf8 :1;
+	uint decode_once :1;
 } cue;
 
 static int cue_trackno(cue *c, fmed_filt *d, ffarr *arr);
@@ -135,6 +141,7 @@ static void* cue_open(fmed_filt *d)
 	c->qu_cur = (void*)fmed_getval("queue_item");
 	c->cu.options = gaps;
 	c->utf8 = 1;
+	c->decode_once = (d->cue_decode_once && d->out_filename != NULL);
 	return c;
 }
 
@@ -146,6 +153,8 @@ static void cue_close(void *ctx)
 	FFARR_FREE_ALL(&c->gmetas, ffarr_free, ffarr);
 	FFARR_FREE_ALL(&c->metas, ffarr_free, ffarr);
 	ffarr_free(&c->trackno);
+	ffvec_free(&c->once);
+	ffstr_free(&c->once_url);
 	ffmem_free(c);
 }
 
@@ -223,6 +232,77 @@ static ffcuetrk* ffcue_index(ffcue *c, uint type, uint val)
 	return NULL;
 }
 
+/** Add 1 queue item for all tracks of the source file.
+afilter.split gets the track list from "cue_tracks" value and writes the tracks one by one. */
+static void cue_once_flush(cue *c)
+{
+	if (c->once.len == 0)
+		return;
+
+	fmed_que_entry e = {};
+	e.url = c->once_url;
+	e.from = -(int)c->once_from;
+	e.to = -(int)c->once_to;
+	e.dur = (c->once_to != 0) ? (c->once_to - c->once_from) * 1000 / 75 : 0;
+
+	fmed_que_entry *cur = (void*)qu->cmdv(FMED_QUE_ADDAFTER | FMED_QUE_NO_ONCHANGE, &e, c->qu_cur);
+	qu->cmdv(FMED_QUE_COPYTRACKPROPS, cur, c->qu_cur);
+	qu->meta_set(cur, FFSTR("cue_tracks"), c->once.ptr, c->once.len, FMED_QUE_TRKDICT);
+	qu->cmd2(FMED_QUE_ADD | FMED_QUE_MORE | FMED_QUE_ADD_DONE, cur, 0);
+	c->qu_cur = cur;
+	c->once.len = 0;
+}
+
+/** Append string to the track list replacing the separator characters. */
+static void cue_once_addval(ffvec *buf, const ffstr *val)
+{
+	ffsize off = buf->len;
+	ffvec_addstr(buf, val);
+	char *p = (char*)buf->ptr;
+	for (ffsize i = off;  i != buf->len;  i++) {
+		if (p[i] == '\t' || p[i] == '\n')
+			p[i] = ' ';
+	}
+}
+
+static void cue_once_addmeta(cue *c, const ffstr *name, const ffstr *val)
+{
+	ffvec_addchar(&c->once, '\t');
+	cue_once_addval(&c->once, name);
+	ffvec_addchar(&c->once, '\t');
+	cue_once_addval(&c->once, val);
+}
+
+/** Add track to the list for the current source file. */
+static void cue_once_add(cue *c, const ffcuetrk *ctrk)
+{
+	if (c->once.len != 0 && !ffstr_eq2(&c->once_url, &c->ent.url))
+		cue_once_flush(c);
+
+	if (c->once.len == 0) {
+		c->once_from = ctrk->from;
+		ffstr_free(&c->once_url);
+		ffstr_dup2(&c->once_url, &c->ent.url);
+	}
+	c->once_to = ctrk->to;
+
+	ffvec_addfmt(&c->once, "%u\t%u", ctrk->from, ctrk->to);
+
+	const ffarr *m = (void*)c->gmetas.ptr;
+	for (uint i = 0;  i != c->gmetas.len;  i += 2) {
+		if (cue_meta_find(&c->metas, c->nmeta, &m[i]) >= 0)
+			continue;
+		cue_once_addmeta(c, (ffstr*)&m[i], (ffstr*)&m[i + 1]);
+	}
+
+	m = (void*)c->metas.ptr;
+	for (uint i = 0;  i != c->nmeta;  i += 2) {
+		cue_once_addmeta(c, (ffstr*)&m[i], (ffstr*)&m[i + 1]);
+	}
+
+	ffvec_addchar(&c->once, '\n');
+}
+
 static int cue_process(void *ctx, fmed_filt *d)
 {
 	cue *c = ctx;
@@ -349,6 +429,11 @@ add:
 			continue;
 		}
 
+		if (c->decode_once) {
+			cue_once_add(c, ctrk);
+			goto next;
+		}
+
 		c->ent.from = -(int)ctrk->from;
 		c->ent.to = -(int)ctrk->to;
 		c->ent.dur = (ctrk->to != 0) ? (ctrk->to - ctrk->from) * 1000 / 75 : 0;
@@ -392,6 +477,7 @@ next:
 		c->nmeta = c->metas.len;
 	}
 
+	cue_once_flush(c);
 	qu->cmd(FMED_QUE_ADD | FMED_QUE_ADD_DONE, NULL);
 	qu->cmd(FMED_QUE_RM, (void*)fmed_getval("queue_item"));
 	rc = FMED_RFIN;
@@ -42,6 +42,7 @@ typedef struct tui {
 	ffstr3 buf;
 	double maxdb;
 	uint nback;
+	ffvec wave; // char[progress_dots]: waveform for the progress bar
 
 	uint rec :1
 		, paused :1
@@ -51,6 +52,7 @@ typedef struct tui {
 static struct tui_conf_t {
 	byte echo_off;
 	byte file_delete_method;
+	byte waveform;
 } tui_conf;
 
 enum {
@@ -99,6 +101,8 @@ typedef void (*cmdfunc1)(uint cmd);
 
 static const fmed_core *core;
 
+#include <afilter/wavepeaks.h>
+
 //FMEDIA MODULE
 static const void* tui_iface(const char *name);
 static int tui_mod_conf(const char *name, fmed_conf_ctx *conf);
@@ -132,6 +136,7 @@ static int conf_file_delete_method(fmed_conf *c, void *obj, ffstr *val)
 static const fmed_conf_arg tui_conf_args[] = {
 	{ "echo_off",	FMC_BOOL8,  FMC_O(struct tui_conf_t, echo_off) },
 	{ "file_delete_method",	FMC_STR,  FMC_F(conf_file_delete_method) },
+	{ "waveform",	FMC_BOOL8,  FMC_O(struct tui_conf_t, waveform) },
 	{}
 };
 
@@ -234,10 +239,77 @@ static void tui_destroy(void)
 static int tui_config(fmed_conf_ctx *conf)
 {
 	tui_conf.echo_off = 1;
+	tui_conf.waveform = 1;
 	fmed_conf_addctx(conf, &tui_conf, tui_conf_args);
 	return 0;
 }
 
+/** Convert the waveform blocks into a character per each progress bar column */
+static void tui_wave_build(tui *t, const struct wavepeaks_hdr *h, const ffvec *blocks)
+{
+	static const char ramp[] = ".:|";
+	uint dots = gt->progress_dots;
+	uint64 n = blocks->len / h->channels;
+	const struct wavepeaks_blk *b = blocks->ptr;
+
+	if (NULL == ffvec_alloc(&t->wave, dots, 1))
+		return;
+	char *p = t->wave.ptr;
+	for (uint c = 0;  c != dots;  c++) {
+		uint64 i = c * n / dots, end = ffmax((c + 1) * n / dots, i + 1);
+		uint peak = 0;
+		for (;  i < end && i < n;  i++) {
+			for (uint ich = 0;  ich != h->channels;  ich++) {
+				const struct wavepeaks_blk *k = &b[i * h->channels + ich];
+				peak = ffmax(peak, (uint)ffmax(-(int)k->min, (int)k->max));
+			}
+		}
+
+		double db = ffpcm_gain2db((double)peak / 32768);
+		uint lev = (db >= -6) ? 2 : (db >= -20) ? 1 : 0;
+		p[c] = ramp[lev];
+	}
+	t->wave.len = dots;
+}
+
+/** Load the waveform from cache.
+The cached waveform must have the same length as the track (not with --until or a .cue track).
+If there's no valid cache, record the waveform while playing the whole file from the beginning. */
+static void tui_wave_open(tui *t, fmed_filt *d)
+{
+	const char *input = d->track->getvalstr(d->trk, "input");
+	int64 mtime = d->track->getval(d->trk, "input_mtime");
+	if (input == FMED_PNULL
+		|| (int64)d->input.size == FMED_NULL || d->input.size == 0
+		|| mtime == FMED_NULL
+		|| gt->progress_dots == 0)
+		return; // not a regular file: the cache can't be validated
+
+	char *fn = wavepeaks_cache_name(input);
+	struct wavepeaks_hdr h;
+	ffvec blocks = {};
+	if (0 <= wavepeaks_load(fn, d->input.size, mtime, gt->progress_dots * 64, &h, &blocks)) {
+		if ((int64)d->audio.total != FMED_NULL
+			&& !wavepeaks_total_match(h.total, d->audio.total)) {
+			fmed_dbglog(core, d->trk, "tui", "waveform: %s: length %U doesn't match the track length %U"
+				, fn, h.total, d->audio.total);
+		} else {
+			fmed_dbglog(core, d->trk, "tui", "waveform: %s", fn);
+			tui_wave_build(t, &h, &blocks);
+		}
+		ffmem_free(fn);
+
+	} else if (FMED_PNULL == d->track->getvalstr(d->trk, "peaks_file")
+		&& (int64)d->audio.until == FMED_NULL) {
+		d->track->setvalstr4(d->trk, "peaks_file", fn, FMED_TRK_FACQUIRE);
+		d->track->cmd(d->trk, FMED_TRACK_FILT_ADD, "afilter.wavepeaks");
+
+	} else {
+		ffmem_free(fn);
+	}
+	ffvec_free(&blocks);
+}
+
 static void* tui_open(fmed_filt *d)
 {
 	tui *t = ffmem_tcalloc1(tui);
@@ -274,6 +346,9 @@ static void* tui_open(fmed_filt *d)
 		uint vol = (gt->mute) ? 0 : gt->vol;
 		if (vol != 100)
 			tui_setvol(t, vol);
+
+		if (tui_conf.waveform && !core->props->parallel)
+			tui_wave_open(t, d);
 	}
 
 	d->meta_changed = 1;
@@ -292,6 +367,7 @@ static void tui_close(void *ctx)
 	if (t == gt->curtrk_rec)
 		gt->curtrk_rec = NULL;
 	ffarr_free(&t->buf);
+	ffvec_free(&t->wave);
 	ffmem_free(t);
 }
 
@@ -539,6 +615,10 @@ static int tui_process(void *ctx, fmed_filt *d)
 			, (size_t)(10 - pos), '.'
 			, db, t->maxdb);
 
+		int64 xruns;
+		if (FMED_NULL != (xruns = d->track->getval(d->trk, "audio_xruns")))
+			ffstr_catfmt(&t->buf, "xruns:%U  ", xruns);
+
 		goto print;
 	}
 
@@ -616,13 +696,28 @@ static int tui_process(void *ctx, fmed_filt *d)
 
 	t->buf.len = 0;
 	uint dots = gt->progress_dots;
-	ffstr_catfmt(&t->buf, "%*c[%*c%*c] %u:%02u / %u:%02u"
+	size_t played = playpos * dots / t->total_samples;
+	ffstr_catfmt(&t->buf, "%*c[%*c"
 		, (size_t)t->nback, '\r'
-		, (size_t)(playpos * dots / t->total_samples), '='
-		, (size_t)(dots - (playpos * dots / t->total_samples)), '.'
+		, played, '=');
+	if (t->wave.len == dots) {
+		ffstr wave;
+		ffstr_set(&wave, (char*)t->wave.ptr + played, dots - played);
+		ffstr_catfmt(&t->buf, "%S", &wave);
+	} else {
+		ffstr_catfmt(&t->buf, "%*c", dots - played, '.');
+	}
+	ffstr_catfmt(&t->buf, "] %u:%02u / %u:%02u"
 		, playtime / 60, playtime % 60
 		, t->total_time_sec / 60, t->total_time_sec % 60);
 
+	int64 xruns;
+	if (FMED_NULL != (xruns = d->track->getval(d->trk, "audio_xruns")))
+		ffstr_catfmt(&t->buf, "  xruns:%U", xruns);
+	int64 latency;
+	if (FMED_NULL != (latency = d->track->getval(d->trk, "audio_latency")))
+		ffstr_catfmt(&t->buf, "  latency:%Ums", latency);
+
 print:
 	fffile_write(ffstderr, t->buf.ptr, t->buf.len);
 	t->nback = 1;
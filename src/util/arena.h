@@ -0,0 +1,116 @@
+/** Arena allocator: many small objects with the same lifetime are freed all at once.
+Copyright (c) 2022 Simon Zolin
+*/
+
+#pragma once
+#include <ffbase/base.h>
+
+#define FFARENA_ALIGN  16
+
+struct ffarena_block {
+	struct ffarena_block *next;
+	size_t cap, len;
+	size_t _pad;
+	char data[0];
+};
+
+/** Singly-linked list of memory blocks; the first one is the current.
+Not thread-safe. */
+typedef struct ffarena {
+	struct ffarena_block *blocks;
+	size_t block_size;
+} ffarena;
+
+/**
+block_size: the size of a regular block */
+static inline void ffarena_init(ffarena *a, size_t block_size)
+{
+	a->blocks = NULL;
+	a->block_size = block_size;
+}
+
+static inline struct ffarena_block* _ffarena_newblock(size_t cap)
+{
+	struct ffarena_block *b;
+	if (NULL == (b = (struct ffarena_block*)ffmem_alloc(sizeof(struct ffarena_block) + cap)))
+		return NULL;
+	b->next = NULL;
+	b->cap = cap;
+	b->len = 0;
+	return b;
+}
+
+/** Allocate zero-filled memory region aligned to FFARENA_ALIGN.
+Large objects get a dedicated block so that the current block can still serve small objects.
+Return NULL on error */
+static inline void* ffarena_alloc(ffarena *a, size_t size)
+{
+	size = (size + FFARENA_ALIGN - 1) & ~(size_t)(FFARENA_ALIGN - 1);
+	struct ffarena_block *b = a->blocks;
+
+	if (size > a->block_size / 4) {
+		if (NULL == (b = _ffarena_newblock(size)))
+			return NULL;
+		if (a->blocks != NULL) {
+			b->next = a->blocks->next;
+			a->blocks->next = b;
+		} else {
+			a->blocks = b;
+		}
+		b->len = size;
+		ffmem_zero(b->data, size);
+		return b->data;
+	}
+
+	if (b == NULL || b->cap - b->len < size) {
+		if (NULL == (b = _ffarena_newblock(a->block_size)))
+			return NULL;
+		b->next = a->blocks;
+		a->blocks = b;
+	}
+
+	void *p = b->data + b->len;
+	b->len += size;
+	ffmem_zero(p, size);
+	return p;
+}
+
+/** Copy string into arena.
+Return NULL-terminated string */
+static inline char* ffarena_strdup(ffarena *a, const char *s, size_t len)
+{
+	char *p;
+	if (NULL == (p = (char*)ffarena_alloc(a, len + 1)))
+		return NULL;
+	ffmem_copy(p, s, len);
+	p[len] = '\0';
+	return p;
+}
+
+/** Free all objects.
+One regular block is kept for reuse. */
+static inline void ffarena_reset(ffarena *a)
+{
+	struct ffarena_block *keep = NULL, *next;
+	for (struct ffarena_block *b = a->blocks;  b != NULL;  b = next) {
+		next = b->next;
+		if (keep == NULL && b->cap == a->block_size) {
+			keep = b;
+			continue;
+		}
+		ffmem_free(b);
+	}
+
+	a->blocks = keep;
+	if (keep != NULL) {
+		keep->next = NULL;
+		keep->len = 0;
+	}
+}
+
+static inline void ffarena_free(ffarena *a)
+{
+	ffarena_reset(a);
+	ffmem_free(a->blocks);
+	a->blocks = NULL;
+}
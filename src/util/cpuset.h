@@ -0,0 +1,200 @@
+/** CPU sets: parse, bind threads, get the CPUs available to the process.
+Copyright (c) 2022 Simon Zolin
+*/
+
+#pragma once
+
+#include "string.h"
+#include <FFOS/file.h>
+#include <FFOS/process.h>
+#ifdef FF_LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+enum {
+	FFCPUSET_MAX = 256,
+};
+
+typedef struct ffcpuset {
+	uint64 bits[FFCPUSET_MAX / 64];
+} ffcpuset;
+
+static inline void ffcpuset_add(ffcpuset *s, uint cpu)
+{
+	if (cpu < FFCPUSET_MAX)
+		s->bits[cpu / 64] |= 1ULL << (cpu % 64);
+}
+
+static inline int ffcpuset_has(const ffcpuset *s, uint cpu)
+{
+	return (cpu < FFCPUSET_MAX) && !!(s->bits[cpu / 64] & (1ULL << (cpu % 64)));
+}
+
+/** Get the number of CPUs in set. */
+static inline uint ffcpuset_count(const ffcpuset *s)
+{
+	uint n = 0;
+	for (uint i = 0;  i != FF_COUNT(s->bits);  i++) {
+		for (uint64 b = s->bits[i];  b != 0;  b &= b - 1) {
+			n++;
+		}
+	}
+	return n;
+}
+
+/** Get the CPU number of the i-th CPU in set (round-robin).
+Return -1 if the set is empty */
+static inline int ffcpuset_nth(const ffcpuset *s, uint i)
+{
+	uint n = ffcpuset_count(s);
+	if (n == 0)
+		return -1;
+	i %= n;
+	for (uint cpu = 0;  cpu != FFCPUSET_MAX;  cpu++) {
+		if (ffcpuset_has(s, cpu) && i-- == 0)
+			return cpu;
+	}
+	return -1;
+}
+
+/** Parse CPU list: "0-3,8,10-11".
+Return 0 on success */
+static inline int ffcpuset_parse(ffcpuset *s, ffstr val)
+{
+	ffmem_zero_obj(s);
+	while (val.len != 0) {
+		ffstr item, lo, hi;
+		ffstr_splitby(&val, ',', &item, &val);
+		ffstr_trimwhite(&item);
+		if (ffstr_splitby(&item, '-', &lo, &hi) < 0)
+			hi = lo;
+		uint a, b;
+		if (!ffstr_to_uint32(&lo, &a)
+			|| !ffstr_to_uint32(&hi, &b)
+			|| a > b || b >= FFCPUSET_MAX)
+			return -1;
+		for (uint i = a;  i <= b;  i++) {
+			ffcpuset_add(s, i);
+		}
+	}
+	return 0;
+}
+
+/** Get the CPUs the process is allowed to run on. */
+static inline void ffcpuset_process(ffcpuset *s)
+{
+	ffmem_zero_obj(s);
+
+#if defined FF_LINUX
+	cpu_set_t cs;
+	if (0 == sched_getaffinity(0, sizeof(cs), &cs)) {
+		for (uint i = 0;  i != ffmin(CPU_SETSIZE, FFCPUSET_MAX);  i++) {
+			if (CPU_ISSET(i, &cs))
+				ffcpuset_add(s, i);
+		}
+		return;
+	}
+
+#elif defined FF_WIN
+	DWORD_PTR pmask, smask;
+	if (GetProcessAffinityMask(GetCurrentProcess(), &pmask, &smask)) {
+		s->bits[0] = pmask;
+		return;
+	}
+#endif
+
+	ffsysconf sc;
+	ffsysconf_init(&sc);
+	uint n = ffsysconf_get(&sc, FFSYSCONF_NPROCESSORS_ONLN);
+	for (uint i = 0;  i != n;  i++) {
+		ffcpuset_add(s, i);
+	}
+}
+
+/** Bind the current thread to the CPUs in set.
+Return 0 on success */
+static inline int ffcpuset_bind(const ffcpuset *s)
+{
+#if defined FF_LINUX
+	cpu_set_t cs;
+	CPU_ZERO(&cs);
+	for (uint i = 0;  i != ffmin(CPU_SETSIZE, FFCPUSET_MAX);  i++) {
+		if (ffcpuset_has(s, i))
+			CPU_SET(i, &cs);
+	}
+	int e = pthread_setaffinity_np(pthread_self(), sizeof(cs), &cs);
+	if (e != 0) {
+		fferr_set(e);
+		return -1;
+	}
+	return 0;
+
+#elif defined FF_WIN
+	if (0 == SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)s->bits[0]))
+		return -1;
+	return 0;
+
+#else
+	fferr_set(ENOSYS);
+	return -1;
+#endif
+}
+
+/** Get the CPU limit set by cgroup CPU quota (cpu.max or cpu.cfs_quota_us), rounded up.
+Return 0 if there's no limit */
+static inline uint ffcpu_quota(void)
+{
+	uint n = 0;
+#ifdef FF_LINUX
+	ffvec d = {};
+	int64 quota = -1, period = 0;
+	ffstr s, q, p;
+
+	// cgroup v2: "max 100000" or "200000 100000"
+	if (0 == fffile_readwhole("/sys/fs/cgroup/cpu.max", &d, 256)) {
+		ffstr_setstr(&s, &d);
+		ffstr_trimwhite(&s);
+		ffstr_splitby(&s, ' ', &q, &p);
+		if (ffstr_eqz(&q, "max")
+			|| !ffstr_to_int64(&q, &quota)
+			|| !ffstr_to_int64(&p, &period))
+			quota = -1;
+
+	// cgroup v1
+	} else if (0 == fffile_readwhole("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", &d, 256)) {
+		ffstr_setstr(&s, &d);
+		ffstr_trimwhite(&s);
+		if (!ffstr_to_int64(&s, &quota))
+			quota = -1;
+		d.len = 0;
+		if (quota > 0
+			&& 0 == fffile_readwhole("/sys/fs/cgroup/cpu/cpu.cfs_period_us", &d, 256)) {
+			ffstr_setstr(&s, &d);
+			ffstr_trimwhite(&s);
+			if (!ffstr_to_int64(&s, &period))
+				period = 0;
+		}
+	}
+	ffvec_free(&d);
+
+	if (quota > 0 && period > 0)
+		n = (quota + period - 1) / period;
+#endif
+	return n;
+}
+
+/** Get NUMA node of CPU.
+Return -1 if unknown */
+static inline int ffcpu_numa_node(uint cpu)
+{
+#ifdef FF_LINUX
+	char fn[128];
+	for (uint node = 0;  node != 64;  node++) {
+		ffs_format(fn, sizeof(fn), "/sys/devices/system/cpu/cpu%u/node%u%Z", cpu, node);
+		if (fffile_exists(fn))
+			return node;
+	}
+#endif
+	return -1;
+}
@@ -3,19 +3,35 @@ Copyright (c) 2019 Simon Zolin
 */
 
 #include "fileread.h"
+#include "list.h"
 #include <FFOS/timer.h>
 #include "ffos-compat/asyncio.h"
 #include <ffbase/slice.h>
+#include <ffbase/murmurhash3.h>
 
 
 static int fr_read_off(fffileread *f, uint64 off);
 static int fr_read(fffileread *f);
 
 
+struct cblock;
+
 struct buf {
 	size_t len;
-	char *ptr;
+	char *ptr; // 'own' or the data of the shared cache block
 	uint64 offset;
+	char *own; // NULL if the shared cache is used
+	struct cblock *cb; // shared cache block referenced by this buffer
+};
+
+/** Identifies a block in the shared cache.
+mtime & size prevent using the data of a file that has been modified */
+struct cache_key {
+	uint64 dev, ino;
+	uint64 mtime_sec, mtime_nsec;
+	uint64 fsize;
+	uint64 off;
+	uint64 bsize;
 };
 
 struct fffileread {
@@ -34,6 +50,8 @@ struct fffileread {
 
 	fffileread_conf conf;
 	struct fffileread_stat stat;
+	struct cache_key ckey; // valid if conf.cache != NULL
+	uint64 dev; // device ID for I/O scheduler
 };
 
 #define dbglog(f, fmt, ...) \
@@ -67,7 +85,219 @@ static void fr_log(fffileread *f, uint level, const char *fmt, ...)
 	f->conf.log(f->conf.udata, level, s);
 }
 
-/** Create buffers aligned to system pagesize. */
+
+struct cblock {
+	fflist_item lru;
+	struct cblock *next; // the next block in hash slot
+	struct cache_key key;
+	uint hash;
+	uint refs; // number of readers' buffers referring to the data
+	uint cached :1; // the block is in the hash table and LRU list
+	size_t len;
+	size_t cap;
+	char *data; // aligned to the reader's 'bufalign'
+};
+
+struct fffileread_cache {
+	fflock lk;
+	uint64 limit;
+	fflist lru; // cblock[].  The first block is the least recently used one.
+	struct cblock **slots;
+	uint nslots; // power of 2
+	struct fffileread_cache_stat stat;
+};
+
+fffileread_cache* fffileread_cache_create(uint64 limit)
+{
+	fffileread_cache *c;
+	if (NULL == (c = ffmem_new(fffileread_cache)))
+		return NULL;
+	c->limit = limit;
+	fflist_init(&c->lru);
+	fflk_init(&c->lk);
+	c->nslots = ff_align_power2(ffmax(limit / (64 * 1024), 64));
+	if (NULL == (c->slots = ffmem_callocT(c->nslots, struct cblock*))) {
+		ffmem_free(c);
+		return NULL;
+	}
+	return c;
+}
+
+static void cblock_free(struct cblock *cb)
+{
+	ffmem_alignfree(cb->data);
+	ffmem_free(cb);
+}
+
+void fffileread_cache_free(fffileread_cache *c)
+{
+	if (c == NULL)
+		return;
+	struct cblock *cb;
+	fflist_item *next;
+	FFLIST_WALKSAFE(&c->lru, cb, lru, next) {
+		FF_ASSERT(cb->refs == 0);
+		cblock_free(cb);
+	}
+	ffmem_free(c->slots);
+	ffmem_free(c);
+}
+
+void fffileread_cache_stat(fffileread_cache *c, struct fffileread_cache_stat *st)
+{
+	fflk_lock(&c->lk);
+	*st = c->stat;
+	fflk_unlock(&c->lk);
+}
+
+static uint cache_hash(const struct cache_key *k)
+{
+	return murmurhash3(k, sizeof(*k), 0x12345678);
+}
+
+static struct cblock** cache_slot(fffileread_cache *c, uint hash)
+{
+	return &c->slots[hash & (c->nslots - 1)];
+}
+
+static struct cblock* cache_find_locked(fffileread_cache *c, const struct cache_key *k, uint hash)
+{
+	for (struct cblock *cb = *cache_slot(c, hash);  cb != NULL;  cb = cb->next) {
+		if (cb->hash == hash && !ffmem_cmp(&cb->key, k, sizeof(*k)))
+			return cb;
+	}
+	return NULL;
+}
+
+/** Remove the block from the hash table and LRU list */
+static void cache_unlink_locked(fffileread_cache *c, struct cblock *cb)
+{
+	struct cblock **pcb = cache_slot(c, cb->hash);
+	while (*pcb != cb) {
+		pcb = &(*pcb)->next;
+	}
+	*pcb = cb->next;
+
+	fflist_rm(&c->lru, &cb->lru);
+	cb->cached = 0;
+	c->stat.size -= cb->cap;
+	c->stat.nblocks--;
+	c->stat.evicted++;
+}
+
+/** Remove the least recently used blocks not referenced by readers,
+ until there's enough space for 'n' bytes.
+reuse: return an evicted block of 'n' bytes with this alignment instead of freeing it
+Return 0 on success */
+static int cache_evict_locked(fffileread_cache *c, size_t n, struct cblock **reuse, size_t align)
+{
+	struct cblock *cb;
+	fflist_item *next;
+	FFLIST_WALKSAFE(&c->lru, cb, lru, next) {
+		if (c->stat.size + n <= c->limit)
+			break;
+		if (cb->refs != 0)
+			continue;
+
+		cache_unlink_locked(c, cb);
+		if (reuse != NULL && *reuse == NULL
+			&& cb->cap == n && ((size_t)cb->data & (align - 1)) == 0)
+			*reuse = cb;
+		else
+			cblock_free(cb);
+	}
+	return !(c->stat.size + n <= c->limit);
+}
+
+/** Find block and reference it. */
+static struct cblock* cache_ref(fffileread_cache *c, const struct cache_key *k)
+{
+	uint hash = cache_hash(k);
+	fflk_lock(&c->lk);
+	struct cblock *cb = cache_find_locked(c, k, hash);
+	if (cb != NULL) {
+		cb->refs++;
+		fflist_rm(&c->lru, &cb->lru);
+		fflist_add(&c->lru, &cb->lru);
+		c->stat.hits++;
+	} else {
+		c->stat.misses++;
+	}
+	fflk_unlock(&c->lk);
+	return cb;
+}
+
+/** Release the reference.  A block not in cache is freed by its last user. */
+static void cache_unref(fffileread_cache *c, struct cblock *cb)
+{
+	fflk_lock(&c->lk);
+	FF_ASSERT(cb->refs != 0);
+	cb->refs--;
+	ffbool rm = (cb->refs == 0 && !cb->cached);
+	fflk_unlock(&c->lk);
+	if (rm)
+		cblock_free(cb);
+}
+
+/** Get a new block the file data will be read into.
+The memory of the least recently used block is reused when the cache is full.
+The block isn't visible to other readers until cache_add().
+Return the block referenced by the caller */
+static struct cblock* cache_block_new(fffileread_cache *c, const struct cache_key *k, size_t cap, size_t align)
+{
+	struct cblock *cb = NULL;
+	fflk_lock(&c->lk);
+	cache_evict_locked(c, cap, &cb, align);
+	fflk_unlock(&c->lk);
+
+	if (cb == NULL) {
+		if (NULL == (cb = ffmem_alloc(sizeof(struct cblock))))
+			return NULL;
+		if (NULL == (cb->data = ffmem_align(cap, align))) {
+			ffmem_free(cb);
+			return NULL;
+		}
+		cb->cap = cap;
+	}
+
+	char *data = cb->data;
+	ffmem_zero_obj(cb);
+	cb->data = data;
+	cb->cap = cap;
+	cb->key = *k;
+	cb->hash = cache_hash(k);
+	cb->refs = 1;
+	return cb;
+}
+
+/** Make the block that has been filled with data available to other readers.
+The block stays private to this reader if another reader has just added the same block,
+ or if all blocks are in use. */
+static void cache_add(fffileread_cache *c, struct cblock *cb)
+{
+	if (cb->len == 0 || cb->cap > c->limit)
+		return;
+
+	fflk_lock(&c->lk);
+	if (NULL != cache_find_locked(c, &cb->key, cb->hash)
+		|| 0 != cache_evict_locked(c, cb->cap, NULL, 0)) {
+		fflk_unlock(&c->lk);
+		return;
+	}
+	struct cblock **slot = cache_slot(c, cb->hash);
+	cb->next = *slot;
+	*slot = cb;
+	fflist_add(&c->lru, &cb->lru);
+	cb->cached = 1;
+	c->stat.size += cb->cap;
+	c->stat.nblocks++;
+	fflk_unlock(&c->lk);
+}
+
+
+/** Create buffers aligned to system pagesize.
+With the shared cache the data is read directly into the cache blocks:
+ the buffers only refer to them. */
 static int bufs_create(fffileread *f, const fffileread_conf *conf)
 {
 	if (NULL == ffslice_zallocT(&f->bufs, conf->nbufs, struct buf))
@@ -75,8 +305,15 @@ static int bufs_create(fffileread *f, const fffileread_conf *conf)
 	f->bufs.len = conf->nbufs;
 	struct buf *b;
 	FFSLICE_WALK_T(&f->bufs, b, struct buf) {
-		if (NULL == (b->ptr = ffmem_align(conf->bufsize, conf->bufalign)))
+		b->offset = (uint64)-1;
+		if (conf->cache != NULL)
+			continue;
+		if (NULL == (b->own = ffmem_align(conf->bufsize, conf->bufalign)))
 			goto err;
+		// first-touch policy: otherwise the pages are placed on the node of the thread pool's thread
+		if (conf->prefault)
+			ffmem_zero(b->own, conf->bufsize);
+		b->ptr = b->own;
 		b->offset = (uint64)-1;
 	}
 	return 0;
@@ -86,13 +323,24 @@ err:
 	return -1;
 }
 
-static void bufs_free(ffslice *bufs)
+/** Stop referring to the shared cache block. */
+static void buf_release(fffileread *f, struct buf *b)
+{
+	if (b->cb == NULL)
+		return;
+	cache_unref(f->conf.cache, b->cb);
+	b->cb = NULL;
+	b->ptr = b->own;
+}
+
+static void bufs_free(fffileread *f)
 {
 	struct buf *b;
-	FFSLICE_WALK_T(bufs, b, struct buf) {
-		ffmem_alignfree(b->ptr);
+	FFSLICE_WALK_T(&f->bufs, b, struct buf) {
+		buf_release(f, b);
+		ffmem_alignfree(b->own);
 	}
-	ffslice_free(bufs);
+	ffslice_free(&f->bufs);
 }
 
 /** Find buffer containing file offset. */
@@ -106,13 +354,26 @@ static struct buf* bufs_find(fffileread *f, uint64 offset)
 	return NULL;
 }
 
-/** Prepare buffer for reading. */
-static void buf_prepread(struct buf *b, uint64 off)
+/** Prepare buffer for reading.
+With the shared cache the buffer gets a new block.
+Return 0 on success */
+static int buf_prepread(fffileread *f, struct buf *b, uint64 off)
 {
+	buf_release(f, b);
 	b->len = 0;
 	b->offset = off;
-}
 
+	if (f->conf.cache != NULL) {
+		f->ckey.off = off;
+		if (NULL == (b->cb = cache_block_new(f->conf.cache, &f->ckey, f->conf.bufsize, f->conf.bufalign))) {
+			b->offset = (uint64)-1;
+			syserrlog(f, "%s", ffmem_alloc_S);
+			return -1;
+		}
+		b->ptr = b->cb->data;
+	}
+	return 0;
+}
 
 enum R {
 	R_ASYNC,
@@ -129,6 +390,83 @@ enum FI_ST {
 	FI_CLOSED,
 };
 
+/** Increment and reset to 0 on reaching the limit. */
+#define ffint_cycleinc(n, lim)  (((n) + 1) % (lim))
+
+/** Set the key of the file's blocks in the shared cache.
+Return 0 on success */
+static int fr_cache_init(fffileread *f)
+{
+	fffileinfo fi;
+	if (0 != fffile_info(f->fd, &fi))
+		return -1;
+
+	struct cache_key *k = &f->ckey;
+	ffmem_zero_obj(k);
+#ifdef FF_WIN
+	k->dev = fi.dwVolumeSerialNumber;
+#else
+	k->dev = fi.st_dev;
+#endif
+	k->ino = fffile_infoid(&fi);
+	fftime mt = fffile_infomtime(&fi);
+	k->mtime_sec = mt.sec;
+	k->mtime_nsec = mt.nsec;
+	k->fsize = fffile_infosize(&fi);
+	k->bsize = f->conf.bufsize;
+	return 0;
+}
+
+/** Get the file offset of the block containing 'off'.
+The blocks in the shared cache are always on 'bufsize' grid:
+ otherwise after a seek the same data would be read and cached again at a different offset. */
+static uint64 fr_block_off(fffileread *f, uint64 off)
+{
+	if (f->conf.cache != NULL)
+		return off - off % f->conf.bufsize;
+	return ff_align_floor2(off, f->conf.bufalign);
+}
+
+/** Make the data just read into the buffer's block available to other readers. */
+static void fr_cache_add(fffileread *f, const struct buf *b)
+{
+	if (b->cb == NULL)
+		return;
+	b->cb->len = b->len;
+	cache_add(f->conf.cache, b->cb);
+}
+
+/** Get the block containing file offset from the shared cache.
+The next buffer refers to the cached data. */
+static struct buf* fr_cache_get(fffileread *f, uint64 off)
+{
+	f->ckey.off = fr_block_off(f, off);
+	struct cblock *cb;
+	if (NULL == (cb = cache_ref(f->conf.cache, &f->ckey)))
+		return NULL;
+	if (off >= f->ckey.off + cb->len) {
+		cache_unref(f->conf.cache, cb);
+		return NULL;
+	}
+
+	struct buf *b = ffslice_itemT(&f->bufs, f->wbuf, struct buf);
+	FF_ASSERT(f->wbuf != f->locked);
+	buf_release(f, b);
+	b->cb = cb;
+	b->ptr = cb->data;
+	b->len = cb->len;
+	b->offset = f->ckey.off;
+	f->wbuf = ffint_cycleinc(f->wbuf, f->conf.nbufs);
+	f->stat.nshared++;
+
+	if (b->len != f->conf.bufsize) {
+		f->eof = b->offset + b->len;
+		if (f->state == FI_OK)
+			f->state = FI_EOF;
+	}
+	return b;
+}
+
 void fffileread_setconf(fffileread_conf *conf)
 {
 	ffmem_tzero(conf);
@@ -158,9 +496,6 @@ fffileread* fffileread_create(const char *fn, fffileread_conf *conf)
 	f->conf.udata = conf->udata;
 	f->conf.log = conf->log;
 
-	if (0 != bufs_create(f, conf))
-		goto err;
-
 	uint flags = conf->oflags;
 
 	if (conf->kq != FF_BADFD)
@@ -185,6 +520,12 @@ fffileread* fffileread_create(const char *fn, fffileread_conf *conf)
 		goto err;
 	}
 	f->conf = *conf;
+	if (f->conf.cache != NULL && 0 != fr_cache_init(f))
+		f->conf.cache = NULL;
+	if (0 != bufs_create(f, &f->conf))
+		goto err;
+	if (f->conf.iosched != NULL)
+		f->dev = ffiosched_dev(f->fd);
 
 	conf->directio = !!(flags & FFO_DIRECT);
 	return f;
@@ -210,7 +551,7 @@ void fffileread_free_ex(fffileread *f, ffuint flags)
 	if (ret)
 		return; //wait until AIO is completed
 
-	bufs_free(&f->bufs);
+	bufs_free(f);
 	ffthpool_task_free(f->iotask);
 	ffmem_free(f);
 }
@@ -289,7 +630,8 @@ static int fr_thpool_read(fffileread *f, ffstr *dst, uint64 off)
 
 	FF_ASSERT(f->wbuf != f->locked);
 	struct buf *b = ffslice_itemT(&f->bufs, f->wbuf, struct buf);
-	b->offset = ff_align_floor2(off, f->conf.bufalign);
+	if (0 != buf_prepread(f, b, fr_block_off(f, off)))
+		return FFFILEREAD_RERR;
 
 	ffthpool_task *t;
 	if (NULL == (t = ffthpool_task_new(sizeof(struct fr_task))))
@@ -307,7 +649,9 @@ static int fr_thpool_read(fffileread *f, ffstr *dst, uint64 off)
 	f->iotask = t;
 	f->nfy_user = 1;
 	dbglog(f, "adding file read task to thread pool: offset:%xU", b->offset);
-	if (0 != ffthpool_add(f->conf.thpool, t)) {
+	if (0 != ((f->conf.iosched != NULL)
+		? ffiosched_add(f->conf.iosched, t, f->dev, f, f->conf.bufsize)
+		: ffthpool_add(f->conf.thpool, t))) {
 		f->iotask = NULL;
 		syserrlog(f, "ffthpool_add", 0);
 		ffthpool_task_free(t);
@@ -317,9 +661,6 @@ static int fr_thpool_read(fffileread *f, ffstr *dst, uint64 off)
 	return FFFILEREAD_RASYNC;
 }
 
-/** Increment and reset to 0 on reaching the limit. */
-#define ffint_cycleinc(n, lim)  (((n) + 1) % (lim))
-
 /** Process the result of operation completed in thread pool's worker. */
 static int fr_thpool_result(fffileread *f)
 {
@@ -340,6 +681,7 @@ static int fr_thpool_result(fffileread *f)
 	b->len = ext->result;
 	f->wbuf = ffint_cycleinc(f->wbuf, f->conf.nbufs);
 	f->stat.nread++;
+	fr_cache_add(f, b);
 
 	if ((uint)ext->result != f->conf.bufsize) {
 		dbglog(f, "read the last block", 0);
@@ -385,6 +727,13 @@ int fffileread_getdata(fffileread *f, ffstr *dst, uint64 off, uint flags)
 		goto done;
 	}
 
+	if (f->conf.cache != NULL && f->state != FI_ASYNC
+		&& NULL != (b = fr_cache_get(f, off))) {
+		cachehit = 1;
+		f->async_off = (uint64)-1;
+		goto done;
+	}
+
 	if (f->conf.thpool != NULL && !(flags & FFFILEREAD_FALLOWBLOCK))
 		return fr_thpool_read(f, dst, off);
 
@@ -400,7 +749,7 @@ int fffileread_getdata(fffileread *f, ffstr *dst, uint64 off, uint flags)
 		f->state = FI_OK;
 	}
 
-	r = fr_read_off(f, ff_align_floor2(off, f->conf.bufalign));
+	r = fr_read_off(f, fr_block_off(f, off));
 	if (r == R_ASYNC) {
 		f->async_off = off;
 		f->nfy_user = 1;
@@ -470,7 +819,10 @@ static int fr_read_off(fffileread *f, uint64 off)
 {
 	struct buf *b = ffslice_itemT(&f->bufs, f->wbuf, struct buf);
 	FF_ASSERT(f->wbuf != f->locked);
-	buf_prepread(b, off);
+	if (0 != buf_prepread(f, b, off)) {
+		f->state = FI_ERR;
+		return R_ERR;
+	}
 	return fr_read(f);
 }
 
@@ -498,6 +850,7 @@ static int fr_read(fffileread *f)
 
 	b->len = r;
 	f->stat.nread++;
+	fr_cache_add(f, b);
 	dbglog(f, "buf#%u: read:%L  offset:%Uk"
 		, f->wbuf, b->len, b->offset / 1024);
 
@@ -6,6 +6,9 @@ Copyright (c) 2020 Simon Zolin
 #include "string.h"
 #include <FFOS/dir.h>
 #include <FFOS/timer.h>
+#ifdef FF_UNIX
+#include <fcntl.h>
+#endif
 
 #define dbglog(f, fmt, ...) \
 do { \
@@ -47,6 +50,13 @@ struct fffilewrite {
 	// preallocation:
 	uint64 prealloc_size; // preallocated size
 	uint64 size; // file size
+
+	uint direct :1; // O_DIRECT is set on the descriptor
+	uint64 dev; // device ID for I/O scheduler
+
+	// write-behind:
+	uint64 wb_off; // start of the range not yet passed to writeback
+	uint64 wb_prev_off, wb_prev_len; // the range passed to writeback previously
 };
 
 enum FW_ST {
@@ -172,7 +182,18 @@ static int fw_open(fffilewrite *f)
 		f->conf.prealloc = 0;
 	flags |= f->conf.oflags;
 	flags |= FFO_WRONLY;
+	if (f->conf.directio)
+		flags |= FFO_DIRECT;
 	while (FF_BADFD == (f->fd = fffile_open(f->name, flags))) {
+#ifdef FF_LINUX
+		if (fferr_last() == EINVAL && (flags & FFO_DIRECT)) {
+			// file system doesn't support O_DIRECT
+			dbglog(f, "O_DIRECT isn't supported", 0);
+			flags &= ~FFO_DIRECT;
+			f->conf.directio = 0;
+			continue;
+		}
+#endif
 		if (fferr_nofile(fferr_last()) && f->conf.mkpath) {
 			if (ffbit_set32(&errmask, 0))
 				goto err;
@@ -186,6 +207,9 @@ static int fw_open(fffilewrite *f)
 		}
 	}
 
+	f->direct = !!(flags & FFO_DIRECT);
+	if (f->conf.iosched != NULL)
+		f->dev = ffiosched_dev(f->fd);
 	return 0;
 
 err:
@@ -270,7 +294,10 @@ static void fw_buf_unlock(fffilewrite *f)
 	f->locked = -1;
 }
 
-/** Preallocate disk space. */
+/** Preallocate disk space.
+Linux: reserve the blocks with fallocate(FALLOC_FL_KEEP_SIZE):
+ the file size isn't changed, the blocks past the end of file are released by fffile_trunc() on close.
+Otherwise: extend the file. */
 static void fw_prealloc(fffilewrite *f, struct buf_s data)
 {
 	uint64 roff = data.off + data.len;
@@ -278,8 +305,16 @@ static void fw_prealloc(fffilewrite *f, struct buf_s data)
 		return;
 
 	uint64 n = ff_align_ceil(roff, f->conf.prealloc);
+#if defined FF_LINUX && defined FALLOC_FL_KEEP_SIZE
+	if (0 != fallocate(f->fd, FALLOC_FL_KEEP_SIZE, 0, n)) {
+		dbglog(f, "fallocate: %E", fferr_last());
+		if (0 != fffile_trunc(f->fd, n))
+			return;
+	}
+#else
 	if (0 != fffile_trunc(f->fd, n))
 		return;
+#endif
 
 	if (f->conf.prealloc_grow)
 		f->conf.prealloc *= 2;
@@ -289,6 +324,56 @@ static void fw_prealloc(fffilewrite *f, struct buf_s data)
 	dbglog(f, "prealloc: %U", n);
 }
 
+/** O_DIRECT requires the buffer address, file offset and length to be aligned:
+ turn it off for the other writes (the last block, header updates) and back on. */
+static void fw_directio(fffilewrite *f, struct buf_s d)
+{
+#if defined FF_LINUX && defined O_DIRECT
+	if (!f->conf.directio)
+		return;
+
+	ffbool direct = !((d.off | d.len | (size_t)d.ptr) & (f->conf.align - 1));
+	if (direct == f->direct)
+		return;
+
+	int fl = fcntl(f->fd, F_GETFL);
+	if (fl < 0
+		|| 0 != fcntl(f->fd, F_SETFL, (direct) ? (fl | O_DIRECT) : (fl & ~O_DIRECT))) {
+		syserrlog(f, "fcntl(O_DIRECT)", 0);
+		return;
+	}
+	f->direct = direct;
+	dbglog(f, "O_DIRECT: %u", (int)direct);
+#endif
+}
+
+/** Start writeback of the data written since the last call,
+ wait for the previous range and drop it from page cache.
+The data is written in 'writebehind' chunks rather than in a burst when the page cache limit is reached,
+ and the page cache isn't filled with the data that won't be read back.
+Called by the thread that performs the write. */
+static void fw_writebehind(fffilewrite *f, uint64 end)
+{
+#if defined FF_LINUX && defined SYNC_FILE_RANGE_WRITE
+	if (f->conf.writebehind == 0 || f->direct
+		|| end < f->wb_off + f->conf.writebehind)
+		return;
+
+	uint64 n = end - f->wb_off;
+	sync_file_range(f->fd, f->wb_off, n, SYNC_FILE_RANGE_WRITE);
+
+	if (f->wb_prev_len != 0) {
+		sync_file_range(f->fd, f->wb_prev_off, f->wb_prev_len
+			, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+		posix_fadvise(f->fd, f->wb_prev_off, f->wb_prev_len, POSIX_FADV_DONTNEED);
+	}
+
+	f->wb_prev_off = f->wb_off;
+	f->wb_prev_len = n;
+	f->wb_off = end;
+#endif
+}
+
 /** Write data to disk. */
 static int fw_write(fffilewrite *f, struct buf_s d)
 {
@@ -296,7 +381,12 @@ static int fw_write(fffilewrite *f, struct buf_s d)
 	if (f->conf.log_debug)
 		ffclk_gettime(&t1);
 
+	fw_directio(f, d);
+	if (f->direct)
+		f->stat.ndirect++;
 	ssize_t n = fffile_pwrite(f->fd, d.ptr, d.len, d.off);
+	if (n >= 0)
+		fw_writebehind(f, d.off + n);
 
 	if (f->conf.log_debug) {
 		ffclk_gettime(&t2);
@@ -342,6 +432,8 @@ static void fw_aio(ffthpool_task *t)
 
 	ext->result = fffile_pwrite(ext->fd, ext->buf.ptr, ext->buf.len, ext->off);
 	ext->error = fferr_last();
+	if (ext->result >= 0)
+		fw_writebehind(f, ext->off + ext->result);
 
 	if (f->conf.log_debug) {
 		ffclk_gettime(&t2);
@@ -390,13 +482,19 @@ static int fw_thpool_write(fffilewrite *f, struct buf_s chunk)
 	ffstr_set2(&ext->buf, &chunk);
 	ext->off = chunk.off;
 
+	fw_directio(f, chunk);
+	if (f->direct)
+		f->stat.ndirect++;
+
 	t->handler = &fw_aio;
 	t->udata = f;
 	FF_ASSERT(f->iotask == NULL);
 	f->iotask = t;
 	f->state = FW_ASYNC;
 	dbglog(f, "adding file write task to thread pool: offset:%xU", chunk.off);
-	if (0 != ffthpool_add(f->conf.thpool, t)) {
+	if (0 != ((f->conf.iosched != NULL)
+		? ffiosched_add(f->conf.iosched, t, f->dev, f, chunk.len)
+		: ffthpool_add(f->conf.thpool, t))) {
 		f->state = FW_OK;
 		syserrlog(f, "ffthpool_add", 0);
 		ffthpool_task_free(t);
@@ -494,6 +592,27 @@ ssize_t fffilewrite_write(fffilewrite *f, ffstr data, int64 off, uint flags)
 	}
 }
 
+int fffilewrite_setsync(fffilewrite *f)
+{
+	if (f->aio_done) {
+		f->aio_done = 0;
+		if (0 != fw_thpool_result(f))
+			return FFFILEWRITE_RERR;
+	}
+
+	fflk_lock(&f->lk);
+	if (f->state == FW_ASYNC) {
+		f->nfy_user = 1;
+		fflk_unlock(&f->lk);
+		return FFFILEWRITE_RASYNC;
+	}
+	fflk_unlock(&f->lk);
+
+	f->conf.thpool = NULL;
+	f->conf.iosched = NULL;
+	return 0;
+}
+
 fffd fffilewrite_fd(fffilewrite *f)
 {
 	return f->fd;
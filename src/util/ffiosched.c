@@ -0,0 +1,249 @@
+/**
+Copyright (c) 2022 Simon Zolin
+*/
+
+#include "iosched.h"
+#include "list.h"
+#include <FFOS/file.h>
+#include <FFOS/timer.h>
+#include <ffbase/vector.h>
+
+
+struct ios_req {
+	fflist_item sib;
+	ffthpool_task *w; // the task object containing this request
+	ffthpool_task *t; // user's task
+	struct ios_dev *d;
+	const void *stream;
+	size_t size;
+	uint64 t_queued; // usec
+};
+
+struct ios_dev {
+	uint active; // N of requests passed to thread pool
+	uint nqueued;
+	const void *last_stream; // the stream of the last request passed to thread pool
+	size_t batch; // bytes passed to thread pool for 'last_stream' in the current batch
+	fflist queue; // ios_req[]
+	uint64 busy_start; // usec
+	struct ffiosched_devstat stat;
+};
+
+struct ffiosched {
+	ffiosched_conf conf;
+	fflock lk;
+	ffvec devs; // struct ios_dev*[]
+};
+
+static uint64 ios_now(void)
+{
+	fftime t;
+	ffclk_gettime(&t);
+	return (uint64)t.sec * 1000000 + t.nsec / 1000;
+}
+
+ffiosched* ffiosched_create(ffiosched_conf *conf)
+{
+	ffiosched *s;
+	if (NULL == (s = ffmem_new(ffiosched)))
+		return NULL;
+	s->conf = *conf;
+	if (s->conf.depth == 0)
+		s->conf.depth = 1;
+	if (s->conf.batch_size == 0)
+		s->conf.batch_size = 4 * 1024 * 1024;
+	fflk_init(&s->lk);
+	return s;
+}
+
+void ffiosched_free(ffiosched *s)
+{
+	if (s == NULL)
+		return;
+	struct ios_dev **pd;
+	FFSLICE_WALK(&s->devs, pd) {
+		FF_ASSERT(fflist_empty(&(*pd)->queue));
+		ffmem_free(*pd);
+	}
+	ffvec_free(&s->devs);
+	ffmem_free(s);
+}
+
+uint64 ffiosched_dev(fffd fd)
+{
+	fffileinfo fi;
+	if (0 != fffile_info(fd, &fi))
+		return 0;
+#ifdef FF_WIN
+	return fi.dwVolumeSerialNumber;
+#else
+	return fi.st_dev;
+#endif
+}
+
+/** Find device object or add a new one. */
+static struct ios_dev* ios_dev_get(ffiosched *s, uint64 dev)
+{
+	struct ios_dev **pd, *d;
+	FFSLICE_WALK(&s->devs, pd) {
+		if ((*pd)->stat.dev == dev)
+			return *pd;
+	}
+
+	if (NULL == (d = ffmem_new(struct ios_dev)))
+		return NULL;
+	if (NULL == (pd = ffvec_pushT(&s->devs, struct ios_dev*))) {
+		ffmem_free(d);
+		return NULL;
+	}
+	*pd = d;
+	d->stat.dev = dev;
+	fflist_init(&d->queue);
+	return d;
+}
+
+/** Set the stream of the request passed to thread pool */
+static void ios_dev_setstream(struct ios_dev *d, const struct ios_req *req)
+{
+	if (req->stream != d->last_stream) {
+		d->last_stream = req->stream;
+		d->batch = 0;
+	}
+	d->batch += req->size;
+}
+
+/** Get the next queued request:
+ continue with the previous stream until its batch is complete,
+ then switch to the oldest request of a different stream. */
+static struct ios_req* ios_dev_pop(ffiosched *s, struct ios_dev *d)
+{
+	if (fflist_empty(&d->queue))
+		return NULL;
+
+	struct ios_req *req, *same = NULL, *other = NULL;
+	_FFLIST_WALK(&d->queue, req, sib) {
+		if (req->stream == d->last_stream) {
+			if (same == NULL)
+				same = req;
+		} else if (other == NULL) {
+			other = req;
+		}
+		if (same != NULL && other != NULL)
+			break;
+	}
+
+	struct ios_req *found = (same != NULL && (d->batch < s->conf.batch_size || other == NULL))
+		? same : other;
+
+	fflist_rm(&d->queue, &found->sib);
+	d->nqueued--;
+	ios_dev_setstream(d, found);
+	return found;
+}
+
+/** Execute user's task, then pass the next queued request for this device to thread pool.
+Thread: thread pool */
+static void ios_run(ffthpool_task *w0)
+{
+	ffiosched *s = w0->udata;
+	ffthpool_task *w = w0;
+
+	for (;;) {
+		struct ios_req *req = (void*)w->ext;
+		struct ios_dev *d = req->d;
+		uint64 t1 = ios_now();
+		req->t->handler(req->t);
+		ffthpool_task_free(req->t);
+		uint64 t2 = ios_now();
+
+		fflk_lock(&s->lk);
+		d->stat.nreq++;
+		d->stat.bytes += req->size;
+		d->stat.wait_usec += t1 - req->t_queued;
+		d->active--;
+		struct ios_req *next = ios_dev_pop(s, d);
+		if (next != NULL)
+			d->active++;
+		if (d->active == 0)
+			d->stat.busy_usec += t2 - d->busy_start;
+		fflk_unlock(&s->lk);
+
+		if (w != w0)
+			ffthpool_task_free(w);
+		if (next == NULL)
+			break;
+
+		w = next->w;
+		if (0 == ffthpool_add(s->conf.thpool, w)) {
+			ffthpool_task_free(w);
+			break;
+		}
+		// the thread pool's queue is full: execute here
+	}
+}
+
+int ffiosched_add(ffiosched *s, ffthpool_task *t, uint64 dev, const void *stream, size_t size)
+{
+	ffthpool_task *w;
+	if (NULL == (w = ffthpool_task_new(sizeof(struct ios_req))))
+		return -1;
+	w->handler = &ios_run;
+	w->udata = s;
+	struct ios_req *req = (void*)w->ext;
+	ffmem_zero_obj(req);
+	req->w = w;
+	req->t = t;
+	req->stream = stream;
+	req->size = size;
+	uint64 now = ios_now();
+	req->t_queued = now;
+
+	fflk_lock(&s->lk);
+	struct ios_dev *d;
+	if (NULL == (d = ios_dev_get(s, dev))) {
+		fflk_unlock(&s->lk);
+		ffthpool_task_free(w);
+		return -1;
+	}
+	req->d = d;
+	ffatom32_inc(&t->ref);
+
+	if (d->active == s->conf.depth) {
+		fflist_add(&d->queue, &req->sib);
+		d->nqueued++;
+		d->stat.max_queue = ffmax(d->stat.max_queue, d->nqueued);
+		fflk_unlock(&s->lk);
+		return 0;
+	}
+
+	if (d->active++ == 0)
+		d->busy_start = now;
+	ios_dev_setstream(d, req);
+	fflk_unlock(&s->lk);
+
+	if (0 != ffthpool_add(s->conf.thpool, w)) {
+		fflk_lock(&s->lk);
+		if (--d->active == 0)
+			d->stat.busy_usec += ios_now() - d->busy_start;
+		fflk_unlock(&s->lk);
+		ffatom32_dec(&t->ref);
+		ffthpool_task_free(w);
+		return -1;
+	}
+	ffthpool_task_free(w);
+	return 0;
+}
+
+uint ffiosched_stat(ffiosched *s, struct ffiosched_devstat *st, uint cap)
+{
+	uint n = 0;
+	struct ios_dev **pd;
+	fflk_lock(&s->lk);
+	FFSLICE_WALK(&s->devs, pd) {
+		if (n == cap)
+			break;
+		st[n++] = (*pd)->stat;
+	}
+	fflk_unlock(&s->lk);
+	return n;
+}
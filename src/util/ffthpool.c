@@ -79,6 +79,9 @@ static int FFTHDCALL ffthpool_loop(void *udata)
 {
 	ffthpool *p = udata;
 
+	if (ffcpuset_count(&p->conf.cpus) != 0)
+		(void)ffcpuset_bind(&p->conf.cpus);
+
 	while (!FF_READONCE(p->stop)) {
 
 		void *ptr;
@@ -5,11 +5,13 @@ Copyright (c) 2019 Simon Zolin
 #pragma once
 
 #include "thpool.h"
+#include "iosched.h"
 #include "string.h"
 #include <FFOS/file.h>
 
 
 typedef struct fffileread fffileread;
+typedef struct fffileread_cache fffileread_cache;
 enum FFFILEREAD_LOG {
 	FFFILEREAD_LOG_DBG,
 	FFFILEREAD_LOG_ERR,
@@ -23,6 +25,7 @@ typedef struct fffileread_conf {
 	fffileread_log log;
 	fffileread_onread onread;
 	ffthpool *thpool; // thread pool
+	ffiosched *iosched; // pass the requests to 'thpool' via I/O scheduler (optional)
 
 	fffd kq; // kqueue descriptor
 	uint oflags; // flags for fffile_open().  default:FFO_RDONLY
@@ -30,9 +33,11 @@ typedef struct fffileread_conf {
 	uint bufsize; // size of 1 buffer.  Aligned to 'bufalign'.  default:64k
 	uint nbufs; // number of buffers.  default:1
 	uint bufalign; // buffer & file offset align value.  Power of 2.
+	fffileread_cache *cache; // process-wide block cache (optional)
 
 	uint directio :1; // use direct I/O if available
 	uint log_debug :1; // enable debug logging.  default:0
+	uint prefault :1; // touch the buffers in the calling thread so their pages are placed on its NUMA node
 } fffileread_conf;
 
 FF_EXTERN void fffileread_setconf(fffileread_conf *conf);
@@ -76,6 +81,37 @@ struct fffileread_stat {
 	uint nread; // number of reads made
 	uint nasync; // number of asynchronous requests
 	uint ncached; // number of cache hits
+	uint nshared; // number of hits in the shared block cache
 };
 
 FF_EXTERN void fffileread_stat(fffileread *f, struct fffileread_stat *st);
+
+
+/** Shared block cache.
+The blocks read from a file are kept in memory after the reader is closed,
+ so the next reader of the same file (a different track) gets the data without I/O.
+Blocks are identified by (device, inode, mtime, size, offset, block size)
+ and evicted in LRU order when the memory limit is reached.
+The block offsets are multiples of the block size, whatever the offset the user seeks to.
+The data is read from file directly into a cache block;
+ the readers' buffers refer to the cached blocks without copying;
+ a referenced block isn't evicted.
+The memory of an evicted block is reused for the next read.
+Thread-safe. */
+
+/** Create cache.
+limit: memory limit (bytes) */
+FF_EXTERN fffileread_cache* fffileread_cache_create(uint64 limit);
+
+/** Free cache.  All readers using it must be closed. */
+FF_EXTERN void fffileread_cache_free(fffileread_cache *c);
+
+struct fffileread_cache_stat {
+	uint64 hits;
+	uint64 misses;
+	uint64 evicted; // number of blocks evicted
+	uint64 size; // memory used by blocks
+	uint nblocks;
+};
+
+FF_EXTERN void fffileread_cache_stat(fffileread_cache *c, struct fffileread_cache_stat *st);
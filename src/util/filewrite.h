@@ -5,6 +5,7 @@ Copyright (c) 2020 Simon Zolin
 #pragma once
 
 #include "thpool.h"
+#include "iosched.h"
 #include "string.h"
 #include <FFOS/file.h>
 
@@ -23,6 +24,7 @@ typedef struct {
 	fffilewrite_log log;
 	fffilewrite_onwrite onwrite;
 	ffthpool *thpool; // thread pool
+	ffiosched *iosched; // pass the requests to 'thpool' via I/O scheduler (optional)
 
 	uint oflags; // additional flags for fffile_open()
 	fffd kq;
@@ -35,8 +37,9 @@ typedef struct {
 	uint overwrite :1; // overwrite existing file
 	uint mkpath :1; // create full path.  default:1
 	uint del_on_err :1; // delete the file if writing is incomplete
-	// uint directio :1; // use O_DIRECT (if available)
+	uint directio :1; // use O_DIRECT (if available).  'bufsize' should be a multiple of 'align'
 	uint log_debug :1; // enable debug logging.  default:0
+	uint64 writebehind; // Linux: start writeback every N bytes and drop the written data from page cache.  default:0
 } fffilewrite_conf;
 
 FF_EXTERN void fffilewrite_setconf(fffilewrite_conf *conf);
@@ -64,6 +67,12 @@ flags: enum FFFILEWRITE_F
 Return N of bytes written or enum FFFILEWRITE_R. */
 FF_EXTERN ssize_t fffilewrite_write(fffilewrite *f, ffstr data, int64 off, uint flags);
 
+/** Perform I/O synchronously from now on (e.g. to finish writing the file in a thread pool's thread).
+Return 0 on success;
+ FFFILEWRITE_RASYNC: an asynchronous task is pending.  onwrite() will be called;
+ FFFILEWRITE_RERR */
+FF_EXTERN int fffilewrite_setsync(fffilewrite *f);
+
 /** Get file descriptor. */
 FF_EXTERN fffd fffilewrite_fd(fffilewrite *f);
 
@@ -72,6 +81,7 @@ typedef struct {
 	uint nfwrite; // N of file writes
 	uint nprealloc; // N of preallocations made
 	uint nasync; // N of asynchronous requests
+	uint ndirect; // N of file writes with O_DIRECT
 } fffilewrite_stat;
 
 FF_EXTERN void fffilewrite_getstat(fffilewrite *f, fffilewrite_stat *stat);
@@ -0,0 +1,58 @@
+/** I/O scheduler: limit the number of concurrent requests per storage device.
+Copyright (c) 2022 Simon Zolin
+*/
+
+#pragma once
+
+#include "thpool.h"
+#include "string.h"
+
+
+/*
+When several files on the same rotational disk (or network share) are read and written in parallel,
+ the concurrent requests make the disk seek between the files all the time.
+The scheduler groups the requests by device and passes at most 'depth' requests per device
+ to the thread pool at once.
+The queued requests are passed in round-robin order by stream (file):
+ the requests of one stream are served until 'batch_size' bytes are transferred
+ or the stream has no more queued requests, then the next stream is served.
+The readers and writers should use a larger block size so each request transfers more data sequentially.
+*/
+
+typedef struct ffiosched ffiosched;
+
+typedef struct ffiosched_conf {
+	ffthpool *thpool;
+	uint depth; // max. number of requests executing on one device.  default:1
+	size_t batch_size; // bytes to transfer for one stream before switching to another.  default:4MB
+} ffiosched_conf;
+
+/** Create scheduler. */
+FF_EXTERN ffiosched* ffiosched_create(ffiosched_conf *conf);
+
+/** Free scheduler.  Thread pool must be stopped. */
+FF_EXTERN void ffiosched_free(ffiosched *s);
+
+/** Add task.  Thread-safe.
+The task is executed in the thread pool, when the device has a free slot.
+dev: device ID (see ffiosched_dev())
+stream: file object from which the request is made
+size: number of bytes the request transfers (for statistics)
+Return 0 on success */
+FF_EXTERN int ffiosched_add(ffiosched *s, ffthpool_task *t, uint64 dev, const void *stream, size_t size);
+
+/** Get device ID of the file. */
+FF_EXTERN uint64 ffiosched_dev(fffd fd);
+
+struct ffiosched_devstat {
+	uint64 dev;
+	uint64 nreq; // requests completed
+	uint64 bytes; // bytes transferred
+	uint64 busy_usec; // time the device has had at least 1 request executing
+	uint64 wait_usec; // total time the requests were waiting in queue
+	uint max_queue; // max. number of requests waiting in queue
+};
+
+/** Get statistics for each device.
+Return N of devices written to 'st'. */
+FF_EXTERN uint ffiosched_stat(ffiosched *s, struct ffiosched_devstat *st, uint cap);
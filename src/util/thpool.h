@@ -5,12 +5,14 @@ Copyright (c) 2020 Simon Zolin
 #pragma once
 
 #include <util/ffos-compat/atomic.h>
+#include <util/cpuset.h>
 
 
 /** Configuration. */
 typedef struct ffthpoolconf {
 	uint maxthreads; // max. allowed threads
 	uint maxqueue; // task queue capacity
+	ffcpuset cpus; // bind the threads to these CPUs (optional)
 } ffthpoolconf;
 
 typedef struct ffthpool ffthpool;
@@ -74,6 +74,22 @@ if test "$1" = "play" ; then
 	./fmedia play_* --seek=2
 fi
 
+if test "$1" = "play_latency" ; then
+	# the latency estimate agrees with the configured buffer length (ALSA or PulseAudio: 200ms)
+	./fmedia @gen:tone --until=3 -o latency.wav -y
+	sed -e '/mod_conf "alsa.out"/,/^}/s/buffer_length 500/buffer_length 200/' \
+		-e '/mod_conf "pulse.out"/,/^}/s/buffer_length 250/buffer_length 200/' \
+		fmedia.conf >latency.conf
+	./fmedia latency.wav --conf=latency.conf --print-time --notui >latency.log 2>&1
+	BUF=$(sed -n 's/.*audio output: buffer:\([0-9]*\)ms .*/\1/p' latency.log)
+	MAX=$(sed -n 's/.*latency:[0-9]*ms (max \([0-9]*\)ms).*/\1/p' latency.log)
+	# the device may grant a larger buffer than requested
+	test $BUF -ge 200
+	# the buffer is full during playback: the estimate is close to its length and never much longer
+	test $MAX -ge $((BUF / 2))
+	test $MAX -le $((BUF + 50))
+fi
+
 if test "$1" = "cue" ; then
 	if ! test -f "rec4.flac" ; then
 		./fmedia --record --format=int16 --rate=48000 --channels=2 --until=4 -o rec4.flac -y
@@ -86,6 +102,11 @@ TRACK 02 AUDIO
  TITLE T2
  INDEX 01 00:02:00' >cue.cue
 	./fmedia cue.cue
+
+	# decode the source file once
+	./fmedia cue.cue -o 'cue-once-$tracknumber.wav' -y --cue-decode-once
+	./fmedia cue-once-01.wav cue-once-02.wav --pcm-peaks
+	./fmedia cue-once-02.wav --info 2>&1 | grep 'T2'
 fi
 
 if test "$1" = "convert" ; then
@@ -162,6 +183,12 @@ if test "$1" = "convert" ; then
 	$BIN rec.wav -o enc48mono-32.ogg $OPTS
 	$BIN rec.wav -o enc48mono-32.opus $OPTS
 	$BIN enc48mono-32.* --pcm-peaks
+
+	# resample 24-bit; 2:1 ratio uses the half-band decimator
+	$BIN rec.wav -o enc96-24.wav -y --format=int24 --rate=96000
+	$BIN enc96-24.wav -o enc96-48-24.wav -y --rate=48000 -D | grep 'half-band'
+	$BIN enc96-24.wav -o enc96-44-24.flac -y --rate=44100
+	$BIN enc96-48-24.wav enc96-44-24.flac --pcm-peaks
 fi
 
 if test "$1" = "convert_meta" ; then
@@ -220,6 +247,10 @@ if test "$1" = "convert_parallel" ; then
 	OPTS="-y --parallel"
 	$BIN rec.* -o 'parallel-$counter.m4a' $OPTS
 	$BIN parallel-*.m4a --pcm-peaks --parallel
+
+	# decode once, encode to several outputs
+	$BIN rec.wav -o tee.flac -o tee.mp3 --out-gain=-6 -o tee.opus $OPTS
+	$BIN tee.flac tee.mp3 tee.opus --pcm-peaks
 fi
 
 if test "$1" = "convert_streamcopy" ; then
@@ -251,6 +282,10 @@ if test "$1" = "filters" ; then
 	sh $0 filters_aconv
 	sh $0 filters_gain
 	sh $0 filters_dynanorm
+	sh $0 filters_level
+	sh $0 filters_silence
+	sh $0 filters_wavepeaks
+	sh $0 filters_loudness
 	OPTS="-y"
 	$BIN rec.wav -o 'split-$counter.wav' --split=0.100 $OPTS
 	$BIN rec.wav -o 'split-$counter.mp3' --split=0.100 $OPTS
@@ -275,6 +310,16 @@ if test "$1" = "filters_aconv" ; then
 	# int16/48000 -> int32/192000
 	./fmedia aconv_rec.wav --format=int32 --rate=192000 -o aconv32-192.wav -y -D | grep 'PCM conv'
 	./fmedia aconv32-192.wav --pcm-peaks
+
+	# number of conversion passes
+	./fmedia aconv_rec.wav --format=int32 -o aconv32.wav -y -D | grep 'PCM conversion passes: 1'
+	./fmedia aconv_rec.wav --format=int32 --rate=192000 -o aconv32-192.wav -y -D | grep 'PCM conversion passes: 1'
+	# channels + sample rate: mixed and resampled by soxr.conv in one pass
+	./fmedia aconv_rec.wav --channels=mono --rate=44100 -o aconv_mono-44.wav -y -D >aconv.log
+	grep 'conversion: soxr.conv$' aconv.log
+	grep 'PCM conversion passes: 1' aconv.log
+	./fmedia aconv_mono-44.wav --info 2>&1 | grep '44100Hz mono'
+	test -z "$(./fmedia aconv_rec.wav -o aconv_copy.wav -y -D | grep 'PCM conversion passes')"
 fi
 
 if test "$1" = "filters_gain" ; then
@@ -293,6 +338,130 @@ if test "$1" = "filters_dynanorm" ; then
 
 	./fmedia rec-dynanorm.wav -o dynanorm.wav --dynanorm -y
 	./fmedia dynanorm.wav --pcm-peaks
+
+	# int16 -> float32 (autoconv) -> dynanorm -> int16 (dynanorm's output conversion)
+	./fmedia rec-dynanorm.wav -o dynanorm.wav --dynanorm -y -D | grep 'PCM conversion passes: 2'
+	./fmedia rec-dynanorm.wav -o dynanorm-mono.wav --dynanorm --channels=mono -y -D | grep 'PCM conversion passes: 2'
+
+	# the user's gain is applied to every track, including those built from a chain template
+	./fmedia @gen:noise --until=2 -o dynanorm-g1.wav -y
+	./fmedia @gen:tone --until=2 -o dynanorm-g2.wav -y
+	./fmedia dynanorm-g1.wav dynanorm-g2.wav --dynanorm --gain=-6 -o '$filename-gain.wav' -y
+	./fmedia dynanorm-g2.wav --dynanorm --gain=-6 -o dynanorm-g2-single.wav -y
+	cmp dynanorm-g2-gain.wav dynanorm-g2-single.wav
+	./fmedia dynanorm-g2.wav --dynanorm -o dynanorm-g2-nogain.wav -y
+	if cmp dynanorm-g2-gain.wav dynanorm-g2-nogain.wav ; then false ; fi
+
+	# parallel processing of the channels: the same output
+	./fmedia @gen:tone --until=3 --format=float32 --channels=5.1 -o dynanorm-in6.wav -y
+	./fmedia dynanorm-in6.wav --dynanorm -o dynanorm-par.wav -y -D | grep 'processing 6 channels'
+	sed 's/# parallel_channels 6/parallel_channels 0/' fmedia.conf >dynanorm-serial.conf
+	./fmedia dynanorm-in6.wav --dynanorm -o dynanorm-serial.wav -y --conf=dynanorm-serial.conf
+	cmp dynanorm-par.wav dynanorm-serial.wav
+
+	# compare the output with the original implementation (abs. error < 2^-22):
+	#  'make danorm-test' and copy it with libDynamicAudioNormalizer-ff into this directory
+	if test -x ./danorm-test ; then
+		./fmedia @gen:noise --until=5 --format=float32 --channels=stereo -o dynanorm-ref-in.wav -y
+		tail -c $((5*44100*2*4)) dynanorm-ref-in.wav >dynanorm-ref-in.raw
+		./danorm-test 2 44100 dynanorm-ref-in.raw 2>&1 | grep 'reference check: OK'
+		tail -c $((3*44100*6*4)) dynanorm-in6.wav >dynanorm-ref-in6.raw
+		./danorm-test 6 44100 dynanorm-ref-in6.raw 2>&1 | grep 'reference check: OK'
+	fi
+fi
+
+if test "$1" = "filters_level" ; then
+	./fmedia @gen:tone --until=2 --start-dblevel=-20 -o level.wav -y | grep 'peak at 0:00.000'
+	./fmedia @gen:silence --until=3 '--stop-dblevel=-20;1' -o level.wav -y | grep 'for 1000ms'
+	./fmedia @gen:noise --until=2 --channels=mono '--stop-dblevel=-20;1' -o level.wav -y
+	./fmedia level.wav --pcm-peaks
+fi
+
+if test "$1" = "filters_silence" ; then
+	# tone(3sec) + silence(2sec) + tone(3sec): concatenate int16/44100/stereo PCM data and read it as .raw
+	./fmedia @gen:tone --until=3 -o silence-t.wav -y
+	./fmedia @gen:silence --until=2 -o silence-s.wav -y
+	tail -c $((3*44100*4)) silence-t.wav >silence-tone.raw
+	tail -c $((2*44100*4)) silence-s.wav >>silence-tone.raw
+	tail -c $((3*44100*4)) silence-t.wav >>silence-tone.raw
+	./fmedia silence-tone.raw -o silence-tone.wav -y
+
+	./fmedia silence-tone.wav '--split-silence=-40;1;2' -y
+	test "$(grep -c TRACK silence-tone.cue)" = "2"
+	grep -A1 'TRACK 01' silence-tone.cue | grep 'INDEX 01 00:00:00'
+	grep -A2 'TRACK 02' silence-tone.cue | grep 'INDEX 00 00:03:00'
+	grep -A2 'TRACK 02' silence-tone.cue | grep 'INDEX 01 00:05:00'
+
+	rm -f silence-split-*.wav
+	./fmedia silence-tone.wav '--split-silence=-40;1;2' -o 'silence-split-$counter.wav' -y
+	test "$(ls silence-split-*.wav | wc -l)" = "2"
+	./fmedia silence-split-*.wav --pcm-peaks
+fi
+
+if test "$1" = "filters_loudness" ; then
+	./fmedia @gen:tone --until=5 -o loud-tone.wav -y
+	./fmedia @gen:noise --until=5 -o loud-noise.flac -y
+	./fmedia loud-tone.wav --loudness | grep 'integrated:'
+	rm -f loudness.json
+	./fmedia loud-tone.wav loud-noise.flac --loudness-album --loudness-json=loudness.json --parallel | grep 'Album loudness (2 tracks)'
+	test "$(grep -c replaygain_gain loudness.json)" = "3"
+	# analysis while converting
+	./fmedia loud-noise.flac -o loud-noise.wav --loudness -y | grep 'true peak:'
+
+	# EBU Tech 3341: 1kHz stereo sine at -23 dBFS (the tone is -6 dBFS) -> -23.0 +/-0.1 LUFS
+	./fmedia @gen:tone --until=10 --format=float32 --gain=-16.98 -o loud-23.wav -y
+	LUFS=$(./fmedia loud-23.wav --loudness | sed -n 's/.*integrated: \(-*[0-9.]*\) LUFS.*/\1/p')
+	echo "$LUFS" | awk '{ exit !($1 >= -23.1 && $1 <= -22.9) }'
+
+	# inter-sample peaks: fs/4 sine at 45 degrees phase (+x +x -x -x), x = -6 dBFS -> true peak ~ -3 dBTP
+	printf '\000\100\000\100\000\100\000\100\000\300\000\300\000\300\000\300' >loud-isp.raw
+	for i in $(seq 14) ; do
+		cat loud-isp.raw loud-isp.raw >loud-isp2.raw
+		mv loud-isp2.raw loud-isp.raw
+	done
+	PEAKS=$(./fmedia loud-isp.raw --loudness | sed -n 's/.*true peak: \(-*[0-9.]*\) dBTP, sample peak: \(-*[0-9.]*\) dBFS.*/\1 \2/p')
+	echo "$PEAKS" | awk '{ exit !($1 > $2 + 2) }'
+fi
+
+if test "$1" = "filters_wavepeaks" ; then
+	./fmedia @gen:tone --until=2 --rate=44100 --channels=stereo -o wave.wav -y
+	./fmedia wave.wav --peaks-file='$filename.peaks'
+	test "$(head -c 4 wave.peaks)" = "FMWP"
+	# header: total samples (2 sec), number of blocks of 256, 4096, 65536 samples
+	test $(od -A n -t u8 -j 24 -N 8 wave.peaks) -eq 88200
+	test $(od -A n -t u8 -j 48 -N 8 wave.peaks) -eq 345
+	test $(od -A n -t u8 -j 72 -N 8 wave.peaks) -eq 22
+	test $(od -A n -t u8 -j 96 -N 8 wave.peaks) -eq 2
+	# 1kHz sine at -6dB: min/max ~ -/+16384, RMS ~ 11585 (level 0, block #1, left channel at 112+12)
+	test $(od -A n -t d2 -j 124 -N 2 wave.peaks) -le -16300
+	test $(od -A n -t d2 -j 124 -N 2 wave.peaks) -ge -16384
+	test $(od -A n -t d2 -j 126 -N 2 wave.peaks) -ge 16300
+	test $(od -A n -t d2 -j 126 -N 2 wave.peaks) -le 16384
+	test $(od -A n -t u2 -j 128 -N 2 wave.peaks) -ge 11400
+	test $(od -A n -t u2 -j 128 -N 2 wave.peaks) -le 11800
+	# the coarsest level: the same peaks
+	test $(od -A n -t d2 -j $(od -A n -t u8 -j 104 -N 8 wave.peaks) -N 2 wave.peaks) -le -16300
+	./fmedia wave.wav --peaks-file=wave-conv.peaks -o wave-conv.flac -y
+	cmp wave.peaks wave-conv.peaks
+	# seeking: the waveform isn't saved
+	rm -f wave-seek.peaks
+	./fmedia wave.wav --peaks-file=wave-seek.peaks --seek=1
+	test ! -f wave-seek.peaks
+	# --until: the waveform isn't complete and isn't saved
+	rm -f wave-until.peaks
+	./fmedia wave.wav --peaks-file=wave-until.peaks --until=1
+	test ! -f wave-until.peaks
+fi
+
+if test "$1" = "bench" ; then
+	./fmedia @gen:tone --until=2 --rate=44100 --channels=stereo -o bench-in.wav -y
+	rm -f bench-test.json
+	./fmedia bench-in.wav -o bench-out.flac -y --bench=bench-test.json
+	# the decoded samples, including the last block
+	grep -q '"samples":88200,"duration_msec":2000,' bench-test.json
+	rm -f bench-test.json
+	./fmedia bench-in.wav -o bench-out.flac -y --seek=1 --bench=bench-test.json
+	grep -q '"samples":44100,' bench-test.json
 fi
 
 if test "$1" = "all" ; then
@@ -300,12 +469,14 @@ if test "$1" = "all" ; then
 	sh $0 record
 	sh $0 info
 	sh $0 play
+	sh $0 play_latency
 	sh $0 cue
 	sh $0 convert
 	sh $0 convert_meta
 	sh $0 convert_streamcopy
 	sh $0 convert_parallel
 	sh $0 filters
+	sh $0 bench
 fi
 
 echo DONE